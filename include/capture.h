@@ -0,0 +1,126 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "container.h"
+#include "frame_ring.h"
+#include "pretrigger.h"
+#include "motion_gate.h"
+#include "copy_pool.h"
+#include "tslog.h"
+#include "lat_hist.h"
+#include "shm_ring.h"
+#include "stream_sink.h"
+#include "tracker.h"
+#include "trace.h"
+
+// Flag of the first frame taken with a live sensor change (see control.h);
+// the bit of MMAL_BUFFER_HEADER_FLAG_USER0, which the camera never sets
+#define FRAME_FLAG_CONTROL	(1u << 28)
+
+// Flag of a frame paired with the sensor's embedded data (see
+// embedded_data.h); the bit of MMAL_BUFFER_HEADER_FLAG_USER1
+#define FRAME_FLAG_EMBEDDED	(1u << 29)
+
+#define CAPTURE_HEALTH_PERIOD_MS	1000	// Between health reports
+
+/*
+ * Live counters of a capture. Each one has a single writer (the source
+ * thread or the writer thread) and is read at any time by the health
+ * reporter, so it is updated with relaxed atomic stores.
+ *
+ * Every frame the source delivers is sorted by its pts step against the
+ * programmed frame period: on time (within 1/8 of a period), late (longer,
+ * nothing missing) or after a gap (one or more frames missing). With the
+ * sensor's embedded data the frame counter decides whether frames are
+ * missing, otherwise a step of 1.5 periods or more does.
+ */
+struct capture_health {
+	uint32_t received;				// Frames the source delivered
+	uint32_t on_time;
+	uint32_t late;
+	uint32_t after_gap;
+	uint32_t dropped_sensor;		// Frames that never reached us (pool exhausted, receiver overrun)
+	uint32_t dropped_queue;			// Frames lost in the frame ring
+	uint32_t saved;
+	uint32_t save_errors;			// Frames the sink failed to store
+	uint32_t embedded;				// Frames with the sensor's frame counter
+};
+
+/*
+ * The save pipeline behind a frame source: every saverate-th frame goes
+ * through the motion gate, the pre-trigger history and the frame ring to
+ * the writer thread,
+ * which stores it in the container, sends it down the stream or stores it
+ * as a file in mem_dir for the copy pool. Nothing in here depends on MMAL, so the same code runs behind the
+ * rawcam callback and behind the synthetic and replay sources.
+ *
+ * Stages are optional and enabled by initialising them: container.hdr,
+ * stream.buf, ring.mem, pretrigger.mem, motion.background and ts_log.mem
+ * are non-NULL when in use. The motion gate needs the pre-trigger history:
+ * an active frame fires the trigger or keeps its post window open.
+ */
+typedef struct capture {
+	// Settings
+	const char *mem_pattern;		// printf pattern of the per-frame files
+	COPY_POOL_T *copy;				// Pool moving them on, NULL if none
+	SHM_RING_T *shm;				// Every frame exported to readers, NULL if none
+	TRACKER_T *tracker;				// Every frame analysed for markers, NULL if none
+	int saverate;
+	int write_empty;
+	const void *header;				// Stored in front of every frame if set
+	size_t header_len;
+	int64_t frame_period_us;		// Programmed pts step, 0 = no gap check; -ctl updates it
+
+	// Stages
+	RRC_CONTAINER_T container;
+	STREAM_SINK_T stream;
+	FRAME_RING_T ring;
+	PRETRIGGER_T pretrigger;
+	MOTION_GATE_T motion;
+	TS_LOG_T ts_log;
+	pthread_t writer;
+
+	// Health reporter, running if health_path is set
+	const char *health_path;		// Status file, "-" = stderr
+	char *health_tmp;				// Written first, then renamed over it
+	uint64_t health_start_ns;
+	pthread_t reporter;
+	volatile int reporter_stop;
+
+	uint32_t count;					// Frames offered by the source
+	int64_t prev_pts;				// Of the last frame offered, for the gap check
+	uint32_t prev_sensor_frame;		// Same from the embedded data
+	struct capture_health health;
+
+	// Live sensor changes: the first frame arriving after mark_ns has its
+	// index stored in marked and is flagged FRAME_FLAG_CONTROL
+	uint64_t mark_ns;				// 0 = nothing pending
+	uint32_t marked;
+
+	// What the save path actually wrote, for the run summary
+	struct {
+		uint32_t frames;
+		uint64_t bytes;
+		uint64_t header_bytes;
+		int64_t first_pts;
+		int64_t last_pts;
+		struct lat_hist lat_deliver;	// Source handed the frame over until capture_frame returned
+		struct lat_hist lat_save;		// Frame entered the pipeline until it was stored
+	} stats;
+} CAPTURE_T;
+
+void capture_init(CAPTURE_T *c);
+int capture_start_ring(CAPTURE_T *c, uint32_t depth, uint32_t slot_size);
+int capture_start_health(CAPTURE_T *c, const char *path);
+
+void capture_mark(CAPTURE_T *c, uint64_t after_ns);
+void capture_frame(CAPTURE_T *c, const struct frame_slot *frame);
+void capture_deliver(void *ctx, const struct frame_slot *frame);
+
+void capture_stop(CAPTURE_T *c);
+
+#endif  // #ifndef
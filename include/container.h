@@ -0,0 +1,79 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Single-file, append-only capture container.
+ *
+ * Layout (all offsets page aligned):
+ *
+ *   [struct rrc_file_header]            page 0
+ *   [shared prefix]                      optional, e.g. the BRCM header
+ *   [struct rrc_frame_record x capacity] record table
+ *   [slot 0][slot 1] ... [slot capacity-1]
+ *
+ * Every slot has the same size (slot_size), large enough for the port's
+ * buffer_size plus the optional per-frame BRCM header, so writing a frame
+ * is a memcpy into an already mapped region and a record update.
+ *
+ * A shared prefix is stored once per container and logically belongs in
+ * front of every frame; readers prepend it when they need legacy files.
+ */
+
+#define RRC_MAGIC			0x31435252	// 'RRC1'
+#define RRC_VERSION			1
+#define RRC_PAGE_SIZE		4096
+#define RRC_WINDOW_SIZE		(64 << 20)	// Bytes of slots mapped at once
+#define RRC_UNTIMED_MS		60000		// Run length to size for when capturing until stopped
+
+struct rrc_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;			// Number of preallocated slots
+	uint32_t count;				// Number of slots filled so far
+	uint32_t slot_size;			// Bytes per slot (page aligned)
+	uint32_t max_frame_size;	// Largest payload a slot can take
+	uint64_t table_offset;		// Offset of the record table
+	uint64_t data_offset;		// Offset of slot 0
+	uint32_t dropped;			// Frames rejected because the container was full
+	uint32_t prefix_offset;		// Offset of the shared prefix (0 if none)
+	uint32_t prefix_length;		// Bytes of shared prefix
+	uint32_t reserved[5];
+};
+
+struct rrc_frame_record {
+	uint32_t index;				// Frame number (as used for out.%04d.raw)
+	uint32_t length;			// Payload bytes stored in the slot
+	int64_t  pts;				// MMAL presentation timestamp (us)
+	uint32_t flags;				// MMAL buffer flags
+	uint32_t reserved[3];
+};
+
+typedef struct rrc_container {
+	int fd;
+	int writable;
+	struct rrc_file_header *hdr;	// Mapped header page
+	struct rrc_frame_record *table;	// Mapped record table
+	size_t table_bytes;
+	uint8_t *window;				// Currently mapped run of slots
+	uint32_t window_first;			// First slot in the window
+	uint32_t window_slots;			// Slots per window
+	size_t window_bytes;
+} RRC_CONTAINER_T;
+
+int rrc_create(RRC_CONTAINER_T *c, const char *path, uint32_t max_frame_size, uint32_t capacity,
+			   const void *shared_prefix, uint32_t prefix_len);
+int rrc_append(RRC_CONTAINER_T *c, uint32_t index, int64_t pts, uint32_t flags,
+			   const void *prefix, size_t prefix_len, const void *data, size_t len);
+void rrc_close(RRC_CONTAINER_T *c);
+
+int rrc_open(RRC_CONTAINER_T *c, const char *path);
+uint32_t rrc_count(const RRC_CONTAINER_T *c);
+const struct rrc_frame_record *rrc_record(const RRC_CONTAINER_T *c, uint32_t slot);
+ssize_t rrc_read(const RRC_CONTAINER_T *c, uint32_t slot, void *dst, size_t len);
+ssize_t rrc_read_prefix(const RRC_CONTAINER_T *c, void *dst, size_t len);
+
+#endif  // #ifndef
@@ -0,0 +1,59 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "sensor.h"
+#include "reg_map.h"
+#include "i2c_regs.h"
+#include "capture.h"
+
+#define CONTROL_MAX_REGS	64		// Changed registers per update
+
+/*
+ * Live exposure, gain and frame length changes while streaming. Text
+ * commands arrive on a FIFO, one per line:
+ *
+ *   exposure <lines>   eus <us>   gain <code>   vts <lines>   fps <rate>
+ *
+ * The reader thread only records the latest requested value of each; a
+ * separate I2C thread applies them to a copy of the mode's register map,
+ * writes what changed between the sensor's grouped parameter hold and
+ * release so it takes effect on one frame boundary, and then waits for
+ * the capture path to report the first frame taken after it. That frame's
+ * index goes into the change log, whether or not -sr saves the frame:
+ *
+ *   frame,exposure,gain,vts      (empty = not changed)
+ */
+typedef struct control {
+	const struct sensor_def *sensor;
+	const struct mode_def *mode;
+	REG_MAP_T *map;					// Registers as the sensor has them
+	I2C_REGS_T *bus;
+	CAPTURE_T *capture;				// NULL = changes are not marked
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int exposure;					// Requested values, -1 = unchanged
+	int gain;
+	int vts;
+	int stop;
+
+	const char *path;
+	int fd;
+	FILE *log;						// Change log, NULL = none
+	pthread_t reader;
+	pthread_t writer;
+	int started;
+
+	uint32_t changes;
+} CONTROL_T;
+
+int control_start(CONTROL_T *c, const char *path, const struct sensor_def *sensor, const struct mode_def *mode,
+				  REG_MAP_T *map, I2C_REGS_T *bus, CAPTURE_T *capture, const char *log_path);
+int control_request(CONTROL_T *c, const char *line);
+void control_stop(CONTROL_T *c);
+
+#endif  // #ifndef
@@ -0,0 +1,77 @@
+#ifndef COPY_POOL_H
+#define COPY_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "copy_queue.h"
+
+#define COPY_POOL_MAX_THREADS	32
+#define COPY_POOL_TICK_MS		50	// Auto-scale sampling period
+#define COPY_POOL_GROW_DEPTH	8	// Queued tasks per active worker before adding one
+#define COPY_POOL_IDLE_TICKS	20	// Empty samples before retiring a worker
+#define COPY_POOL_BUF_SIZE		(1 << 20)	// Bounce buffer of the pwrite fallback
+
+/*
+ * Ways of moving a frame out of mem_dir, cheapest first. The pool starts
+ * with rename when both directories are on the same filesystem and
+ * otherwise with copy_file_range, and steps down whenever the kernel
+ * refuses a method for this pair of filesystems.
+ */
+enum copy_method {
+	COPY_RENAME,
+	COPY_FILE_RANGE,
+	COPY_SENDFILE,
+	COPY_PWRITE,
+	COPY_METHODS
+};
+
+struct copy_method_stats {
+	uint32_t frames;
+	uint64_t bytes;
+	uint64_t ns;
+};
+
+/*
+ * Workers moving frames from mem_dir to the destination. Size, CPU set and
+ * scheduling policy come from the command line; with auto-scaling only
+ * 'active' workers take tasks and the rest are parked.
+ */
+typedef struct copy_pool {
+	COPY_QUEUE_T queue;
+
+	pthread_t threads[COPY_POOL_MAX_THREADS];
+	int num_threads;
+	int min_threads;
+	int active;
+	int autoscale;
+	int peak_active;
+
+	cpu_set_t cpus;
+	int pin;
+	int policy;
+	int priority;
+
+	volatile int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t monitor;
+
+	int method;
+	struct copy_method_stats stats[COPY_METHODS];
+	struct lat_hist lat_wait;		// Queued until a worker took it
+	struct lat_hist lat_copy;		// Taken until copied
+
+	uint32_t copied;
+	uint32_t failed;
+} COPY_POOL_T;
+
+int copy_pool_parse_workers(COPY_POOL_T *p, const char *arg);
+int copy_pool_parse_cpus(COPY_POOL_T *p, const char *arg);
+int copy_pool_parse_sched(COPY_POOL_T *p, const char *arg);
+
+void copy_pool_defaults(COPY_POOL_T *p, int num_threads);
+int copy_pool_start(COPY_POOL_T *p, const char *src_pattern, const char *dst_pattern);
+void copy_pool_stop(COPY_POOL_T *p);
+
+#endif  // #ifndef
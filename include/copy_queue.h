@@ -0,0 +1,60 @@
+#ifndef COPY_QUEUE_H
+#define COPY_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <semaphore.h>
+
+#include "lat_hist.h"
+
+#define COPY_QUEUE_SLOTS		4096	// Power of two
+#define COPY_QUEUE_CACHELINE	64
+
+/*
+ * A copy task is just the frame number (and when it was queued); source
+ * and destination paths are rebuilt by the worker from the two printf
+ * patterns.
+ */
+struct copy_task {
+	uint32_t index;
+	uint64_t queued_ns;
+};
+
+struct copy_cell {
+	uint32_t seq;
+	struct copy_task task;
+};
+
+/*
+ * Bounded, preallocated multi-producer/multi-consumer queue (sequence
+ * numbered cells). Neither side takes a lock; idle workers sleep on a
+ * semaphore counting queued tasks.
+ */
+typedef struct copy_queue {
+	struct copy_cell cells[COPY_QUEUE_SLOTS];
+	const char *src_pattern;
+	const char *dst_pattern;
+
+	uint32_t enqueue_pos __attribute__((aligned(COPY_QUEUE_CACHELINE)));
+	uint32_t high_water;
+	uint32_t rejected;
+	struct lat_hist lat;			// Enqueue latency
+
+	uint32_t dequeue_pos __attribute__((aligned(COPY_QUEUE_CACHELINE)));
+
+	sem_t items __attribute__((aligned(COPY_QUEUE_CACHELINE)));
+} COPY_QUEUE_T;
+
+void copy_queue_init(COPY_QUEUE_T *q, const char *src_pattern, const char *dst_pattern);
+void copy_queue_destroy(COPY_QUEUE_T *q);
+
+int copy_queue_push(COPY_QUEUE_T *q, uint32_t index);
+int copy_queue_pop(COPY_QUEUE_T *q, struct copy_task *task);
+void copy_queue_wait(COPY_QUEUE_T *q);
+uint32_t copy_queue_depth(const COPY_QUEUE_T *q);
+
+int copy_queue_paths(const COPY_QUEUE_T *q, const struct copy_task *task, char *src, char *dst, size_t len);
+uint64_t copy_queue_latency_pct(const COPY_QUEUE_T *q, double pct);
+void copy_queue_report(const COPY_QUEUE_T *q);
+
+#endif  // #ifndef
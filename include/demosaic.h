@@ -0,0 +1,27 @@
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include <stdint.h>
+
+// Colour of the top left pixel pair, same values as VC_IMAGE_BAYER_ORDER_T
+enum bayer_order {
+	BAYER_RGGB,
+	BAYER_GBRG,
+	BAYER_BGGR,
+	BAYER_GRBG,
+};
+
+enum demosaic_method {
+	DEMOSAIC_BILINEAR,				// Average of the nearest samples of each colour
+	DEMOSAIC_EDGE,					// Green along the smaller gradient, red and blue from colour differences
+};
+
+/*
+ * Interpolates a Bayer plane (raw_stride values per line, at most max) to
+ * interleaved RGB at the same scale, width * 3 values per line. Edges are
+ * handled by mirroring, so the output has the full size of the input.
+ */
+int demosaic(const uint16_t *raw, uint32_t width, uint32_t height, uint32_t raw_stride, enum bayer_order order,
+			 uint32_t max, enum demosaic_method method, uint16_t *rgb);
+
+#endif  // #ifndef
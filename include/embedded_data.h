@@ -0,0 +1,70 @@
+#ifndef EMBEDDED_DATA_H
+#define EMBEDDED_DATA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame_ring.h"
+#include "sensor.h"
+
+// SMIA embedded data tags; every tag is followed by one data byte
+#define EMBEDDED_LINE_START		0x0a	// First byte of a line, no data byte
+#define EMBEDDED_TAG_ADDR_HI	0xaa	// Register address bits 15:8
+#define EMBEDDED_TAG_ADDR_LO	0xa5	// Register address bits 7:0
+#define EMBEDDED_TAG_VALUE		0x5a	// Value of the register, address + 1
+#define EMBEDDED_TAG_SKIP		0x55	// No value, address + 1
+#define EMBEDDED_TAG_END		0x07	// End of the line's data
+
+/*
+ * Sensor metadata of every frame (-embedded). Sensors like the IMX219 send
+ * lines of their own ahead of the image with the values of their registers,
+ * which rawcam hands over in a buffer flagged
+ * MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO just before the image buffer.
+ *
+ * The lines are packed like the image (RAW10 and RAW12 lines carry a byte
+ * of low bits after every 4 or 2 bytes, which is skipped) and hold SMIA
+ * tagged data: a start byte, then tag/data byte pairs setting the register
+ * address and giving one value after the other. The registers read are the
+ * sensor's frame_count_reg, exposure_reg and gain_reg.
+ *
+ * The parsed values wait for the next image buffer and go with it if its
+ * pts is within half a frame period; the 8 bit frame counter is extended
+ * to 32 bits on the way.
+ */
+typedef struct embedded_data {
+	// Layout of the side-info buffer
+	uint32_t lines;
+	uint32_t stride;
+	uint32_t line_bytes;			// Packed bytes holding data in a line
+	uint32_t bit_depth;
+	int64_t max_skew_us;			// Largest pts difference to its image
+
+	// Registers read
+	uint16_t frame_reg;
+	uint16_t exposure_reg;
+	uint16_t gain_reg;
+	uint32_t exposure_bytes;		// Consecutive registers, most significant first
+	uint32_t gain_bytes;
+	uint32_t exposure_mask;
+	uint32_t gain_mask;
+
+	// Last side-info buffer, waiting for its image
+	int pending;
+	int64_t pts;
+	uint32_t frame;
+	uint32_t exposure;
+	uint32_t gain;
+	uint32_t parsed;				// Side-info buffers read
+
+	// Statistics
+	uint32_t bad;					// Side-info buffers without the registers
+	uint32_t paired;				// Images that got their metadata
+	uint32_t unpaired;				// Images that did not
+} EMBEDDED_T;
+
+int embedded_init(EMBEDDED_T *e, const struct sensor_def *sensor, uint32_t width, uint32_t stride,
+				  uint32_t bit_depth, int64_t frame_period_us);
+int embedded_parse(EMBEDDED_T *e, const uint8_t *data, uint32_t length, int64_t pts);
+void embedded_attach(EMBEDDED_T *e, struct frame_slot *frame);
+
+#endif  // #ifndef
@@ -0,0 +1,76 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <semaphore.h>
+#include <time.h>
+
+#define FRAME_RING_CACHELINE	64
+#define FRAME_RING_MEMORY		(64 << 20)	// Default budget when no depth is given
+#define FRAME_RING_MIN_DEPTH	4
+#define FRAME_RING_MAX_DEPTH	1024
+
+/*
+ * One captured frame. Used both for the ring slots (data points into the
+ * ring's preallocated memory) and to describe an MMAL buffer in place.
+ */
+struct frame_slot {
+	uint32_t index;
+	uint32_t length;
+	int64_t  pts;
+	uint32_t flags;
+	uint8_t  *data;
+	uint64_t host_ns;		// CLOCK_MONOTONIC when the callback saw the frame
+	uint32_t score;			// Motion gate score, 0 without -motion
+
+	// From the sensor's embedded data, if flags has FRAME_FLAG_EMBEDDED
+	uint32_t sensor_frame;	// Frame counter, extended past its 8 bits
+	uint32_t exposure;		// Lines
+	uint32_t gain;			// Analogue gain code
+};
+
+static inline uint64_t frame_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Single-producer/single-consumer ring of preallocated frame slots.
+ * The producer (MMAL callback) never blocks: when the ring is full the
+ * frame is dropped and counted.
+ */
+typedef struct frame_ring {
+	struct frame_slot *slots;
+	uint8_t *mem;
+	size_t mem_bytes;
+	uint32_t depth;					// Power of two
+	uint32_t slot_size;
+
+	uint32_t head __attribute__((aligned(FRAME_RING_CACHELINE)));	// Producer
+	uint32_t dropped;
+	uint32_t high_water;
+
+	uint32_t tail __attribute__((aligned(FRAME_RING_CACHELINE)));	// Consumer
+	volatile int stop;
+	sem_t ready;
+} FRAME_RING_T;
+
+uint32_t frame_ring_depth_for(uint32_t slot_size, uint32_t requested);
+
+int frame_ring_init(FRAME_RING_T *r, uint32_t depth, uint32_t slot_size);
+void frame_ring_destroy(FRAME_RING_T *r);
+
+struct frame_slot *frame_ring_claim(FRAME_RING_T *r);
+void frame_ring_publish(FRAME_RING_T *r);
+int frame_ring_push(FRAME_RING_T *r, const struct frame_slot *frame);
+
+struct frame_slot *frame_ring_wait(FRAME_RING_T *r);
+void frame_ring_release(FRAME_RING_T *r);
+void frame_ring_wake(FRAME_RING_T *r);
+void frame_ring_stop(FRAME_RING_T *r);
+
+#endif  // #ifndef
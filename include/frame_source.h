@@ -0,0 +1,54 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "frame_ring.h"
+
+typedef void (*frame_source_cb)(void *ctx, const struct frame_slot *frame);
+
+/*
+ * Something that produces RAW frames and hands each of them to a callback,
+ * from its own thread, until stopped: the rawcam port on a Pi, or one of
+ * the host backends below. The frame and its data are only valid for the
+ * duration of the callback.
+ *
+ *   synthetic:<w>x<h>[:<bits>[:<fps>]]     Bayer test pattern, RAW8/10/12
+ *                                          packed like the CSI-2 receiver
+ *   replay:<pattern>[:<tstamps.csv>]       recorded out.%04d.raw files, at
+ *                                          the cadence of the -ts file
+ */
+typedef struct frame_source {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bit_depth;
+	double fps;
+	uint32_t buffer_size;			// Largest frame the source delivers
+
+	int (*start)(struct frame_source *s);
+	void (*stop)(struct frame_source *s);
+	void (*close)(struct frame_source *s);
+
+	frame_source_cb deliver;
+	void *ctx;
+	volatile int running;
+	pthread_t thread;
+	uint32_t delivered;				// Frames handed to deliver()
+	uint32_t finished;				// Replay ran out of frames
+	void *priv;
+} FRAME_SOURCE_T;
+
+int frame_source_open(FRAME_SOURCE_T *s, const char *spec);
+int frame_source_start(FRAME_SOURCE_T *s, frame_source_cb deliver, void *ctx);
+void frame_source_stop(FRAME_SOURCE_T *s);
+void frame_source_close(FRAME_SOURCE_T *s);
+
+uint32_t frame_source_stride(uint32_t width, uint32_t bit_depth);
+
+int synthetic_source_open(FRAME_SOURCE_T *s, const char *args);
+int replay_source_open(FRAME_SOURCE_T *s, const char *args);
+
+#endif  // #ifndef
@@ -0,0 +1,56 @@
+#ifndef I2C_REGS_H
+#define I2C_REGS_H
+
+#include <stdint.h>
+#include <linux/i2c.h>
+
+#define I2C_REGS_MAX_MSGS	42		// I2C_RDWR_IOCTL_MAX_MSGS of i2c-dev
+#define I2C_REGS_BUF_SIZE	1024	// Message bytes per transfer
+#define I2C_REGS_MAX_BURST	32		// Default registers per auto-increment write
+
+// Pseudo registers of the mode tables
+#define I2C_REGS_SET_ADDR	0xFFFF	// Following writes go to slave address data
+#define I2C_REGS_SLEEP		0xFFFE	// Wait data ms
+
+struct sensor_regs {
+	uint16_t reg;
+	uint16_t data;
+};
+
+/*
+ * Writes register tables to a sensor with as few syscalls as possible:
+ * runs of consecutive registers become one auto-increment write of up to
+ * max_burst registers, and up to max_msgs such messages go out in one
+ * I2C_RDWR ioctl. A sleep pseudo register flushes what is queued before
+ * waiting; an address switch just changes the address of the following
+ * messages.
+ *
+ * transfer replaces the ioctl, e.g. with a stand-in bus for testing
+ * (see tools/i2cregs.c). It returns the number of messages written.
+ */
+typedef struct i2c_regs {
+	int fd;
+	uint16_t addr;					// Slave address every table starts with
+	int addressing;					// Bytes of register address (1 or 2)
+	int data_size;					// Bytes of register data (1 or 2)
+	int max_burst;					// 1 = one register per message
+	int max_msgs;					// 1 = one message per syscall
+	int rdwr;						// Adapter takes I2C_RDWR, otherwise write() per message
+
+	int (*transfer)(void *ctx, struct i2c_msg *msgs, int num);
+	void *ctx;
+
+	// Totals over all tables written, for the start-up report
+	uint32_t regs;
+	uint32_t msgs;
+	uint32_t transfers;
+	uint32_t bytes;
+	uint64_t ns;
+} I2C_REGS_T;
+
+void i2c_regs_init(I2C_REGS_T *bus, uint16_t addr, int addressing, int data_size, int max_burst);
+int i2c_regs_open(I2C_REGS_T *bus, const char *device);
+int i2c_regs_write(I2C_REGS_T *bus, const struct sensor_regs *regs, int num_regs);
+void i2c_regs_close(I2C_REGS_T *bus);
+
+#endif  // #ifndef
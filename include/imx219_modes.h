@@ -591,6 +591,16 @@ struct sensor_regs imx219_stop[] = {
       {0x0100, 0x00},          /* disable streaming  */
 };
 
+// Live changes are collected by the grouped parameter hold and applied on
+// the next frame boundary after it is released
+struct sensor_regs imx219_hold[] = {
+      {0x0104, 0x01},
+};
+
+struct sensor_regs imx219_release[] = {
+      {0x0104, 0x00},
+};
+
 // ID, exposure, and gain register settings taken from
 // https://android.googlesource.com/kernel/bcm/+/android-bcm-tetra-3.10-lollipop-wear-release/drivers/media/video/imx219.c
 // Flip settings taken from https://github.com/rellimmot/Sony-IMX219-Raspberry-Pi-V2-CMOS/blob/master/imx219mipiraw_Sensor.c#L585
@@ -600,9 +610,15 @@ struct sensor_def imx219 = {
       .num_modes =            NUM_ELEMENTS(imx219_modes),
       .stop =                 imx219_stop,
       .num_stop_regs =        NUM_ELEMENTS(imx219_stop),
+      .hold =                 imx219_hold,
+      .num_hold_regs =        NUM_ELEMENTS(imx219_hold),
+      .release =              imx219_release,
+      .num_release_regs =     NUM_ELEMENTS(imx219_release),
 
       .i2c_addr =             0x10,
       .i2c_addressing =       2,
+      .stream_reg =           0x0100,     // Mode tables end by starting streaming
+      .i2c_burst =            I2C_REGS_MAX_BURST,
       .i2c_ident_length =     2,
       .i2c_ident_reg =        0x0000,
       .i2c_ident_value =      0x1902,     // 0x0219 bytes reversed
@@ -626,6 +642,9 @@ struct sensor_def imx219 = {
 
       .yos_reg =              0x016E,
       .yos_reg_num_bits =     12,      // y_output_size [11:8] and [7:0] (imx219 datasheet)
+
+      .embedded_lines =       2,       // SMIA tagged registers from 0x0000
+      .frame_count_reg =      0x0018,  // FRM_CNT
 };
 
 #endif
@@ -0,0 +1,53 @@
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <stdint.h>
+#include <signal.h>
+
+#define JOB_LINE_MAX		1024
+
+/*
+ * One capture job, sent as a single line of key=value words:
+ *
+ *   mode=<n> fps=<rate> exposure=<lines> eus=<us> gain=<code>
+ *   left=<px> top=<px> t=<ms> sr=<n> o=<pattern> ts=<csv> tb=<log>
+ *
+ * Anything not given keeps the daemon's setting; t=0 runs until the
+ * client sends "stop" or goes away.
+ */
+struct capture_job {
+	int mode;					// -1 = unchanged for all ints
+	double fps;					// 0 = unchanged
+	int exposure;
+	int exposure_us;
+	int gain;
+	int left;
+	int top;
+	int timeout;
+	int saverate;
+	const char *output;			// NULL = unchanged, point into line
+	const char *tstamps;
+	const char *tslog;
+	char line[JOB_LINE_MAX];
+};
+
+/*
+ * Local Unix socket the capture daemon (-daemon) takes jobs from, one
+ * connection per job. The connection stays open while the job runs and
+ * gets one "ok ..." or "error ..." line back at the end.
+ */
+typedef struct job_server {
+	const char *path;
+	int fd;
+	int client;					// Connection of the running job, -1 if none
+	int client_eof;				// Client will send nothing more
+	uint32_t jobs;
+} JOB_SERVER_T;
+
+int job_server_open(JOB_SERVER_T *s, const char *path);
+int job_server_next(JOB_SERVER_T *s, struct capture_job *job, volatile sig_atomic_t *stop);
+int job_server_cancelled(JOB_SERVER_T *s);
+void job_server_reply(JOB_SERVER_T *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void job_server_close(JOB_SERVER_T *s);
+
+#endif  // #ifndef
@@ -0,0 +1,48 @@
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <stdint.h>
+
+#define LAT_HIST_BUCKETS	32		// log2(ns), bucket i counts [2^(i-1), 2^i)
+
+/*
+ * Lock-free latency histogram, cheap enough to update once per frame from
+ * any thread.
+ */
+struct lat_hist {
+	uint32_t bucket[LAT_HIST_BUCKETS];
+};
+
+static inline void lat_hist_add(struct lat_hist *h, uint64_t ns)
+{
+	uint32_t i = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	if (i >= LAT_HIST_BUCKETS)
+		i = LAT_HIST_BUCKETS - 1;
+	__atomic_fetch_add(&h->bucket[i], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Latency at the given percentile (0..100), as the upper bound of the
+ * bucket it falls into; 0 if nothing was recorded.
+ */
+static inline uint64_t lat_hist_pct(const struct lat_hist *h, double pct)
+{
+	uint64_t total = 0, seen = 0;
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		total += h->bucket[i];
+	if (!total)
+		return 0;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+	{
+		seen += h->bucket[i];
+		if (seen * 100.0 >= pct * total)
+			break;
+	}
+	return i ? 1ull << i : 0;
+}
+
+#endif  // #ifndef
@@ -0,0 +1,63 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MOTION_SCORE_ONE		256		// Score of a mean difference of one 8 bit grey level
+#define MOTION_GATE_COLUMNS		128		// Samples per line the automatic step aims for
+#define MOTION_GATE_BAND		8		// Sample lines scored together
+#define MOTION_GATE_BG_SHIFT	5		// Background follows 1/32 of each difference per frame
+#define MOTION_GATE_FRAC		7		// Fraction bits of the background
+#define MOTION_GATE_ALIGN		16		// Sample lines are padded to this
+
+/*
+ * Activity detector for motion-gated recording (-motion), run in the
+ * callback on every frame that would be saved.
+ *
+ * It samples one green pixel every step pixels in both directions, taking
+ * the 8 most significant bits straight from the packed line, so nothing is
+ * unpacked. Each sample is compared with a running background (an
+ * exponential average over about 1 << MOTION_GATE_BG_SHIFT frames) and the
+ * frame's score is the mean absolute difference of the busiest band of
+ * MOTION_GATE_BAND sample lines, in 1/MOTION_SCORE_ONE grey levels. A
+ * frame is active when its score reaches the threshold. The difference and
+ * the background update are done in one pass with SSE2 or NEON where the
+ * compiler has them; the scalar kernel is the reference they must match.
+ */
+typedef struct motion_gate {
+	// Settings
+	uint32_t threshold;				// Score counted as motion
+	uint32_t bg_shift;
+	int scalar;						// Plain C kernel only (motionbench)
+
+	// Sample grid
+	uint32_t cols;
+	uint32_t rows;
+	uint32_t pitch;					// cols padded to MOTION_GATE_ALIGN
+	uint32_t stride;				// Bytes per packed line
+	uint32_t step;					// Pixels between samples, even
+	uint32_t *col_offset;			// Byte of every sample within its line
+	uint8_t *line;					// Samples of the line being scored
+	int16_t *acc;					// Background, MOTION_GATE_FRAC fraction bits
+	uint8_t *background;			// Same, rounded to 8 bits
+	int primed;						// Background taken from a first frame
+
+	// Statistics
+	uint32_t score;					// Of the last frame
+	uint32_t peak;
+	uint64_t score_sum;
+	uint32_t frames;
+	uint32_t active;
+	uint64_t busy_ns;				// Time spent scoring
+} MOTION_GATE_T;
+
+int motion_gate_parse(const char *spec, uint32_t *threshold, uint32_t *step);
+
+int motion_gate_init(MOTION_GATE_T *g, uint32_t width, uint32_t height, uint32_t stride, uint32_t bit_depth,
+					 int green_first, uint32_t step, uint32_t threshold);
+void motion_gate_destroy(MOTION_GATE_T *g);
+
+int motion_gate_frame(MOTION_GATE_T *g, const uint8_t *data, uint32_t length);
+
+#endif  // #ifndef
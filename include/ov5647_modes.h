@@ -859,6 +859,17 @@ struct sensor_regs ov5647_stop[] = {
    { 0x0100, 0x00 },
 };
 
+// Live changes go through group 0: start, end and quick launch on the
+// next frame boundary (as the mode tables do at their end)
+struct sensor_regs ov5647_hold[] = {
+   { 0x3212, 0x00 },
+};
+
+struct sensor_regs ov5647_release[] = {
+   { 0x3212, 0x10 },
+   { 0x3212, 0xA0 },
+};
+
 // ID register settings taken from http://www.mail-archive.com/linux-kernel@vger.kernel.org/msg1298623.html
 struct sensor_def ov5647 = {
    .name =                 "ov5647",
@@ -866,9 +877,14 @@ struct sensor_def ov5647 = {
    .num_modes =            NUM_ELEMENTS(ov5647_modes),
    .stop =                 ov5647_stop,
    .num_stop_regs =        NUM_ELEMENTS(ov5647_stop),
+   .hold =                 ov5647_hold,
+   .num_hold_regs =        NUM_ELEMENTS(ov5647_hold),
+   .release =              ov5647_release,
+   .num_release_regs =     NUM_ELEMENTS(ov5647_release),
 
    .i2c_addr =             0x36,
    .i2c_addressing =       2,
+   .stream_reg =           0x0100,     // Mode tables end by starting streaming
    .i2c_ident_length =     2,
    .i2c_ident_reg =        0x300A,
    .i2c_ident_value =      0x4756,  //0x5647 byte swapped
@@ -892,6 +908,8 @@ struct sensor_def ov5647 = {
 
    .yos_reg =              0x380A,
    .yos_reg_num_bits =     12,      // y_output_size [11:8] and [7:0] (ov5647 datasheet)
+
+   .embedded_lines =       0,       // No embedded data; frame gaps only show in the pts
 };
 
 #endif
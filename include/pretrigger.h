@@ -0,0 +1,60 @@
+#ifndef PRETRIGGER_H
+#define PRETRIGGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+
+#include "frame_ring.h"
+
+#define PRETRIGGER_MAX_SOURCES	4
+
+enum pretrigger_state {
+	PRETRIGGER_ARMED,	// Frames go into the history only
+	PRETRIGGER_POST,	// Trigger seen, frames go to the writer
+	PRETRIGGER_WAIT,	// Post window done, waiting for the history dump
+};
+
+/*
+ * Circular pre-trigger capture. The callback keeps the last pre_frames
+ * frames in a preallocated history; when a trigger fires the history is
+ * frozen and handed to the writer thread, followed by post_frames live
+ * frames, after which the history is re-armed.
+ */
+typedef struct pretrigger {
+	uint8_t *mem;
+	size_t mem_bytes;
+	struct frame_slot *slots;
+	uint32_t pre_frames;
+	uint32_t post_frames;
+	uint32_t slot_size;
+
+	// Callback side
+	enum pretrigger_state state;
+	uint32_t written;			// Frames stored since arming
+	uint32_t post_left;
+
+	// Trigger sources (signal handler, GPIO ISR, FIFO thread)
+	volatile sig_atomic_t fired;
+
+	// Hand-over to the writer
+	volatile int dump_pending;
+	uint32_t dump_first;
+	uint32_t dump_count;
+
+	uint32_t triggers;
+	uint32_t dumped;
+	FRAME_RING_T *wake;			// Ring whose writer does the dump
+} PRETRIGGER_T;
+
+int pretrigger_init(PRETRIGGER_T *p, uint32_t pre_frames, uint32_t post_frames, uint32_t slot_size, FRAME_RING_T *wake);
+void pretrigger_destroy(PRETRIGGER_T *p);
+
+int pretrigger_frame(PRETRIGGER_T *p, const struct frame_slot *frame);
+void pretrigger_dump(PRETRIGGER_T *p, void (*save)(void *ctx, const struct frame_slot *frame), void *ctx);
+
+void pretrigger_fire(PRETRIGGER_T *p);
+void pretrigger_hold(PRETRIGGER_T *p);
+int pretrigger_add_source(PRETRIGGER_T *p, const char *spec);
+
+#endif  // #ifndef
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
@@ -36,99 +37,29 @@
 #include "bcm_host.h"
 #include "RaspiCLI.h"
 #include "raw_header.h"
-
-
-#define MAX_THREADS			4
+#include "capture.h"
+#include "embedded_data.h"
+#include "frame_source.h"
+#include "sensor.h"
+#include "reg_map.h"
+#include "control.h"
+#include "job_server.h"
+#include "tune.h"
+#include "trace.h"
+
+
+#define MAX_THREADS			4	// Default number of copy workers (-cw)
 #define I2C_SLAVE_FORCE 	0x0706
 
 #define DEFAULT_I2C_DEVICE 	0
 #define FRAME_LOG		   	0
-#define BUFFER_NUM_MANUAL	8	// 0 sets the recommended buffer num
+#define BUFFER_NUM_MANUAL	8	// When the free GPU memory is unknown, 0 sets the recommended buffer num
+#define BUFFER_NUM_MAX		32	// Upper bound of the sizing from free GPU memory
+#define GPU_MEM_RESERVE		(16 << 20)	// Left to the firmware when sizing the pool
 
 #define I2C_DEVICE_NAME_LEN 13	// "/dev/i2c-XXX"+NULL
 static char i2c_device_name[I2C_DEVICE_NAME_LEN];
 
-enum bayer_order {
-	//Carefully ordered so that an hflip is ^1,
-	//and a vflip is ^2.
-	BAYER_ORDER_BGGR,
-	BAYER_ORDER_GBRG,
-	BAYER_ORDER_GRBG,
-	BAYER_ORDER_RGGB
-};
-
-struct sensor_regs {
-	uint16_t reg;
-	uint16_t data;
-};
-
-struct mode_def
-{
-	struct sensor_regs *regs;
-	int num_regs;
-	int width;
-	int height;
-	MMAL_FOURCC_T encoding;
-	enum bayer_order order;
-	int native_bit_depth;
-	uint8_t image_id;
-	uint8_t data_lanes;
-	unsigned int min_vts;
-	int line_time_ns;
-	uint32_t timing1;
-	uint32_t timing2;
-	uint32_t timing3;
-	uint32_t timing4;
-	uint32_t timing5;
-	uint32_t term1;
-	uint32_t term2;
-	int black_level;
-};
-
-struct sensor_def
-{
-	char *name;
-	struct mode_def *modes;
-	int num_modes;
-	struct sensor_regs *stop;
-	int num_stop_regs;
-
-	uint8_t i2c_addr;	// Device I2C slave address
-	int i2c_addressing; // Length of register address values
-	int i2c_data_size;	// Length of register data to write
-
-	//  Detecting the device
-	int i2c_ident_length;	  // Length of I2C ID register
-	uint16_t i2c_ident_reg;	  // ID register address
-	uint16_t i2c_ident_value; // ID register value
-
-	// Flip configuration
-	uint16_t vflip_reg;				   // Register for VFlip
-	int vflip_reg_bit;				   // Bit in that register for VFlip
-	uint16_t hflip_reg;				   // Register for HFlip
-	int hflip_reg_bit;				   // Bit in that register for HFlip
-	int flips_dont_change_bayer_order; // Some sensors do not change the
-									   // Bayer order by adjusting X/Y starts
-									   // to compensate.
-
-	uint16_t exposure_reg;
-	int exposure_reg_num_bits;
-
-	uint16_t vts_reg;
-	int vts_reg_num_bits;
-
-	uint16_t gain_reg;
-	int gain_reg_num_bits;
-
-	uint16_t xos_reg;
-	int xos_reg_num_bits;
-
-	uint16_t yos_reg;
-	int yos_reg_num_bits;
-};
-
-#define NUM_ELEMENTS(a)  (sizeof(a) / sizeof(a[0]))
-
 
 enum {
 	CommandHelp,
@@ -163,15 +94,33 @@ enum {
 	CommandWriteHeaderG,
 	CommandWriteTimestamps,
 	CommandWriteEmpty,
+	CommandContainer,
+	CommandCapacity,
+	CommandRingDepth,
+	CommandPreTrigger,
+	CommandPostTrigger,
+	CommandTrigger,
+	CommandHeaderMode,
+	CommandCopyWorkers,
+	CommandCopyCpus,
+	CommandCopySched,
+	CommandWriteTsLog,
+	CommandControl,
+	CommandDaemon,
+	CommandBuffers,
+	CommandProfile,
+	CommandCalibrate,
+	CommandShm,
+	CommandStreamHeader,
+	CommandMotion,
+	CommandTrack,
+	CommandTrackSettings,
+	CommandEmbedded,
+	CommandHealth,
+	CommandTrace,
 };
 
 
-typedef struct __attribute__((aligned(16))) pts_node {
-	uint32_t idx;
-	uint64_t pts;
-	struct pts_node *nxt;
-} *PTS_NODE_T;
-
 typedef struct
 {
 	int 	mode;
@@ -182,6 +131,7 @@ typedef struct
 	char 	*output;
 	int 	capture;
 	int 	write_header;
+	int 	header_once;
 	int 	timeout;
 	int 	saverate;
 	int 	bit_depth;
@@ -204,9 +154,35 @@ typedef struct
 	char 	*write_header0;
 	char 	*write_headerg;
 	char 	*write_timestamps;
+	char 	*write_tslog;
 	int 	write_empty;
-	PTS_NODE_T ptsa;
-	PTS_NODE_T ptso;
+	char 	*container;
+	int 	capacity;
+	int 	ring_depth;
+	char 	*pretrigger;
+	char 	*posttrigger;
+	char 	*triggers[PRETRIGGER_MAX_SOURCES];
+	int 	num_triggers;
+	char 	*control;
+	char 	*daemon;
+	int 	buffer_num;
+	char 	*profile;
+	int 	calibrate;
+	int 	copy_workers_set;
+	char 	*shm;
+	int 	shm_slots;
+	int 	stream;
+	int 	stream_headers;
+	char 	*motion;
+	uint32_t motion_threshold;
+	uint32_t motion_step;
+	char 	*track;
+	uint32_t track_level;
+	uint32_t track_step;
+	uint32_t track_min_area;
+	int 	embedded;
+	char 	*health;
+	char 	*trace;
 } RASPIRAW_PARAMS_T;
 
 
@@ -219,31 +195,8 @@ struct DEPTH {
 
 extern const struct DEPTH DEPTH_T;
 
-//The process first loads the cleaned up dump of the registers
-//than updates the known registers to the proper values
-//based on: http://www.seeedstudio.com/wiki/images/3/3c/Ov5647_full.pdf
-enum operation {
-       EQUAL,  //Set bit to value
-       SET,    //Set bit
-       CLEAR,  //Clear bit
-       XOR     //Xor bit
-};
 
 static int parse_cmdline(int argc, char **argv, RASPIRAW_PARAMS_T *cfg);
 
 
-typedef struct file_copy_task{
-    char *src;  // Source file path
-    char *dst;  // Destination file path
-	struct file_copy_task* next;
-} file_copy_task_t;
-
-void *worker(void* args);
-
-void enqueue_task(char *const, char *const);
-file_copy_task_t* dequeue_task();
-
-void init_thread_pool(size_t);
-void dstr_thread_pool(size_t);
-
 #endif  // #ifndef
@@ -28,7 +28,38 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef RAWHEADER_H_
 #define RAWHEADER_H_
 
+#ifdef __has_include
+#if __has_include("vc_image_types.h")
+#define RAW_HEADER_HAVE_VC
+#endif
+#else
+#define RAW_HEADER_HAVE_VC
+#endif
+
+#ifdef RAW_HEADER_HAVE_VC
 #include "vc_image_types.h"
+#else
+// Host tools without the VideoCore userland (tools/rawconv.c): the values
+// of vc_image_types.h the header stores
+#include <stdint.h>
+
+typedef enum {
+   VC_IMAGE_BAYER_RGGB,
+   VC_IMAGE_BAYER_GBRG,
+   VC_IMAGE_BAYER_BGGR,
+   VC_IMAGE_BAYER_GRBG
+} VC_IMAGE_BAYER_ORDER_T;
+
+typedef enum {
+   VC_IMAGE_BAYER_RAW6,
+   VC_IMAGE_BAYER_RAW7,
+   VC_IMAGE_BAYER_RAW8,
+   VC_IMAGE_BAYER_RAW10,
+   VC_IMAGE_BAYER_RAW12,
+   VC_IMAGE_BAYER_RAW14,
+   VC_IMAGE_BAYER_RAW16
+} VC_IMAGE_BAYER_FORMAT_T;
+#endif
 
 #define BRCM_ID_SIG 0x4D435242 /* 'BRCM' */
 #define HEADER_VERSION 111
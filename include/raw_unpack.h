@@ -0,0 +1,44 @@
+#ifndef RAW_UNPACK_H
+#define RAW_UNPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Kernels unpacking CSI-2 packed RAW10 (4 pixels in 5 bytes) and RAW12
+ * (2 pixels in 3 bytes) lines. The scalar one is the reference, the others
+ * must match it bit for bit (see tools/unpackbench.c).
+ */
+enum raw_unpack_impl {
+	RAW_UNPACK_AUTO,				// Fastest one this CPU has
+	RAW_UNPACK_SCALAR,
+	RAW_UNPACK_SSSE3,
+	RAW_UNPACK_AVX2,
+	RAW_UNPACK_NEON,
+};
+
+/*
+ * A packed frame as the rawcam component stores it: lines of stride bytes,
+ * each holding VCOS_ALIGN_UP(width, 16) pixels padded to 32 bytes, with
+ * the height padded to 16 lines. Only width x height pixels are unpacked.
+ */
+struct raw_image {
+	const uint8_t *data;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;				// Bytes per line, 0 = raw_unpack_stride()
+	uint32_t bit_depth;				// 8, 10 or 12
+};
+
+uint32_t raw_unpack_stride(uint32_t width, uint32_t bit_depth);
+size_t raw_unpack_frame_size(uint32_t width, uint32_t height, uint32_t bit_depth);
+
+int raw_unpack_supported(enum raw_unpack_impl impl);
+const char *raw_unpack_name(enum raw_unpack_impl impl);
+
+// dst_stride is in pixels, 0 = width
+int raw_unpack16(const struct raw_image *src, uint16_t *dst, uint32_t dst_stride, enum raw_unpack_impl impl);
+int raw_unpack8(const struct raw_image *src, uint8_t *dst, uint32_t dst_stride, const uint8_t *lut,
+				enum raw_unpack_impl impl);
+
+#endif  // #ifndef
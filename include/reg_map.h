@@ -0,0 +1,55 @@
+#ifndef REG_MAP_H
+#define REG_MAP_H
+
+#include <stdint.h>
+
+#include "i2c_regs.h"
+
+// Mask of register bits start..end
+#define REG_BITS(start, end)	((uint16_t)(((1u << ((end) + 1)) - 1) & ~((1u << (start)) - 1)))
+
+//The process first loads the cleaned up dump of the registers
+//than updates the known registers to the proper values
+//based on: http://www.seeedstudio.com/wiki/images/3/3c/Ov5647_full.pdf
+enum operation {
+       EQUAL,  //Set bits to value
+       SET,    //Set bits
+       CLEAR,  //Clear bits
+       XOR     //Xor bits with value
+};
+
+/*
+ * Editable copy of a mode's register table with an address -> slot hash
+ * index, so every edit is one lookup and one masked update instead of a
+ * scan of the table per bit. Registers missing from the table are added
+ * in front of its final stream-on write, and two maps can be diffed to
+ * send only what changed.
+ *
+ * Only registers of the sensor's own slave address are indexed; the first
+ * write to a register is the one edits and diffs refer to. Pseudo
+ * registers and writes to other slaves are kept in place untouched.
+ */
+typedef struct reg_map {
+	struct sensor_regs *regs;		// Table in write order
+	int num_regs;
+	int capacity;
+	int insert_at;					// Slot added registers go to
+	uint16_t addr;					// Slave address the index covers
+	uint16_t *index;				// reg -> slot + 1, 0 = empty
+	uint32_t index_mask;			// Index size - 1, a power of two
+	uint32_t added;					// Registers that were not in the table
+} REG_MAP_T;
+
+int reg_map_init(REG_MAP_T *map, const struct sensor_regs *regs, int num_regs, uint16_t addr, uint16_t stream_reg);
+int reg_map_copy(REG_MAP_T *dst, const REG_MAP_T *src);
+void reg_map_destroy(REG_MAP_T *map);
+
+int reg_map_find(const REG_MAP_T *map, uint16_t reg);
+int reg_map_get(const REG_MAP_T *map, uint16_t reg, uint16_t *value);
+int reg_map_update(REG_MAP_T *map, uint16_t reg, uint16_t mask, uint16_t value, enum operation op);
+int reg_map_set_value(REG_MAP_T *map, uint16_t reg, int num_bits, uint32_t value);
+uint32_t reg_map_get_value(const REG_MAP_T *map, uint16_t reg, int num_bits);
+
+int reg_map_diff(const REG_MAP_T *from, const REG_MAP_T *to, struct sensor_regs *out, int max);
+
+#endif  // #ifndef
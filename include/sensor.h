@@ -0,0 +1,100 @@
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+
+#include "i2c_regs.h"
+
+/*
+ * Sensor and mode descriptions used by the *_modes.h tables. Kept free of
+ * MMAL so the register tables can also be built into host tools.
+ */
+enum bayer_order {
+	//Carefully ordered so that an hflip is ^1,
+	//and a vflip is ^2.
+	BAYER_ORDER_BGGR,
+	BAYER_ORDER_GBRG,
+	BAYER_ORDER_GRBG,
+	BAYER_ORDER_RGGB
+};
+
+struct mode_def
+{
+	struct sensor_regs *regs;
+	int num_regs;
+	int width;
+	int height;
+	uint32_t encoding;			// MMAL_FOURCC_T, 0 = from the bit depth
+	enum bayer_order order;
+	int native_bit_depth;
+	uint8_t image_id;
+	uint8_t data_lanes;
+	unsigned int min_vts;
+	int line_time_ns;
+	uint32_t timing1;
+	uint32_t timing2;
+	uint32_t timing3;
+	uint32_t timing4;
+	uint32_t timing5;
+	uint32_t term1;
+	uint32_t term2;
+	int black_level;
+};
+
+struct sensor_def
+{
+	char *name;
+	struct mode_def *modes;
+	int num_modes;
+	struct sensor_regs *stop;
+	int num_stop_regs;
+	struct sensor_regs *hold;	// Grouped parameter hold around live changes
+	int num_hold_regs;
+	struct sensor_regs *release;
+	int num_release_regs;
+
+	uint8_t i2c_addr;	// Device I2C slave address
+	int i2c_addressing; // Length of register address values
+	int i2c_data_size;	// Length of register data to write
+	int i2c_burst;		// Registers per auto-increment write, 0 = one per message
+	uint16_t stream_reg;	// Written last by the mode tables; added registers go before it
+
+	//  Detecting the device
+	int i2c_ident_length;	  // Length of I2C ID register
+	uint16_t i2c_ident_reg;	  // ID register address
+	uint16_t i2c_ident_value; // ID register value
+
+	// Flip configuration
+	uint16_t vflip_reg;				   // Register for VFlip
+	int vflip_reg_bit;				   // Bit in that register for VFlip
+	uint16_t hflip_reg;				   // Register for HFlip
+	int hflip_reg_bit;				   // Bit in that register for HFlip
+	int flips_dont_change_bayer_order; // Some sensors do not change the
+									   // Bayer order by adjusting X/Y starts
+									   // to compensate.
+
+	uint16_t exposure_reg;
+	int exposure_reg_num_bits;
+
+	uint16_t vts_reg;
+	int vts_reg_num_bits;
+
+	uint16_t gain_reg;
+	int gain_reg_num_bits;
+
+	uint16_t xos_reg;
+	int xos_reg_num_bits;
+
+	uint16_t yos_reg;
+	int yos_reg_num_bits;
+
+	// Embedded data (-embedded): register values the sensor sends ahead
+	// of every image, read with exposure_reg and gain_reg (see
+	// embedded_data.h)
+	int embedded_lines;			// 0 = the sensor sends none
+	uint16_t frame_count_reg;	// 8 bit frame counter
+};
+
+#define NUM_ELEMENTS(a)  (sizeof(a) / sizeof(a[0]))
+
+#endif  // #ifndef
@@ -0,0 +1,79 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame_ring.h"
+
+#define SHM_RING_MAGIC		0x4D485352	// "RSHM"
+#define SHM_RING_VERSION	1
+#define SHM_RING_SLOTS		8			// Default number of frames kept
+#define SHM_RING_ALIGN		4096		// Of every slot's data
+
+/*
+ * Descriptor of one slot. seq is 2n+1 while frame n is being written into
+ * the slot and 2n+2 once it is complete, so a reader can tell whether the
+ * data it looked at still belongs to the frame it asked for.
+ */
+struct shm_ring_slot {
+	uint32_t seq;
+	uint32_t index;					// Frame number of the capture
+	uint32_t length;
+	uint32_t flags;
+	int64_t pts;
+	uint64_t host_ns;				// CLOCK_MONOTONIC when the frame arrived
+	uint64_t offset;				// Of the data from the start of the mapping
+	uint8_t pad[24];
+};
+
+/*
+ * Start of the shared memory object, followed by num_slots descriptors and
+ * then the slot data.
+ */
+struct shm_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bit_depth;
+	uint32_t writer_pid;
+	uint64_t size;					// Of the whole object
+
+	uint32_t head __attribute__((aligned(FRAME_RING_CACHELINE)));	// Frames published, futex word
+	uint32_t closed;				// Writer has gone away
+};
+
+/*
+ * Named POSIX shared memory ring exporting every frame of the capture to
+ * local processes (tracking, preview, recording). The capture side copies
+ * each frame in once and never waits for anyone: readers map the object
+ * read-only, wait on the head counter with a futex and work on the slot
+ * data in place, and a reader that falls num_slots frames behind just
+ * finds newer frames in the slots it wanted.
+ */
+typedef struct shm_ring {
+	char name[64];
+	int fd;
+	int owner;						// Created it, unlinks it
+	size_t size;
+	struct shm_ring_header *hdr;
+	struct shm_ring_slot *slots;
+	uint8_t *base;
+} SHM_RING_T;
+
+// Capture side
+int shm_ring_create(SHM_RING_T *r, const char *name, uint32_t num_slots, uint32_t slot_size,
+					uint32_t width, uint32_t height, uint32_t bit_depth);
+void shm_ring_publish(SHM_RING_T *r, const struct frame_slot *frame);
+void shm_ring_destroy(SHM_RING_T *r);
+
+// Readers
+int shm_ring_attach(SHM_RING_T *r, const char *name);
+int shm_ring_wait(const SHM_RING_T *r, uint32_t seen, int timeout_ms);
+const struct shm_ring_slot *shm_ring_frame(const SHM_RING_T *r, uint32_t n, const uint8_t **data);
+int shm_ring_valid(const SHM_RING_T *r, const struct shm_ring_slot *slot, uint32_t n);
+
+#endif  // #ifndef
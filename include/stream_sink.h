@@ -0,0 +1,56 @@
+#ifndef STREAM_SINK_H
+#define STREAM_SINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define STREAM_MAGIC			0x31465352	// "RSF1"
+#define STREAM_STAGING_FRAMES	8			// Frames the sink holds while the reader is slow
+#define STREAM_PIPE_SIZE		(1 << 20)	// Asked for as pipe buffer size
+#define STREAM_CLOSE_TIMEOUT_MS	2000		// Final flush gives up without progress
+
+/*
+ * Optional header in front of every frame of the stream (-sh).
+ */
+struct stream_frame_header {
+	uint32_t magic;
+	uint32_t index;
+	uint32_t length;				// Bytes of frame data that follow
+	uint32_t flags;
+	int64_t pts;
+};
+
+/*
+ * Continuous byte stream of frames to stdout or a FIFO (-o -, -o <fifo>)
+ * for an encoder or analyser reading it directly. The descriptor is
+ * non-blocking: every frame goes out in one writev() with its header and
+ * whatever is still staged, a frame the pipe only took part of is staged
+ * in the sink's own buffer, and frames arriving while the staging buffer
+ * is full are dropped and counted instead of stalling the capture.
+ */
+typedef struct stream_sink {
+	int fd;
+	int frame_headers;
+	int closed;						// Reader went away
+
+	uint8_t *buf;					// Staging buffer, NULL when not in use
+	size_t size;
+	size_t head;					// Staged bytes are buf[head..tail)
+	size_t tail;
+
+	uint32_t frames;
+	uint32_t dropped;
+	uint32_t staged;				// Frames that did not go out in one piece
+	uint32_t writes;
+	uint64_t bytes;
+} STREAM_SINK_T;
+
+int stream_sink_is_stream(const char *path);
+int stream_sink_take_stdout(void);
+int stream_sink_open(STREAM_SINK_T *s, const char *path, size_t max_frame, int frame_headers,
+					 const void *prefix, size_t prefix_len);
+int stream_sink_write(STREAM_SINK_T *s, uint32_t index, int64_t pts, uint32_t flags, const void *data, uint32_t length);
+void stream_sink_close(STREAM_SINK_T *s);
+
+#endif  // #ifndef
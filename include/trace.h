@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "frame_ring.h"
+
+// 1 builds the -trace probes in (cmake -DRASPIRAW_TRACE=ON); with 0 they
+// compile to nothing
+#ifndef RASPIRAW_TRACE
+#define RASPIRAW_TRACE			0
+#endif
+
+#define TRACE_DEFAULT_EVENTS	16384	// Per thread
+#define TRACE_EXTRA_THREADS		8		// Callback, writer, control... besides the copy workers
+#define TRACE_THREAD_NAME_LEN	24		// pthread names take 16, "thread <n>" up to 18
+
+/*
+ * One timed stretch of a thread: a probe name (a string literal), when it
+ * started and how long it took, and a number such as the frame index.
+ */
+struct trace_event {
+	const char *name;
+	uint64_t start_ns;
+	uint32_t dur_ns;
+	uint32_t arg;
+};
+
+/*
+ * Events of one thread. Only the owning thread writes to it, so recording
+ * takes no lock and no atomic read-modify-write; the buffer is allocated
+ * and touched at trace_start() and simply stops taking events when full.
+ */
+struct trace_buffer {
+	char name[TRACE_THREAD_NAME_LEN];
+	int tid;
+	uint32_t count;
+	uint32_t lost;					// Events past the end
+	struct trace_event *events;
+};
+
+/*
+ * Per-stage latency trace (-trace): the probes below time the rawcam
+ * callback, the hand-over to the writer, the file and container writes,
+ * the copy workers and the I2C writes into per-thread buffers, which
+ * trace_stop() writes out as Chrome trace JSON (chrome://tracing,
+ * ui.perfetto.dev).
+ */
+extern volatile int trace_enabled;
+
+int trace_start(const char *spec, uint32_t threads);
+void trace_thread(const char *name);
+void trace_record(const char *name, uint64_t start_ns, uint32_t arg);
+int trace_stop(void);
+
+#if RASPIRAW_TRACE
+// TRACE_BEGIN(t); ... TRACE_END(t, "probe", frame); times what is between
+#define TRACE_BEGIN(t)				uint64_t t = trace_enabled ? frame_clock_ns() : 0
+#define TRACE_END(t, name, arg)		do { if (t) trace_record(name, t, arg); } while (0)
+#define TRACE_THREAD(name)			do { if (trace_enabled) trace_thread(name); } while (0)
+#else
+#define TRACE_BEGIN(t)
+#define TRACE_END(t, name, arg)		do { } while (0)
+#define TRACE_THREAD(name)			do { } while (0)
+#endif
+
+#endif  // #ifndef
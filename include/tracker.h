@@ -0,0 +1,128 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "frame_ring.h"
+#include "raw_unpack.h"
+
+#define TRACKER_MAGIC			0x4b525452	// 'RTRK'
+#define TRACKER_VERSION			1
+#define TRACKER_MAX_BLOBS		4			// Markers stored per frame
+#define TRACKER_MAX_LABELS		4096		// Bright runs per frame before giving up
+#define TRACKER_RING_DEPTH		8			// Frames queued for the tracker thread
+
+#define TRACKER_FLAG_OVERFLOW	1			// More than TRACKER_MAX_LABELS runs, no blobs
+#define TRACKER_FLAG_SHORT		2			// Frame shorter than its geometry
+
+/*
+ * Marker position in pixels of the full frame: the brightness weighted
+ * centroid of a blob, with (0, 0) the centre of the top left pixel.
+ */
+struct tracker_blob {
+	float x;
+	float y;
+	uint32_t area;				// Cells of the decimated plane
+	uint32_t peak;				// Brightest cell, 8 bit grey level
+};
+
+/*
+ * One record per analysed frame. The blobs are the strongest ones (area
+ * times brightness above the level); the first two are ordered left to
+ * right and angle is the direction from blob 0 to blob 1 in degrees,
+ * positive clockwise as y grows downwards.
+ */
+struct tracker_record {
+	uint32_t index;				// Frame number, as in the timestamp log
+	uint32_t count;				// Blobs found, of which the first TRACKER_MAX_BLOBS are stored
+	int64_t pts;
+	float angle;				// NAN with fewer than 2 blobs
+	uint32_t flags;				// TRACKER_FLAG_*
+	struct tracker_blob blob[TRACKER_MAX_BLOBS];
+};
+
+/*
+ * Binary output: this header, then one struct tracker_record per frame.
+ * A path ending in .csv gets the same as text instead, one line per
+ * frame: index,pts,angle,count,flags,x0,y0,area0,...
+ */
+struct tracker_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t max_blobs;
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved[2];
+};
+
+struct tracker_label {
+	uint32_t parent;
+	uint32_t area;
+	uint32_t peak;
+	uint64_t weight;
+	uint64_t sum_x;
+	uint64_t sum_y;
+};
+
+struct tracker_run {
+	uint32_t start;
+	uint32_t end;				// Last cell of the run
+	uint32_t label;
+};
+
+/*
+ * Real-time marker tracking (-track). The callback only copies every frame
+ * into a small ring; a thread of its own finds the bright blobs and writes
+ * a record per frame, so the frame goes back to MMAL as fast as without
+ * it. Frames arriving while the ring is full are not tracked and counted.
+ *
+ * The frame is reduced to a plane of one value per 2x2 Bayer cell (the sum
+ * of its four pixels' top 8 bits), every step-th cell in both directions.
+ * Cells of at least 4 * level form blobs by 8-connectivity, labelled in one
+ * pass over runs of bright cells with union-find; blobs smaller than
+ * min_area cells are ignored.
+ */
+typedef struct tracker {
+	// Settings
+	uint32_t level;
+	uint32_t step;
+	uint32_t min_area;
+	struct raw_image image;		// Geometry of the frames, data unused
+
+	// Decimated plane
+	uint32_t cols;
+	uint32_t rows;
+	uint8_t *lines;				// Two sensor lines unpacked to 8 bit
+	uint16_t *cells;			// One row of the plane
+	struct tracker_run *runs[2];	// Previous and current row
+	struct tracker_label *labels;
+
+	// Thread and output
+	FILE *out;
+	int csv;
+	FRAME_RING_T ring;
+	pthread_t thread;
+
+	// Statistics
+	uint32_t frames;
+	uint32_t pairs;				// Frames with an angle
+	uint32_t write_errors;
+	uint64_t busy_ns;
+} TRACKER_T;
+
+int tracker_parse(const char *spec, uint32_t *level, uint32_t *step, uint32_t *min_area);
+
+int tracker_init(TRACKER_T *t, uint32_t width, uint32_t height, uint32_t stride, uint32_t bit_depth,
+				 uint32_t level, uint32_t step, uint32_t min_area);
+int tracker_find(TRACKER_T *t, const uint8_t *data, uint32_t length, struct tracker_record *rec);
+void tracker_destroy(TRACKER_T *t);
+
+int tracker_start(TRACKER_T *t, const char *path, uint32_t slot_size);
+void tracker_frame(TRACKER_T *t, const struct frame_slot *frame);
+void tracker_stop(TRACKER_T *t);
+
+#endif  // #ifndef
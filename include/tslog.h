@@ -0,0 +1,79 @@
+#ifndef TSLOG_H
+#define TSLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "frame_ring.h"
+
+/*
+ * Binary timestamp log (-ts / -tb).
+ *
+ * Layout:
+ *
+ *   [struct ts_log_header]
+ *   [block 0][block 1] ...
+ *
+ * Each block is a struct ts_log_block followed by its entries stored as
+ * arrays (struct of arrays), in this order:
+ *
+ *   uint32_t index[count]      frame number
+ *   int64_t  pts[count]        MMAL presentation timestamp (us)
+ *   uint64_t host_ns[count]    CLOCK_MONOTONIC when the callback saw the frame
+ *   uint32_t flags[count]      MMAL buffer flags, FRAME_FLAG_CONTROL on the
+ *                              first frame after a live sensor change
+ *   uint32_t score[count]      motion gate score (see motion_gate.h), 0
+ *                              without -motion; not in version 1 logs
+ *   uint32_t sensor_frame[count]
+ *   uint32_t exposure[count]
+ *   uint32_t gain[count]       from the sensor's embedded data when flags
+ *                              has FRAME_FLAG_EMBEDDED (see capture.h), 0
+ *                              otherwise; only in version 3 logs
+ *
+ * Every block but the last one holds TS_LOG_BLOCK entries. Entries are
+ * collected in page-locked memory and a block is written out as soon as it
+ * is full, so the log never grows in RAM however long the capture runs.
+ */
+
+#define TS_LOG_MAGIC		0x4c535452	// 'RTSL'
+#define TS_LOG_VERSION		3
+#define TS_LOG_BLOCK		4096		// Entries per block
+
+struct ts_log_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_entries;		// TS_LOG_BLOCK of the writer
+	uint32_t reserved;
+};
+
+struct ts_log_block {
+	uint32_t count;				// Entries in this block
+	uint32_t reserved;
+};
+
+typedef struct ts_log {
+	int fd;
+	uint32_t count;				// Entries in the current block
+	uint64_t total;				// Entries written so far
+	uint32_t write_errors;
+
+	uint8_t *mem;				// Page-locked block buffer
+	size_t mem_bytes;
+	uint32_t *index;
+	int64_t *pts;
+	uint64_t *host_ns;
+	uint32_t *flags;
+	uint32_t *score;
+	uint32_t *sensor_frame;
+	uint32_t *exposure;
+	uint32_t *gain;
+} TS_LOG_T;
+
+int ts_log_open(TS_LOG_T *t, const char *path);
+void ts_log_record(TS_LOG_T *t, const struct frame_slot *frame);
+int ts_log_close(TS_LOG_T *t);
+
+int ts_log_to_csv(const char *path, FILE *out, int extended);
+
+#endif  // #ifndef
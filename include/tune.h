@@ -0,0 +1,54 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdint.h>
+
+#define TUNE_MAX_ENTRIES	64		// Lines kept in a profile
+#define TUNE_MAX_STEPS		16		// Buffer counts tried by one calibration
+
+/*
+ * Smallest rawcam buffer and copy worker counts found to sustain a frame
+ * rate at a resolution. A profile is a text file of such entries, one per
+ * line:
+ *
+ *   # width height fps buffers workers
+ *   640 64 660.0 12 2
+ *
+ * workers is 0 when the frames were written in place (no copy pool).
+ */
+struct tune_entry {
+	uint32_t width;
+	uint32_t height;
+	double fps;
+	int buffer_num;
+	int copy_workers;
+};
+
+/*
+ * Search run by -calibrate: buffer counts go up the ladder with all copy
+ * workers until a trial sustains the frame rate, then workers are taken
+ * away while it still does.
+ */
+typedef struct tune {
+	int buffers[TUNE_MAX_STEPS];
+	int num_buffers;
+	int max_workers;
+
+	int step;						// Index into buffers
+	int workers;					// Of the trial handed out
+	int shrinking;					// Buffer count found, reducing workers
+	int done;
+
+	int found;
+	struct tune_entry best;
+	uint32_t trials;
+} TUNE_T;
+
+void tune_init(TUNE_T *t, int min_buffers, int max_buffers, int max_workers);
+int tune_next(TUNE_T *t, int *buffer_num, int *copy_workers);
+void tune_result(TUNE_T *t, int sustained);
+
+int tune_profile_load(const char *path, uint32_t width, uint32_t height, double fps, struct tune_entry *entry);
+int tune_profile_save(const char *path, const struct tune_entry *entry);
+
+#endif  // #ifndef
@@ -1,7 +1,8 @@
 #!/bin/bash
 
-# # Path to the hd0.32k file
-# header_file="hd0.32k"
+# Captures taken with "-hdm once" store the BRCM header a single time as
+# hd0.32k next to the frames; it is put back in front of each frame only
+# for the dcraw run. Override the location with HEADER=<file>.
 
 # Path to dcraw executable
 dcraw_path="./bin/dcraw"
@@ -19,12 +20,19 @@ process_file() {
     temp_output_file="${raw_file%.*}.ppm" # Assuming dcraw creates .ppm files
     final_output_file="$output_path/$base_name.ppm"
 
-    # # Combine header and raw data
-    # sudo cat "$header_file" "$raw_file" > "$output_file"
-
-    # Run dcraw on the combined file
-    # "$dcraw_path" "$output_file"
-    "$dcraw_path" "$raw_file"
+    if [ -n "$header_file" ]; then
+        # Combine header and raw data in a file of its own, so an output
+        # directory equal to the input one never overwrites the frame
+        combined_file=$(mktemp "$output_path/${base_name%.*}.XXXXXX.hdr") || return 1
+        temp_output_file="${combined_file%.*}.ppm"
+        cat "$header_file" "$raw_file" > "$combined_file"
+        "$dcraw_path" "$combined_file"
+        if [ "$combined_file" != "$raw_file" ]; then
+            rm -f "$combined_file"
+        fi
+    else
+        "$dcraw_path" "$raw_file"
+    fi
 
     # Move the output file to the output path
     if [ -f "$temp_output_file" ]; then
@@ -57,8 +65,16 @@ if [ ! -d "$output_path" ]; then
     exit 1
 fi
 
+header_file="${HEADER:-$raw_path/hd0.32k}"
+if [ ! -f "$header_file" ]; then
+    header_file=""
+fi
+
 # Display configuration
 echo "Processing files from '$raw_path' to '$output_path'."
+if [ -n "$header_file" ]; then
+    echo "Using shared header '$header_file'."
+fi
 
 # Use find and xargs to process files in parallel
 find "$raw_path" -name 'out.*.raw' | xargs -n 1 -P 3 -I {} bash -c 'process_file "$@"' _ {} "$output_path"
\ No newline at end of file
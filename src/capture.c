@@ -0,0 +1,518 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+
+// One writer per counter; the reporter may read it at any time
+static inline void health_add(uint32_t *counter, uint32_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+void capture_init(CAPTURE_T *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->container.fd = -1;
+	c->stream.fd = -1;
+	c->saverate = 1;
+}
+
+static void count_saved(CAPTURE_T *c, const struct frame_slot *frame, size_t header_len)
+{
+	if (!c->stats.frames)
+		c->stats.first_pts = frame->pts;
+	c->stats.last_pts = frame->pts;
+	c->stats.frames++;
+	c->stats.bytes += frame->length + header_len;
+	c->stats.header_bytes += header_len;
+	health_add(&c->health.saved, 1);
+}
+
+/**
+ * Stores one frame as a slot of the preallocated container (-cf).
+ * No syscalls on this path unless the mapped window has to move on.
+ */
+static void save_frame_container(CAPTURE_T *c, const struct frame_slot *frame)
+{
+	TRACE_BEGIN(append);
+	int ret = rrc_append(&c->container, frame->index, frame->pts, frame->flags, c->header, c->header_len,
+						 c->write_empty ? NULL : frame->data, frame->length);
+
+	TRACE_END(append, "container append", frame->index);
+	if (ret == 0)
+	{
+		ts_log_record(&c->ts_log, frame);
+		count_saved(c, frame, c->header_len);
+	}
+	else
+		health_add(&c->health.save_errors, 1);
+}
+
+/**
+ * Sends one frame down the stream (-o - or a FIFO). The BRCM header went
+ * out once when the stream was opened.
+ */
+static void save_frame_stream(CAPTURE_T *c, const struct frame_slot *frame)
+{
+	TRACE_BEGIN(write);
+	int ret = stream_sink_write(&c->stream, frame->index, frame->pts, frame->flags,
+								c->write_empty ? NULL : frame->data, frame->length);
+
+	TRACE_END(write, "stream write", frame->index);
+	if (ret == 0)
+	{
+		ts_log_record(&c->ts_log, frame);
+		count_saved(c, frame, 0);
+	}
+	else
+		health_add(&c->health.save_errors, 1);
+}
+
+/**
+ * Stores one frame as its own file in mem_pattern and, once it is written,
+ * hands it to the copy pool.
+ */
+static void save_frame_file(CAPTURE_T *c, const struct frame_slot *frame)
+{
+	uint32_t idx = frame->index;
+	char *filename = NULL;
+	int saved = 0;
+
+	if (asprintf(&filename, c->mem_pattern, idx) >= 0)
+	{
+		TRACE_BEGIN(open_start);
+		int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+		TRACE_END(open_start, "open", idx);
+		if (fd >= 0)
+		{
+			// Calculate the size needed for the file
+			size_t file_size = frame->length + c->header_len;
+			TRACE_BEGIN(mmap_start);
+
+			// Set the file size
+			ftruncate(fd, file_size);
+
+			// Memory-map the file
+			void *mapped_mem = mmap(NULL, file_size, PROT_WRITE, MAP_SHARED, fd, 0);
+			TRACE_END(mmap_start, "mmap", idx);
+			if (mapped_mem != MAP_FAILED)
+			{
+				ts_log_record(&c->ts_log, frame);
+				count_saved(c, frame, c->header_len);
+
+				if (!c->write_empty)
+				{
+					TRACE_BEGIN(copy_start);
+
+					if (c->header)
+						memcpy(mapped_mem, c->header, c->header_len);
+					memcpy((uint8_t *)mapped_mem + c->header_len, frame->data, frame->length);
+					TRACE_END(copy_start, "memcpy", idx);
+				}
+				// Unmap the file
+				munmap(mapped_mem, file_size);
+				saved = 1;
+			}
+			else
+			{
+				// Handle mmap failure
+				perror("mmap");
+				health_add(&c->health.save_errors, 1);
+			}
+			close(fd);
+		}
+		else
+		{
+			// Handle open file failure
+			perror("open");
+			health_add(&c->health.save_errors, 1);
+		}
+
+		// signal to copy the file; a failed save is counted above only
+		if (c->copy && saved)
+		{
+			TRACE_BEGIN(push);
+			int ret = copy_queue_push(&c->copy->queue, idx);
+
+			TRACE_END(push, "copy enqueue", idx);
+			if (ret < 0)
+				fprintf(stderr, "Copy queue full, frame %u stays in %s\n", idx, filename);
+		}
+	}
+	else
+		health_add(&c->health.save_errors, 1);
+
+	free(filename);
+}
+
+static void save_frame(CAPTURE_T *c, const struct frame_slot *frame)
+{
+	TRACE_BEGIN(start);
+
+	if (c->container.hdr)
+		save_frame_container(c, frame);
+	else if (c->stream.buf)
+		save_frame_stream(c, frame);
+	else
+		save_frame_file(c, frame);
+	TRACE_END(start, "save", frame->index);
+	lat_hist_add(&c->stats.lat_save, frame_clock_ns() - frame->host_ns);
+}
+
+static void save_history_frame(void *ctx, const struct frame_slot *frame)
+{
+	save_frame((CAPTURE_T *)ctx, frame);
+}
+
+/**
+ * Drains the frame ring to the configured sink, so that file system stalls
+ * never delay returning buffers to the source.
+ */
+static void *frame_writer(void *args)
+{
+	CAPTURE_T *c = (CAPTURE_T *)args;
+	struct frame_slot *frame;
+
+	TRACE_THREAD("frame writer");
+	for (;;)
+	{
+		frame = frame_ring_wait(&c->ring);
+		// A frozen pre-trigger history goes out before the frames behind it
+		if (c->pretrigger.mem)
+			pretrigger_dump(&c->pretrigger, save_history_frame, c);
+		if (frame)
+		{
+			save_frame(c, frame);
+			frame_ring_release(&c->ring);
+		}
+		else if (c->ring.stop)
+			break;
+	}
+	return NULL;
+}
+
+/**
+ * Creates the frame ring (depth 0 = sized from FRAME_RING_MEMORY) and the
+ * writer thread draining it.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int capture_start_ring(CAPTURE_T *c, uint32_t depth, uint32_t slot_size)
+{
+	depth = frame_ring_depth_for(slot_size, depth);
+	fprintf(stderr, "Create frame ring of %u slots of size %u\n", depth, slot_size);
+	if (frame_ring_init(&c->ring, depth, slot_size) < 0)
+		return -1;
+	if (pthread_create(&c->writer, NULL, frame_writer, c) != 0)
+	{
+		frame_ring_destroy(&c->ring);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Arms the marker for a live sensor change: the first frame that arrives
+ * at or after after_ns is taken as the first one with the change. Its
+ * index ends up in c->marked, and if -sr saves it, it carries
+ * FRAME_FLAG_CONTROL into the timestamp log.
+ */
+void capture_mark(CAPTURE_T *c, uint64_t after_ns)
+{
+	__atomic_store_n(&c->marked, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->mark_ns, after_ns, __ATOMIC_RELEASE);
+}
+
+/**
+ * Sorts a delivered frame into on time, late or after a gap (see struct
+ * capture_health) and counts the frames missing before it.
+ */
+static void classify_frame(CAPTURE_T *c, const struct frame_slot *frame)
+{
+	int64_t period = __atomic_load_n(&c->frame_period_us, __ATOMIC_RELAXED), step = 0;
+	uint32_t missing = 0;
+
+	// A pts step of 1.5 periods or more means the sensor's frames never
+	// reached us (pool exhausted, receiver overrun)
+	if (period && frame->pts >= 0)
+	{
+		if (c->count)
+		{
+			step = frame->pts - c->prev_pts;
+			if (step >= period * 3 / 2)
+				missing = (step + period / 2) / period - 1;
+		}
+		c->prev_pts = frame->pts;
+	}
+
+	// The sensor's own frame counter tells exactly. A frame that came
+	// without its embedded data still is the one after the last.
+	if (frame->flags & FRAME_FLAG_EMBEDDED)
+	{
+		if (c->health.embedded)
+			missing = frame->sensor_frame - c->prev_sensor_frame > 1 ? frame->sensor_frame - c->prev_sensor_frame - 1 : 0;
+		c->prev_sensor_frame = frame->sensor_frame;
+		health_add(&c->health.embedded, 1);
+	}
+	else if (c->health.embedded)
+		c->prev_sensor_frame++;
+
+	if (missing)
+	{
+		health_add(&c->health.dropped_sensor, missing);
+		health_add(&c->health.after_gap, 1);
+	}
+	else if (step > period + period / 8)
+		health_add(&c->health.late, 1);
+	else if (period)
+		health_add(&c->health.on_time, 1);
+}
+
+/**
+ * Called by the frame source for every frame it produces. Only copies the
+ * frame (into the pre-trigger history or the ring) unless the ring is
+ * disabled, in which case the frame is saved right here.
+ */
+void capture_frame(CAPTURE_T *c, const struct frame_slot *frame)
+{
+	struct frame_slot slot = *frame;
+	uint64_t mark_ns = __atomic_load_n(&c->mark_ns, __ATOMIC_ACQUIRE);
+
+	if (mark_ns && frame->host_ns >= mark_ns)
+	{
+		slot.flags |= FRAME_FLAG_CONTROL;
+		__atomic_store_n(&c->marked, c->count + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&c->mark_ns, 0, __ATOMIC_RELEASE);
+	}
+
+	// Readers and the tracker see every frame, whatever is saved
+	slot.index = c->count + 1;
+	if (c->shm)
+		shm_ring_publish(c->shm, &slot);
+	if (c->tracker)
+		tracker_frame(c->tracker, &slot);
+
+	if (!c->health.received)
+		c->health_start_ns = frame->host_ns;
+	health_add(&c->health.received, 1);
+	classify_frame(c, frame);
+
+	// Save every Nth frame
+	if ((c->count++) % c->saverate)
+		return;
+
+	// Activity keeps saving going until the post window after it ends
+	if (c->motion.background && c->pretrigger.mem)
+	{
+		if (motion_gate_frame(&c->motion, frame->data, frame->length))
+			pretrigger_hold(&c->pretrigger);
+		slot.score = c->motion.score;
+	}
+
+	slot.index = c->count;
+	if (c->write_empty)
+		slot.data = NULL;
+	if (c->pretrigger.mem)
+	{
+		TRACE_BEGIN(push);
+
+		// Only frames inside a post-trigger window reach the writer
+		if (pretrigger_frame(&c->pretrigger, &slot) && frame_ring_push(&c->ring, &slot) < 0)
+			health_add(&c->health.dropped_queue, 1);
+		TRACE_END(push, "enqueue", slot.index);
+	}
+	else if (c->ring.mem)
+	{
+		TRACE_BEGIN(push);
+
+		// Copy and return the buffer straight away, the writer
+		// thread does the rest
+		if (frame_ring_push(&c->ring, &slot) < 0)
+			health_add(&c->health.dropped_queue, 1);
+		TRACE_END(push, "enqueue", slot.index);
+	}
+	else
+	{
+		slot.data = frame->data;
+		save_frame(c, &slot);
+	}
+	lat_hist_add(&c->stats.lat_deliver, frame_clock_ns() - frame->host_ns);
+}
+
+/**
+ * capture_frame() with the signature of a frame source callback.
+ */
+void capture_deliver(void *ctx, const struct frame_slot *frame)
+{
+	capture_frame((CAPTURE_T *)ctx, frame);
+}
+
+/**
+ * Prints the health counters to stderr, or rewrites the status file with
+ * them as key=value lines; the final report goes to both. fps is the
+ * delivery rate since the last report.
+ */
+static void health_report(CAPTURE_T *c, double fps, int final)
+{
+	struct capture_health h;
+	uint64_t start = c->health_start_ns;
+	double secs = start ? (frame_clock_ns() - start) / 1e9 : 0.0;
+	// Without a frame period there is nothing to judge timing by
+	int timed = __atomic_load_n(&c->frame_period_us, __ATOMIC_RELAXED) != 0;
+	char timing[96] = "";
+	FILE *f;
+
+	h.received = __atomic_load_n(&c->health.received, __ATOMIC_RELAXED);
+	h.on_time = __atomic_load_n(&c->health.on_time, __ATOMIC_RELAXED);
+	h.late = __atomic_load_n(&c->health.late, __ATOMIC_RELAXED);
+	h.after_gap = __atomic_load_n(&c->health.after_gap, __ATOMIC_RELAXED);
+	h.dropped_sensor = __atomic_load_n(&c->health.dropped_sensor, __ATOMIC_RELAXED);
+	h.dropped_queue = __atomic_load_n(&c->health.dropped_queue, __ATOMIC_RELAXED);
+	h.saved = __atomic_load_n(&c->health.saved, __ATOMIC_RELAXED);
+	h.save_errors = __atomic_load_n(&c->health.save_errors, __ATOMIC_RELAXED);
+	h.embedded = __atomic_load_n(&c->health.embedded, __ATOMIC_RELAXED);
+
+	if (timed)
+		snprintf(timing, sizeof(timing), " %u on time, %u late, %u after a gap,", h.on_time, h.late, h.after_gap);
+	if (final || !c->health_path || !strcmp(c->health_path, "-"))
+		fprintf(stderr, "Health%s: %.1f s, %u received at %.1f fps, %u saved,%s "
+				"dropped %u by the sensor and %u in the queue, %u save errors%s\n", final ? " (final)" : "", secs,
+				h.received, fps, h.saved, timing, h.dropped_sensor, h.dropped_queue,
+				h.save_errors, h.embedded ? ", gaps from the sensor frame counter" : "");
+	if (!c->health_path || !strcmp(c->health_path, "-"))
+		return;
+	f = fopen(c->health_tmp, "w");
+	if (!f)
+		return;
+	fprintf(f, "seconds=%.1f\nfps=%.1f\nreceived=%u\nsaved=%u\n", secs, fps, h.received, h.saved);
+	if (timed)
+		fprintf(f, "on_time=%u\nlate=%u\nafter_gap=%u\n", h.on_time, h.late, h.after_gap);
+	fprintf(f, "dropped_sensor=%u\ndropped_queue=%u\nsave_errors=%u\nembedded=%u\nfinal=%d\n", h.dropped_sensor,
+			h.dropped_queue, h.save_errors, h.embedded, final);
+	if (fclose(f) == 0)
+		rename(c->health_tmp, c->health_path);
+}
+
+static void *health_reporter(void *args)
+{
+	CAPTURE_T *c = (CAPTURE_T *)args;
+	uint64_t last_ns = frame_clock_ns();
+	uint32_t last = 0;
+
+	while (!c->reporter_stop)
+	{
+		uint64_t now;
+		uint32_t received;
+		int i;
+
+		for (i = 0; i < CAPTURE_HEALTH_PERIOD_MS / 100 && !c->reporter_stop; i++)
+			usleep(100000);
+		if (c->reporter_stop)
+			break;
+		now = frame_clock_ns();
+		received = __atomic_load_n(&c->health.received, __ATOMIC_RELAXED);
+		health_report(c, (received - last) * 1e9 / (now - last_ns), 0);
+		last = received;
+		last_ns = now;
+	}
+	return NULL;
+}
+
+/**
+ * Reports the health counters once per second while capturing: to stderr
+ * if path is "-", else by rewriting the file path. capture_stop() writes
+ * the final report there as well.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int capture_start_health(CAPTURE_T *c, const char *path)
+{
+	c->health_path = path;
+	if (strcmp(path, "-") && asprintf(&c->health_tmp, "%s.tmp", path) < 0)
+	{
+		c->health_path = NULL;
+		return -1;
+	}
+	c->reporter_stop = 0;
+	if (pthread_create(&c->reporter, NULL, health_reporter, c) != 0)
+	{
+		free(c->health_tmp);
+		c->health_tmp = NULL;
+		c->health_path = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Lets the writer drain the ring, prints the run summary and closes all
+ * stages. The copy pool is left running so it can finish the backlog.
+ */
+void capture_stop(CAPTURE_T *c)
+{
+	if (c->health_path)
+	{
+		c->reporter_stop = 1;
+		pthread_join(c->reporter, NULL);
+	}
+	if (c->ring.mem)
+	{
+		// Writer drains whatever is still queued before it exits
+		frame_ring_stop(&c->ring);
+		pthread_join(c->writer, NULL);
+		fprintf(stderr, "Frame ring: depth %u, high water %u, dropped %u\n",
+				c->ring.depth, c->ring.high_water, c->ring.dropped);
+		frame_ring_destroy(&c->ring);
+	}
+	if (c->stats.frames)
+	{
+		double secs = (c->stats.last_pts - c->stats.first_pts) / 1e6;
+
+		fprintf(stderr, "Saved %u frames, %llu bytes (%llu header bytes), %.1f fps sustained\n",
+				c->stats.frames, (unsigned long long)c->stats.bytes, (unsigned long long)c->stats.header_bytes,
+				secs > 0 ? (c->stats.frames - 1) / secs : 0.0);
+	}
+	if (c->health.received)
+	{
+		double secs = c->health_start_ns ? (frame_clock_ns() - c->health_start_ns) / 1e9 : 0.0;
+
+		health_report(c, secs > 0 ? c->health.received / secs : 0.0, 1);
+	}
+	free(c->health_tmp);
+	c->health_tmp = NULL;
+	c->health_path = NULL;
+	if (c->motion.background)
+	{
+		MOTION_GATE_T *g = &c->motion;
+
+		fprintf(stderr, "Motion gate: %u of %u frames active, score mean %.2f peak %.2f threshold %.2f, %.1f us per frame\n",
+				g->active, g->frames, g->frames ? g->score_sum / (double)g->frames / MOTION_SCORE_ONE : 0.0,
+				g->peak / (double)MOTION_SCORE_ONE, g->threshold / (double)MOTION_SCORE_ONE,
+				g->frames ? g->busy_ns / 1e3 / g->frames : 0.0);
+		motion_gate_destroy(g);
+	}
+	if (c->pretrigger.mem)
+	{
+		fprintf(stderr, "Pre-trigger: %u triggers, %u history frames saved\n", c->pretrigger.triggers, c->pretrigger.dumped);
+		pretrigger_destroy(&c->pretrigger);
+	}
+	if (c->ts_log.mem)
+	{
+		fprintf(stderr, "Timestamp log: %llu frames\n", (unsigned long long)(c->ts_log.total + c->ts_log.count));
+		ts_log_close(&c->ts_log);
+	}
+	if (c->container.hdr)
+	{
+		fprintf(stderr, "Container: %u frames stored, %u dropped\n", c->container.hdr->count, c->container.hdr->dropped);
+		rrc_close(&c->container);
+	}
+	if (c->stream.buf)
+		stream_sink_close(&c->stream);
+}
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "container.h"
+
+#define RRC_ALIGN_UP(x, a)	(((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+/**
+ * Maps the run of slots starting at first. Only rrc_create() prefaults the
+ * window (populate); when rrc_append() moves it on during a capture, pages
+ * fault in as frames are copied instead of all at once on the save path.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int rrc_map_window(RRC_CONTAINER_T *c, uint32_t first, int populate)
+{
+	uint32_t slots = c->window_slots;
+	void *map;
+
+	if (c->window)
+	{
+		munmap(c->window, c->window_bytes);
+		c->window = NULL;
+	}
+	if (first + slots > c->hdr->capacity)
+		slots = c->hdr->capacity - first;
+
+	c->window_bytes = (size_t)slots * c->hdr->slot_size;
+	map = mmap(NULL, c->window_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | (populate ? MAP_POPULATE : 0),
+			   c->fd, c->hdr->data_offset + (uint64_t)first * c->hdr->slot_size);
+	if (map == MAP_FAILED)
+	{
+		perror("rrc: mmap window");
+		return -1;
+	}
+	c->window = map;
+	c->window_first = first;
+	return 0;
+}
+
+/**
+ * Creates a container file with capacity slots of max_frame_size bytes each.
+ * The whole file is allocated up front so that running out of space is
+ * reported here and not in the middle of a capture. shared_prefix (may be
+ * NULL) is stored once and not counted in max_frame_size.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int rrc_create(RRC_CONTAINER_T *c, const char *path, uint32_t max_frame_size, uint32_t capacity,
+			   const void *shared_prefix, uint32_t prefix_len)
+{
+	uint64_t prefix_bytes = shared_prefix ? RRC_ALIGN_UP(prefix_len, RRC_PAGE_SIZE) : 0;
+	uint64_t table_offset = RRC_PAGE_SIZE + prefix_bytes;
+	uint64_t table_bytes = RRC_ALIGN_UP((uint64_t)capacity * sizeof(struct rrc_frame_record), RRC_PAGE_SIZE);
+	uint32_t slot_size = RRC_ALIGN_UP(max_frame_size, RRC_PAGE_SIZE);
+	uint64_t data_offset = table_offset + table_bytes;
+	uint64_t total = data_offset + (uint64_t)capacity * slot_size;
+	void *map;
+	int err;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	if (!capacity || !max_frame_size)
+		return -1;
+
+	c->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (c->fd < 0)
+	{
+		perror("rrc: open");
+		return -1;
+	}
+	if (shared_prefix && pwrite(c->fd, shared_prefix, prefix_len, RRC_PAGE_SIZE) != (ssize_t)prefix_len)
+	{
+		perror("rrc: write prefix");
+		goto fail;
+	}
+	if (ftruncate(c->fd, total) < 0)
+	{
+		perror("rrc: ftruncate");
+		goto fail;
+	}
+	err = posix_fallocate(c->fd, 0, total);
+	if (err && err != EOPNOTSUPP && err != EINVAL)
+	{
+		fprintf(stderr, "rrc: cannot preallocate %llu bytes for %s: %s\n",
+				(unsigned long long)total, path, strerror(err));
+		goto fail;
+	}
+
+	c->table_bytes = table_bytes;
+	map = mmap(NULL, RRC_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, c->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("rrc: mmap header");
+		goto fail;
+	}
+	c->hdr = map;
+	map = mmap(NULL, table_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, c->fd, table_offset);
+	if (map == MAP_FAILED)
+	{
+		perror("rrc: mmap table");
+		goto fail;
+	}
+	c->table = map;
+	c->writable = 1;
+
+	c->hdr->magic = RRC_MAGIC;
+	c->hdr->version = RRC_VERSION;
+	c->hdr->capacity = capacity;
+	c->hdr->count = 0;
+	c->hdr->slot_size = slot_size;
+	c->hdr->max_frame_size = max_frame_size;
+	c->hdr->table_offset = table_offset;
+	c->hdr->data_offset = data_offset;
+	c->hdr->prefix_offset = shared_prefix ? RRC_PAGE_SIZE : 0;
+	c->hdr->prefix_length = shared_prefix ? prefix_len : 0;
+
+	c->window_slots = RRC_WINDOW_SIZE / slot_size;
+	if (!c->window_slots)
+		c->window_slots = 1;
+	if (rrc_map_window(c, 0, 1) < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	rrc_close(c);
+	unlink(path);
+	return -1;
+}
+
+/**
+ * Appends one frame: prefix (may be NULL) followed by data (may be NULL to
+ * leave the slot zeroed, as --empty does). Single producer only.
+ *
+ * @return 0 on success, -1 if the frame was dropped
+ */
+int rrc_append(RRC_CONTAINER_T *c, uint32_t index, int64_t pts, uint32_t flags,
+			   const void *prefix, size_t prefix_len, const void *data, size_t len)
+{
+	uint32_t n = c->hdr->count;
+	struct rrc_frame_record *rec;
+	uint8_t *slot;
+
+	if (n >= c->hdr->capacity || prefix_len + len > c->hdr->max_frame_size)
+	{
+		c->hdr->dropped++;
+		return -1;
+	}
+
+	if (n < c->window_first || n >= c->window_first + c->window_slots)
+	{
+		if (rrc_map_window(c, n, 0) < 0)
+		{
+			c->hdr->dropped++;
+			return -1;
+		}
+	}
+
+	slot = c->window + (size_t)(n - c->window_first) * c->hdr->slot_size;
+	if (prefix)
+		memcpy(slot, prefix, prefix_len);
+	if (data)
+		memcpy(slot + prefix_len, data, len);
+
+	rec = &c->table[n];
+	rec->index = index;
+	rec->length = prefix_len + len;
+	rec->pts = pts;
+	rec->flags = flags;
+
+	// Publish the slot only once its payload and record are in place
+	__atomic_store_n(&c->hdr->count, n + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Unmaps and closes the container. A writer trims the unused tail slots so
+ * the space goes back to /dev/shm.
+ */
+void rrc_close(RRC_CONTAINER_T *c)
+{
+	uint64_t used = 0;
+
+	if (c->window)
+		munmap(c->window, c->window_bytes);
+	if (c->hdr)
+	{
+		used = c->hdr->data_offset + (uint64_t)c->hdr->count * c->hdr->slot_size;
+		munmap(c->hdr, RRC_PAGE_SIZE);
+	}
+	if (c->table)
+		munmap(c->table, c->table_bytes);
+	if (c->fd >= 0)
+	{
+		if (c->writable && used && ftruncate(c->fd, used) < 0)
+			perror("rrc: trim");
+		close(c->fd);
+	}
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+}
+
+/**
+ * Opens an existing container read-only. The header is checked against the
+ * file size first, so a truncated or foreign file is rejected instead of
+ * faulting on the mapping.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int rrc_open(RRC_CONTAINER_T *c, const char *path)
+{
+	const struct rrc_file_header *h;
+	struct stat st;
+	void *map;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = open(path, O_RDONLY);
+	if (c->fd < 0)
+	{
+		perror("rrc: open");
+		return -1;
+	}
+	if (fstat(c->fd, &st) < 0)
+	{
+		perror("rrc: stat");
+		goto fail;
+	}
+	if (st.st_size < RRC_PAGE_SIZE)
+	{
+		fprintf(stderr, "rrc: %s is too short for a capture container (%lld bytes)\n", path,
+				(long long)st.st_size);
+		goto fail;
+	}
+
+	map = mmap(NULL, RRC_PAGE_SIZE, PROT_READ, MAP_SHARED, c->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("rrc: mmap header");
+		goto fail;
+	}
+	c->hdr = map;
+	if (c->hdr->magic != RRC_MAGIC || c->hdr->version != RRC_VERSION)
+	{
+		fprintf(stderr, "rrc: %s is not a capture container (magic %08X, version %u)\n",
+				path, c->hdr->magic, c->hdr->version);
+		goto fail;
+	}
+	h = c->hdr;
+	if (h->table_offset < RRC_PAGE_SIZE || h->table_offset % RRC_PAGE_SIZE || h->data_offset < h->table_offset ||
+		h->data_offset > (uint64_t)st.st_size || h->count > h->capacity || !h->slot_size ||
+		h->max_frame_size > h->slot_size ||
+		(uint64_t)h->capacity * sizeof(struct rrc_frame_record) > h->data_offset - h->table_offset ||
+		h->data_offset + (uint64_t)h->count * h->slot_size > (uint64_t)st.st_size ||
+		(uint64_t)h->prefix_offset + h->prefix_length > h->table_offset)
+	{
+		fprintf(stderr, "rrc: %s is truncated or corrupt (%u frames, data at %llu, file %lld bytes)\n",
+				path, h->count, (unsigned long long)h->data_offset, (long long)st.st_size);
+		goto fail;
+	}
+
+	c->table_bytes = c->hdr->data_offset - c->hdr->table_offset;
+	map = mmap(NULL, c->table_bytes, PROT_READ, MAP_SHARED, c->fd, c->hdr->table_offset);
+	if (map == MAP_FAILED)
+	{
+		perror("rrc: mmap table");
+		goto fail;
+	}
+	c->table = map;
+	return 0;
+
+fail:
+	rrc_close(c);
+	return -1;
+}
+
+uint32_t rrc_count(const RRC_CONTAINER_T *c)
+{
+	return __atomic_load_n(&c->hdr->count, __ATOMIC_ACQUIRE);
+}
+
+const struct rrc_frame_record *rrc_record(const RRC_CONTAINER_T *c, uint32_t slot)
+{
+	if (slot >= rrc_count(c))
+		return NULL;
+	return &c->table[slot];
+}
+
+/**
+ * Copies the payload of a slot into dst. A record claiming more than a
+ * slot holds is corrupt and read as a failure.
+ *
+ * @return number of bytes read, -1 on failure
+ */
+ssize_t rrc_read(const RRC_CONTAINER_T *c, uint32_t slot, void *dst, size_t len)
+{
+	const struct rrc_frame_record *rec = rrc_record(c, slot);
+
+	if (!rec || rec->length > c->hdr->max_frame_size || rec->length > c->hdr->slot_size)
+		return -1;
+	if (len > rec->length)
+		len = rec->length;
+	return pread(c->fd, dst, len, c->hdr->data_offset + (uint64_t)slot * c->hdr->slot_size);
+}
+
+/**
+ * Copies the shared prefix (e.g. the BRCM header) into dst.
+ *
+ * @return number of bytes read, 0 if the container has no prefix
+ */
+ssize_t rrc_read_prefix(const RRC_CONTAINER_T *c, void *dst, size_t len)
+{
+	if (!c->hdr->prefix_offset)
+		return 0;
+	if (len > c->hdr->prefix_length)
+		len = c->hdr->prefix_length;
+	return pread(c->fd, dst, len, c->hdr->prefix_offset);
+}
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "control.h"
+
+#define CONTROL_MARK_TIMEOUT_NS	1000000000ull	// Give up waiting for the marked frame
+
+static int control_range(const char *name, int value, int num_bits)
+{
+	if (value < 0 || value >= (1 << num_bits))
+	{
+		fprintf(stderr, "Invalid %s %d, range is 0 to %u\n", name, value, (1u << num_bits) - 1);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Parses one command line and records the requested value for the I2C
+ * thread. Later requests replace earlier ones not written yet.
+ *
+ * @return 0 on success, -1 if the command is invalid or not supported
+ *         by the sensor
+ */
+int control_request(CONTROL_T *c, const char *line)
+{
+	const struct sensor_def *s = c->sensor;
+	char name[16];
+	double value;
+	int v, *field = NULL;
+
+	if (sscanf(line, "%15s %lf", name, &value) != 2)
+		return -1;
+
+	if (!strcmp(name, "exposure") || !strcmp(name, "eus"))
+	{
+		if (!s->exposure_reg)
+			return -1;
+		v = !strcmp(name, "eus") ? (int)(value * 1000 / c->mode->line_time_ns) : (int)value;
+		if (control_range("exposure", v, s->exposure_reg_num_bits) < 0)
+			return -1;
+		field = &c->exposure;
+	}
+	else if (!strcmp(name, "gain"))
+	{
+		v = (int)value;
+		if (!s->gain_reg || control_range("gain", v, s->gain_reg_num_bits) < 0)
+			return -1;
+		field = &c->gain;
+	}
+	else if (!strcmp(name, "vts") || !strcmp(name, "fps"))
+	{
+		if (!s->vts_reg || value <= 0)
+			return -1;
+		v = !strcmp(name, "fps") ? (int)(1000000000 / (c->mode->line_time_ns * value)) : (int)value;
+		if (control_range("vts", v, s->vts_reg_num_bits) < 0)
+			return -1;
+		field = &c->vts;
+	}
+	else
+		return -1;
+
+	pthread_mutex_lock(&c->lock);
+	*field = v;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+/**
+ * Writes the changed registers between hold and release.
+ *
+ * @return number of registers written, -1 on failure
+ */
+static int control_apply(CONTROL_T *c, int exposure, int gain, int vts)
+{
+	const struct sensor_def *s = c->sensor;
+	struct sensor_regs regs[CONTROL_MAX_REGS];
+	REG_MAP_T next;
+	int i, n = 0, changed;
+
+	if (reg_map_copy(&next, c->map) < 0)
+		return -1;
+	if (exposure >= 0)
+	{
+		reg_map_set_value(&next, s->exposure_reg, s->exposure_reg_num_bits, exposure);
+		// Stretch the frame if the exposure does not fit, as update_regs() does
+		if (vts < 0 && s->vts_reg && exposure >= (int)c->mode->min_vts && exposure < (1 << s->vts_reg_num_bits))
+			vts = exposure;
+	}
+	if (gain >= 0)
+		reg_map_set_value(&next, s->gain_reg, s->gain_reg_num_bits, gain);
+	if (vts >= 0)
+		reg_map_set_value(&next, s->vts_reg, s->vts_reg_num_bits, vts);
+
+	for (i = 0; i < s->num_hold_regs && n < CONTROL_MAX_REGS; i++)
+		regs[n++] = s->hold[i];
+	changed = reg_map_diff(c->map, &next, &regs[n], CONTROL_MAX_REGS - n - s->num_release_regs);
+	if (changed > CONTROL_MAX_REGS - n - s->num_release_regs)
+	{
+		fprintf(stderr, "Control: %d registers changed, more than fit in one update\n", changed);
+		reg_map_destroy(&next);
+		return -1;
+	}
+	if (!changed)
+	{
+		reg_map_destroy(&next);
+		return 0;
+	}
+	n += changed;
+	for (i = 0; i < s->num_release_regs; i++)
+		regs[n++] = s->release[i];
+
+	if (i2c_regs_write(c->bus, regs, n) < 0)
+	{
+		reg_map_destroy(&next);
+		return -1;
+	}
+	reg_map_destroy(c->map);
+	*c->map = next;
+	return changed;
+}
+
+/**
+ * Length of one frame at the VTS in the map, to tell frames exposed
+ * before a change from those after it.
+ */
+static uint64_t control_frame_ns(CONTROL_T *c)
+{
+	const struct sensor_def *s = c->sensor;
+	uint64_t vts = s->vts_reg ? reg_map_get_value(c->map, s->vts_reg, s->vts_reg_num_bits) : 0;
+
+	if (!vts)
+		vts = c->mode->min_vts;
+	return vts * c->mode->line_time_ns;
+}
+
+static void control_log_value(FILE *log, int value, char sep)
+{
+	if (value >= 0)
+		fprintf(log, "%d", value);
+	fputc(sep, log);
+}
+
+static void *control_writer(void *args)
+{
+	CONTROL_T *c = (CONTROL_T *)args;
+
+	TRACE_THREAD("control");
+	pthread_mutex_lock(&c->lock);
+	for (;;)
+	{
+		int exposure, gain, vts, changed;
+		uint64_t start, done, deadline;
+
+		while (!c->stop && c->exposure < 0 && c->gain < 0 && c->vts < 0)
+			pthread_cond_wait(&c->cond, &c->lock);
+		if (c->stop)
+			break;
+		exposure = c->exposure;
+		gain = c->gain;
+		vts = c->vts;
+		c->exposure = c->gain = c->vts = -1;
+		pthread_mutex_unlock(&c->lock);
+
+		start = frame_clock_ns();
+		changed = control_apply(c, exposure, gain, vts);
+		done = frame_clock_ns();
+
+		if (changed > 0)
+		{
+			uint32_t marked = 0;
+
+			c->changes++;
+			// The sensor switches on the next frame boundary, so the first
+			// frame wholly taken with the change arrives a frame later
+			if (c->capture)
+			{
+				// The health counters judge frames by the new period
+				__atomic_store_n(&c->capture->frame_period_us, (int64_t)(control_frame_ns(c) / 1000), __ATOMIC_RELAXED);
+				capture_mark(c->capture, done + control_frame_ns(c));
+				deadline = done + control_frame_ns(c) + CONTROL_MARK_TIMEOUT_NS;
+				while (!(marked = __atomic_load_n(&c->capture->marked, __ATOMIC_ACQUIRE)) &&
+					   frame_clock_ns() < deadline && !c->stop)
+					usleep(1000);
+			}
+			fprintf(stderr, "Control: exposure %d gain %d vts %d, %d registers in %.2f ms, from frame %u\n",
+					exposure, gain, vts, changed, (done - start) / 1e6, marked);
+			if (c->log && marked)
+			{
+				fprintf(c->log, "%u,", marked);
+				control_log_value(c->log, exposure, ',');
+				control_log_value(c->log, gain, ',');
+				control_log_value(c->log, vts, '\n');
+				fflush(c->log);
+			}
+		}
+		else if (changed < 0)
+			fprintf(stderr, "Control: failed to apply exposure %d gain %d vts %d\n", exposure, gain, vts);
+
+		pthread_mutex_lock(&c->lock);
+	}
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+
+static void *control_reader(void *args)
+{
+	CONTROL_T *c = (CONTROL_T *)args;
+	char buf[256];
+	size_t used = 0;
+
+	for (;;)
+	{
+		ssize_t n = read(c->fd, buf + used, sizeof(buf) - 1 - used);
+		char *line, *end;
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		used += n;
+		buf[used] = '\0';
+
+		for (line = buf; (end = strchr(line, '\n')); line = end + 1)
+		{
+			*end = '\0';
+			if (*line && control_request(c, line) < 0)
+				fprintf(stderr, "Control: ignoring \"%s\"\n", line);
+		}
+		used -= line - buf;
+		memmove(buf, line, used);
+		// Drop a line too long for the buffer
+		if (used == sizeof(buf) - 1)
+			used = 0;
+	}
+	return NULL;
+}
+
+/**
+ * Creates the FIFO if missing and starts the reader and I2C threads.
+ * map and bus are the ones the mode was started with; from here on only
+ * the I2C thread writes to them until control_stop(). log_path (may be
+ * NULL) receives the frame each change took effect on.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int control_start(CONTROL_T *c, const char *path, const struct sensor_def *sensor, const struct mode_def *mode,
+				  REG_MAP_T *map, I2C_REGS_T *bus, CAPTURE_T *capture, const char *log_path)
+{
+	memset(c, 0, sizeof(*c));
+	c->sensor = sensor;
+	c->mode = mode;
+	c->map = map;
+	c->bus = bus;
+	c->capture = capture;
+	c->path = path;
+	c->exposure = c->gain = c->vts = -1;
+
+	if (mkfifo(path, 0666) < 0 && errno != EEXIST)
+	{
+		perror(path);
+		return -1;
+	}
+	// O_RDWR keeps the FIFO open with no writer attached, so read() blocks
+	// instead of returning EOF between controlling processes
+	c->fd = open(path, O_RDWR);
+	if (c->fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	if (log_path && capture)
+	{
+		c->log = fopen(log_path, "w");
+		if (!c->log)
+		{
+			perror(log_path);
+			close(c->fd);
+			return -1;
+		}
+		fprintf(c->log, "frame,exposure,gain,vts\n");
+		fflush(c->log);
+	}
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->cond, NULL);
+	if (pthread_create(&c->writer, NULL, control_writer, c) != 0)
+		goto fail;
+	if (pthread_create(&c->reader, NULL, control_reader, c) != 0)
+	{
+		c->stop = 1;
+		pthread_cond_signal(&c->cond);
+		pthread_join(c->writer, NULL);
+		goto fail;
+	}
+	c->started = 1;
+	return 0;
+
+fail:
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->cond);
+	if (c->log)
+		fclose(c->log);
+	close(c->fd);
+	return -1;
+}
+
+/**
+ * Stops both threads. A change being written is finished first, so the
+ * register map matches the sensor afterwards.
+ */
+void control_stop(CONTROL_T *c)
+{
+	if (!c->started)
+		return;
+	pthread_cancel(c->reader);
+	pthread_join(c->reader, NULL);
+
+	pthread_mutex_lock(&c->lock);
+	c->stop = 1;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	pthread_join(c->writer, NULL);
+
+	close(c->fd);
+	if (c->log)
+		fclose(c->log);
+	c->log = NULL;
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->cond);
+	c->started = 0;
+	fprintf(stderr, "Control: %u changes applied\n", c->changes);
+}
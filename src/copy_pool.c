@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "copy_pool.h"
+#include "trace.h"
+
+struct copy_worker_arg {
+	COPY_POOL_T *pool;
+	int id;
+};
+
+static struct copy_worker_arg worker_args[COPY_POOL_MAX_THREADS];
+
+static const char *copy_method_names[COPY_METHODS] = {
+	"rename", "copy_file_range", "sendfile", "pwrite"
+};
+
+static inline uint64_t copy_pool_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Moves the pool on to method unless another worker already stepped down
+ * further; the shared method only ever goes down the list, so a worker
+ * holding an older value cannot bring back one the kernel refused.
+ *
+ * @return the method to use from now on
+ */
+static int copy_pool_step_down(COPY_POOL_T *p, int method)
+{
+	int cur = __atomic_load_n(&p->method, __ATOMIC_RELAXED);
+
+	while (cur < method &&
+		   !__atomic_compare_exchange_n(&p->method, &cur, method, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return cur > method ? cur : method;
+}
+
+/**
+ * Whether err means the kernel does not support a method for this pair of
+ * files (as opposed to an I/O error on this particular frame).
+ */
+static int copy_unsupported(int err)
+{
+	return err == EXDEV || err == ENOSYS || err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP;
+}
+
+/**
+ * Moves len bytes from src_fd to dst_fd with the given in-kernel method.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int copy_kernel(int method, int src_fd, int dst_fd, size_t len)
+{
+	off_t off = 0;
+
+	while ((size_t)off < len)
+	{
+		ssize_t n;
+
+		if (method == COPY_FILE_RANGE)
+			n = copy_file_range(src_fd, &off, dst_fd, NULL, len - off, 0);
+		else
+			n = sendfile(dst_fd, src_fd, &off, len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			// A first call copying nothing means the method is not usable here
+			if (!n)
+				errno = off ? EIO : EINVAL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Copies len bytes from src_fd to dst_fd through a user space buffer, which
+ * is allocated on first use since only the last-resort method needs it.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int copy_buffered(int src_fd, int dst_fd, size_t len, uint8_t **bufp)
+{
+	off_t off = 0;
+	uint8_t *buf = *bufp;
+
+	if (!buf && !(buf = *bufp = malloc(COPY_POOL_BUF_SIZE)))
+		return -1;
+
+	while ((size_t)off < len)
+	{
+		size_t chunk = len - off < COPY_POOL_BUF_SIZE ? len - off : COPY_POOL_BUF_SIZE;
+		ssize_t n = pread(src_fd, buf, chunk, off), done = 0;
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			if (!n)
+				errno = EIO;
+			return -1;
+		}
+		while (done < n)
+		{
+			ssize_t m = pwrite(dst_fd, buf + done, n - done, off + done);
+
+			if (m < 0 && errno == EINTR)
+				continue;
+			if (m <= 0)
+				return -1;
+			done += m;
+		}
+		off += n;
+	}
+	return 0;
+}
+
+/**
+ * Copies src to dst and removes src, starting with the pool's current
+ * method and stepping down (for the whole pool) whenever it turns out to
+ * be unsupported.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int copy_one(COPY_POOL_T *p, const char *src, const char *dst, uint8_t **buf)
+{
+	uint64_t start = copy_pool_now_ns();
+	int method = __atomic_load_n(&p->method, __ATOMIC_RELAXED);
+	int src_fd, dst_fd, ret;
+	struct stat st;
+
+	if (method == COPY_RENAME)
+	{
+		if (stat(src, &st) < 0)
+		{
+			perror("Error getting source file size");
+			return -1;
+		}
+		TRACE_BEGIN(move);
+		ret = rename(src, dst);
+		TRACE_END(move, "rename", 0);
+		if (ret == 0)
+			goto done;
+		if (errno != EXDEV)
+		{
+			perror("Error moving source file");
+			return -1;
+		}
+		method = copy_pool_step_down(p, COPY_FILE_RANGE);
+	}
+
+	TRACE_BEGIN(open_start);
+	src_fd = open(src, O_RDONLY);
+	if (src_fd < 0)
+	{
+		perror("Error opening source file");
+		return -1;
+	}
+	if (fstat(src_fd, &st) < 0)
+	{
+		perror("Error getting source file size");
+		close(src_fd);
+		return -1;
+	}
+
+	dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (dst_fd < 0)
+	{
+		perror("Error opening destination file");
+		close(src_fd);
+		return -1;
+	}
+	TRACE_END(open_start, "open", 0);
+
+	TRACE_BEGIN(copy_start);
+	for (;;)
+	{
+		if (method == COPY_PWRITE)
+			ret = copy_buffered(src_fd, dst_fd, st.st_size, buf);
+		else
+			ret = copy_kernel(method, src_fd, dst_fd, st.st_size);
+		if (!ret || method == COPY_PWRITE || !copy_unsupported(errno))
+			break;
+
+		// Start over with the next method on a clean destination
+		method = copy_pool_step_down(p, method + 1);
+		if (ftruncate(dst_fd, 0) < 0)
+			break;
+	}
+	TRACE_END(copy_start, copy_method_names[method], 0);
+	if (ret < 0)
+		perror("Error copying frame");
+
+	close(src_fd);
+	if (close(dst_fd) < 0 && !ret)
+	{
+		perror("Error closing destination file");
+		ret = -1;
+	}
+	if (ret < 0)
+		return -1;
+
+	TRACE_BEGIN(unlink_start);
+	ret = unlink(src);
+	TRACE_END(unlink_start, "unlink", 0);
+	if (ret != 0)
+	{
+		perror("Error deleting source file after copy");
+		return -1;
+	}
+
+done:
+	__atomic_fetch_add(&p->stats[method].frames, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&p->stats[method].bytes, (uint64_t)st.st_size, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&p->stats[method].ns, copy_pool_now_ns() - start, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * Picks the first method to try: rename if mem_dir and the destination
+ * directory are on the same filesystem.
+ */
+static int copy_pool_pick_method(const char *src_pattern, const char *dst_pattern)
+{
+	char src[PATH_MAX], dst[PATH_MAX];
+	struct stat src_st, dst_st;
+
+	snprintf(src, sizeof(src), src_pattern, 0);
+	snprintf(dst, sizeof(dst), dst_pattern, 0);
+	if (stat(dirname(src), &src_st) == 0 && stat(dirname(dst), &dst_st) == 0 &&
+		src_st.st_dev == dst_st.st_dev)
+		return COPY_RENAME;
+	return COPY_FILE_RANGE;
+}
+
+static void *copy_worker(void *args)
+{
+	struct copy_worker_arg *arg = (struct copy_worker_arg *)args;
+	COPY_POOL_T *p = arg->pool;
+	char src[PATH_MAX], dst[PATH_MAX];
+	struct copy_task task;
+	uint8_t *buf = NULL;
+	uint64_t start;
+
+	TRACE_THREAD("copy worker");
+	for (;;)
+	{
+		if (arg->id >= p->active && !p->stop)
+		{
+			// Parked by the auto-scaler
+			pthread_mutex_lock(&p->lock);
+			while (arg->id >= p->active && !p->stop)
+				pthread_cond_wait(&p->cond, &p->lock);
+			pthread_mutex_unlock(&p->lock);
+			continue;
+		}
+
+		if (!copy_queue_pop(&p->queue, &task))
+		{
+			// Drain-and-exit: only leave once nothing is queued any more
+			if (p->stop)
+				break;
+			copy_queue_wait(&p->queue);
+			continue;
+		}
+
+		start = copy_pool_now_ns();
+		lat_hist_add(&p->lat_wait, start - task.queued_ns);
+		if (copy_queue_paths(&p->queue, &task, src, dst, sizeof(src)) < 0 ||
+			copy_one(p, src, dst, &buf) < 0)
+			__atomic_fetch_add(&p->failed, 1, __ATOMIC_RELAXED);
+		else
+		{
+			lat_hist_add(&p->lat_copy, copy_pool_now_ns() - start);
+			__atomic_fetch_add(&p->copied, 1, __ATOMIC_RELAXED);
+		}
+		TRACE_END(start, "copy", task.index);
+	}
+	free(buf);
+	return NULL;
+}
+
+/**
+ * Grows the number of active workers while the backlog builds up and
+ * parks them again once the queue has stayed empty for a while.
+ */
+static void *copy_monitor(void *args)
+{
+	COPY_POOL_T *p = (COPY_POOL_T *)args;
+	int idle = 0;
+
+	while (!p->stop)
+	{
+		uint32_t depth = copy_queue_depth(&p->queue);
+		int active = p->active;
+
+		usleep(COPY_POOL_TICK_MS * 1000);
+
+		if (depth > (uint32_t)active * COPY_POOL_GROW_DEPTH && active < p->num_threads)
+			active++;
+		else if (!depth && ++idle >= COPY_POOL_IDLE_TICKS && active > p->min_threads)
+			active--;
+		if (depth)
+			idle = 0;
+
+		if (active != p->active)
+		{
+			pthread_mutex_lock(&p->lock);
+			p->active = active;
+			if (active > p->peak_active)
+				p->peak_active = active;
+			pthread_cond_broadcast(&p->cond);
+			pthread_mutex_unlock(&p->lock);
+			idle = 0;
+		}
+	}
+	return NULL;
+}
+
+void copy_pool_defaults(COPY_POOL_T *p, int num_threads)
+{
+	memset(p, 0, sizeof(*p));
+	p->num_threads = num_threads;
+	p->min_threads = num_threads;
+	p->policy = SCHED_OTHER;
+}
+
+/**
+ * Parses "<n>" (fixed pool) or "auto[:<min>-<max>]" (auto-scaling pool).
+ *
+ * @return 0 on success, -1 on failure
+ */
+int copy_pool_parse_workers(COPY_POOL_T *p, const char *arg)
+{
+	int min = 1, max = COPY_POOL_MAX_THREADS / 4;
+
+	if (!strncmp(arg, "auto", 4))
+	{
+		if (arg[4] == ':' && sscanf(arg + 5, "%d-%d", &min, &max) != 2)
+			return -1;
+		else if (arg[4] && arg[4] != ':')
+			return -1;
+		p->autoscale = 1;
+	}
+	else
+	{
+		if (sscanf(arg, "%d", &max) != 1)
+			return -1;
+		min = max;
+		p->autoscale = 0;
+	}
+	if (min < 1 || max < min || max > COPY_POOL_MAX_THREADS)
+		return -1;
+	p->min_threads = min;
+	p->num_threads = max;
+	return 0;
+}
+
+/**
+ * Parses a CPU list such as "1-3" or "1,3".
+ *
+ * @return 0 on success, -1 on failure
+ */
+int copy_pool_parse_cpus(COPY_POOL_T *p, const char *arg)
+{
+	const char *s = arg;
+
+	CPU_ZERO(&p->cpus);
+	while (*s)
+	{
+		char *end;
+		long first = strtol(s, &end, 10), last;
+
+		if (end == s || first < 0 || first >= CPU_SETSIZE)
+			return -1;
+		last = first;
+		if (*end == '-')
+		{
+			s = end + 1;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first || last >= CPU_SETSIZE)
+				return -1;
+		}
+		for (; first <= last; first++)
+			CPU_SET(first, &p->cpus);
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		s = end;
+	}
+	p->pin = CPU_COUNT(&p->cpus) > 0;
+	return p->pin ? 0 : -1;
+}
+
+/**
+ * Parses "other", "batch", "idle", "fifo:<prio>" or "rr:<prio>".
+ *
+ * @return 0 on success, -1 on failure
+ */
+int copy_pool_parse_sched(COPY_POOL_T *p, const char *arg)
+{
+	p->priority = 0;
+	if (!strcmp(arg, "other"))
+		p->policy = SCHED_OTHER;
+	else if (!strcmp(arg, "batch"))
+		p->policy = SCHED_BATCH;
+	else if (!strcmp(arg, "idle"))
+		p->policy = SCHED_IDLE;
+	else if (!strncmp(arg, "fifo:", 5) && sscanf(arg + 5, "%d", &p->priority) == 1)
+		p->policy = SCHED_FIFO;
+	else if (!strncmp(arg, "rr:", 3) && sscanf(arg + 3, "%d", &p->priority) == 1)
+		p->policy = SCHED_RR;
+	else
+		return -1;
+
+	if (p->priority < sched_get_priority_min(p->policy) || p->priority > sched_get_priority_max(p->policy))
+		return -1;
+	return 0;
+}
+
+/**
+ * Starts the workers (and the auto-scaler). Scheduling and affinity are
+ * applied per thread; failing to apply them (e.g. no CAP_SYS_NICE) is
+ * reported but not fatal.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int copy_pool_start(COPY_POOL_T *p, const char *src_pattern, const char *dst_pattern)
+{
+	struct sched_param param = { .sched_priority = p->priority };
+	int i;
+
+	copy_queue_init(&p->queue, src_pattern, dst_pattern);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	p->stop = 0;
+	p->method = copy_pool_pick_method(src_pattern, dst_pattern);
+	p->active = p->autoscale ? p->min_threads : p->num_threads;
+	p->peak_active = p->active;
+
+	for (i = 0; i < p->num_threads; i++)
+	{
+		worker_args[i].pool = p;
+		worker_args[i].id = i;
+		if (pthread_create(&p->threads[i], NULL, copy_worker, &worker_args[i]) != 0)
+		{
+			perror("copy pool: pthread_create");
+			p->num_threads = i;
+			break;
+		}
+		if (p->pin && pthread_setaffinity_np(p->threads[i], sizeof(p->cpus), &p->cpus) != 0)
+			fprintf(stderr, "copy pool: cannot set CPU affinity of worker %d\n", i);
+		if ((p->policy != SCHED_OTHER || p->priority) &&
+			pthread_setschedparam(p->threads[i], p->policy, &param) != 0)
+			fprintf(stderr, "copy pool: cannot set scheduling policy of worker %d\n", i);
+	}
+	if (!p->num_threads)
+		return -1;
+	if (p->active > p->num_threads)
+		p->active = p->num_threads;
+
+	if (p->autoscale && pthread_create(&p->monitor, NULL, copy_monitor, p) != 0)
+	{
+		// Without the auto-scaler everything runs at full size
+		p->autoscale = 0;
+		p->active = p->num_threads;
+	}
+	return 0;
+}
+
+/**
+ * Lets the workers finish everything queued so far, then joins them.
+ */
+void copy_pool_stop(COPY_POOL_T *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	// Parked workers help with the final drain
+	p->active = p->num_threads;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->autoscale)
+		pthread_join(p->monitor, NULL);
+	for (i = 0; i < p->num_threads; i++)
+		sem_post(&p->queue.items);
+	for (i = 0; i < p->num_threads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	fprintf(stderr, "Copy pool: %d workers (peak %d active), %u frames copied, %u failed\n",
+			p->num_threads, p->peak_active, p->copied, p->failed);
+	for (i = 0; i < COPY_METHODS; i++)
+	{
+		const struct copy_method_stats *st = &p->stats[i];
+
+		if (!st->frames)
+			continue;
+		fprintf(stderr, "Copy path %s: %u frames, %.1f MB, %.1f MB/s\n", copy_method_names[i],
+				st->frames, st->bytes / 1e6, st->ns ? st->bytes * 1e3 / st->ns : 0.0);
+	}
+	copy_queue_report(&p->queue);
+
+	copy_queue_destroy(&p->queue);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "copy_queue.h"
+
+static inline uint64_t copy_queue_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void copy_queue_init(COPY_QUEUE_T *q, const char *src_pattern, const char *dst_pattern)
+{
+	uint32_t i;
+
+	memset(q, 0, sizeof(*q));
+	for (i = 0; i < COPY_QUEUE_SLOTS; i++)
+		q->cells[i].seq = i;
+	q->src_pattern = src_pattern;
+	q->dst_pattern = dst_pattern;
+	sem_init(&q->items, 0, 0);
+}
+
+void copy_queue_destroy(COPY_QUEUE_T *q)
+{
+	sem_destroy(&q->items);
+}
+
+/**
+ * Queues frame index for copying. Never blocks and never allocates.
+ *
+ * @return 0 on success, -1 if COPY_QUEUE_SLOTS copies are already pending
+ */
+int copy_queue_push(COPY_QUEUE_T *q, uint32_t index)
+{
+	uint64_t start = copy_queue_now_ns();
+	uint32_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	struct copy_cell *cell;
+	uint32_t depth;
+
+	for (;;)
+	{
+		int32_t dif;
+
+		cell = &q->cells[pos & (COPY_QUEUE_SLOTS - 1)];
+		dif = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (dif == 0)
+		{
+			if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (dif < 0)
+		{
+			__atomic_fetch_add(&q->rejected, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		else
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	}
+
+	cell->task.index = index;
+	cell->task.queued_ns = start;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&q->items);
+
+	depth = pos + 1 - __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	if (depth > q->high_water)
+		q->high_water = depth;
+
+	lat_hist_add(&q->lat, copy_queue_now_ns() - start);
+	return 0;
+}
+
+/**
+ * Takes one task without blocking.
+ *
+ * @return 1 if a task was taken, 0 if the queue is empty
+ */
+int copy_queue_pop(COPY_QUEUE_T *q, struct copy_task *task)
+{
+	uint32_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	struct copy_cell *cell;
+
+	for (;;)
+	{
+		int32_t dif;
+
+		cell = &q->cells[pos & (COPY_QUEUE_SLOTS - 1)];
+		dif = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (dif == 0)
+		{
+			if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (dif < 0)
+			return 0;
+		else
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	}
+
+	*task = cell->task;
+	__atomic_store_n(&cell->seq, pos + COPY_QUEUE_SLOTS, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ * Sleeps until a task has been queued (or copy_queue_push's semaphore
+ * was posted for another reason).
+ */
+void copy_queue_wait(COPY_QUEUE_T *q)
+{
+	while (sem_wait(&q->items) < 0 && errno == EINTR)
+		;
+}
+
+uint32_t copy_queue_depth(const COPY_QUEUE_T *q)
+{
+	return __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED) -
+		   __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+}
+
+/**
+ * Builds the source and destination paths of a task.
+ *
+ * @return 0 on success, -1 if a path did not fit into len bytes
+ */
+int copy_queue_paths(const COPY_QUEUE_T *q, const struct copy_task *task, char *src, char *dst, size_t len)
+{
+	int n = snprintf(src, len, q->src_pattern, task->index);
+	int m = snprintf(dst, len, q->dst_pattern, task->index);
+
+	return (n < 0 || m < 0 || (size_t)n >= len || (size_t)m >= len) ? -1 : 0;
+}
+
+/**
+ * Enqueue latency at the given percentile (0..100), as the upper bound of
+ * the log2 histogram bucket it falls into.
+ */
+uint64_t copy_queue_latency_pct(const COPY_QUEUE_T *q, double pct)
+{
+	return lat_hist_pct(&q->lat, pct);
+}
+
+void copy_queue_report(const COPY_QUEUE_T *q)
+{
+	fprintf(stderr, "Copy queue: %u slots, high water %u, %u rejected, enqueue latency "
+			"p50 <%lluns p90 <%lluns p99 <%lluns max <%lluns\n",
+			COPY_QUEUE_SLOTS, q->high_water, q->rejected,
+			(unsigned long long)copy_queue_latency_pct(q, 50),
+			(unsigned long long)copy_queue_latency_pct(q, 90),
+			(unsigned long long)copy_queue_latency_pct(q, 99),
+			(unsigned long long)copy_queue_latency_pct(q, 100));
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "demosaic.h"
+
+#define DEMOSAIC_BORDER	2		// Pixels within reach of the kernels
+
+// Colour (0 = R, 1 = G, 2 = B) of the four pixels of a 2x2 cell per order
+static const uint8_t bayer_colours[4][4] = {
+	[BAYER_RGGB] = { 0, 1, 1, 2 },
+	[BAYER_GBRG] = { 1, 2, 0, 1 },
+	[BAYER_BGGR] = { 2, 1, 1, 0 },
+	[BAYER_GRBG] = { 1, 0, 2, 1 },
+};
+
+struct bayer {
+	const uint16_t *raw;
+	int width;
+	int height;
+	int stride;
+	const uint8_t *colours;
+	int max;
+	uint16_t *rgb;
+};
+
+// Reflects about the first and last pixel, which keeps the Bayer phase
+static inline int mirror(int i, int n)
+{
+	if (i < 0)
+		i = -i;
+	if (i >= n)
+		i = 2 * n - 2 - i;
+	return i;
+}
+
+static inline int clamp(int v, int max)
+{
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+static inline int raw_at(const struct bayer *b, int x, int y, int border)
+{
+	if (border)
+	{
+		x = mirror(x, b->width);
+		y = mirror(y, b->height);
+	}
+	return b->raw[(size_t)y * b->stride + x];
+}
+
+// Green plane of the output, filled in by the first DEMOSAIC_EDGE pass
+static inline int green_at(const struct bayer *b, int x, int y, int border)
+{
+	if (border)
+	{
+		x = mirror(x, b->width);
+		y = mirror(y, b->height);
+	}
+	return b->rgb[((size_t)y * b->width + x) * 3 + 1];
+}
+
+#define RAW(dx, dy)		raw_at(b, x + (dx), y + (dy), border)
+#define GREEN(dx, dy)	green_at(b, x + (dx), y + (dy), border)
+#define COLOUR(x, y)	b->colours[((y) & 1) * 2 + ((x) & 1)]
+
+static inline void bilinear_pixel(const struct bayer *b, int x, int y, uint16_t *out, int border)
+{
+	int c = COLOUR(x, y);
+
+	if (c == 1)
+	{
+		// Colour of the left and right neighbours
+		int hc = COLOUR(x + 1, y);
+
+		out[1] = RAW(0, 0);
+		out[hc] = (RAW(-1, 0) + RAW(1, 0) + 1) >> 1;
+		out[2 - hc] = (RAW(0, -1) + RAW(0, 1) + 1) >> 1;
+	}
+	else
+	{
+		out[c] = RAW(0, 0);
+		out[1] = (RAW(-1, 0) + RAW(1, 0) + RAW(0, -1) + RAW(0, 1) + 2) >> 2;
+		out[2 - c] = (RAW(-1, -1) + RAW(1, -1) + RAW(-1, 1) + RAW(1, 1) + 2) >> 2;
+	}
+}
+
+/*
+ * Green at a red or blue site along the direction with the smaller
+ * gradient, corrected by the second derivative of the site's own colour
+ * (Hamilton-Adams).
+ */
+static inline void edge_green_pixel(const struct bayer *b, int x, int y, uint16_t *out, int border)
+{
+	int v = RAW(0, 0), gl, gr, gu, gd, ch, cv, dh, dv, g;
+
+	if (COLOUR(x, y) == 1)
+	{
+		out[1] = v;
+		return;
+	}
+	gl = RAW(-1, 0);
+	gr = RAW(1, 0);
+	gu = RAW(0, -1);
+	gd = RAW(0, 1);
+	ch = 2 * v - RAW(-2, 0) - RAW(2, 0);
+	cv = 2 * v - RAW(0, -2) - RAW(0, 2);
+	dh = abs(gl - gr) + abs(ch);
+	dv = abs(gu - gd) + abs(cv);
+	if (dh < dv)
+		g = (2 * (gl + gr) + ch + 2) >> 2;
+	else if (dv < dh)
+		g = (2 * (gu + gd) + cv + 2) >> 2;
+	else
+		g = (2 * (gl + gr + gu + gd) + ch + cv + 4) >> 3;
+	out[1] = clamp(g, b->max);
+}
+
+/*
+ * Red and blue as green plus the interpolated colour difference of the
+ * nearest samples, so they follow the edges the green plane kept.
+ */
+static inline void edge_rb_pixel(const struct bayer *b, int x, int y, uint16_t *out, int border)
+{
+	int c = COLOUR(x, y), g = out[1];
+
+	if (c == 1)
+	{
+		int hc = COLOUR(x + 1, y);
+
+		out[hc] = clamp(g + ((RAW(-1, 0) - GREEN(-1, 0) + RAW(1, 0) - GREEN(1, 0)) >> 1), b->max);
+		out[2 - hc] = clamp(g + ((RAW(0, -1) - GREEN(0, -1) + RAW(0, 1) - GREEN(0, 1)) >> 1), b->max);
+	}
+	else
+	{
+		out[c] = RAW(0, 0);
+		out[2 - c] = clamp(g + ((RAW(-1, -1) - GREEN(-1, -1) + RAW(1, -1) - GREEN(1, -1) +
+								 RAW(-1, 1) - GREEN(-1, 1) + RAW(1, 1) - GREEN(1, 1)) >> 2), b->max);
+	}
+}
+
+/*
+ * Runs pixel() over the frame. Only the DEMOSAIC_BORDER pixels along the
+ * edges mirror their neighbours; the inner loop reads them directly.
+ */
+#define FOR_EACH_PIXEL(b, pixel)													\
+	do {																			\
+		int x, y;																	\
+		for (y = 0; y < (b)->height; y++)											\
+		{																			\
+			uint16_t *out = (b)->rgb + (size_t)y * (b)->width * 3;					\
+			int inner = y >= DEMOSAIC_BORDER && y < (b)->height - DEMOSAIC_BORDER;	\
+																					\
+			for (x = 0; x < (b)->width && (!inner || x < DEMOSAIC_BORDER); x++)		\
+				pixel(b, x, y, out + x * 3, 1);										\
+			if (!inner)																\
+				continue;															\
+			for (; x < (b)->width - DEMOSAIC_BORDER; x++)							\
+				pixel(b, x, y, out + x * 3, 0);										\
+			for (; x < (b)->width; x++)												\
+				pixel(b, x, y, out + x * 3, 1);										\
+		}																			\
+	} while (0)
+
+/**
+ * Interpolates the Bayer plane to RGB.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int demosaic(const uint16_t *raw, uint32_t width, uint32_t height, uint32_t raw_stride, enum bayer_order order,
+			 uint32_t max, enum demosaic_method method, uint16_t *rgb)
+{
+	struct bayer b = { raw, width, height, raw_stride, NULL, max, rgb };
+
+	if (order > BAYER_GRBG || width <= DEMOSAIC_BORDER * 2 || height <= DEMOSAIC_BORDER * 2)
+	{
+		fprintf(stderr, "Cannot demosaic a %ux%u frame with Bayer order %d\n", width, height, order);
+		return -1;
+	}
+	b.colours = bayer_colours[order];
+	if (method == DEMOSAIC_BILINEAR)
+		FOR_EACH_PIXEL(&b, bilinear_pixel);
+	else
+	{
+		// Red and blue need the green of their neighbours
+		FOR_EACH_PIXEL(&b, edge_green_pixel);
+		FOR_EACH_PIXEL(&b, edge_rb_pixel);
+	}
+	return 0;
+}
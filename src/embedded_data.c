@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "embedded_data.h"
+#include "capture.h"
+
+/**
+ * Sets up the parser for a sensor sending width pixel lines of stride
+ * bytes at bit_depth. frame_period_us bounds the pts difference between a
+ * side-info buffer and its image, 0 = no check.
+ *
+ * @return 0 on success, -1 if the sensor sends no embedded data
+ */
+int embedded_init(EMBEDDED_T *e, const struct sensor_def *sensor, uint32_t width, uint32_t stride,
+				  uint32_t bit_depth, int64_t frame_period_us)
+{
+	memset(e, 0, sizeof(*e));
+	if (!sensor->embedded_lines || (bit_depth != 8 && bit_depth != 10 && bit_depth != 12))
+	{
+		fprintf(stderr, "Embedded data: not available from %s in RAW%u\n", sensor->name, bit_depth);
+		return -1;
+	}
+	e->lines = sensor->embedded_lines;
+	e->line_bytes = (width * bit_depth + 7) / 8;
+	e->stride = stride ? stride : e->line_bytes;
+	e->bit_depth = bit_depth;
+	e->max_skew_us = frame_period_us ? frame_period_us / 2 : INT64_MAX;
+
+	e->frame_reg = sensor->frame_count_reg;
+	e->exposure_reg = sensor->exposure_reg;
+	e->exposure_bytes = (sensor->exposure_reg_num_bits + 7) / 8;
+	e->exposure_mask = (1u << sensor->exposure_reg_num_bits) - 1;
+	e->gain_reg = sensor->gain_reg;
+	e->gain_bytes = (sensor->gain_reg_num_bits + 7) / 8;
+	e->gain_mask = (1u << sensor->gain_reg_num_bits) - 1;
+	return 0;
+}
+
+// Byte of low bits after every 4 (RAW10) or 2 (RAW12) bytes of a line
+static inline int embedded_low_bits(const EMBEDDED_T *e, uint32_t pos)
+{
+	return (e->bit_depth == 10 && pos % 5 == 4) || (e->bit_depth == 12 && pos % 3 == 2);
+}
+
+/**
+ * Reads the registers out of one side-info buffer and keeps them for the
+ * image that follows.
+ *
+ * @return 0 on success, -1 if the buffer is malformed or lacks a register
+ */
+int embedded_parse(EMBEDDED_T *e, const uint8_t *data, uint32_t length, int64_t pts)
+{
+	uint32_t need = 1 + e->exposure_bytes + e->gain_bytes, have = 0;
+	uint32_t addr = 0, count = 0, exposure = 0, gain = 0, l;
+
+	for (l = 0; l < e->lines && (size_t)l * e->stride < length; l++)
+	{
+		const uint8_t *line = data + (size_t)l * e->stride;
+		uint32_t n = length - l * e->stride < e->line_bytes ? length - l * e->stride : e->line_bytes;
+		uint32_t pos;
+		int tag = -1;
+
+		if (line[0] != EMBEDDED_LINE_START)
+			break;
+		for (pos = 1; pos < n; pos++)
+		{
+			uint8_t value = line[pos];
+
+			if (embedded_low_bits(e, pos))
+				continue;
+			if (tag < 0)
+			{
+				tag = value;
+				continue;
+			}
+			if (tag == EMBEDDED_TAG_END)
+				break;
+			switch (tag)
+			{
+				case EMBEDDED_TAG_ADDR_HI:
+					addr = (addr & 0xff) | value << 8;
+					break;
+				case EMBEDDED_TAG_ADDR_LO:
+					addr = (addr & 0xff00) | value;
+					break;
+				case EMBEDDED_TAG_SKIP:
+					addr++;
+					break;
+				case EMBEDDED_TAG_VALUE:
+					if (addr == e->frame_reg)
+					{
+						count = value;
+						have++;
+					}
+					else if (addr - e->exposure_reg < e->exposure_bytes)
+					{
+						exposure = exposure << 8 | value;
+						have++;
+					}
+					else if (addr - e->gain_reg < e->gain_bytes)
+					{
+						gain = gain << 8 | value;
+						have++;
+					}
+					addr++;
+					break;
+				default:
+					e->bad++;
+					return -1;
+			}
+			tag = -1;
+		}
+	}
+	if (have != need)
+	{
+		e->bad++;
+		return -1;
+	}
+
+	// Extend the 8 bit counter; a wrap is one step past 0xff
+	if (e->parsed++)
+		e->frame += (uint8_t)(count - e->frame);
+	else
+		e->frame = count;
+	e->exposure = exposure & e->exposure_mask;
+	e->gain = gain & e->gain_mask;
+	e->pts = pts;
+	e->pending = 1;
+	return 0;
+}
+
+/**
+ * Gives an image buffer the metadata parsed last, if that belongs to it,
+ * and flags it FRAME_FLAG_EMBEDDED.
+ */
+void embedded_attach(EMBEDDED_T *e, struct frame_slot *frame)
+{
+	int64_t skew = frame->pts - e->pts;
+
+	if (e->pending && (frame->pts < 0 || e->pts < 0 || (skew < 0 ? -skew : skew) <= e->max_skew_us))
+	{
+		frame->sensor_frame = e->frame;
+		frame->exposure = e->exposure;
+		frame->gain = e->gain;
+		frame->flags |= FRAME_FLAG_EMBEDDED;
+		e->paired++;
+	}
+	else
+		e->unpaired++;
+	e->pending = 0;
+}
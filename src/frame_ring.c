@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "frame_ring.h"
+
+/**
+ * Picks a ring depth: the requested one rounded down to a power of two, or
+ * as many slots as fit into FRAME_RING_MEMORY when requested is 0.
+ */
+uint32_t frame_ring_depth_for(uint32_t slot_size, uint32_t requested)
+{
+	uint32_t depth = requested;
+
+	if (!depth)
+	{
+		depth = slot_size ? FRAME_RING_MEMORY / slot_size : FRAME_RING_MIN_DEPTH;
+		if (depth < FRAME_RING_MIN_DEPTH)
+			depth = FRAME_RING_MIN_DEPTH;
+	}
+	if (depth > FRAME_RING_MAX_DEPTH)
+		depth = FRAME_RING_MAX_DEPTH;
+
+	while (depth & (depth - 1))
+		depth &= depth - 1;
+	return depth;
+}
+
+/**
+ * Allocates and page-locks depth slots of slot_size bytes, so the callback
+ * never takes a page fault when copying into the ring.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int frame_ring_init(FRAME_RING_T *r, uint32_t depth, uint32_t slot_size)
+{
+	uint32_t i;
+
+	memset(r, 0, sizeof(*r));
+	if (!depth || (depth & (depth - 1)))
+		return -1;
+
+	r->depth = depth;
+	r->slot_size = (slot_size + FRAME_RING_CACHELINE - 1) & ~(FRAME_RING_CACHELINE - 1);
+	r->mem_bytes = (size_t)r->depth * r->slot_size;
+
+	r->slots = calloc(depth, sizeof(*r->slots));
+	if (!r->slots)
+		return -1;
+
+	r->mem = mmap(NULL, r->mem_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (r->mem == MAP_FAILED)
+	{
+		perror("frame_ring: mmap");
+		free(r->slots);
+		r->mem = NULL;
+		r->slots = NULL;
+		return -1;
+	}
+	if (mlock(r->mem, r->mem_bytes) < 0)
+		perror("frame_ring: mlock (continuing unlocked)");
+
+	for (i = 0; i < depth; i++)
+		r->slots[i].data = r->mem + (size_t)i * r->slot_size;
+
+	sem_init(&r->ready, 0, 0);
+	return 0;
+}
+
+void frame_ring_destroy(FRAME_RING_T *r)
+{
+	if (r->mem)
+	{
+		munlock(r->mem, r->mem_bytes);
+		munmap(r->mem, r->mem_bytes);
+		sem_destroy(&r->ready);
+	}
+	free(r->slots);
+	memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Producer side: returns the next free slot, or NULL (and counts a drop)
+ * when the consumer has fallen depth frames behind.
+ */
+struct frame_slot *frame_ring_claim(FRAME_RING_T *r)
+{
+	uint32_t head = r->head;
+	uint32_t used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (used >= r->depth)
+	{
+		r->dropped++;
+		return NULL;
+	}
+	if (used + 1 > r->high_water)
+		r->high_water = used + 1;
+	return &r->slots[head & (r->depth - 1)];
+}
+
+void frame_ring_publish(FRAME_RING_T *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+	sem_post(&r->ready);
+}
+
+/**
+ * Copies one frame into the ring: its data (none if frame->data is NULL)
+ * and everything known about it, including the arrival time the source
+ * stamped in host_ns (the time it was queued if the source gave none).
+ *
+ * @return 0 on success, -1 if the frame was dropped
+ */
+int frame_ring_push(FRAME_RING_T *r, const struct frame_slot *frame)
+{
+	struct frame_slot *slot;
+	uint8_t *mem;
+
+	if (frame->length > r->slot_size)
+	{
+		r->dropped++;
+		return -1;
+	}
+	slot = frame_ring_claim(r);
+	if (!slot)
+		return -1;
+
+	mem = slot->data;
+	*slot = *frame;
+	slot->data = mem;
+	if (!slot->host_ns)
+		slot->host_ns = frame_clock_ns();
+	if (frame->data)
+		memcpy(mem, frame->data, frame->length);
+	frame_ring_publish(r);
+	return 0;
+}
+
+/**
+ * Consumer side: blocks until a frame is available. Returns NULL when woken
+ * by frame_ring_wake() with nothing queued, or once the ring was stopped and
+ * everything queued before has been drained.
+ */
+struct frame_slot *frame_ring_wait(FRAME_RING_T *r)
+{
+	uint32_t tail = r->tail;
+
+	if (tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		return &r->slots[tail & (r->depth - 1)];
+	if (r->stop)
+		return NULL;
+
+	while (sem_wait(&r->ready) < 0 && errno == EINTR)
+		;
+	if (tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		return &r->slots[tail & (r->depth - 1)];
+	return NULL;
+}
+
+void frame_ring_release(FRAME_RING_T *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Makes a pending frame_ring_wait() return. Async-signal-safe.
+ */
+void frame_ring_wake(FRAME_RING_T *r)
+{
+	sem_post(&r->ready);
+}
+
+void frame_ring_stop(FRAME_RING_T *r)
+{
+	r->stop = 1;
+	sem_post(&r->ready);
+}
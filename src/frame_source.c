@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_source.h"
+
+/**
+ * Bytes per line of a CSI-2 packed RAW frame as the rawcam component lays
+ * it out (RAW10: 4 pixels in 5 bytes, RAW12: 2 pixels in 3 bytes), padded
+ * to 32 bytes.
+ */
+uint32_t frame_source_stride(uint32_t width, uint32_t bit_depth)
+{
+	return (((width * bit_depth + 7) / 8) + 31) & ~31u;
+}
+
+/**
+ * Opens a host frame source from "<backend>:<args>".
+ *
+ * @return 0 on success, -1 on failure
+ */
+int frame_source_open(FRAME_SOURCE_T *s, const char *spec)
+{
+	memset(s, 0, sizeof(*s));
+	if (!strncmp(spec, "synthetic:", 10))
+		return synthetic_source_open(s, spec + 10);
+	if (!strncmp(spec, "replay:", 7))
+		return replay_source_open(s, spec + 7);
+
+	fprintf(stderr, "Unknown frame source %s\n", spec);
+	return -1;
+}
+
+/**
+ * Starts delivering frames to deliver(ctx, frame).
+ *
+ * @return 0 on success, -1 on failure
+ */
+int frame_source_start(FRAME_SOURCE_T *s, frame_source_cb deliver, void *ctx)
+{
+	s->deliver = deliver;
+	s->ctx = ctx;
+	s->delivered = 0;
+	s->finished = 0;
+	s->running = 1;
+	if (s->start(s) < 0)
+	{
+		s->running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the source; no callback runs any more once this returns.
+ */
+void frame_source_stop(FRAME_SOURCE_T *s)
+{
+	if (!s->running)
+		return;
+	s->running = 0;
+	if (s->stop)
+		s->stop(s);
+}
+
+void frame_source_close(FRAME_SOURCE_T *s)
+{
+	frame_source_stop(s);
+	if (s->close)
+		s->close(s);
+	s->priv = NULL;
+}
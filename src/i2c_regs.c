@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c_regs.h"
+#include "trace.h"
+
+static uint64_t i2c_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Default transfer: one I2C_RDWR ioctl for all messages, or one write()
+ * per message on adapters that only do plain transfers.
+ */
+static int i2c_regs_ioctl(void *ctx, struct i2c_msg *msgs, int num)
+{
+	I2C_REGS_T *bus = (I2C_REGS_T *)ctx;
+	int i;
+
+	if (bus->rdwr)
+	{
+		struct i2c_rdwr_ioctl_data set = { msgs, num };
+
+		return ioctl(bus->fd, I2C_RDWR, &set);
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		if (ioctl(bus->fd, I2C_SLAVE_FORCE, msgs[i].addr) < 0 ||
+			write(bus->fd, msgs[i].buf, msgs[i].len) != msgs[i].len)
+			return i ? i : -1;
+	}
+	return num;
+}
+
+/**
+ * Sets up a bus description without opening a device; transfer and ctx
+ * can then be pointed at a stand-in.
+ */
+void i2c_regs_init(I2C_REGS_T *bus, uint16_t addr, int addressing, int data_size, int max_burst)
+{
+	memset(bus, 0, sizeof(*bus));
+	bus->fd = -1;
+	bus->addr = addr;
+	bus->addressing = addressing == 1 ? 1 : 2;
+	bus->data_size = data_size == 2 ? 2 : 1;
+	// Auto-increment steps one address per byte, so only for 8 bit registers
+	bus->max_burst = max_burst > 1 && bus->data_size == 1 ? max_burst : 1;
+	bus->max_msgs = I2C_REGS_MAX_MSGS;
+	bus->transfer = i2c_regs_ioctl;
+	bus->ctx = bus;
+}
+
+/**
+ * Opens the i2c-dev device and checks whether it takes I2C_RDWR. The
+ * descriptor stays open until i2c_regs_close(), so start and stop tables
+ * do not pay for reopening it.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int i2c_regs_open(I2C_REGS_T *bus, const char *device)
+{
+	unsigned long funcs = 0;
+
+	bus->fd = open(device, O_RDWR);
+	if (bus->fd < 0)
+	{
+		perror(device);
+		return -1;
+	}
+	bus->rdwr = ioctl(bus->fd, I2C_FUNCS, &funcs) == 0 && (funcs & I2C_FUNC_I2C);
+	if (!bus->rdwr)
+		bus->max_msgs = 1;
+	return 0;
+}
+
+static int i2c_regs_flush(I2C_REGS_T *bus, struct i2c_msg *msgs, int *num, int *used)
+{
+	int ret = 0;
+
+	if (!*num)
+		return 0;
+	if (bus->transfer(bus->ctx, msgs, *num) != *num)
+	{
+		int reg = bus->addressing == 1 ? msgs[0].buf[0] : msgs[0].buf[0] << 8 | msgs[0].buf[1];
+
+		fprintf(stderr, "Failed to write %d register messages from %02X:%04X: %s\n",
+				*num, msgs[0].addr, reg, strerror(errno));
+		ret = -1;
+	}
+	bus->msgs += *num;
+	bus->transfers++;
+	*num = 0;
+	*used = 0;
+	return ret;
+}
+
+/**
+ * Writes a register table, honouring the address switch and sleep pseudo
+ * registers. A failed transfer is reported and the rest of the table is
+ * still written, as a partly programmed sensor is no worse than before.
+ *
+ * @return 0 on success, -1 if any register could not be written
+ */
+int i2c_regs_write(I2C_REGS_T *bus, const struct sensor_regs *regs, int num_regs)
+{
+	struct i2c_msg msgs[I2C_REGS_MAX_MSGS];
+	uint8_t buf[I2C_REGS_BUF_SIZE];
+	int max_msgs = bus->max_msgs > 0 && bus->max_msgs < I2C_REGS_MAX_MSGS ? bus->max_msgs : I2C_REGS_MAX_MSGS;
+	int num = 0, used = 0, ret = 0, i = 0;
+	uint64_t start = i2c_clock_ns();
+	uint16_t addr = bus->addr;
+
+	while (i < num_regs)
+	{
+		const struct sensor_regs *r = &regs[i];
+		uint8_t *p;
+		int n, j, len;
+
+		if (r->reg == I2C_REGS_SET_ADDR)
+		{
+			addr = r->data;
+			i++;
+			continue;
+		}
+		if (r->reg == I2C_REGS_SLEEP)
+		{
+			// Whatever the sensor needs the delay after must be out first
+			if (i2c_regs_flush(bus, msgs, &num, &used) < 0)
+				ret = -1;
+			usleep(r->data * 1000);
+			i++;
+			continue;
+		}
+
+		// Run of consecutive registers, written with auto-increment
+		for (n = 1; n < bus->max_burst && i + n < num_regs && regs[i + n].reg == r->reg + n; n++)
+			;
+		len = bus->addressing + n * bus->data_size;
+		if (num == max_msgs || used + len > I2C_REGS_BUF_SIZE)
+		{
+			if (i2c_regs_flush(bus, msgs, &num, &used) < 0)
+				ret = -1;
+		}
+
+		p = buf + used;
+		msgs[num].addr = addr;
+		msgs[num].flags = 0;
+		msgs[num].len = len;
+		msgs[num].buf = p;
+		num++;
+		used += len;
+
+		if (bus->addressing == 2)
+			*p++ = r->reg >> 8;
+		*p++ = r->reg;
+		for (j = 0; j < n; j++)
+		{
+			if (bus->data_size == 2)
+				*p++ = r[j].data >> 8;
+			*p++ = r[j].data;
+		}
+		bus->regs += n;
+		bus->bytes += len;
+		i += n;
+	}
+	if (i2c_regs_flush(bus, msgs, &num, &used) < 0)
+		ret = -1;
+
+	bus->ns += i2c_clock_ns() - start;
+	TRACE_END(start, "i2c write", num_regs);
+	return ret;
+}
+
+void i2c_regs_close(I2C_REGS_T *bus)
+{
+	if (bus->fd >= 0)
+		close(bus->fd);
+	bus->fd = -1;
+}
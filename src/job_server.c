@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "job_server.h"
+
+#define JOB_READ_TIMEOUT_MS	2000	// For the job line once connected
+
+/**
+ * Creates the listening socket, replacing a stale one left by an earlier
+ * daemon.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int job_server_open(JOB_SERVER_T *s, const char *path)
+{
+	struct sockaddr_un addr;
+
+	memset(s, 0, sizeof(*s));
+	s->path = path;
+	s->client = -1;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path %s too long\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	s->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s->fd < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	if (bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s->fd, 4) < 0)
+	{
+		perror(path);
+		close(s->fd);
+		s->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int job_parse(struct capture_job *job)
+{
+	char *save = NULL, *word;
+
+	job->mode = job->exposure = job->exposure_us = job->gain = -1;
+	job->left = job->top = job->timeout = job->saverate = -1;
+	job->fps = 0;
+	job->output = job->tstamps = job->tslog = NULL;
+
+	for (word = strtok_r(job->line, " \t\r\n", &save); word; word = strtok_r(NULL, " \t\r\n", &save))
+	{
+		char *val = strchr(word, '=');
+		int *field = NULL;
+
+		if (!val || !val[1])
+			return -1;
+		*val++ = '\0';
+		if (!strcmp(word, "o"))
+			job->output = val;
+		else if (!strcmp(word, "ts"))
+			job->tstamps = val;
+		else if (!strcmp(word, "tb"))
+			job->tslog = val;
+		else if (!strcmp(word, "fps"))
+		{
+			if (sscanf(val, "%lf", &job->fps) != 1 || job->fps <= 0)
+				return -1;
+		}
+		else
+		{
+			if (!strcmp(word, "mode"))
+				field = &job->mode;
+			else if (!strcmp(word, "exposure"))
+				field = &job->exposure;
+			else if (!strcmp(word, "eus"))
+				field = &job->exposure_us;
+			else if (!strcmp(word, "gain"))
+				field = &job->gain;
+			else if (!strcmp(word, "left"))
+				field = &job->left;
+			else if (!strcmp(word, "top"))
+				field = &job->top;
+			else if (!strcmp(word, "t"))
+				field = &job->timeout;
+			else if (!strcmp(word, "sr"))
+				field = &job->saverate;
+			if (!field || sscanf(val, "%d", field) != 1 || *field < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reads one line from the client into job->line.
+ *
+ * @return 0 on success, -1 on timeout, error or an empty connection
+ */
+static int job_read_line(JOB_SERVER_T *s, struct capture_job *job)
+{
+	size_t used = 0;
+
+	while (used < sizeof(job->line) - 1)
+	{
+		struct pollfd pfd = { s->client, POLLIN, 0 };
+		ssize_t n;
+
+		if (poll(&pfd, 1, JOB_READ_TIMEOUT_MS) <= 0)
+			return -1;
+		n = read(s->client, job->line + used, sizeof(job->line) - 1 - used);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			s->client_eof = 1;
+			break;
+		}
+		used += n;
+		job->line[used] = '\0';
+		if (strchr(job->line, '\n'))
+			break;
+	}
+	job->line[used] = '\0';
+	return used ? 0 : -1;
+}
+
+/**
+ * Waits for the next client and reads its job. Clients with a malformed
+ * job get an error line back and the wait goes on.
+ *
+ * @return 1 with a job, 0 once stop is set, -1 on failure
+ */
+int job_server_next(JOB_SERVER_T *s, struct capture_job *job, volatile sig_atomic_t *stop)
+{
+	while (!*stop)
+	{
+		struct pollfd pfd = { s->fd, POLLIN, 0 };
+		int ret = poll(&pfd, 1, 100);
+
+		if (ret < 0 && errno != EINTR)
+			return -1;
+		if (ret <= 0)
+			continue;
+
+		s->client = accept4(s->fd, NULL, NULL, SOCK_CLOEXEC);
+		if (s->client < 0)
+			continue;
+		s->client_eof = 0;
+		if (job_read_line(s, job) < 0)
+		{
+			close(s->client);
+			s->client = -1;
+			continue;
+		}
+		if (job_parse(job) < 0)
+		{
+			job_server_reply(s, "error invalid job");
+			continue;
+		}
+		s->jobs++;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Whether the client of the running job asked to stop it ("stop") or
+ * closed the connection. Does not block.
+ */
+int job_server_cancelled(JOB_SERVER_T *s)
+{
+	struct pollfd pfd = { s->client, s->client_eof ? 0 : POLLIN, 0 };
+	char buf[64];
+	ssize_t n;
+
+	if (s->client < 0)
+		return 1;
+	if (poll(&pfd, 1, 0) <= 0)
+		return 0;
+	if (pfd.revents & (POLLHUP | POLLERR))
+		return 1;
+	if (!(pfd.revents & POLLIN))
+		return 0;
+	n = read(s->client, buf, sizeof(buf) - 1);
+	if (n == 0)
+	{
+		// Half-closed: the client sent its job and only waits for the reply
+		s->client_eof = 1;
+		return 0;
+	}
+	if (n < 0)
+		return errno != EINTR && errno != EAGAIN;
+	buf[n] = '\0';
+	return strstr(buf, "stop") != NULL;
+}
+
+/**
+ * Sends the result line of the running job and closes its connection.
+ */
+void job_server_reply(JOB_SERVER_T *s, const char *fmt, ...)
+{
+	char line[JOB_LINE_MAX];
+	va_list ap;
+	int len;
+
+	if (s->client < 0)
+		return;
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+	va_end(ap);
+	if (len > (int)sizeof(line) - 2)
+		len = sizeof(line) - 2;
+	line[len++] = '\n';
+	if (send(s->client, line, len, MSG_NOSIGNAL) != len)
+		fprintf(stderr, "Job reply lost: %s", line);
+	close(s->client);
+	s->client = -1;
+}
+
+void job_server_close(JOB_SERVER_T *s)
+{
+	if (s->client >= 0)
+		close(s->client);
+	if (s->fd >= 0)
+	{
+		close(s->fd);
+		unlink(s->path);
+	}
+	s->fd = s->client = -1;
+}
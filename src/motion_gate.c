@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion_gate.h"
+#include "frame_ring.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MOTION_GATE_HAVE_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define MOTION_GATE_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define MOTION_GATE_ALIGN_UP(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+
+/*
+ * A line kernel returns the sum of absolute differences between the
+ * samples and the background, then moves the background towards the
+ * samples by 1/2^shift of the difference. n is a multiple of
+ * MOTION_GATE_ALIGN; the padding is zero in both, so it adds nothing.
+ */
+static uint32_t motion_line_scalar(const uint8_t *line, int16_t *acc, uint8_t *bg, uint32_t n, uint32_t shift)
+{
+	uint32_t i, sad = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		int d = line[i] - bg[i];
+
+		sad += d < 0 ? -d : d;
+		acc[i] += (int16_t)((line[i] << MOTION_GATE_FRAC) - acc[i]) >> shift;
+		bg[i] = (acc[i] + (1 << (MOTION_GATE_FRAC - 1))) >> MOTION_GATE_FRAC;
+	}
+	return sad;
+}
+
+#ifdef MOTION_GATE_HAVE_SSE2
+static uint32_t motion_line_simd(const uint8_t *line, int16_t *acc, uint8_t *bg, uint32_t n, uint32_t shift)
+{
+	const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(1 << (MOTION_GATE_FRAC - 1));
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	__m128i total = zero;
+	uint32_t i;
+
+	for (i = 0; i < n; i += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(line + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(bg + i));
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(acc + i));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(acc + i + 8));
+		__m128i t0 = _mm_slli_epi16(_mm_unpacklo_epi8(s, zero), MOTION_GATE_FRAC);
+		__m128i t1 = _mm_slli_epi16(_mm_unpackhi_epi8(s, zero), MOTION_GATE_FRAC);
+
+		total = _mm_add_epi64(total, _mm_sad_epu8(s, b));
+		a0 = _mm_add_epi16(a0, _mm_sra_epi16(_mm_sub_epi16(t0, a0), count));
+		a1 = _mm_add_epi16(a1, _mm_sra_epi16(_mm_sub_epi16(t1, a1), count));
+		b = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(a0, round), MOTION_GATE_FRAC),
+							 _mm_srli_epi16(_mm_add_epi16(a1, round), MOTION_GATE_FRAC));
+		_mm_storeu_si128((__m128i *)(acc + i), a0);
+		_mm_storeu_si128((__m128i *)(acc + i + 8), a1);
+		_mm_storeu_si128((__m128i *)(bg + i), b);
+	}
+	return _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total));
+}
+#endif  // MOTION_GATE_HAVE_SSE2
+
+#ifdef MOTION_GATE_HAVE_NEON
+static uint32_t motion_line_simd(const uint8_t *line, int16_t *acc, uint8_t *bg, uint32_t n, uint32_t shift)
+{
+	const uint16x8_t round = vdupq_n_u16(1 << (MOTION_GATE_FRAC - 1));
+	const int16x8_t count = vdupq_n_s16(-(int16_t)shift);	// Negative: arithmetic shift right
+	uint32x4_t total = vdupq_n_u32(0);
+	uint64x2_t sum;
+	uint32_t i;
+
+	for (i = 0; i < n; i += 16)
+	{
+		uint8x16_t s = vld1q_u8(line + i), b = vld1q_u8(bg + i);
+		int16x8_t a0 = vld1q_s16(acc + i), a1 = vld1q_s16(acc + i + 8);
+		int16x8_t t0 = vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(s), MOTION_GATE_FRAC));
+		int16x8_t t1 = vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(s), MOTION_GATE_FRAC));
+
+		total = vpadalq_u16(total, vpaddlq_u8(vabdq_u8(s, b)));
+		a0 = vaddq_s16(a0, vshlq_s16(vsubq_s16(t0, a0), count));
+		a1 = vaddq_s16(a1, vshlq_s16(vsubq_s16(t1, a1), count));
+		b = vcombine_u8(vshrn_n_u16(vaddq_u16(vreinterpretq_u16_s16(a0), round), MOTION_GATE_FRAC),
+						vshrn_n_u16(vaddq_u16(vreinterpretq_u16_s16(a1), round), MOTION_GATE_FRAC));
+		vst1q_s16(acc + i, a0);
+		vst1q_s16(acc + i + 8, a1);
+		vst1q_u8(bg + i, b);
+	}
+	sum = vpaddlq_u32(total);
+	return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+}
+#endif  // MOTION_GATE_HAVE_NEON
+
+static inline uint32_t motion_line(const MOTION_GATE_T *g, const uint8_t *line, int16_t *acc, uint8_t *bg)
+{
+#if defined(MOTION_GATE_HAVE_SSE2) || defined(MOTION_GATE_HAVE_NEON)
+	if (!g->scalar)
+		return motion_line_simd(line, acc, bg, g->pitch, g->bg_shift);
+#endif
+	return motion_line_scalar(line, acc, bg, g->pitch, g->bg_shift);
+}
+
+/**
+ * Parses "<level>[:<step>]": the threshold as a mean difference in 8 bit
+ * grey levels (fractions allowed, 0 passes every frame and only logs the
+ * scores) and optionally the pixels between samples.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int motion_gate_parse(const char *spec, uint32_t *threshold, uint32_t *step)
+{
+	char *end;
+	double level = strtod(spec, &end);
+
+	if (end == spec || level < 0 || level > 255)
+		return -1;
+	*threshold = (uint32_t)(level * MOTION_SCORE_ONE + 0.5);
+	*step = 0;
+	if (*end == ':')
+	{
+		long v = strtol(end + 1, &end, 10);
+
+		if (v < 1 || v > 1024)
+			return -1;
+		*step = v;
+	}
+	return *end ? -1 : 0;
+}
+
+/**
+ * Sets up the sample grid for frames of width x height pixels with lines
+ * of stride bytes. green_first is set when the top left pixel is green
+ * (GBRG, GRBG). step 0 picks the step giving about MOTION_GATE_COLUMNS
+ * samples per line; odd steps are rounded up to stay on green.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int motion_gate_init(MOTION_GATE_T *g, uint32_t width, uint32_t height, uint32_t stride, uint32_t bit_depth,
+					 int green_first, uint32_t step, uint32_t threshold)
+{
+	uint32_t x0 = green_first ? 0 : 1, c;
+
+	memset(g, 0, sizeof(*g));
+	if ((bit_depth != 8 && bit_depth != 10 && bit_depth != 12) || width <= x0 || !height)
+	{
+		fprintf(stderr, "Motion gate: cannot sample %ux%u RAW%u frames\n", width, height, bit_depth);
+		return -1;
+	}
+	if (!step)
+		step = width / (2 * MOTION_GATE_COLUMNS) > 1 ? width / (2 * MOTION_GATE_COLUMNS) * 2 : 2;
+	step = (step + 1) & ~1u;
+
+	g->threshold = threshold;
+	g->bg_shift = MOTION_GATE_BG_SHIFT;
+	g->step = step;
+	g->stride = stride;
+	g->cols = (width - x0 - 1) / step + 1;
+	g->rows = (height - 1) / step + 1;
+	g->pitch = MOTION_GATE_ALIGN_UP(g->cols, MOTION_GATE_ALIGN);
+
+	g->col_offset = malloc(g->cols * sizeof(*g->col_offset));
+	g->line = calloc(g->pitch, 1);
+	g->acc = calloc((size_t)g->rows * g->pitch, sizeof(*g->acc));
+	g->background = calloc((size_t)g->rows * g->pitch, 1);
+	if (!g->col_offset || !g->line || !g->acc || !g->background)
+	{
+		fprintf(stderr, "Motion gate: out of memory\n");
+		motion_gate_destroy(g);
+		return -1;
+	}
+
+	// Byte holding the 8 most significant bits of each sampled pixel
+	for (c = 0; c < g->cols; c++)
+	{
+		uint32_t x = x0 + c * step;
+
+		if (bit_depth == 10)
+			g->col_offset[c] = (x >> 2) * 5 + (x & 3);
+		else if (bit_depth == 12)
+			g->col_offset[c] = (x >> 1) * 3 + (x & 1);
+		else
+			g->col_offset[c] = x;
+	}
+	return 0;
+}
+
+void motion_gate_destroy(MOTION_GATE_T *g)
+{
+	free(g->col_offset);
+	free(g->line);
+	free(g->acc);
+	free(g->background);
+	memset(g, 0, sizeof(*g));
+}
+
+/**
+ * Scores one frame against the background and updates the background.
+ * The first frame only sets the background up and scores 0. A frame
+ * shorter than the grid is scored on the sample lines it holds.
+ *
+ * @return 1 if the frame is active (score at or above the threshold),
+ *         0 if not
+ */
+int motion_gate_frame(MOTION_GATE_T *g, const uint8_t *data, uint32_t length)
+{
+	uint64_t start = frame_clock_ns();
+	uint32_t last = g->col_offset[g->cols - 1], row_bytes = g->step * g->stride;
+	uint32_t rows = length > last ? (length - last - 1) / row_bytes + 1 : 0;
+	uint32_t r, c, band_sad = 0, band_rows = 0, score = 0;
+
+	if (rows > g->rows)
+		rows = g->rows;
+	for (r = 0; r < rows; r++)
+	{
+		const uint8_t *in = data + (size_t)r * row_bytes;
+		int16_t *acc = g->acc + (size_t)r * g->pitch;
+		uint8_t *bg = g->background + (size_t)r * g->pitch;
+
+		for (c = 0; c < g->cols; c++)
+			g->line[c] = in[g->col_offset[c]];
+
+		if (!g->primed)
+		{
+			for (c = 0; c < g->cols; c++)
+			{
+				acc[c] = g->line[c] << MOTION_GATE_FRAC;
+				bg[c] = g->line[c];
+			}
+			continue;
+		}
+
+		band_sad += motion_line(g, g->line, acc, bg);
+		if (++band_rows == MOTION_GATE_BAND || r == rows - 1)
+		{
+			uint32_t band = (uint64_t)band_sad * MOTION_SCORE_ONE / (band_rows * g->cols);
+
+			if (band > score)
+				score = band;
+			band_sad = band_rows = 0;
+		}
+	}
+	if (rows == g->rows)
+		g->primed = 1;
+
+	g->score = score;
+	g->score_sum += score;
+	if (score > g->peak)
+		g->peak = score;
+	g->frames++;
+	if (score >= g->threshold)
+		g->active++;
+	g->busy_ns += frame_clock_ns() - start;
+	return score >= g->threshold;
+}
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_WIRINGPI
+#include <wiringPi.h>
+#endif
+
+#include "pretrigger.h"
+
+// Trigger sources without a context pointer (signal handler, wiringPi ISR)
+static PRETRIGGER_T *active_pretrigger = NULL;
+
+/**
+ * Allocates and page-locks the history of pre_frames slots.
+ * wake is the frame ring whose writer thread performs the dump.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int pretrigger_init(PRETRIGGER_T *p, uint32_t pre_frames, uint32_t post_frames, uint32_t slot_size, FRAME_RING_T *wake)
+{
+	uint32_t i;
+
+	memset(p, 0, sizeof(*p));
+	if (!pre_frames)
+		return -1;
+
+	p->pre_frames = pre_frames;
+	p->post_frames = post_frames;
+	p->slot_size = (slot_size + FRAME_RING_CACHELINE - 1) & ~(FRAME_RING_CACHELINE - 1);
+	p->mem_bytes = (size_t)pre_frames * p->slot_size;
+	p->wake = wake;
+
+	p->slots = calloc(pre_frames, sizeof(*p->slots));
+	if (!p->slots)
+		return -1;
+
+	p->mem = mmap(NULL, p->mem_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (p->mem == MAP_FAILED)
+	{
+		perror("pretrigger: mmap");
+		free(p->slots);
+		memset(p, 0, sizeof(*p));
+		return -1;
+	}
+	if (mlock(p->mem, p->mem_bytes) < 0)
+		perror("pretrigger: mlock (continuing unlocked)");
+
+	for (i = 0; i < pre_frames; i++)
+		p->slots[i].data = p->mem + (size_t)i * p->slot_size;
+
+	p->state = PRETRIGGER_ARMED;
+	active_pretrigger = p;
+	return 0;
+}
+
+void pretrigger_destroy(PRETRIGGER_T *p)
+{
+	if (active_pretrigger == p)
+		active_pretrigger = NULL;
+	if (p->mem)
+	{
+		munlock(p->mem, p->mem_bytes);
+		munmap(p->mem, p->mem_bytes);
+	}
+	free(p->slots);
+	memset(p, 0, sizeof(*p));
+}
+
+static void pretrigger_store(PRETRIGGER_T *p, const struct frame_slot *frame)
+{
+	struct frame_slot *slot = &p->slots[p->written % p->pre_frames];
+	uint8_t *mem = slot->data;
+
+	*slot = *frame;
+	slot->data = mem;
+	if (!slot->host_ns)
+		slot->host_ns = frame_clock_ns();
+	if (slot->length > p->slot_size)
+		slot->length = p->slot_size;
+	if (frame->data)
+		memcpy(mem, frame->data, slot->length);
+	p->written++;
+}
+
+/**
+ * Callback side, called for every frame that would be saved.
+ *
+ * @return 1 if the frame is inside a post-trigger window and must be passed
+ *         on to the writer, 0 if it was kept in (or skipped by) the history
+ */
+int pretrigger_frame(PRETRIGGER_T *p, const struct frame_slot *frame)
+{
+	switch (p->state)
+	{
+		case PRETRIGGER_ARMED:
+			pretrigger_store(p, frame);
+			if (!p->fired)
+				return 0;
+
+			// Freeze the history, including the frame the trigger landed on
+			p->fired = 0;
+			p->triggers++;
+			p->dump_count = p->written < p->pre_frames ? p->written : p->pre_frames;
+			p->dump_first = p->written - p->dump_count;
+			__atomic_store_n(&p->dump_pending, 1, __ATOMIC_RELEASE);
+			frame_ring_wake(p->wake);
+
+			p->post_left = p->post_frames;
+			p->state = PRETRIGGER_POST;
+			return 0;
+
+		case PRETRIGGER_POST:
+			if (p->post_left)
+			{
+				p->post_left--;
+				return 1;
+			}
+			p->state = PRETRIGGER_WAIT;
+			// fall through
+
+		case PRETRIGGER_WAIT:
+			if (__atomic_load_n(&p->dump_pending, __ATOMIC_ACQUIRE))
+				return 0;
+
+			// Dump finished, start a fresh history. Triggers that arrived
+			// during the window belong to the event just saved.
+			p->written = 0;
+			p->fired = 0;
+			p->state = PRETRIGGER_ARMED;
+			pretrigger_store(p, frame);
+			return 0;
+	}
+	return 0;
+}
+
+/**
+ * Writer side: saves the frozen history (oldest first) if a trigger is
+ * pending. Must run before the post-trigger frames queued behind it.
+ */
+void pretrigger_dump(PRETRIGGER_T *p, void (*save)(void *ctx, const struct frame_slot *frame), void *ctx)
+{
+	uint32_t i;
+
+	if (!__atomic_load_n(&p->dump_pending, __ATOMIC_ACQUIRE))
+		return;
+
+	for (i = 0; i < p->dump_count; i++)
+		save(ctx, &p->slots[(p->dump_first + i) % p->pre_frames]);
+	p->dumped += p->dump_count;
+
+	__atomic_store_n(&p->dump_pending, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Fires the trigger. Async-signal-safe.
+ */
+void pretrigger_fire(PRETRIGGER_T *p)
+{
+	if (p)
+		p->fired = 1;
+}
+
+/**
+ * Callback side, for triggers raised in the callback itself (-motion):
+ * fires the trigger, or restarts the post-trigger window if one is open,
+ * so saving goes on until post_frames after the last call.
+ */
+void pretrigger_hold(PRETRIGGER_T *p)
+{
+	if (p->state == PRETRIGGER_POST)
+		p->post_left = p->post_frames;
+	else
+		p->fired = 1;
+}
+
+static void pretrigger_signal(int sig)
+{
+	(void)sig;
+	pretrigger_fire(active_pretrigger);
+}
+
+#ifdef HAVE_WIRINGPI
+static void pretrigger_gpio(void)
+{
+	pretrigger_fire(active_pretrigger);
+}
+#endif
+
+static void *pretrigger_fifo(void *args)
+{
+	const char *path = (const char *)args;
+	char buf[64];
+	int fd;
+
+	// O_RDWR keeps the FIFO open with no writer attached, so read() blocks
+	// instead of returning EOF between triggering processes
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+	{
+		perror(path);
+		return NULL;
+	}
+	for (;;)
+	{
+		ssize_t n = read(fd, buf, sizeof(buf));
+
+		if (n > 0)
+			pretrigger_fire(active_pretrigger);
+		else if (n < 0 && errno != EINTR)
+			break;
+	}
+	close(fd);
+	return NULL;
+}
+
+/**
+ * Adds a trigger source:
+ *   sigusr1
+ *   gpio:<BCM pin>[:rising|falling|both]   (default rising)
+ *   fifo:<path>                           (created if missing)
+ *
+ * @return 0 on success, -1 on failure
+ */
+int pretrigger_add_source(PRETRIGGER_T *p, const char *spec)
+{
+	(void)p;
+
+	if (!strcmp(spec, "sigusr1"))
+	{
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = pretrigger_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		return sigaction(SIGUSR1, &sa, NULL);
+	}
+	else if (!strncmp(spec, "gpio:", 5))
+	{
+#ifdef HAVE_WIRINGPI
+		int pin, edge = INT_EDGE_RISING;
+		const char *mode = strchr(spec + 5, ':');
+
+		if (sscanf(spec + 5, "%d", &pin) != 1)
+			return -1;
+		if (mode && !strcmp(mode + 1, "falling"))
+			edge = INT_EDGE_FALLING;
+		else if (mode && !strcmp(mode + 1, "both"))
+			edge = INT_EDGE_BOTH;
+		else if (mode && strcmp(mode + 1, "rising"))
+			return -1;
+
+		if (wiringPiSetupGpio() < 0)
+			return -1;
+		return wiringPiISR(pin, edge, pretrigger_gpio) < 0 ? -1 : 0;
+#else
+		fprintf(stderr, "GPIO triggers need wiringPi\n");
+		return -1;
+#endif
+	}
+	else if (!strncmp(spec, "fifo:", 5))
+	{
+		pthread_t thread;
+		const char *path = spec + 5;
+
+		if (mkfifo(path, 0666) < 0 && errno != EEXIST)
+		{
+			perror(path);
+			return -1;
+		}
+		if (pthread_create(&thread, NULL, pretrigger_fifo, (void *)path) != 0)
+			return -1;
+		pthread_detach(thread);
+		return 0;
+	}
+	return -1;
+}
@@ -70,10 +70,37 @@ const static COMMAND_LIST cmdline_commands[] =
 	{ CommandWriteHeader0,	"-header0",		"hd0",	"Sets filename to write the BRCM header to", 0 },
 	{ CommandWriteHeaderG,	"-headerg",		"hdg",	"Sets filename to write the .pgm header to", 0 },
 	{ CommandWriteTimestamps,"-tstamps",	"ts", 	"Sets filename to write timestamps to", 0 },
+	{ CommandWriteTsLog,	"-tslog",		"tb", 	"Sets filename to write the binary timestamp log to (see ts2csv)", 0 },
 	{ CommandWriteEmpty,	"-empty",		"emp",	"Write empty output files", 0 },
+	{ CommandContainer,		"-container",	"cf", 	"Write all frames into one preallocated container file", 1 },
+	{ CommandCapacity,		"-capacity",	"cn", 	"Number of frames to preallocate in the container (default from -t, 60 s with -t 0, and -f)", 1 },
+	{ CommandRingDepth,		"-ringdepth",	"rd", 	"Frames buffered between callback and writer thread (0 = save in callback)", 1 },
+	{ CommandPreTrigger,	"-pretrigger",	"pre",	"Keep the last <N> frames (or <N>s seconds) in RAM, save only on trigger", 1 },
+	{ CommandPostTrigger,	"-posttrigger",	"post",	"Frames (or <N>s seconds) to save after each trigger", 1 },
+	{ CommandTrigger,		"-trigger",		"tg", 	"Trigger source: sigusr1, gpio:<pin>[:rising|falling|both] or fifo:<path>", 1 },
+	{ CommandCopyWorkers,	"-copyworkers",	"cw", 	"Copy worker threads: <n> or auto[:<min>-<max>] (default 4)", 1 },
+	{ CommandCopyCpus,		"-copycpus",	"cc", 	"CPUs the copy workers may run on, e.g. 1-3", 1 },
+	{ CommandCopySched,		"-copysched",	"cs", 	"Copy worker scheduling: other, batch, idle, fifo:<prio> or rr:<prio>", 1 },
+	{ CommandHeaderMode,	"-headermode",	"hdm",	"BRCM header storage: frame (every file), once (per capture) or none", 1 },
+	{ CommandControl,		"-control",		"ctl",	"FIFO taking live exposure, eus, gain, vts and fps changes while streaming", 1 },
+	{ CommandBuffers,		"-buffers",		"bn", 	"Rawcam buffers to allocate (default as many as the free GPU memory allows)", 1 },
+	{ CommandProfile,		"-profile",		"pf", 	"Buffer and copy worker counts per resolution and fps, loaded at startup or written by -cal", 1 },
+	{ CommandCalibrate,		"-calibrate",	"cal",	"Find the smallest buffer and copy worker counts sustaining the frame rate, in trials of -t ms", 0 },
+	{ CommandShm,			"-shm",			"shm",	"Export every frame to local readers in the shared memory ring <name>[:<slots>]", 1 },
+	{ CommandStreamHeader,	"-streamheader",	"sh", 	"Put index, length, flags and pts in front of every frame streamed to -o - or a FIFO", 0 },
+	{ CommandMotion,		"-motion",		"mo", 	"Save only frames with motion: <level>[:<step>] mean grey level difference to the background, -pre/-post as margins", 1 },
+	{ CommandTrack,			"-track",		"trk",	"Write the marker centroids and angle of every frame to <file> (.csv for text)", 1 },
+	{ CommandTrackSettings,	"-tracksettings",	"tks",	"Marker tracking: <level>[:<step>[:<min area>]] 8 bit grey level, cells between samples, smallest marker (default 200:1:2)", 1 },
+	{ CommandEmbedded,		"-embedded",	"emb",	"Read the sensor's embedded data: frame counter, exposure and gain of every frame into the timestamp log", 0 },
+	{ CommandHealth,		"-health",		"hl",	"Report capture health once per second to stderr (-) or into <file>, plus a final report", 1 },
+	{ CommandTrace,			"-trace",		"trc",	"Write per-stage latency events to <file>[:<events per thread>] as Chrome trace JSON at exit (RASPIRAW_TRACE builds)", 1 },
+	{ CommandDaemon,		"-daemon",		"dm", 	"Stay up and take capture jobs from the Unix socket <path>", 1 },
 };
 
 struct brcm_raw_header *brcm_header = NULL;
+static CAPTURE_T capture;										// Everything behind the rawcam callback
+static FRAME_SOURCE_T rawcam_source;
+static char *ts_log_tmp = NULL;									// Binary log behind -ts without -tb
 
 const static int cmdline_commands_size = sizeof(cmdline_commands) / sizeof(cmdline_commands[0]);
 
@@ -82,158 +109,14 @@ static char* des_dir = NULL;
 static char* appended_path = NULL;
 volatile bool enableCopy = true;
 
-pthread_t threads[MAX_THREADS];  									// Working threads
-pthread_mutex_t task_enqueue_mutex = PTHREAD_MUTEX_INITIALIZER;  	// Mutex for protecting task queue
-pthread_mutex_t task_dequeue_mutex = PTHREAD_MUTEX_INITIALIZER;  	// Mutex for protecting task queue
-sem_t produced_sem;
-
-file_copy_task_t* task_queue_head = NULL;
-file_copy_task_t* task_queue_tail = NULL;
-
-void init_thread_pool(size_t num_threads) {
-    pthread_mutex_init(&task_enqueue_mutex, NULL);
-	pthread_mutex_init(&task_dequeue_mutex, NULL);
-    sem_init(&produced_sem, 0, 0);
-    // sem_init(&producer_stop_sem, 0, 0);
-
-
-    pthread_t threads[num_threads];
-    for (int i = 0; i < num_threads; ++i) {
-        pthread_create(&threads[i], NULL, worker, NULL);
-    }
-}
-
-void dstr_thread_pool(size_t num_threads){
-	// sem_wait(&producer_stop_sem);
-	for (int i = 0; i < num_threads; ++i) {
-        pthread_join(threads[i], NULL);
-    }
-	pthread_mutex_destroy(&task_dequeue_mutex);
-	pthread_mutex_destroy(&task_enqueue_mutex);
-    sem_destroy(&produced_sem);
-	// sem_destroy(&producer_stop_sem);
-}
-
-void enqueue_task(char *const src, char *const dst) {
-
-    pthread_mutex_lock(&task_enqueue_mutex);
-
-	file_copy_task_t *new_task = malloc(sizeof(file_copy_task_t));
-
-    if (task_queue_tail) {
-        task_queue_tail->next = new_task;
-    } else {
-        task_queue_head = new_task;
-    }
-    task_queue_tail = new_task;
-	task_queue_tail->src = src;
-    task_queue_tail->dst = dst;
-
-    pthread_mutex_unlock(&task_enqueue_mutex);
-	sem_post(&produced_sem);  // Signal a new task
-}
-
-file_copy_task_t* dequeue_task(){
-
-	pthread_mutex_lock(&task_dequeue_mutex);
-	if (task_queue_head == NULL) {
-        pthread_mutex_unlock(&task_dequeue_mutex);
-        return NULL;
-    }
-
-	file_copy_task_t* task = malloc(sizeof(task_queue_head));
-	// Deep copy the src and dst strings
-	task->src = strdup(task_queue_head->src);
-	task->dst = strdup(task_queue_head->dst);
-	task->next = NULL;
-
-	task_queue_head = task_queue_head->next;
-
-	if (task_queue_head == NULL) {
-		task_queue_tail = NULL;
-	}
-
-	pthread_mutex_unlock(&task_dequeue_mutex);
-	return task;
-}
-
-void* worker(void *args){
-	while(1){
-		sem_wait(&produced_sem);
-		file_copy_task_t* task = dequeue_task();
-		if(task){
-            int src_fd = shm_open(strrchr(task->src, '/'), O_RDONLY, 0644);
-            // int src_fd = open(task->src, O_RDONLY);
-            if (src_fd < 0) {
-                perror("Error opening source file");
-                goto cleanup;
-            }
-
-            struct stat st;
-            if (fstat(src_fd, &st) < 0) {
-                perror("Error getting source file size");
-                goto cleanup;
-            }
-
-            size_t file_sz = st.st_size;
-            void *src_map = mmap(NULL, file_sz, PROT_READ, MAP_SHARED, src_fd, 0);
-            if (src_map == MAP_FAILED) {
-                perror("Error mmap'ing source file");
-                goto cleanup;
-            }
-
-            int dst_fd = open(task->dst, O_RDWR | O_CREAT | O_TRUNC, 0666);
-            if (dst_fd < 0) {
-                perror("Error opening destination file");
-                goto cleanup;
-            }
-
-            if (ftruncate(dst_fd, file_sz) < 0) {
-                perror("Error setting destination file size");
-                goto cleanup;
-            }
-
-            void *dst_map = mmap(NULL, file_sz, PROT_WRITE, MAP_SHARED, dst_fd, 0);
-            if (dst_map == MAP_FAILED) {
-                perror("Error mmap'ing destination file");
-                goto cleanup;
-            }
-
-            memcpy(dst_map, src_map, file_sz);  // Perform the copy
-
-            munmap(src_map, file_sz);
-            munmap(dst_map, file_sz);
-            close(src_fd);
-            close(dst_fd);
-			
-			if (unlink(task->src) != 0) {
-				perror("Error deleting source file after copy");
-				goto cleanup;
-			}
-			goto cleanrest;
-
-		cleanup:
-            // Clean up task memory
-			if(task->src){
-				free(task->src);
-				task->src = NULL;
-			}
-		cleanrest:
-			if(task->dst){
-				free(task->dst);
-				task->src= NULL;
-			}
-			if(task){
-				free(task);
-				task->src = NULL;
-			}
-		}
-		else{
-			continue;
-		}
-	}
-	
-}
+static COPY_POOL_T copy_pool;										// Moves frames out of mem_dir
+static I2C_REGS_T sensor_i2c = { .fd = -1 };						// Register writes to the sensor
+static uint64_t launch_ns;											// For the time to "Now streaming"
+static REG_MAP_T mode_map;											// Selected mode with the command line edits
+static SHM_RING_T shm_ring = { .fd = -1 };							// Frames for other processes (-shm)
+static CONTROL_T control;											// Live changes to mode_map (-ctl)
+static TRACKER_T tracker;											// Marker positions of every frame (-track)
+static EMBEDDED_T embedded;											// Sensor metadata of every frame (-embedded)
 
 
 int i2c_rd(int fd, uint8_t i2c_addr, uint16_t reg, uint8_t *values, uint32_t n, const struct sensor_def *sensor)
@@ -271,41 +154,38 @@ int i2c_rd(int fd, uint8_t i2c_addr, uint16_t reg, uint8_t *values, uint32_t n,
 	return 0;
 }
 
-void start_camera_streaming(const struct sensor_def *sensor, struct mode_def *mode)
+/**
+ * Opens the sensor's I2C bus once; start and stop tables share it.
+ */
+static int open_sensor_i2c(const struct sensor_def *sensor)
 {
-	int fd;
-	fd = open(i2c_device_name, O_RDWR);
-	if (!fd)
+	if (sensor_i2c.fd >= 0)
+		return 0;
+	i2c_regs_init(&sensor_i2c, sensor->i2c_addr, sensor->i2c_addressing, sensor->i2c_data_size, sensor->i2c_burst);
+	if (i2c_regs_open(&sensor_i2c, i2c_device_name) < 0)
 	{
 		vcos_log_error("Couldn't open I2C device");
-		return;
+		return -1;
 	}
-	if (ioctl(fd, I2C_SLAVE_FORCE, sensor->i2c_addr) < 0)
-	{
-		vcos_log_error("Failed to set I2C address");
+	return 0;
+}
+
+void start_camera_streaming(const struct sensor_def *sensor, const REG_MAP_T *map)
+{
+	if (open_sensor_i2c(sensor) < 0)
 		return;
-	}
-	send_regs(fd, sensor, mode->regs, mode->num_regs);
-	close(fd);
-	vcos_log_error("Now streaming...");
+	i2c_regs_write(&sensor_i2c, map->regs, map->num_regs);
+	vcos_log_error("Now streaming... %.1f ms after launch, %u registers in %u messages, %u transfers, %.2f ms",
+				   (frame_clock_ns() - launch_ns) / 1e6, sensor_i2c.regs, sensor_i2c.msgs, sensor_i2c.transfers,
+				   sensor_i2c.ns / 1e6);
 }
 
 void stop_camera_streaming(const struct sensor_def *sensor)
 {
-	int fd;
-	fd = open(i2c_device_name, O_RDWR);
-	if (!fd)
-	{
-		vcos_log_error("Couldn't open I2C device");
+	if (open_sensor_i2c(sensor) < 0)
 		return;
-	}
-	if (ioctl(fd, I2C_SLAVE_FORCE, sensor->i2c_addr) < 0)
-	{
-		vcos_log_error("Failed to set I2C address");
-		return;
-	}
-	send_regs(fd, sensor, sensor->stop, sensor->num_stop_regs);
-	close(fd);
+	i2c_regs_write(&sensor_i2c, sensor->stop, sensor->num_stop_regs);
+	i2c_regs_close(&sensor_i2c);
 }
 
 
@@ -378,114 +258,114 @@ MMAL_STATUS_T create_filenames(char** finalName, char * pattern, int frame)
 	return MMAL_SUCCESS;
 }
 
-int running = 0;
+struct rawcam_source {
+	MMAL_PORT_T *output;
+	MMAL_POOL_T *pool;
+	EMBEDDED_T *embedded;			// Side-info buffers parsed and paired, NULL = dropped
+};
+
 static void callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
 {
-	volatile static u_int32_t count = 0;
+	FRAME_SOURCE_T *s = (FRAME_SOURCE_T *)port->userdata;
+	TRACE_BEGIN(start);
+
+	TRACE_THREAD("rawcam callback");
 #if FRAME_LOG
 		vcos_log_error("Buffer %p returned, filled %d, timestamp %llu, flags %04X", buffer, buffer->length, buffer->pts, buffer->flags);
 #endif
-	if (running)
+	if (s->running)
 	{
-		RASPIRAW_PARAMS_T *cfg = (RASPIRAW_PARAMS_T *)port->userdata;
+		struct rawcam_source *cam = (struct rawcam_source *)s->priv;
 
-		if (!(buffer->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO) &&
-			(((count++) % cfg->saverate) == 0))
+		if (!(buffer->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO))
 		{
-			// FIXME
-			// Save every Nth frame
-			// SD card access is too slow to do much more.
-
-			char *filename = NULL;
-			char *des_filename = NULL;
-			// printf("Filename: %s\n", mem_dir);
-			if (asprintf(&filename, mem_dir, count) >= 0 &&
-				(asprintf(&des_filename, des_dir, count) >= 0))
-			{
-				// printf("\nfilename: %s, des_filename%s\n", filename, des_filename);
-				int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-				if (fd >= 0)
-				{
-					// Calculate the size needed for the file
-					size_t file_size = buffer->length;
-					if (cfg->write_header)
-						file_size += BRCM_RAW_HEADER_LENGTH;
-
-					// Set the file size
-					ftruncate(fd, file_size);
-
-					// Memory-map the file
-					void *mapped_mem = mmap(NULL, file_size, PROT_WRITE, MAP_SHARED, fd, 0);
-					if (mapped_mem != MAP_FAILED)
-					{
-						size_t offset = 0;
-
-						if (cfg->ptso) // make sure previous malloc() was successful
-						{
-							cfg->ptso->idx = count;
-							cfg->ptso->pts = buffer->pts;
-							cfg->ptso->nxt = malloc(sizeof(*cfg->ptso->nxt));
-							cfg->ptso = cfg->ptso->nxt;
-						}
-
-						if (!cfg->write_empty)
-						{
-							if (cfg->write_header)
-							{
-								memcpy(mapped_mem, brcm_header, BRCM_RAW_HEADER_LENGTH);
-								offset += BRCM_RAW_HEADER_LENGTH;
-							}
-							memcpy(mapped_mem + offset, buffer->data, buffer->length);
-						}
-						// Unmap the file
-						munmap(mapped_mem, file_size);
-					}
-					else
-					{
-						// Handle mmap failure
-						perror("mmap");
-					}
-					close(fd);
-
-					// vcos_log_error("Now enqueueing task success...");
-				}
-				else
-				{
-					// Handle open file failure
-					perror("open");
-				}
-
-				// FIXME
-				// signal to copy the file
-				// vcos_log_error("Now enqueueing task...");
-				if (filename && des_filename)
-				{
-					// printf("%s, %s\n", filename, des_filename);
-					if (enableCopy){
-						char* src = strdup(filename);
-						char* dst = strdup(des_filename);
-						enqueue_task(src, dst);
-
-					}
-				}
+			struct frame_slot frame = { 0, buffer->length, buffer->pts, buffer->flags, buffer->data,
+										frame_clock_ns() };
 
-				if (filename){
-					free(filename);
-					filename = NULL;
-				}
-				if (des_filename){
-					free(des_filename);
-					filename = NULL;
-				}
-			}
+			if (cam->embedded)
+				embedded_attach(cam->embedded, &frame);
+			s->deliver(s->ctx, &frame);
+			s->delivered++;
 		}
+		else if (cam->embedded)
+			embedded_parse(cam->embedded, buffer->data, buffer->length, buffer->pts);
 		buffer->length = 0;
 		mmal_port_send_buffer(port, buffer);
+		TRACE_END(start, "callback", s->delivered);
 	}
 	else
 		mmal_buffer_header_release(buffer);
 }
 
+/**
+ * Enables the rawcam output port and hands it all buffers of the pool.
+ */
+static int rawcam_start(FRAME_SOURCE_T *s)
+{
+	struct rawcam_source *cam = (struct rawcam_source *)s->priv;
+	MMAL_STATUS_T status;
+	unsigned int i;
+
+	cam->output->userdata = (struct MMAL_PORT_USERDATA_T *)s;
+	status = mmal_port_enable(cam->output, callback);
+	if (status != MMAL_SUCCESS)
+	{
+		vcos_log_error("Failed to enable port");
+		return -1;
+	}
+	for (i = 0; i < cam->output->buffer_num; i++)
+	{
+		MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(cam->pool->queue);
+
+		if (!buffer)
+		{
+			vcos_log_error("Where'd my buffer go?!");
+			mmal_port_disable(cam->output);
+			return -1;
+		}
+		status = mmal_port_send_buffer(cam->output, buffer);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("mmal_port_send_buffer failed on buffer %p, status %d", buffer, status);
+			mmal_port_disable(cam->output);
+			return -1;
+		}
+		vcos_log_error("Sent buffer %p", buffer);
+	}
+	return 0;
+}
+
+static void rawcam_stop(FRAME_SOURCE_T *s)
+{
+	struct rawcam_source *cam = (struct rawcam_source *)s->priv;
+
+	if (mmal_port_disable(cam->output) != MMAL_SUCCESS)
+		vcos_log_error("Failed to disable port");
+}
+
+/**
+ * Wraps the configured rawcam output port and its buffer pool as a frame
+ * source, so the capture pipeline is fed the same way as from the host
+ * backends.
+ */
+static void rawcam_source_init(FRAME_SOURCE_T *s, struct rawcam_source *cam, MMAL_PORT_T *output,
+							   MMAL_POOL_T *pool, const struct mode_def *mode, int bit_depth, double fps)
+{
+	memset(s, 0, sizeof(*s));
+	cam->output = output;
+	cam->pool = pool;
+	cam->embedded = NULL;
+	s->name = "rawcam";
+	s->width = mode->width;
+	s->height = mode->height;
+	s->bit_depth = bit_depth;
+	s->fps = fps;
+	s->buffer_size = output->buffer_size;
+	s->start = rawcam_start;
+	s->stop = rawcam_stop;
+	s->priv = cam;
+}
+
 uint32_t order_and_bit_depth_to_encoding(enum bayer_order order, int bit_depth)
 {
 	//BAYER_ORDER_BGGR,
@@ -513,6 +393,63 @@ uint32_t order_and_bit_depth_to_encoding(enum bayer_order order, int bit_depth)
 	return 0;
 }
 
+/**
+ * Free GPU relocatable heap as reported by the firmware.
+ *
+ * @return bytes, 0 if unknown
+ */
+static uint64_t gpu_free_mem(void)
+{
+	char response[64];
+	unsigned long long value;
+	char unit = 'M';
+
+	if (vc_gencmd(response, sizeof(response), "get_mem reloc") != 0 ||
+		sscanf(response, "reloc=%llu%c", &value, &unit) < 1)
+		return 0;
+	switch (unit)
+	{
+		case 'G':
+			return value << 30;
+		case 'M':
+			return value << 20;
+		case 'K':
+		case 'k':
+			return value << 10;
+	}
+	return value;
+}
+
+/**
+ * Rawcam buffers to allocate: as many as fit in the free GPU memory left
+ * after the graph is set up, less a reserve for the firmware, between the
+ * port's recommendation and BUFFER_NUM_MAX. BUFFER_NUM_MANUAL if the free
+ * memory cannot be queried.
+ */
+static unsigned int gpu_buffer_num(MMAL_PORT_T *output)
+{
+	uint64_t free_mem = 0;
+	unsigned int num = BUFFER_NUM_MANUAL ? BUFFER_NUM_MANUAL : output->buffer_num_recommended;
+	unsigned int min = output->buffer_num_recommended;
+
+	if (vc_gencmd_init() == 0)
+	{
+		free_mem = gpu_free_mem();
+		vc_gencmd_stop();
+	}
+	if (free_mem && output->buffer_size)
+	{
+		uint64_t fit = free_mem > GPU_MEM_RESERVE ? (free_mem - GPU_MEM_RESERVE) / output->buffer_size : 0;
+
+		if (min < output->buffer_num_min)
+			min = output->buffer_num_min;
+		num = fit > BUFFER_NUM_MAX ? BUFFER_NUM_MAX : fit < min ? min : (unsigned int)fit;
+		vcos_log_error("%llu MB of GPU memory free, %u buffers of %u bytes", (unsigned long long)(free_mem >> 20),
+					   num, output->buffer_size);
+	}
+	return num;
+}
+
 /**
  * Parse the incoming command line and put resulting parameters in to the state
  *
@@ -652,6 +589,54 @@ static int parse_cmdline(int argc, char **argv, RASPIRAW_PARAMS_T *cfg)
 				cfg->write_header = 1;
 				break;
 
+			case CommandCopyWorkers:
+				if (copy_pool_parse_workers(&copy_pool, argv[i + 1]) < 0)
+					valid = 0;
+				else
+				{
+					cfg->copy_workers_set = 1;
+					i++;
+				}
+				break;
+
+			case CommandCopyCpus:
+				if (copy_pool_parse_cpus(&copy_pool, argv[i + 1]) < 0)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandCopySched:
+				if (copy_pool_parse_sched(&copy_pool, argv[i + 1]) < 0)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandHeaderMode:
+				if (!strcmp(argv[i + 1], "frame"))
+				{
+					cfg->write_header = 1;
+					cfg->header_once = 0;
+				}
+				else if (!strcmp(argv[i + 1], "once"))
+				{
+					cfg->write_header = 0;
+					cfg->header_once = 1;
+				}
+				else if (!strcmp(argv[i + 1], "none"))
+				{
+					cfg->write_header = 0;
+					cfg->header_once = 0;
+				}
+				else
+				{
+					valid = 0;
+					break;
+				}
+				i++;
+				break;
+
 			case CommandTimeout: // Time to run for in milliseconds
 				if (sscanf(argv[i + 1], "%u", &cfg->timeout) == 1)
 				{
@@ -792,65 +777,671 @@ static int parse_cmdline(int argc, char **argv, RASPIRAW_PARAMS_T *cfg)
 					i++;
 				break;
 
-			case CommandLeft:
-				if (sscanf(argv[i + 1], "%d", &cfg->left) != 1)
-					valid = 0;
-				else
-					i++;
-				break;
+			case CommandLeft:
+				if (sscanf(argv[i + 1], "%d", &cfg->left) != 1)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandTop:
+				if (sscanf(argv[i + 1], "%d", &cfg->top) != 1)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandWriteHeader0:
+				len = strlen(argv[i + 1]);
+				cfg->write_header0 = malloc(len + 1);
+				vcos_assert(cfg->write_header0);
+				strncpy(cfg->write_header0, argv[i + 1], len+1);
+				i++;
+				break;
+
+			case CommandWriteHeaderG:
+				len = strlen(argv[i + 1]);
+				cfg->write_headerg = malloc(len + 1);
+				vcos_assert(cfg->write_headerg);
+				strncpy(cfg->write_headerg, argv[i + 1], len+1);
+				i++;
+				break;
+
+			case CommandWriteTimestamps:
+				len = strlen(argv[i + 1]);
+				cfg->write_timestamps = malloc(len + 1);
+				vcos_assert(cfg->write_timestamps);
+				strncpy(cfg->write_timestamps, argv[i + 1], len+1);
+				i++;
+				break;
+
+			case CommandWriteTsLog:
+				len = strlen(argv[i + 1]);
+				cfg->write_tslog = malloc(len + 1);
+				vcos_assert(cfg->write_tslog);
+				strncpy(cfg->write_tslog, argv[i + 1], len+1);
+				i++;
+				break;
+
+			case CommandWriteEmpty:
+				cfg->write_empty = 1;
+				break;
+
+			case CommandContainer:
+				len = strlen(argv[i + 1]);
+				cfg->container = malloc(len + 1);
+				vcos_assert(cfg->container);
+				strncpy(cfg->container, argv[i + 1], len+1);
+				i++;
+				cfg->capture = 1;
+				break;
+
+			case CommandRingDepth:
+				if (sscanf(argv[i + 1], "%d", &cfg->ring_depth) != 1 || cfg->ring_depth < 0)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandPreTrigger:
+				cfg->pretrigger = argv[i + 1];
+				i++;
+				cfg->capture = 1;
+				break;
+
+			case CommandPostTrigger:
+				cfg->posttrigger = argv[i + 1];
+				i++;
+				break;
+
+			case CommandTrigger:
+				if (cfg->num_triggers >= PRETRIGGER_MAX_SOURCES)
+					valid = 0;
+				else
+				{
+					cfg->triggers[cfg->num_triggers++] = argv[i + 1];
+					i++;
+				}
+				break;
+
+			case CommandControl:
+				cfg->control = argv[i + 1];
+				i++;
+				break;
+
+			case CommandBuffers:
+				if (sscanf(argv[i + 1], "%d", &cfg->buffer_num) != 1 || cfg->buffer_num < 1)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandProfile:
+				cfg->profile = argv[i + 1];
+				i++;
+				break;
+
+			case CommandCalibrate:
+				cfg->calibrate = 1;
+				break;
+
+			case CommandShm:
+			{
+				char *colon = strchr(argv[i + 1], ':');
+
+				cfg->shm = argv[i + 1];
+				if (colon)
+				{
+					*colon = '\0';
+					if (sscanf(colon + 1, "%d", &cfg->shm_slots) != 1 || cfg->shm_slots < 1)
+						valid = 0;
+				}
+				i++;
+				break;
+			}
+
+			case CommandStreamHeader:
+				cfg->stream_headers = 1;
+				break;
+
+			case CommandMotion:
+				if (motion_gate_parse(argv[i + 1], &cfg->motion_threshold, &cfg->motion_step) < 0)
+					valid = 0;
+				else
+				{
+					cfg->motion = argv[i + 1];
+					i++;
+					cfg->capture = 1;
+				}
+				break;
+
+			case CommandTrack:
+				cfg->track = argv[i + 1];
+				i++;
+				break;
+
+			case CommandEmbedded:
+				cfg->embedded = 1;
+				break;
+
+			case CommandHealth:
+				cfg->health = argv[i + 1];
+				i++;
+				break;
+
+			case CommandTrace:
+				cfg->trace = argv[i + 1];
+				i++;
+				break;
+
+			case CommandTrackSettings:
+				if (tracker_parse(argv[i + 1], &cfg->track_level, &cfg->track_step, &cfg->track_min_area) < 0)
+					valid = 0;
+				else
+					i++;
+				break;
+
+			case CommandDaemon:
+				cfg->daemon = argv[i + 1];
+				i++;
+				break;
+
+			case CommandCapacity:
+				if (sscanf(argv[i + 1], "%d", &cfg->capacity) != 1 || cfg->capacity <= 0)
+					valid = 0;
+				else
+					i++;
+				break;
+				
+			default:
+				valid = 0;
+				break;
+		}
+	}
+
+	if (!valid)
+	{
+		fprintf(stderr, "Invalid command line option (%s)\n", argv[i-1]);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Frame rate to size buffers for: the requested one, or the fastest the
+ * mode can run at.
+ */
+static double expected_fps(const RASPIRAW_PARAMS_T *cfg, const struct mode_def *mode)
+{
+	if (cfg->fps > 0)
+		return cfg->fps;
+	return 1e9 / ((double)mode->line_time_ns * (mode->min_vts ? mode->min_vts : mode->height));
+}
+
+/**
+ * Frame period the sensor is programmed for: VTS lines of line_time_ns
+ * when the sensor has a VTS register set in map, else from expected_fps().
+ */
+static int64_t programmed_frame_period_us(const RASPIRAW_PARAMS_T *cfg, const struct sensor_def *sensor,
+										  const struct mode_def *mode, const REG_MAP_T *map)
+{
+	uint32_t vts = sensor->vts_reg ? reg_map_get_value(map, sensor->vts_reg, sensor->vts_reg_num_bits) : 0;
+
+	if (vts)
+		return (int64_t)vts * mode->line_time_ns / 1000;
+	return 1e6 / expected_fps(cfg, mode);
+}
+
+/**
+ * Converts "<N>" (frames) or "<N>s" (seconds) into a frame count.
+ */
+static int frames_from_arg(const char *arg, double fps, int saverate)
+{
+	char *end;
+	double v = strtod(arg, &end);
+
+	if (*end == 's')
+		v = v * fps / saverate;
+	return v > 0 ? (int)(v + 0.5) : 0;
+}
+
+/**
+ * Moves the readout window of the ov5647 (-lt, -tp); offsets are in
+ * binned pixels of the mode.
+ */
+static void set_window_offset(const struct sensor_def *sensor, REG_MAP_T *map, int mode, int left, int top)
+{
+	int scale = mode < 2 ? 1 : 1 << (mode / 2 - 1);
+
+	if (strcmp(sensor->name, "ov5647"))
+		return;
+	if (left > 0)
+	{
+		reg_map_update(map, 0x3800, REG_BITS(0, 3), (left * scale) >> 8, EQUAL);
+		reg_map_update(map, 0x3801, REG_BITS(0, 7), (left * scale) & 0xFF, EQUAL);
+	}
+	if (top > 0)
+	{
+		reg_map_update(map, 0x3802, REG_BITS(0, 3), (top * scale) >> 8, EQUAL);
+		reg_map_update(map, 0x3803, REG_BITS(0, 7), (top * scale) & 0xFF, EQUAL);
+	}
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+/**
+ * Where -ctl logs the frame each change took effect on: next to the -ts
+ * CSV, or else the -tb log, as <path>.ctl.
+ *
+ * @return the path to free, NULL without timestamps
+ */
+static char *control_log_path(const char *tstamps, const char *tslog)
+{
+	char *path = NULL;
+
+	if ((tstamps || tslog) && asprintf(&path, "%s.ctl", tstamps ? tstamps : tslog) < 0)
+		return NULL;
+	return path;
+}
+
+/**
+ * Converts the binary timestamp log into the CSV layout measure.sh and
+ * tools/ expect (-ts).
+ */
+static void write_timestamps_csv(const char *tslog, const char *path)
+{
+	FILE *csv = fopen(path, "w");
+
+	if (!csv || ts_log_to_csv(tslog, csv, 0) < 0)
+		vcos_log_error("Failed to write timestamps to %s", path);
+	if (csv)
+		fclose(csv);
+}
+
+/**
+ * Where the frames of a daemon job are written first: /dev/shm under the
+ * output's file name with the copy pool moving them on, as for -o, or the
+ * output itself when it already is in /dev/shm.
+ *
+ * @return malloc()ed pattern, NULL if the output has no directory
+ */
+static char *job_mem_pattern(const char *output, bool *copy)
+{
+	const char *name = strrchr(output, '/');
+	char *mem = NULL;
+
+	if (!name || asprintf(&mem, "/dev/shm%s", name) < 0)
+		return NULL;
+	*copy = strncmp(mem, output, name - output) != 0;
+	if (!*copy)
+	{
+		free(mem);
+		mem = strdup(output);
+	}
+	return mem;
+}
+
+/*
+ * State of the capture daemon (-daemon) between jobs: the rawcam graph,
+ * its pool and the I2C bus stay up, and the sensor keeps the mode table
+ * minus its final stream-on write, so a job only sends the registers its
+ * settings change and starts streaming.
+ */
+struct daemon {
+	JOB_SERVER_T server;
+	REG_MAP_T state;						// Registers as the sensor has them
+	const struct sensor_regs *stream_on;	// Held back mode table entry, NULL = whole table per job
+	const struct sensor_def *sensor;
+	struct mode_def *mode;
+	FRAME_SOURCE_T *source;
+	const struct brcm_raw_header *header;
+};
+
+/**
+ * Runs one job against the warm graph and replies with its result.
+ * Settings the job does not give are those of the command line.
+ */
+static void daemon_job(struct daemon *d, RASPIRAW_PARAMS_T *cfg, struct capture_job *job)
+{
+	const struct sensor_def *sensor = d->sensor;
+	const char *output = job->output ? job->output : cfg->output;
+	const char *tstamps = job->tstamps ? job->tstamps : cfg->write_timestamps;
+	const char *tslog = job->tslog ? job->tslog : (job->tstamps ? NULL : cfg->write_tslog);
+	const char *error = NULL;
+	char *mem = NULL, *tmp_log = NULL;
+	struct sensor_regs *regs = NULL;
+	REG_MAP_T next = { 0 };
+	bool copy = false, copying = false;
+	int n = 0, exposure = job->exposure;
+	int timeout = job->timeout >= 0 ? job->timeout : cfg->timeout;
+	uint64_t received = frame_clock_ns(), streaming = 0, first = 0, now;
+
+	if (job->mode >= 0 && job->mode != cfg->mode)
+	{
+		// The port format and buffer pool are fixed while the graph is up
+		job_server_reply(&d->server, "error mode %d needs a restart, running mode %d", job->mode, cfg->mode);
+		return;
+	}
+	mem = job_mem_pattern(output, &copy);
+	if (!mem)
+	{
+		job_server_reply(&d->server, "error output %s has no directory", output);
+		return;
+	}
+
+	// Registers of this job, starting from the command line's
+	if (reg_map_copy(&next, &mode_map) < 0 ||
+		!(regs = malloc((next.num_regs + 1) * sizeof(*regs))))
+	{
+		error = "out of memory";
+		goto done;
+	}
+	if (job->fps > 0 && sensor->vts_reg)
+		reg_map_set_value(&next, sensor->vts_reg, sensor->vts_reg_num_bits,
+						  (uint32_t)(1e9 / (d->mode->line_time_ns * job->fps)));
+	if (job->exposure_us >= 0)
+		exposure = ((int64_t)job->exposure_us * 1000) / d->mode->line_time_ns;
+	update_regs(sensor, d->mode, &next, 0, 0, exposure, job->gain);
+	set_window_offset(sensor, &next, cfg->mode, job->left, job->top);
+	if (d->stream_on)
+	{
+		n = reg_map_diff(&d->state, &next, regs, next.num_regs);
+		regs[n++] = *d->stream_on;
+	}
+	else
+	{
+		memcpy(regs, next.regs, next.num_regs * sizeof(*regs));
+		n = next.num_regs;
+	}
+
+	capture_init(&capture);
+	capture.saverate = job->saverate > 0 ? job->saverate : cfg->saverate;
+	capture.write_empty = cfg->write_empty;
+	capture.header = cfg->write_header ? d->header : NULL;
+	capture.header_len = cfg->write_header ? BRCM_RAW_HEADER_LENGTH : 0;
+	capture.mem_pattern = mem;
+	capture.copy = copy ? &copy_pool : NULL;
+	capture.frame_period_us = programmed_frame_period_us(cfg, sensor, d->mode, &next);
+	capture.shm = shm_ring.base ? &shm_ring : NULL;
+	if (cfg->ring_depth != 0 &&
+		capture_start_ring(&capture, cfg->ring_depth > 0 ? cfg->ring_depth : 0, d->source->buffer_size) < 0)
+	{
+		error = "failed to create frame ring";
+		goto done;
+	}
+	if (cfg->health && capture_start_health(&capture, cfg->health) < 0)
+	{
+		error = "failed to start health reports";
+		goto done;
+	}
+	if (tstamps && !tslog && asprintf(&tmp_log, "%s.bin", tstamps) >= 0)
+		tslog = tmp_log;
+	if (tslog && ts_log_open(&capture.ts_log, tslog) < 0)
+	{
+		error = "failed to create timestamp log";
+		goto done;
+	}
+	if (cfg->header_once && d->header)
+	{
+		// One header per job, next to its frames
+		char *dir = strdup(output), *path = NULL;
+		FILE *file;
+
+		if (dir && asprintf(&path, "%s/hd0.32k", dirname(dir)) >= 0 && (file = fopen(path, "wb")))
+		{
+			fwrite(d->header, BRCM_RAW_HEADER_LENGTH, 1, file);
+			fclose(file);
+		}
+		free(path);
+		free(dir);
+	}
+	if (copy)
+	{
+		if (copy_pool_start(&copy_pool, mem, output) < 0)
+		{
+			error = "failed to start copy workers";
+			goto done;
+		}
+		copying = true;
+	}
+
+	// Re-arm the pool, then one register transfer starts the sensor
+	if (frame_source_start(d->source, capture_deliver, &capture) < 0)
+	{
+		error = "failed to enable the rawcam port";
+		goto done;
+	}
+	if (i2c_regs_write(&sensor_i2c, regs, n) < 0)
+	{
+		error = "failed to write the sensor registers";
+		goto done;
+	}
+	streaming = frame_clock_ns();
+	reg_map_destroy(&d->state);
+	d->state = next;
+	memset(&next, 0, sizeof(next));
+	vcos_log_error("Job %u: streaming %.2f ms after the request, %d registers", d->server.jobs,
+				   (streaming - received) / 1e6, n);
+
+	if (cfg->control)
+	{
+		char *log = control_log_path(tstamps, tslog);
+
+		if (control_start(&control, cfg->control, sensor, d->mode, &d->state, &sensor_i2c, &capture, log) < 0)
+			vcos_log_error("Failed to open control FIFO %s, exposure and gain stay fixed", cfg->control);
+		free(log);
+	}
+
+	// -t 0 runs until the client sends "stop" or goes away
+	for (;;)
+	{
+		now = frame_clock_ns();
+		if (!first && d->source->delivered)
+			first = now;
+		if (stop_requested || job_server_cancelled(&d->server) ||
+			(timeout && now - streaming >= (uint64_t)timeout * 1000000))
+			break;
+		vcos_sleep(first ? 10 : 1);
+	}
+	control_stop(&control);
+	i2c_regs_write(&sensor_i2c, sensor->stop, sensor->num_stop_regs);
+
+done:
+	frame_source_stop(d->source);
+	capture_stop(&capture);
+	if (copying)
+		copy_pool_stop(&copy_pool);
+	if (!error && tstamps && tslog)
+		write_timestamps_csv(tslog, tstamps);
+	if (tmp_log)
+	{
+		unlink(tmp_log);
+		free(tmp_log);
+	}
+	reg_map_destroy(&next);
+	free(regs);
+	free(mem);
+
+	if (error)
+		job_server_reply(&d->server, "error %s", error);
+	else
+		job_server_reply(&d->server, "ok frames=%u saved=%u first_frame_ms=%.2f regs=%d", d->source->delivered,
+						 capture.stats.frames, first ? (first - received) / 1e6 : -1.0, n);
+}
 
-			case CommandTop:
-				if (sscanf(argv[i + 1], "%d", &cfg->top) != 1)
-					valid = 0;
-				else
-					i++;
-				break;
+/**
+ * Programs the sensor once and serves capture jobs from the socket until
+ * SIGINT/SIGTERM.
+ */
+static void run_daemon(RASPIRAW_PARAMS_T *cfg, const struct sensor_def *sensor, struct mode_def *mode,
+					   FRAME_SOURCE_T *source, const struct brcm_raw_header *header)
+{
+	struct daemon d = { .sensor = sensor, .mode = mode, .source = source, .header = header };
+	struct capture_job job;
+	int n = mode_map.num_regs;
 
-			case CommandWriteHeader0:
-				len = strlen(argv[i + 1]);
-				cfg->write_header0 = malloc(len + 1);
-				vcos_assert(cfg->write_header0);
-				strncpy(cfg->write_header0, argv[i + 1], len+1);
-				i++;
-				break;
+	if (open_sensor_i2c(sensor) < 0)
+		return;
+	if (reg_map_copy(&d.state, &mode_map) < 0)
+	{
+		i2c_regs_close(&sensor_i2c);
+		return;
+	}
+	if (job_server_open(&d.server, cfg->daemon) < 0)
+	{
+		reg_map_destroy(&d.state);
+		i2c_regs_close(&sensor_i2c);
+		return;
+	}
 
-			case CommandWriteHeaderG:
-				len = strlen(argv[i + 1]);
-				cfg->write_headerg = malloc(len + 1);
-				vcos_assert(cfg->write_headerg);
-				strncpy(cfg->write_headerg, argv[i + 1], len+1);
-				i++;
-				break;
+	// Everything but the final stream-on write, so jobs only send deltas
+	if (sensor->stream_reg && n && mode_map.regs[n - 1].reg == sensor->stream_reg && mode_map.regs[n - 1].data)
+	{
+		d.stream_on = &mode_map.regs[n - 1];
+		i2c_regs_write(&sensor_i2c, mode_map.regs, n - 1);
+	}
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	vcos_log_error("Waiting for jobs on %s, %.1f ms after launch%s", cfg->daemon, (frame_clock_ns() - launch_ns) / 1e6,
+				   d.stream_on ? "" : ", the whole mode table is sent per job");
+
+	while (job_server_next(&d.server, &job, &stop_requested) == 1)
+		daemon_job(&d, cfg, &job);
+
+	vcos_log_error("Daemon: %u jobs", d.server.jobs);
+	job_server_close(&d.server);
+	reg_map_destroy(&d.state);
+	i2c_regs_close(&sensor_i2c);
+}
 
-			case CommandWriteTimestamps:
-				len = strlen(argv[i + 1]);
-				cfg->write_timestamps = malloc(len + 1);
-				vcos_assert(cfg->write_timestamps);
-				strncpy(cfg->write_timestamps, argv[i + 1], len+1);
-				i++;
-				cfg->ptsa = malloc(sizeof(*cfg->ptsa));
-				cfg->ptso = cfg->ptsa;
-				break;
+/**
+ * One calibration trial: a capture of duration ms with buffer_num rawcam
+ * buffers and workers copy workers.
+ *
+ * @return 1 if it sustained fps, 0 if not, -1 on failure
+ */
+static int calibration_trial(RASPIRAW_PARAMS_T *cfg, const struct sensor_def *sensor, FRAME_SOURCE_T *source,
+							 const struct brcm_raw_header *header, int buffer_num, int workers, double fps, int duration)
+{
+	struct rawcam_source *cam = (struct rawcam_source *)source->priv;
+	uint32_t failed = copy_pool.failed, dropped, backlog = 0, rejected = 0;
+	uint32_t expected = (uint32_t)(duration * fps / 1000);
+	int i, sustained;
 
-			case CommandWriteEmpty:
-				cfg->write_empty = 1;
-				break;
-				
-			default:
-				valid = 0;
-				break;
+	if (cam->output->buffer_num != (uint32_t)buffer_num)
+	{
+		mmal_port_pool_destroy(cam->output, cam->pool);
+		cam->output->buffer_num = buffer_num;
+		cam->pool = mmal_port_pool_create(cam->output, buffer_num, cam->output->buffer_size);
+		if (!cam->pool)
+		{
+			vcos_log_error("Failed to create pool of %d buffers", buffer_num);
+			return -1;
 		}
 	}
 
-	if (!valid)
+	capture_init(&capture);
+	capture.saverate = cfg->saverate;
+	capture.write_empty = cfg->write_empty;
+	capture.header = cfg->write_header ? header : NULL;
+	capture.header_len = cfg->write_header ? BRCM_RAW_HEADER_LENGTH : 0;
+	capture.mem_pattern = mem_dir;
+	capture.copy = workers ? &copy_pool : NULL;
+	capture.frame_period_us = 1e6 / fps;
+	if (cfg->ring_depth != 0 &&
+		capture_start_ring(&capture, cfg->ring_depth > 0 ? cfg->ring_depth : 0, source->buffer_size) < 0)
+		return -1;
+	if (workers)
 	{
-		fprintf(stderr, "Invalid command line option (%s)\n", argv[i-1]);
-		return 1;
+		copy_pool.num_threads = copy_pool.min_threads = workers;
+		copy_pool.autoscale = 0;
+		if (copy_pool_start(&copy_pool, mem_dir, des_dir) < 0)
+		{
+			capture_stop(&capture);
+			return -1;
+		}
+	}
+	if (frame_source_start(source, capture_deliver, &capture) < 0)
+	{
+		capture_stop(&capture);
+		if (workers)
+			copy_pool_stop(&copy_pool);
+		return -1;
 	}
 
-	return 0;
+	start_camera_streaming(sensor, &mode_map);
+	for (i = 0; !stop_requested && i < duration; i += 100)
+		vcos_sleep(duration - i < 100 ? duration - i : 100);
+	stop_camera_streaming(sensor);
+	frame_source_stop(source);
+
+	dropped = capture.ring.dropped;
+	capture_stop(&capture);
+	if (workers)
+	{
+		// What the workers did not get to while the frames came in
+		backlog = copy_queue_depth(&copy_pool.queue);
+		rejected = copy_pool.queue.rejected;
+		copy_pool_stop(&copy_pool);
+	}
+	sustained = !capture.health.dropped_sensor && !dropped && !capture.health.save_errors && !rejected &&
+				copy_pool.failed == failed && backlog <= fps / 4 && source->delivered >= expected * 0.95;
+	vcos_log_error("Calibration: %d buffers, %d copy workers: %u of %u frames, %u skipped, %u ring drops, "
+				   "copy backlog %u: %s", buffer_num, workers, source->delivered, expected, capture.health.dropped_sensor,
+				   dropped, backlog, sustained ? "sustained" : "not sustained");
+	return sustained;
 }
 
+/**
+ * -calibrate: raises the rawcam buffer count up to what the GPU memory
+ * allowed at startup, then lowers the copy workers, and writes the
+ * smallest configuration sustaining the frame rate to the profile.
+ */
+static void run_calibration(RASPIRAW_PARAMS_T *cfg, const struct sensor_def *sensor, struct mode_def *mode,
+							FRAME_SOURCE_T *source, const struct brcm_raw_header *header)
+{
+	struct rawcam_source *cam = (struct rawcam_source *)source->priv;
+	double fps = expected_fps(cfg, mode);
+	int duration = cfg->timeout ? cfg->timeout : 2000;
+	int buffer_num, workers, ret = 0;
+	TUNE_T tune;
+
+	tune_init(&tune, cam->output->buffer_num_min > 2 ? cam->output->buffer_num_min : 2, cam->output->buffer_num,
+			  enableCopy ? copy_pool.num_threads : 0);
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	vcos_log_error("Calibrating %ux%u at %.1f fps, up to %d buffers and %d copy workers, %d ms per trial",
+				   mode->width, mode->height, fps, cam->output->buffer_num, tune.max_workers, duration);
+
+	while (!stop_requested && tune_next(&tune, &buffer_num, &workers))
+	{
+		ret = calibration_trial(cfg, sensor, source, header, buffer_num, workers, fps, duration);
+		if (ret < 0)
+			break;
+		tune_result(&tune, ret);
+	}
+	if (ret < 0 || stop_requested)
+		vcos_log_error("Calibration aborted after %u trials", tune.trials);
+	else if (!tune.found)
+		vcos_log_error("Calibration: nothing up to %d buffers sustained %.1f fps", cam->output->buffer_num, fps);
+	else
+	{
+		tune.best.width = mode->width;
+		tune.best.height = mode->height;
+		tune.best.fps = fps;
+		if (tune_profile_save(cfg->profile, &tune.best) == 0)
+			vcos_log_error("Calibration: %d buffers and %d copy workers sustain %.1f fps, saved to %s",
+						   tune.best.buffer_num, tune.best.copy_workers, fps, cfg->profile);
+	}
+}
 
 int main(int argc, char** argv) {
 	RASPIRAW_PARAMS_T cfg = {
@@ -862,6 +1453,7 @@ int main(int argc, char** argv) {
 		.output = NULL,
 		.capture = 0,
 		.write_header = 1,
+		.header_once = 0,
 		.timeout = 5000,
 		.saverate = 20,
 		.bit_depth = -1,
@@ -882,14 +1474,37 @@ int main(int argc, char** argv) {
 		.write_header0 = NULL,
 		.write_headerg = NULL,
 		.write_timestamps = NULL,
+		.write_tslog = NULL,
 		.write_empty = 0,
-		.ptsa = NULL,
-		.ptso = NULL,
+		.container = NULL,
+		.capacity = 0,
+		.ring_depth = -1,
+		.pretrigger = NULL,
+		.posttrigger = NULL,
+		.num_triggers = 0,
+		.control = NULL,
+		.daemon = NULL,
+		.buffer_num = 0,
+		.profile = NULL,
+		.calibrate = 0,
+		.copy_workers_set = 0,
+		.shm = NULL,
+		.shm_slots = 0,
+		.motion = NULL,
+		.track = NULL,
+		.track_level = 200,
+		.track_step = 1,
+		.track_min_area = 2,
+		.embedded = 0,
+		.health = NULL,
+		.trace = NULL,
 	};
 	uint32_t encoding;
 	const struct sensor_def *sensor;
 	struct mode_def *sensor_mode = NULL;
+	bool runs;
 
+	launch_ns = frame_clock_ns();
 	bcm_host_init();
 	vcos_log_register("RaspiRaw", VCOS_LOG_CATEGORY);
 
@@ -901,11 +1516,53 @@ int main(int argc, char** argv) {
 		exit(-1);
 	}
 
+	copy_pool_defaults(&copy_pool, MAX_THREADS);
+	capture_init(&capture);
+
 	// Parse the command line and put options in to our status structure
 	if (parse_cmdline(argc, argv, &cfg))
 	{
 		exit(-1);
 	}
+	// The motion gate saves through the pre-trigger history
+	if (cfg.motion && !cfg.pretrigger)
+	{
+		cfg.pretrigger = "0.05s";
+		if (!cfg.posttrigger)
+			cfg.posttrigger = "0.05s";
+	}
+	if ((cfg.track || cfg.embedded) && !cfg.capture)
+	{
+		fprintf(stderr, "-track and -embedded need -o\n");
+		exit(-1);
+	}
+	if (cfg.daemon && (!cfg.capture || cfg.container || cfg.pretrigger || cfg.track))
+	{
+		fprintf(stderr, "-daemon needs -o and works without -cf, -pre, -motion and -track\n");
+		exit(-1);
+	}
+	if (cfg.calibrate && (!cfg.capture || !cfg.profile || cfg.container || cfg.pretrigger || cfg.daemon || cfg.track))
+	{
+		fprintf(stderr, "-calibrate needs -o and -pf and works without -cf, -pre, -motion, -track and -daemon\n");
+		exit(-1);
+	}
+	// -o - or a FIFO: frames go to a reader, not into files
+	cfg.stream = cfg.output && stream_sink_is_stream(cfg.output);
+	if (cfg.stream && (cfg.container || cfg.daemon || cfg.calibrate))
+	{
+		fprintf(stderr, "Streaming to -o - or a FIFO works without -cf, -daemon and -calibrate\n");
+		exit(-1);
+	}
+	if (cfg.stream && !strcmp(cfg.output, "-") && stream_sink_take_stdout() < 0)
+	{
+		perror("stdout");
+		exit(-1);
+	}
+	// From here on, so the sensor start-up is in it too
+	if (cfg.trace && trace_start(cfg.trace, COPY_POOL_MAX_THREADS + TRACE_EXTRA_THREADS) < 0)
+		exit(-1);
+	// Jobs and calibration trials set up their own ring, log and copy pool
+	runs = cfg.daemon || cfg.calibrate;
 
 	snprintf(i2c_device_name, sizeof(i2c_device_name), "/dev/i2c-%d", cfg.i2c_bus);
 	printf("Using i2C device %s\n", i2c_device_name);
@@ -927,6 +1584,11 @@ int main(int argc, char** argv) {
 		vcos_log_error("Invalid mode %d - aborting", cfg.mode);
 		return -2;
 	}
+	if (reg_map_init(&mode_map, sensor_mode->regs, sensor_mode->num_regs, sensor->i2c_addr, sensor->stream_reg) < 0)
+	{
+		vcos_log_error("Failed to index the mode registers");
+		return -2;
+	}
 
 
 	if (cfg.regs)
@@ -950,7 +1612,7 @@ int main(int argc, char** argv) {
 				sscanf(q,"%2x",&b);
 				vcos_log_error("%04x: %02x",r,b);
 
-				modReg(sensor_mode, r, 0, 7, b, EQUAL);
+				reg_map_update(&mode_map, r, REG_BITS(0, 7), b, EQUAL);
 
 				++r;
 				q+=2;
@@ -962,67 +1624,49 @@ int main(int argc, char** argv) {
 	if (cfg.hinc >= 0)
 	{
                 if (!strcmp(sensor->name, "ov5647"))
-		        modReg(sensor_mode, 0x3814, 0, 7, cfg.hinc, EQUAL);
+		        reg_map_update(&mode_map, 0x3814, REG_BITS(0, 7), cfg.hinc, EQUAL);
 	}
 
 	if (cfg.vinc >= 0)
 	{
                 if (!strcmp(sensor->name, "ov5647"))
-		        modReg(sensor_mode, 0x3815, 0, 7, cfg.vinc, EQUAL);
+		        reg_map_update(&mode_map, 0x3815, REG_BITS(0, 7), cfg.vinc, EQUAL);
 	}
 
 	if (cfg.voinc >= 0)
 	{
                 if (!strcmp(sensor->name, "imx219"))
-		        modReg(sensor_mode, 0x0171, 0, 2, cfg.voinc, EQUAL);
+		        reg_map_update(&mode_map, 0x0171, REG_BITS(0, 2), cfg.voinc, EQUAL);
 	}
 
 	if (cfg.hoinc >= 0)
 	{
                 if (!strcmp(sensor->name, "imx219"))
-		        modReg(sensor_mode, 0x0170, 0, 2, cfg.hoinc, EQUAL);
+		        reg_map_update(&mode_map, 0x0170, REG_BITS(0, 2), cfg.hoinc, EQUAL);
 	}
 
 	if (cfg.fps > 0)
 	{
 		int n = 1000000000 / (sensor_mode->line_time_ns * cfg.fps);
-		modReg(sensor_mode, sensor->vts_reg+0, 0, 7, n>>8, EQUAL);
-		modReg(sensor_mode, sensor->vts_reg+1, 0, 7, n&0xFF, EQUAL);
+		reg_map_update(&mode_map, sensor->vts_reg+0, REG_BITS(0, 7), n>>8, EQUAL);
+		reg_map_update(&mode_map, sensor->vts_reg+1, REG_BITS(0, 7), n&0xFF, EQUAL);
 	}
 
 	if (cfg.width > 0)
 	{
 		sensor_mode->width = cfg.width;
-		modReg(sensor_mode, sensor->xos_reg + 0, 0, 3, cfg.width >> 8, EQUAL);
-		modReg(sensor_mode, sensor->xos_reg + 1, 0, 7, cfg.width & 0xFF, EQUAL);
+		reg_map_update(&mode_map, sensor->xos_reg + 0, REG_BITS(0, 3), cfg.width >> 8, EQUAL);
+		reg_map_update(&mode_map, sensor->xos_reg + 1, REG_BITS(0, 7), cfg.width & 0xFF, EQUAL);
 	}
 
 	if (cfg.height > 0)
 	{
 		sensor_mode->height = cfg.height;
-		modReg(sensor_mode, sensor->yos_reg+0, 0, 3, cfg.height >>8, EQUAL);
-		modReg(sensor_mode, sensor->yos_reg+1, 0, 7, cfg.height &0xFF, EQUAL);
-	}
-
-	if (cfg.left > 0)
-	{
-		if (!strcmp(sensor->name, "ov5647"))
-		{
-			int val = cfg.left * (cfg.mode < 2 ? 1 : 1 << (cfg.mode / 2 - 1));
-			modReg(sensor_mode, 0x3800, 0, 3, val >> 8, EQUAL);
-			modReg(sensor_mode, 0x3801, 0, 7, val & 0xFF, EQUAL);
-		}
+		reg_map_update(&mode_map, sensor->yos_reg+0, REG_BITS(0, 3), cfg.height >>8, EQUAL);
+		reg_map_update(&mode_map, sensor->yos_reg+1, REG_BITS(0, 7), cfg.height &0xFF, EQUAL);
 	}
 
-	if (cfg.top > 0)
-	{
-		if (!strcmp(sensor->name, "ov5647"))
-		{
-			int val = cfg.top * (cfg.mode < 2 ? 1 : 1 << (cfg.mode / 2 - 1));
-			modReg(sensor_mode, 0x3802, 0, 3, val >> 8, EQUAL);
-			modReg(sensor_mode, 0x3803, 0, 7, val & 0xFF, EQUAL);
-		}
-	}
+	set_window_offset(sensor, &mode_map, cfg.mode, cfg.left, cfg.top);
 
 	if (cfg.bin44 == 1)
 	{
@@ -1031,8 +1675,8 @@ int main(int argc, char** argv) {
 			fprintf(stderr, "start\n");
 			unsigned nwidth, nheight, border, end;
 			// enabled 4x4 binning
-			//		modReg(sensor_mode, 0x0174, 0, 7, 2, EQUAL);
-			//		modReg(sensor_mode, 0x0175, 0, 7, 2, EQUAL);
+			//		reg_map_update(&mode_map, 0x0174, REG_BITS(0, 7), 2, EQUAL);
+			//		reg_map_update(&mode_map, 0x0175, REG_BITS(0, 7), 2, EQUAL);
 
 			// calculate native fov x borders
 			//		nwidth = cfg.width*4 * ((cfg.hoinc == 3) ? 2 : 1);
@@ -1041,10 +1685,10 @@ int main(int argc, char** argv) {
 			end = 3280 - border - 1;
 
 			// set x params
-			modReg(sensor_mode, 0x0164, 0, 7, border >> 8, EQUAL);
-			modReg(sensor_mode, 0x0165, 0, 7, border & 0xff, EQUAL);
-			modReg(sensor_mode, 0x0166, 0, 7, end >> 8, EQUAL);
-			modReg(sensor_mode, 0x0167, 0, 7, end & 0xff, EQUAL);
+			reg_map_update(&mode_map, 0x0164, REG_BITS(0, 7), border >> 8, EQUAL);
+			reg_map_update(&mode_map, 0x0165, REG_BITS(0, 7), border & 0xff, EQUAL);
+			reg_map_update(&mode_map, 0x0166, REG_BITS(0, 7), end >> 8, EQUAL);
+			reg_map_update(&mode_map, 0x0167, REG_BITS(0, 7), end & 0xff, EQUAL);
 
 			// calculate native fov y borders
 			// nheight = cfg.height*4 * ((cfg.voinc == 3) ? 2 : 1);
@@ -1053,10 +1697,10 @@ int main(int argc, char** argv) {
 			end = 2464 - border - 1;
 
 			// set y params
-			modReg(sensor_mode, 0x0168, 0, 7, border >> 8, EQUAL);
-			modReg(sensor_mode, 0x0169, 0, 7, border & 0xff, EQUAL);
-			modReg(sensor_mode, 0x016a, 0, 7, end >> 8, EQUAL);
-			modReg(sensor_mode, 0x016b, 0, 7, end & 0xff, EQUAL);
+			reg_map_update(&mode_map, 0x0168, REG_BITS(0, 7), border >> 8, EQUAL);
+			reg_map_update(&mode_map, 0x0169, REG_BITS(0, 7), border & 0xff, EQUAL);
+			reg_map_update(&mode_map, 0x016a, REG_BITS(0, 7), end >> 8, EQUAL);
+			reg_map_update(&mode_map, 0x016b, REG_BITS(0, 7), end & 0xff, EQUAL);
 			fprintf(stderr, "end\n");
 		}
 	}
@@ -1080,7 +1724,7 @@ int main(int argc, char** argv) {
 		vcos_log_error("Setting exposure to %d from time %dus", cfg.exposure, cfg.exposure_us);
 	}
 
-	update_regs(sensor, sensor_mode, cfg.hflip, cfg.vflip, cfg.exposure, cfg.gain);
+	update_regs(sensor, sensor_mode, &mode_map, cfg.hflip, cfg.vflip, cfg.exposure, cfg.gain);
 	if (sensor_mode->encoding == 0)
 		encoding = order_and_bit_depth_to_encoding(sensor_mode->order, cfg.bit_depth);
 	else
@@ -1096,6 +1740,7 @@ int main(int argc, char** argv) {
 	MMAL_STATUS_T status;
 	MMAL_PORT_T *output = NULL;
 	MMAL_POOL_T *pool = NULL;
+	struct rawcam_source rawcam_port;
 	MMAL_CONNECTION_T *rawcam_isp = NULL;
 	MMAL_CONNECTION_T *isp_render = NULL;
 	MMAL_PARAMETER_CAMERA_RX_CONFIG_T rx_cfg = {{MMAL_PARAMETER_CAMERA_RX_CONFIG, sizeof(rx_cfg)}};
@@ -1105,10 +1750,39 @@ int main(int argc, char** argv) {
 	bcm_host_init();
 	vcos_log_register("FastRaspiRaw", VCOS_LOG_CATEGORY);
 	
-	// vcos_log_error("Now start thread pool...");
-	if(enableCopy)
-		init_thread_pool(MAX_THREADS);
-	// vcos_log_error("Now start thread pool successful...");
+	// The container is written in place and the stream goes straight to
+	// its reader, nothing to copy afterwards
+	if (cfg.container || cfg.stream)
+		enableCopy = false;
+
+	if (cfg.profile && !cfg.calibrate)
+	{
+		struct tune_entry entry;
+		double fps = expected_fps(&cfg, sensor_mode);
+
+		if (tune_profile_load(cfg.profile, sensor_mode->width, sensor_mode->height, fps, &entry) == 0)
+		{
+			if (!cfg.buffer_num)
+				cfg.buffer_num = entry.buffer_num;
+			if (!cfg.copy_workers_set && entry.copy_workers)
+			{
+				copy_pool.num_threads = copy_pool.min_threads = entry.copy_workers;
+				copy_pool.autoscale = 0;
+			}
+			vcos_log_error("Profile %s: %d buffers, %d copy workers for %ux%u at %.1f fps", cfg.profile,
+						   entry.buffer_num, entry.copy_workers, entry.width, entry.height, entry.fps);
+		}
+		else
+			vcos_log_error("Profile %s has nothing for %ux%u at %.1f fps, using the defaults", cfg.profile,
+						   sensor_mode->width, sensor_mode->height, fps);
+	}
+
+	// Jobs and trials start them for their own output
+	if (enableCopy && !runs && copy_pool_start(&copy_pool, mem_dir, des_dir) < 0)
+	{
+		vcos_log_error("Failed to start copy workers");
+		return -1;
+	}
 	
 
 	status = mmal_component_create("vc.ril.rawcam", &rawcam);
@@ -1118,18 +1792,23 @@ int main(int argc, char** argv) {
 		return -1;
 	}
 
-	status = mmal_component_create("vc.ril.isp", &isp);
-	if (status != MMAL_SUCCESS)
+	// The ISP and renderer only take part in the preview; a raw capture
+	// leaves their GPU memory to the rawcam buffer pool
+	if (!cfg.capture)
 	{
-		vcos_log_error("Failed to create isp");
-		goto component_destroy;
-	}
+		status = mmal_component_create("vc.ril.isp", &isp);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("Failed to create isp");
+			goto component_destroy;
+		}
 
-	status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &render);
-	if (status != MMAL_SUCCESS)
-	{
-		vcos_log_error("Failed to create render");
-		goto component_destroy;
+		status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &render);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("Failed to create render");
+			goto component_destroy;
+		}
 	}
 
 	output = rawcam->output[0];
@@ -1196,6 +1875,15 @@ int main(int argc, char** argv) {
 		rx_cfg.data_lanes = sensor_mode->data_lanes;
 	if (sensor_mode->image_id)
 		rx_cfg.image_id = sensor_mode->image_id;
+	if (cfg.embedded)
+	{
+		if (embedded_init(&embedded, sensor, sensor_mode->width,
+						  mmal_encoding_width_to_stride(encoding, sensor_mode->width), cfg.bit_depth,
+						  1e6 / expected_fps(&cfg, sensor_mode)) < 0)
+			goto component_destroy;
+		rx_cfg.embedded_data_lines = sensor->embedded_lines;
+		vcos_log_error("Embedded data: %d lines ahead of every image", sensor->embedded_lines);
+	}
 	status = mmal_port_parameter_set(output, &rx_cfg.hdr);
 	if (status != MMAL_SUCCESS)
 	{
@@ -1249,17 +1937,20 @@ int main(int argc, char** argv) {
 		vcos_log_error("Failed to enable rawcam");
 		goto component_destroy;
 	}
-	status = mmal_component_enable(isp);
-	if (status != MMAL_SUCCESS)
-	{
-		vcos_log_error("Failed to enable isp");
-		goto component_destroy;
-	}
-	status = mmal_component_enable(render);
-	if (status != MMAL_SUCCESS)
+	if (isp)
 	{
-		vcos_log_error("Failed to enable render");
-		goto component_destroy;
+		status = mmal_component_enable(isp);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("Failed to enable isp");
+			goto component_destroy;
+		}
+		status = mmal_component_enable(render);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("Failed to enable render");
+			goto component_destroy;
+		}
 	}
 
 	output->format->es->video.crop.width = sensor_mode->width;
@@ -1276,12 +1967,11 @@ int main(int argc, char** argv) {
 	}
 
 	output->buffer_size = output->buffer_size_recommended;
-	output->buffer_num = BUFFER_NUM_MANUAL ? BUFFER_NUM_MANUAL : output->buffer_num_recommended;
-	// output->buffer_num = output->buffer_num_recommended;
+	output->buffer_num = cfg.buffer_num ? cfg.buffer_num : gpu_buffer_num(output);
 
 	if (cfg.capture)
 	{
-		if (cfg.write_header || cfg.write_header0)
+		if (cfg.write_header || cfg.header_once || cfg.write_header0)
 		{
 			brcm_header = (struct brcm_raw_header*)malloc(BRCM_RAW_HEADER_LENGTH);
 			if (brcm_header)
@@ -1327,6 +2017,16 @@ int main(int argc, char** argv) {
 						brcm_header->mode.bayer_format = VC_IMAGE_BAYER_RAW16;
 						break;
 				}
+				if (cfg.header_once && !cfg.write_header0 && !cfg.container && !cfg.stream && des_dir)
+				{
+					// One header per capture, next to the frames it describes,
+					// under the name tools/ and process.sh look for
+					char *dir = strdup(des_dir);
+
+					if (dir && asprintf(&cfg.write_header0, "%s/hd0.32k", dirname(dir)) < 0)
+						cfg.write_header0 = NULL;
+					free(dir);
+				}
 				if (cfg.write_header0)
 				{
 					// Save bcrm_header into one file only
@@ -1352,6 +2052,42 @@ int main(int argc, char** argv) {
 			}
 		}
 
+		if (cfg.container)
+		{
+			uint32_t frame_size = output->buffer_size;
+			int capacity = cfg.capacity;
+
+			if (cfg.write_header)
+				frame_size += BRCM_RAW_HEADER_LENGTH;
+			if (!capacity)
+			{
+				// Enough slots for the whole run at the requested (or the
+				// mode's maximum) frame rate, plus the frames in flight;
+				// -t 0 has no length, so size for RRC_UNTIMED_MS
+				int ms = cfg.timeout ? cfg.timeout : RRC_UNTIMED_MS;
+
+				if (!cfg.timeout)
+					vcos_log_error("-t 0 without -cn: container sized for %d s, later frames are dropped", ms / 1000);
+				capacity = (int)(ms * expected_fps(&cfg, sensor_mode) / 1000 / cfg.saverate) + output->buffer_num;
+			}
+			vcos_log_error("Create container %s: %d slots of %u bytes", cfg.container, capacity, frame_size);
+			if (rrc_create(&capture.container, cfg.container, frame_size, capacity,
+						   cfg.header_once ? brcm_header : NULL, cfg.header_once ? BRCM_RAW_HEADER_LENGTH : 0) < 0)
+			{
+				vcos_log_error("Failed to create container");
+				goto component_disable;
+			}
+		}
+
+		if (cfg.write_timestamps && !cfg.write_tslog && !runs &&
+			asprintf(&ts_log_tmp, "%s.bin", cfg.write_timestamps) >= 0)
+			cfg.write_tslog = ts_log_tmp;
+		if (cfg.write_tslog && !runs && ts_log_open(&capture.ts_log, cfg.write_tslog) < 0)
+		{
+			vcos_log_error("Failed to create timestamp log %s", cfg.write_tslog);
+			goto component_disable;
+		}
+
 		status = mmal_port_parameter_set_boolean(output, MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
 		if (status != MMAL_SUCCESS)
 		{
@@ -1359,6 +2095,58 @@ int main(int argc, char** argv) {
 			goto component_disable;
 		}
 
+		if (cfg.pretrigger && cfg.ring_depth == 0)
+		{
+			vcos_log_error("Pre-trigger capture needs the frame ring, ignoring -rd 0");
+			cfg.ring_depth = -1;
+		}
+		if (cfg.ring_depth != 0 && !runs)
+		{
+			if (capture_start_ring(&capture, cfg.ring_depth > 0 ? cfg.ring_depth : 0, output->buffer_size) < 0)
+			{
+				vcos_log_error("Failed to create frame ring");
+				goto component_disable;
+			}
+		}
+
+		if (cfg.pretrigger)
+		{
+			double fps = expected_fps(&cfg, sensor_mode);
+			int pre = frames_from_arg(cfg.pretrigger, fps, cfg.saverate);
+			int post = cfg.posttrigger ? frames_from_arg(cfg.posttrigger, fps, cfg.saverate) : 0;
+
+			vcos_log_error("Pre-trigger history of %d frames, %d frames after each trigger", pre, post);
+			if (pretrigger_init(&capture.pretrigger, pre, post, output->buffer_size, &capture.ring) < 0)
+			{
+				vcos_log_error("Failed to create pre-trigger history");
+				goto component_disable;
+			}
+			if (cfg.motion)
+			{
+				int green_first = sensor_mode->order == BAYER_ORDER_GBRG || sensor_mode->order == BAYER_ORDER_GRBG;
+
+				if (motion_gate_init(&capture.motion, sensor_mode->width, sensor_mode->height,
+									 mmal_encoding_width_to_stride(encoding, output->format->es->video.width),
+									 cfg.bit_depth, green_first, cfg.motion_step, cfg.motion_threshold) < 0)
+				{
+					vcos_log_error("Failed to create motion gate");
+					goto component_disable;
+				}
+				vcos_log_error("Motion gate: %ux%u samples every %u pixels, threshold %.2f", capture.motion.cols,
+							   capture.motion.rows, capture.motion.step, cfg.motion_threshold / (double)MOTION_SCORE_ONE);
+			}
+			if (!cfg.num_triggers)
+				cfg.triggers[cfg.num_triggers++] = "sigusr1";
+			for (i = 0; i < cfg.num_triggers; i++)
+			{
+				if (pretrigger_add_source(&capture.pretrigger, cfg.triggers[i]) < 0)
+				{
+					vcos_log_error("Invalid trigger source %s", cfg.triggers[i]);
+					goto component_disable;
+				}
+			}
+		}
+
 		vcos_log_error("Create pool of %d buffers of size %d", output->buffer_num, output->buffer_size);
 		pool = mmal_port_pool_create(output, output->buffer_num, output->buffer_size);
 		if (!pool)
@@ -1367,31 +2155,77 @@ int main(int argc, char** argv) {
 			goto component_disable;
 		}
 
-		output->userdata = (struct MMAL_PORT_USERDATA_T *)&cfg;
-		status = mmal_port_enable(output, callback);
-		if (status != MMAL_SUCCESS)
+		capture.saverate = cfg.saverate;
+		capture.write_empty = cfg.write_empty;
+		capture.header = cfg.write_header ? brcm_header : NULL;
+		capture.header_len = cfg.write_header ? BRCM_RAW_HEADER_LENGTH : 0;
+		capture.mem_pattern = mem_dir;
+		capture.copy = enableCopy ? &copy_pool : NULL;
+		capture.frame_period_us = programmed_frame_period_us(&cfg, sensor, sensor_mode, &mode_map);
+
+		if (cfg.shm)
 		{
-			vcos_log_error("Failed to enable port");
-			goto pool_destroy;
+			if (shm_ring_create(&shm_ring, cfg.shm, cfg.shm_slots, output->buffer_size, sensor_mode->width,
+								sensor_mode->height, cfg.bit_depth) < 0)
+			{
+				vcos_log_error("Failed to create shared memory ring %s", cfg.shm);
+				goto pool_destroy;
+			}
+			capture.shm = &shm_ring;
 		}
-		running = 1;
-		for(i = 0; i<output->buffer_num; i++)
-		{
-			MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(pool->queue);
 
-			if (!buffer)
+		if (cfg.track)
+		{
+			if (tracker_init(&tracker, sensor_mode->width, sensor_mode->height,
+							 mmal_encoding_width_to_stride(encoding, output->format->es->video.width), cfg.bit_depth,
+							 cfg.track_level, cfg.track_step, cfg.track_min_area) < 0 ||
+				tracker_start(&tracker, cfg.track, output->buffer_size) < 0)
 			{
-				vcos_log_error("Where'd my buffer go?!");
-				goto port_disable;
+				vcos_log_error("Failed to start marker tracking to %s", cfg.track);
+				goto pool_destroy;
 			}
-			status = mmal_port_send_buffer(output, buffer);
-			if (status != MMAL_SUCCESS)
+			vcos_log_error("Marker tracking: %ux%u cells, level %u, to %s", tracker.cols, tracker.rows,
+						   cfg.track_level, cfg.track);
+			capture.tracker = &tracker;
+		}
+
+		if (cfg.health && capture_start_health(&capture, cfg.health) < 0)
+		{
+			vcos_log_error("Failed to start health reports to %s", cfg.health);
+			goto pool_destroy;
+		}
+
+		if (cfg.stream)
+		{
+			// The BRCM header leads the stream instead of every frame
+			int header = cfg.write_header || cfg.header_once;
+
+			vcos_log_error("Stream to %s%s", cfg.output, cfg.stream_headers ? " with frame headers" : "");
+			if (stream_sink_open(&capture.stream, cfg.output, output->buffer_size, cfg.stream_headers,
+								 header ? brcm_header : NULL, header ? BRCM_RAW_HEADER_LENGTH : 0) < 0)
 			{
-				vcos_log_error("mmal_port_send_buffer failed on buffer %p, status %d", buffer, status);
-				goto port_disable;
+				vcos_log_error("Failed to open stream %s", cfg.output);
+				goto pool_destroy;
 			}
-			vcos_log_error("Sent buffer %p", buffer);
 		}
+
+		rawcam_source_init(&rawcam_source, &rawcam_port, output, pool, sensor_mode, cfg.bit_depth, expected_fps(&cfg, sensor_mode));
+		if (cfg.embedded)
+			rawcam_port.embedded = &embedded;
+		if (cfg.daemon)
+		{
+			run_daemon(&cfg, sensor, sensor_mode, &rawcam_source, brcm_header);
+			goto port_disable;
+		}
+		if (cfg.calibrate)
+		{
+			run_calibration(&cfg, sensor, sensor_mode, &rawcam_source, brcm_header);
+			// Trials recreate the pool at their buffer count
+			pool = rawcam_port.pool;
+			goto port_disable;
+		}
+		if (frame_source_start(&rawcam_source, capture_deliver, &capture) < 0)
+			goto port_disable;
 	}
 	else
 	{
@@ -1465,23 +2299,28 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	start_camera_streaming(sensor, sensor_mode);
+	start_camera_streaming(sensor, &mode_map);
+	if (cfg.control)
+	{
+		char *log = control_log_path(cfg.write_timestamps, cfg.write_tslog);
 
-	vcos_sleep(cfg.timeout);
-	running = 0;
+		if (control_start(&control, cfg.control, sensor, sensor_mode, &mode_map, &sensor_i2c,
+						  cfg.capture ? &capture : NULL, log) < 0)
+			vcos_log_error("Failed to open control FIFO %s, exposure and gain stay fixed", cfg.control);
+		free(log);
+	}
 
+	// -t 0 runs until SIGINT/SIGTERM
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	for (i = 0; !stop_requested && (!cfg.timeout || i < cfg.timeout); i += 100)
+		vcos_sleep(cfg.timeout && cfg.timeout - i < 100 ? cfg.timeout - i : 100);
+	control_stop(&control);
 	stop_camera_streaming(sensor);
 
 port_disable:
 	if (cfg.capture)
-	{
-		status = mmal_port_disable(output);
-		if (status != MMAL_SUCCESS)
-		{
-			vcos_log_error("Failed to disable port");
-			return -1;
-		}
-	}
+		frame_source_stop(&rawcam_source);
 pool_destroy:
 	if (pool)
 		mmal_port_pool_destroy(output, pool);
@@ -1496,17 +2335,29 @@ pool_destroy:
 		mmal_connection_destroy(rawcam_isp);
 	}
 component_disable:
+	capture_stop(&capture);
+	shm_ring_destroy(&shm_ring);
+	tracker_stop(&tracker);
+	if (embedded.lines)
+		vcos_log_error("Embedded data: %u buffers read, %u without the registers, %u images paired, %u not",
+					   embedded.parsed, embedded.bad, embedded.paired, embedded.unpaired);
 	if (brcm_header)
 		free(brcm_header);
-	status = mmal_component_disable(render);
-	if (status != MMAL_SUCCESS)
+	if (render)
 	{
-		vcos_log_error("Failed to disable render");
+		status = mmal_component_disable(render);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("Failed to disable render");
+		}
 	}
-	status = mmal_component_disable(isp);
-	if (status != MMAL_SUCCESS)
+	if (isp)
 	{
-		vcos_log_error("Failed to disable isp");
+		status = mmal_component_disable(isp);
+		if (status != MMAL_SUCCESS)
+		{
+			vcos_log_error("Failed to disable isp");
+		}
 	}
 	status = mmal_component_disable(rawcam);
 	if (status != MMAL_SUCCESS)
@@ -1521,67 +2372,18 @@ component_destroy:
 	if (render)
 		mmal_component_destroy(render);
 
-	if (cfg.write_timestamps)
+	if (cfg.write_timestamps && cfg.write_tslog && !runs)
 	{
-		// FIXME
-		// Save timestamps
-
-
-		PTS_NODE_T aux;
-		// Rough estimation of the line size
-		size_t file_sz = (cfg.timeout / cfg.saverate) << 4;
-
-		int fd = open(cfg.write_timestamps, O_RDWR | O_CREAT | O_TRUNC, 0644);
-		if(fd == -1){
-			perror("Error opening file");
-			return -1;
-		}
-		if(ftruncate(fd, file_sz) == -1){
-			perror("Error setting file size");
-			close(fd);
-			return -1;
-		}
-		void* mapped_mem = mmap(NULL, file_sz, PROT_WRITE, MAP_SHARED, fd, 0);
-		if (mapped_mem == MAP_FAILED){
-			perror("Error mapping file");
-			close(fd);
-			return -1;
-		}
-
-		uint64_t old = 0;
-		char *write_ptr = (char *)mapped_mem;
-		for(aux = cfg.ptsa; aux != cfg.ptso; aux = aux->nxt)
-		{
-			if (aux == cfg.ptsa)
-				write_ptr += sprintf(write_ptr, ",%d,%lld\n", aux->idx, aux->pts);
-			else
-				write_ptr += sprintf(write_ptr, "%lld,%d,%lld\n", aux->pts-old, aux->idx, aux->pts);
-			old = aux->pts;
-		}
-
-		// // Clean up memory-mapped region and file
-		// if (msync(mapped_mem, file_sz, MS_SYNC) == -1) {
-		// 	perror("Error syncing file");
-		// }
-
-		munmap(mapped_mem, file_sz);
-		close(fd);
-
-		while (cfg.ptsa != cfg.ptso)
-		{
-			aux = cfg.ptsa->nxt;
-			free(cfg.ptsa);
-			cfg.ptsa = aux;
-		}
-		free(cfg.ptso);
+		write_timestamps_csv(cfg.write_tslog, cfg.write_timestamps);
+		if (ts_log_tmp)
+			unlink(ts_log_tmp);
 	}
 
-	vcos_log_error("Now stop thread pool...");
-	if(enableCopy){
-		// sem_post(&producer_stop_sem);
-		dstr_thread_pool(MAX_THREADS);
-	}
-	vcos_log_error("Now stop thread pool successful...");
+	// Returns as soon as the copy backlog has been flushed
+	if (enableCopy && !runs)
+		copy_pool_stop(&copy_pool);
+	reg_map_destroy(&mode_map);
+	trace_stop();
 
 	return 0;
 }
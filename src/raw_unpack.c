@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "raw_unpack.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RAW_UNPACK_HAVE_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#define RAW_UNPACK_HAVE_X86
+#include <immintrin.h>
+#endif
+
+#define RAW_UNPACK_ALIGN_UP(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+#define RAW_UNPACK_CHUNK			256		// Pixels unpacked at a time before the LUT
+
+/*
+ * A line kernel unpacks as many whole steps of the line as it can without
+ * reading past in_len bytes and returns the number of pixels done; the
+ * scalar code finishes the rest.
+ */
+typedef uint32_t (*raw_line16_fn)(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width);
+typedef uint32_t (*raw_line8_fn)(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width);
+
+struct raw_unpack_kernels {
+	const char *name;
+	raw_line16_fn to16[2];			// RAW10, RAW12
+	raw_line8_fn to8[2];			// Top 8 bits
+};
+
+/**
+ * Bytes per line of a packed frame from the rawcam component, whose port
+ * width is VCOS_ALIGN_UP(width, 16) and whose lines are padded to 32 bytes.
+ */
+uint32_t raw_unpack_stride(uint32_t width, uint32_t bit_depth)
+{
+	return RAW_UNPACK_ALIGN_UP(RAW_UNPACK_ALIGN_UP(width, 16u) * bit_depth / 8, 32u);
+}
+
+/**
+ * Size of a packed frame from the rawcam component (height padded to 16).
+ */
+size_t raw_unpack_frame_size(uint32_t width, uint32_t height, uint32_t bit_depth)
+{
+	return (size_t)raw_unpack_stride(width, bit_depth) * RAW_UNPACK_ALIGN_UP(height, 16u);
+}
+
+// Scalar reference, from pixel x to the end of the line
+
+static void unpack10_16_scalar(const uint8_t *in, uint16_t *out, uint32_t x, uint32_t width)
+{
+	for (; x < width; x++)
+	{
+		const uint8_t *g = in + (x >> 2) * 5;
+
+		out[x] = g[x & 3] << 2 | (g[4] >> ((x & 3) * 2) & 3);
+	}
+}
+
+static void unpack12_16_scalar(const uint8_t *in, uint16_t *out, uint32_t x, uint32_t width)
+{
+	for (; x < width; x++)
+	{
+		const uint8_t *g = in + (x >> 1) * 3;
+
+		out[x] = g[x & 1] << 4 | (g[2] >> ((x & 1) * 4) & 15);
+	}
+}
+
+static void unpack10_8_scalar(const uint8_t *in, uint8_t *out, uint32_t x, uint32_t width)
+{
+	for (; x < width; x++)
+		out[x] = in[(x >> 2) * 5 + (x & 3)];
+}
+
+static void unpack12_8_scalar(const uint8_t *in, uint8_t *out, uint32_t x, uint32_t width)
+{
+	for (; x < width; x++)
+		out[x] = in[(x >> 1) * 3 + (x & 1)];
+}
+
+#ifdef RAW_UNPACK_HAVE_X86
+
+// 8 pixels from 10 (RAW10) or 12 (RAW12) bytes per 128 bit lane: the high
+// bits go to the top of 16 bit lanes, and the low bits are moved to the
+// top of their byte by a multiply and shifted down from there
+
+__attribute__((target("ssse3")))
+static uint32_t unpack10_16_ssse3(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width)
+{
+	const __m128i msb_idx = _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1);
+	const __m128i lsb_idx = _mm_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1);
+	const __m128i lsb_mul = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+	const __m128i mask = _mm_set1_epi16(3);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width && x / 4 * 5 + 16 <= in_len; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x / 4 * 5));
+		__m128i msb = _mm_slli_epi16(_mm_shuffle_epi8(v, msb_idx), 2);
+		__m128i lsb = _mm_mullo_epi16(_mm_shuffle_epi8(v, lsb_idx), lsb_mul);
+
+		lsb = _mm_and_si128(_mm_srli_epi16(lsb, 6), mask);
+		_mm_storeu_si128((__m128i *)(out + x), _mm_or_si128(msb, lsb));
+	}
+	return x;
+}
+
+__attribute__((target("ssse3")))
+static uint32_t unpack12_16_ssse3(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width)
+{
+	const __m128i msb_idx = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+	const __m128i lsb_idx = _mm_setr_epi8(2, -1, 2, -1, 5, -1, 5, -1, 8, -1, 8, -1, 11, -1, 11, -1);
+	const __m128i lsb_mul = _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1);
+	const __m128i mask = _mm_set1_epi16(15);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width && x / 2 * 3 + 16 <= in_len; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x / 2 * 3));
+		__m128i msb = _mm_slli_epi16(_mm_shuffle_epi8(v, msb_idx), 4);
+		__m128i lsb = _mm_mullo_epi16(_mm_shuffle_epi8(v, lsb_idx), lsb_mul);
+
+		lsb = _mm_and_si128(_mm_srli_epi16(lsb, 4), mask);
+		_mm_storeu_si128((__m128i *)(out + x), _mm_or_si128(msb, lsb));
+	}
+	return x;
+}
+
+__attribute__((target("ssse3")))
+static uint32_t unpack10_8_ssse3(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width)
+{
+	const __m128i idx = _mm_setr_epi8(0, 1, 2, 3, 5, 6, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width && x / 4 * 5 + 26 <= in_len; x += 16)
+	{
+		const uint8_t *p = in + x / 4 * 5;
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), idx);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 10)), idx);
+
+		_mm_storeu_si128((__m128i *)(out + x), _mm_unpacklo_epi64(a, b));
+	}
+	return x;
+}
+
+__attribute__((target("ssse3")))
+static uint32_t unpack12_8_ssse3(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width)
+{
+	const __m128i idx = _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width && x / 2 * 3 + 28 <= in_len; x += 16)
+	{
+		const uint8_t *p = in + x / 2 * 3;
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), idx);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 12)), idx);
+
+		_mm_storeu_si128((__m128i *)(out + x), _mm_unpacklo_epi64(a, b));
+	}
+	return x;
+}
+
+// Same as SSSE3 with 16 pixels per step, one 128 bit load per lane
+
+__attribute__((target("avx2")))
+static inline __m256i load_lanes(const uint8_t *lo, const uint8_t *hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo)),
+								   _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack10_16_avx2(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width)
+{
+	const __m256i msb_idx = _mm256_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1,
+											 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1);
+	const __m256i lsb_idx = _mm256_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1,
+											 4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1);
+	const __m256i lsb_mul = _mm256_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+	const __m256i mask = _mm256_set1_epi16(3);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width && x / 4 * 5 + 26 <= in_len; x += 16)
+	{
+		const uint8_t *p = in + x / 4 * 5;
+		__m256i v = load_lanes(p, p + 10);
+		__m256i msb = _mm256_slli_epi16(_mm256_shuffle_epi8(v, msb_idx), 2);
+		__m256i lsb = _mm256_mullo_epi16(_mm256_shuffle_epi8(v, lsb_idx), lsb_mul);
+
+		lsb = _mm256_and_si256(_mm256_srli_epi16(lsb, 6), mask);
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_or_si256(msb, lsb));
+	}
+	return x;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack12_16_avx2(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width)
+{
+	const __m256i msb_idx = _mm256_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1,
+											 0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+	const __m256i lsb_idx = _mm256_setr_epi8(2, -1, 2, -1, 5, -1, 5, -1, 8, -1, 8, -1, 11, -1, 11, -1,
+											 2, -1, 2, -1, 5, -1, 5, -1, 8, -1, 8, -1, 11, -1, 11, -1);
+	const __m256i lsb_mul = _mm256_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1);
+	const __m256i mask = _mm256_set1_epi16(15);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width && x / 2 * 3 + 28 <= in_len; x += 16)
+	{
+		const uint8_t *p = in + x / 2 * 3;
+		__m256i v = load_lanes(p, p + 12);
+		__m256i msb = _mm256_slli_epi16(_mm256_shuffle_epi8(v, msb_idx), 4);
+		__m256i lsb = _mm256_mullo_epi16(_mm256_shuffle_epi8(v, lsb_idx), lsb_mul);
+
+		lsb = _mm256_and_si256(_mm256_srli_epi16(lsb, 4), mask);
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_or_si256(msb, lsb));
+	}
+	return x;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack10_8_avx2(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width)
+{
+	const __m256i idx = _mm256_setr_epi8(0, 1, 2, 3, 5, 6, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1,
+										 0, 1, 2, 3, 5, 6, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width && x / 4 * 5 + 46 <= in_len; x += 32)
+	{
+		const uint8_t *p = in + x / 4 * 5;
+		__m256i a = _mm256_shuffle_epi8(load_lanes(p, p + 10), idx);
+		__m256i b = _mm256_shuffle_epi8(load_lanes(p + 20, p + 30), idx);
+
+		// Quadwords are pixels 0-7, 16-23, 8-15, 24-31
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xd8));
+	}
+	return x;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack12_8_avx2(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width)
+{
+	const __m256i idx = _mm256_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, -1, -1, -1, -1, -1, -1, -1, -1,
+										 0, 1, 3, 4, 6, 7, 9, 10, -1, -1, -1, -1, -1, -1, -1, -1);
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width && x / 2 * 3 + 52 <= in_len; x += 32)
+	{
+		const uint8_t *p = in + x / 2 * 3;
+		__m256i a = _mm256_shuffle_epi8(load_lanes(p, p + 12), idx);
+		__m256i b = _mm256_shuffle_epi8(load_lanes(p + 24, p + 36), idx);
+
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xd8));
+	}
+	return x;
+}
+
+#endif  // RAW_UNPACK_HAVE_X86
+
+#ifdef RAW_UNPACK_HAVE_NEON
+
+// 8 pixels per step, gathered from two 8 byte loads with vtbl2 (ARMv7 and
+// AArch64); the low bits are moved into place with a per-lane shift
+
+static uint32_t unpack10_16_neon(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width)
+{
+	static const uint8_t msb_tbl[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+	static const uint8_t lsb_tbl[8] = { 4, 4, 4, 4, 9, 9, 9, 9 };
+	static const int16_t shifts[8] = { 0, -2, -4, -6, 0, -2, -4, -6 };
+	const uint8x8_t msb_idx = vld1_u8(msb_tbl), lsb_idx = vld1_u8(lsb_tbl);
+	const int16x8_t shift = vld1q_s16(shifts);
+	const uint16x8_t mask = vdupq_n_u16(3);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width && x / 4 * 5 + 16 <= in_len; x += 8)
+	{
+		const uint8_t *p = in + x / 4 * 5;
+		uint8x8x2_t v = { { vld1_u8(p), vld1_u8(p + 8) } };
+		uint16x8_t msb = vshll_n_u8(vtbl2_u8(v, msb_idx), 2);
+		uint16x8_t lsb = vandq_u16(vshlq_u16(vmovl_u8(vtbl2_u8(v, lsb_idx)), shift), mask);
+
+		vst1q_u16(out + x, vorrq_u16(msb, lsb));
+	}
+	return x;
+}
+
+static uint32_t unpack12_16_neon(const uint8_t *in, uint32_t in_len, uint16_t *out, uint32_t width)
+{
+	static const uint8_t msb_tbl[8] = { 0, 1, 3, 4, 6, 7, 9, 10 };
+	static const uint8_t lsb_tbl[8] = { 2, 2, 5, 5, 8, 8, 11, 11 };
+	static const int16_t shifts[8] = { 0, -4, 0, -4, 0, -4, 0, -4 };
+	const uint8x8_t msb_idx = vld1_u8(msb_tbl), lsb_idx = vld1_u8(lsb_tbl);
+	const int16x8_t shift = vld1q_s16(shifts);
+	const uint16x8_t mask = vdupq_n_u16(15);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width && x / 2 * 3 + 16 <= in_len; x += 8)
+	{
+		const uint8_t *p = in + x / 2 * 3;
+		uint8x8x2_t v = { { vld1_u8(p), vld1_u8(p + 8) } };
+		uint16x8_t msb = vshll_n_u8(vtbl2_u8(v, msb_idx), 4);
+		uint16x8_t lsb = vandq_u16(vshlq_u16(vmovl_u8(vtbl2_u8(v, lsb_idx)), shift), mask);
+
+		vst1q_u16(out + x, vorrq_u16(msb, lsb));
+	}
+	return x;
+}
+
+static uint32_t unpack10_8_neon(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width)
+{
+	static const uint8_t msb_tbl[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+	const uint8x8_t msb_idx = vld1_u8(msb_tbl);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width && x / 4 * 5 + 16 <= in_len; x += 8)
+	{
+		const uint8_t *p = in + x / 4 * 5;
+		uint8x8x2_t v = { { vld1_u8(p), vld1_u8(p + 8) } };
+
+		vst1_u8(out + x, vtbl2_u8(v, msb_idx));
+	}
+	return x;
+}
+
+static uint32_t unpack12_8_neon(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t width)
+{
+	static const uint8_t msb_tbl[8] = { 0, 1, 3, 4, 6, 7, 9, 10 };
+	const uint8x8_t msb_idx = vld1_u8(msb_tbl);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width && x / 2 * 3 + 16 <= in_len; x += 8)
+	{
+		const uint8_t *p = in + x / 2 * 3;
+		uint8x8x2_t v = { { vld1_u8(p), vld1_u8(p + 8) } };
+
+		vst1_u8(out + x, vtbl2_u8(v, msb_idx));
+	}
+	return x;
+}
+
+#endif  // RAW_UNPACK_HAVE_NEON
+
+// Indexed by enum raw_unpack_impl; NULL kernels are not built for this CPU
+static const struct raw_unpack_kernels kernels[RAW_UNPACK_NEON + 1] = {
+	[RAW_UNPACK_SCALAR] = { "scalar", { NULL, NULL }, { NULL, NULL } },
+#ifdef RAW_UNPACK_HAVE_X86
+	[RAW_UNPACK_SSSE3] = { "ssse3", { unpack10_16_ssse3, unpack12_16_ssse3 }, { unpack10_8_ssse3, unpack12_8_ssse3 } },
+	[RAW_UNPACK_AVX2] = { "avx2", { unpack10_16_avx2, unpack12_16_avx2 }, { unpack10_8_avx2, unpack12_8_avx2 } },
+#endif
+#ifdef RAW_UNPACK_HAVE_NEON
+	[RAW_UNPACK_NEON] = { "neon", { unpack10_16_neon, unpack12_16_neon }, { unpack10_8_neon, unpack12_8_neon } },
+#endif
+};
+
+/**
+ * Whether impl is built in and this CPU can run it.
+ */
+int raw_unpack_supported(enum raw_unpack_impl impl)
+{
+	if (impl == RAW_UNPACK_AUTO)
+		return 1;
+	if (impl < RAW_UNPACK_SCALAR || impl > RAW_UNPACK_NEON || !kernels[impl].name)
+		return 0;
+#ifdef RAW_UNPACK_HAVE_X86
+	if (impl == RAW_UNPACK_SSSE3)
+		return __builtin_cpu_supports("ssse3");
+	if (impl == RAW_UNPACK_AVX2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return 1;
+}
+
+static enum raw_unpack_impl raw_unpack_resolve(enum raw_unpack_impl impl)
+{
+	static const enum raw_unpack_impl order[] = { RAW_UNPACK_NEON, RAW_UNPACK_AVX2, RAW_UNPACK_SSSE3 };
+	size_t i;
+
+	if (impl != RAW_UNPACK_AUTO)
+		return impl;
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+	{
+		if (raw_unpack_supported(order[i]))
+			return order[i];
+	}
+	return RAW_UNPACK_SCALAR;
+}
+
+/**
+ * Name of impl, or of the kernels RAW_UNPACK_AUTO picks.
+ */
+const char *raw_unpack_name(enum raw_unpack_impl impl)
+{
+	impl = raw_unpack_resolve(impl);
+	return raw_unpack_supported(impl) ? kernels[impl].name : "unsupported";
+}
+
+/**
+ * Kernels for impl, after checking the frame layout.
+ *
+ * @return the kernels, NULL if impl or the frame cannot be handled
+ */
+static const struct raw_unpack_kernels *raw_unpack_prepare(const struct raw_image *src, enum raw_unpack_impl impl,
+														   uint32_t *stride)
+{
+	uint32_t min_stride;
+
+	impl = raw_unpack_resolve(impl);
+	if (!raw_unpack_supported(impl))
+	{
+		fprintf(stderr, "Unpack kernels %d not available on this CPU\n", impl);
+		return NULL;
+	}
+	if (src->bit_depth != 8 && src->bit_depth != 10 && src->bit_depth != 12)
+	{
+		fprintf(stderr, "Cannot unpack RAW%u\n", src->bit_depth);
+		return NULL;
+	}
+	// The scalar code reads the whole group of the last pixel
+	min_stride = src->bit_depth == 10 ? (src->width + 3) / 4 * 5 :
+				 src->bit_depth == 12 ? (src->width + 1) / 2 * 3 : src->width;
+	*stride = src->stride ? src->stride : raw_unpack_stride(src->width, src->bit_depth);
+	if (*stride < min_stride)
+	{
+		fprintf(stderr, "Line stride %u too small for %u RAW%u pixels\n", *stride, src->width, src->bit_depth);
+		return NULL;
+	}
+	return &kernels[impl];
+}
+
+static void unpack_line16(const struct raw_unpack_kernels *k, uint32_t bit_depth, const uint8_t *in, uint32_t in_len,
+						  uint16_t *out, uint32_t width)
+{
+	uint32_t x = 0;
+
+	if (bit_depth == 8)
+	{
+		for (; x < width; x++)
+			out[x] = in[x];
+		return;
+	}
+	if (k->to16[bit_depth == 12])
+		x = k->to16[bit_depth == 12](in, in_len, out, width);
+	if (bit_depth == 10)
+		unpack10_16_scalar(in, out, x, width);
+	else
+		unpack12_16_scalar(in, out, x, width);
+}
+
+/**
+ * Unpacks the frame to one 16 bit value per pixel, right aligned
+ * (0..1023 for RAW10, 0..4095 for RAW12).
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raw_unpack16(const struct raw_image *src, uint16_t *dst, uint32_t dst_stride, enum raw_unpack_impl impl)
+{
+	const struct raw_unpack_kernels *k;
+	uint32_t stride, y;
+
+	k = raw_unpack_prepare(src, impl, &stride);
+	if (!k)
+		return -1;
+	if (!dst_stride)
+		dst_stride = src->width;
+	for (y = 0; y < src->height; y++)
+		unpack_line16(k, src->bit_depth, src->data + (size_t)y * stride, stride, dst + (size_t)y * dst_stride,
+					  src->width);
+	return 0;
+}
+
+/**
+ * Unpacks the frame to 8 bits per pixel: through lut (1 << bit_depth
+ * entries, e.g. a gamma curve) if given, else the top 8 bits, which are
+ * the high bytes of the packed groups and need no arithmetic.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raw_unpack8(const struct raw_image *src, uint8_t *dst, uint32_t dst_stride, const uint8_t *lut,
+				enum raw_unpack_impl impl)
+{
+	const struct raw_unpack_kernels *k;
+	uint32_t stride, y;
+
+	k = raw_unpack_prepare(src, impl, &stride);
+	if (!k)
+		return -1;
+	if (!dst_stride)
+		dst_stride = src->width;
+	for (y = 0; y < src->height; y++)
+	{
+		const uint8_t *in = src->data + (size_t)y * stride;
+		uint8_t *out = dst + (size_t)y * dst_stride;
+		uint32_t x = 0;
+
+		if (lut)
+		{
+			uint16_t line[RAW_UNPACK_CHUNK];
+
+			// Chunks start on whole groups, so each is a line of its own
+			for (; x < src->width; x += RAW_UNPACK_CHUNK)
+			{
+				uint32_t offset = x * src->bit_depth / 8, n = src->width - x, i;
+
+				if (n > RAW_UNPACK_CHUNK)
+					n = RAW_UNPACK_CHUNK;
+				unpack_line16(k, src->bit_depth, in + offset, stride - offset, line, n);
+				for (i = 0; i < n; i++)
+					out[x + i] = lut[line[i]];
+			}
+		}
+		else if (src->bit_depth == 8)
+			memcpy(out, in, src->width);
+		else
+		{
+			if (k->to8[src->bit_depth == 12])
+				x = k->to8[src->bit_depth == 12](in, stride, out, src->width);
+			if (src->bit_depth == 10)
+				unpack10_8_scalar(in, out, x, src->width);
+			else
+				unpack12_8_scalar(in, out, x, src->width);
+		}
+	}
+	return 0;
+}
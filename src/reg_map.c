@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reg_map.h"
+
+static uint32_t reg_hash(const REG_MAP_T *map, uint16_t reg)
+{
+	return ((uint32_t)reg * 2654435761u >> 16) & map->index_mask;
+}
+
+static int is_pseudo(uint16_t reg)
+{
+	return reg == I2C_REGS_SET_ADDR || reg == I2C_REGS_SLEEP;
+}
+
+/**
+ * Rebuilds the index after the table was (re)allocated or had registers
+ * inserted. Keeps the index at most half full.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int reg_map_reindex(REG_MAP_T *map)
+{
+	uint32_t size = 64;
+	uint16_t addr = map->addr;
+	int i;
+
+	while (size < 2 * (uint32_t)map->capacity)
+		size <<= 1;
+	if (size != map->index_mask + 1 || !map->index)
+	{
+		free(map->index);
+		map->index = malloc(size * sizeof(map->index[0]));
+		if (!map->index)
+			return -1;
+		map->index_mask = size - 1;
+	}
+	memset(map->index, 0, size * sizeof(map->index[0]));
+
+	for (i = 0; i < map->num_regs; i++)
+	{
+		uint16_t reg = map->regs[i].reg;
+		uint32_t h;
+
+		if (reg == I2C_REGS_SET_ADDR)
+			addr = map->regs[i].data;
+		if (is_pseudo(reg) || addr != map->addr)
+			continue;
+		for (h = reg_hash(map, reg); map->index[h]; h = (h + 1) & map->index_mask)
+		{
+			if (map->regs[map->index[h] - 1].reg == reg)
+				break;
+		}
+		// First write wins, as with the old scans of the table
+		if (!map->index[h])
+			map->index[h] = i + 1;
+	}
+	return 0;
+}
+
+/**
+ * Copies a mode's register table into a new map. stream_reg is the
+ * register whose write ends the table and starts streaming (0 if none);
+ * added registers go in front of it.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int reg_map_init(REG_MAP_T *map, const struct sensor_regs *regs, int num_regs, uint16_t addr, uint16_t stream_reg)
+{
+	memset(map, 0, sizeof(*map));
+	map->capacity = num_regs + 16;
+	map->regs = malloc(map->capacity * sizeof(map->regs[0]));
+	if (!map->regs)
+		return -1;
+	memcpy(map->regs, regs, num_regs * sizeof(regs[0]));
+	map->num_regs = num_regs;
+	map->addr = addr;
+	map->insert_at = num_regs;
+	if (stream_reg && num_regs && regs[num_regs - 1].reg == stream_reg)
+		map->insert_at = num_regs - 1;
+	if (reg_map_reindex(map) < 0)
+	{
+		reg_map_destroy(map);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @return 0 on success, -1 on failure
+ */
+int reg_map_copy(REG_MAP_T *dst, const REG_MAP_T *src)
+{
+	if (reg_map_init(dst, src->regs, src->num_regs, src->addr, 0) < 0)
+		return -1;
+	dst->insert_at = src->insert_at;
+	dst->added = src->added;
+	return 0;
+}
+
+void reg_map_destroy(REG_MAP_T *map)
+{
+	free(map->regs);
+	free(map->index);
+	memset(map, 0, sizeof(*map));
+}
+
+/**
+ * @return slot of the register in map->regs, -1 if it is not in the map
+ */
+int reg_map_find(const REG_MAP_T *map, uint16_t reg)
+{
+	uint32_t h;
+
+	if (!map->index)
+		return -1;
+	for (h = reg_hash(map, reg); map->index[h]; h = (h + 1) & map->index_mask)
+	{
+		if (map->regs[map->index[h] - 1].reg == reg)
+			return map->index[h] - 1;
+	}
+	return -1;
+}
+
+/**
+ * @return 0 on success, -1 if the register is not in the map
+ */
+int reg_map_get(const REG_MAP_T *map, uint16_t reg, uint16_t *value)
+{
+	int slot = reg_map_find(map, reg);
+
+	if (slot < 0)
+		return -1;
+	*value = map->regs[slot].data;
+	return 0;
+}
+
+/**
+ * Inserts a register at insert_at, switching to the sensor's address and
+ * back around it if the table talks to another slave there.
+ *
+ * @return slot of the new register, -1 on failure
+ */
+static int reg_map_add(REG_MAP_T *map, uint16_t reg)
+{
+	struct sensor_regs ins[3];
+	uint16_t addr = map->addr;
+	int i, n = 0, slot;
+
+	for (i = 0; i < map->insert_at; i++)
+	{
+		if (map->regs[i].reg == I2C_REGS_SET_ADDR)
+			addr = map->regs[i].data;
+	}
+	if (addr != map->addr)
+		ins[n++] = (struct sensor_regs){ I2C_REGS_SET_ADDR, map->addr };
+	slot = map->insert_at + n;
+	ins[n++] = (struct sensor_regs){ reg, 0 };
+	if (addr != map->addr)
+		ins[n++] = (struct sensor_regs){ I2C_REGS_SET_ADDR, addr };
+
+	if (map->num_regs + n > map->capacity)
+	{
+		struct sensor_regs *regs = realloc(map->regs, (map->capacity * 2 + n) * sizeof(regs[0]));
+
+		if (!regs)
+			return -1;
+		map->regs = regs;
+		map->capacity = map->capacity * 2 + n;
+	}
+	memmove(&map->regs[map->insert_at + n], &map->regs[map->insert_at],
+			(map->num_regs - map->insert_at) * sizeof(map->regs[0]));
+	memcpy(&map->regs[map->insert_at], ins, n * sizeof(ins[0]));
+	map->num_regs += n;
+	map->insert_at += n;
+	map->added++;
+	if (reg_map_reindex(map) < 0)
+		return -1;
+	return slot;
+}
+
+/**
+ * Applies op to the bits of mask in one register: EQUAL copies them from
+ * value, SET and CLEAR set or clear them, XOR flips those set in value.
+ * Value is given in register bit positions. A register missing from the
+ * table is added, starting from 0.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int reg_map_update(REG_MAP_T *map, uint16_t reg, uint16_t mask, uint16_t value, enum operation op)
+{
+	int slot = reg_map_find(map, reg);
+	uint16_t *data;
+
+	if (is_pseudo(reg))
+		return -1;
+	if (slot < 0)
+	{
+		slot = reg_map_add(map, reg);
+		if (slot < 0)
+		{
+			fprintf(stderr, "Failed to add register %04X\n", reg);
+			return -1;
+		}
+		fprintf(stderr, "Reg %04X not in mode, added\n", reg);
+	}
+
+	data = &map->regs[slot].data;
+	switch (op)
+	{
+		case EQUAL:
+			*data = (*data & ~mask) | (value & mask);
+			break;
+		case SET:
+			*data |= mask;
+			break;
+		case CLEAR:
+			*data &= ~mask;
+			break;
+		case XOR:
+			*data ^= value & mask;
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Stores a num_bits wide value in the 8 bit registers from reg on, most
+ * significant byte first, the way the sensors split exposure, gain and
+ * VTS. Bits of the first register above the value are left alone.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int reg_map_set_value(REG_MAP_T *map, uint16_t reg, int num_bits, uint32_t value)
+{
+	int i, j = num_bits - 1;
+	int num_regs = (num_bits + 7) >> 3;
+
+	for (i = 0; i < num_regs; i++, j -= 8)
+	{
+		// Only the first register holds part of a byte
+		uint16_t mask = i == 0 ? REG_BITS(0, j & 0x7) : 0xFF;
+
+		if (reg_map_update(map, reg + i, mask, value >> (j & ~7), EQUAL) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * Reads back a value stored the way reg_map_set_value() does. Registers
+ * missing from the map read as 0.
+ *
+ * @return the value
+ */
+uint32_t reg_map_get_value(const REG_MAP_T *map, uint16_t reg, int num_bits)
+{
+	uint32_t value = 0;
+	int i;
+
+	for (i = 0; i < (num_bits + 7) >> 3; i++)
+	{
+		uint16_t v = 0;
+
+		reg_map_get(map, reg + i, &v);
+		value = value << 8 | (v & 0xFF);
+	}
+	return num_bits < 32 ? value & ((1u << num_bits) - 1) : value;
+}
+
+/**
+ * Collects the registers of to that differ from from, or are missing in
+ * it, in the order of to's table, so a mode change only writes those.
+ *
+ * @return number of changed registers; only the first max are stored
+ */
+int reg_map_diff(const REG_MAP_T *from, const REG_MAP_T *to, struct sensor_regs *out, int max)
+{
+	int i, n = 0;
+
+	for (i = 0; i < to->num_regs; i++)
+	{
+		const struct sensor_regs *r = &to->regs[i];
+		uint16_t old;
+
+		// Indexed registers only, in their first slot
+		if (reg_map_find(to, r->reg) != i)
+			continue;
+		if (reg_map_get(from, r->reg, &old) == 0 && old == r->data)
+			continue;
+		if (n < max)
+			out[n] = *r;
+		n++;
+	}
+	return n;
+}
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "shm_ring.h"
+
+#define SHM_RING_ALIGN_UP(x)	(((x) + SHM_RING_ALIGN - 1) & ~(uint64_t)(SHM_RING_ALIGN - 1))
+
+static void shm_ring_name(SHM_RING_T *r, const char *name)
+{
+	// shm_open() wants "/name"
+	snprintf(r->name, sizeof(r->name), "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+/**
+ * Creates (or replaces) the shared memory object and maps it.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int shm_ring_create(SHM_RING_T *r, const char *name, uint32_t num_slots, uint32_t slot_size,
+					uint32_t width, uint32_t height, uint32_t bit_depth)
+{
+	uint64_t data_offset, stride = SHM_RING_ALIGN_UP(slot_size);
+	uint32_t i;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	shm_ring_name(r, name);
+	if (!num_slots)
+		num_slots = SHM_RING_SLOTS;
+	data_offset = SHM_RING_ALIGN_UP(sizeof(struct shm_ring_header) + num_slots * sizeof(struct shm_ring_slot));
+	r->size = data_offset + num_slots * stride;
+
+	shm_unlink(r->name);
+	r->fd = shm_open(r->name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (r->fd < 0)
+	{
+		perror(r->name);
+		return -1;
+	}
+	r->owner = 1;
+	if (ftruncate(r->fd, r->size) < 0)
+	{
+		perror("ftruncate");
+		shm_ring_destroy(r);
+		return -1;
+	}
+	r->base = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (r->base == MAP_FAILED)
+	{
+		perror("mmap");
+		r->base = NULL;
+		shm_ring_destroy(r);
+		return -1;
+	}
+	// Fault the slots in now, not in the capture callback
+	memset(r->base, 0, r->size);
+
+	r->hdr = (struct shm_ring_header *)r->base;
+	r->slots = (struct shm_ring_slot *)(r->hdr + 1);
+	r->hdr->version = SHM_RING_VERSION;
+	r->hdr->num_slots = num_slots;
+	r->hdr->slot_size = slot_size;
+	r->hdr->width = width;
+	r->hdr->height = height;
+	r->hdr->bit_depth = bit_depth;
+	r->hdr->writer_pid = getpid();
+	r->hdr->size = r->size;
+	for (i = 0; i < num_slots; i++)
+		r->slots[i].offset = data_offset + i * stride;
+	// Readers only look at the rest once the magic is there
+	__atomic_store_n(&r->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+	fprintf(stderr, "Shared memory ring %s: %u slots of %u bytes\n", r->name, num_slots, slot_size);
+	return 0;
+}
+
+static void shm_ring_wake(SHM_RING_T *r)
+{
+	syscall(SYS_futex, &r->hdr->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Copies one frame into the next slot and wakes the waiting readers.
+ * Never blocks; the oldest frame is overwritten.
+ */
+void shm_ring_publish(SHM_RING_T *r, const struct frame_slot *frame)
+{
+	uint32_t n = r->hdr->head;
+	struct shm_ring_slot *slot = &r->slots[n % r->hdr->num_slots];
+	uint32_t length = frame->length < r->hdr->slot_size ? frame->length : r->hdr->slot_size;
+
+	__atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (frame->data)
+		memcpy(r->base + slot->offset, frame->data, length);
+	slot->index = frame->index;
+	slot->length = length;
+	slot->flags = frame->flags;
+	slot->pts = frame->pts;
+	slot->host_ns = frame->host_ns;
+	__atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->hdr->head, n + 1, __ATOMIC_RELEASE);
+	shm_ring_wake(r);
+}
+
+/**
+ * Unmaps the ring. The capture side also tells the readers it is gone and
+ * removes the name; readers still attached keep their mapping.
+ */
+void shm_ring_destroy(SHM_RING_T *r)
+{
+	if (r->base)
+	{
+		if (r->owner)
+		{
+			__atomic_store_n(&r->hdr->closed, 1, __ATOMIC_RELEASE);
+			shm_ring_wake(r);
+			fprintf(stderr, "Shared memory ring: %u frames published\n", r->hdr->head);
+		}
+		munmap(r->base, r->size);
+	}
+	if (r->fd >= 0)
+		close(r->fd);
+	if (r->owner)
+		shm_unlink(r->name);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+/**
+ * Maps an existing ring read-only.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int shm_ring_attach(SHM_RING_T *r, const char *name)
+{
+	const struct shm_ring_header *hdr;
+	struct stat st;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	shm_ring_name(r, name);
+	r->fd = shm_open(r->name, O_RDONLY, 0);
+	if (r->fd < 0 || fstat(r->fd, &st) < 0)
+	{
+		perror(r->name);
+		return -1;
+	}
+	r->size = st.st_size;
+	r->base = r->size >= sizeof(*hdr) ? mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0) : MAP_FAILED;
+	if (r->base == MAP_FAILED)
+	{
+		fprintf(stderr, "Cannot map %s\n", r->name);
+		r->base = NULL;
+		shm_ring_destroy(r);
+		return -1;
+	}
+	hdr = (const struct shm_ring_header *)r->base;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || hdr->version != SHM_RING_VERSION ||
+		hdr->size != r->size)
+	{
+		fprintf(stderr, "%s is not a frame ring of this version\n", r->name);
+		shm_ring_destroy(r);
+		return -1;
+	}
+	r->hdr = (struct shm_ring_header *)r->base;
+	r->slots = (struct shm_ring_slot *)(r->hdr + 1);
+	return 0;
+}
+
+/**
+ * Waits until more than seen frames have been published.
+ *
+ * @return the number published so far, 0 on timeout, -1 once the capture
+ *         side has gone away
+ */
+int shm_ring_wait(const SHM_RING_T *r, uint32_t seen, int timeout_ms)
+{
+	struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+	for (;;)
+	{
+		uint32_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+
+		if ((int32_t)(head - seen) > 0)
+			return head;
+		if (__atomic_load_n(&r->hdr->closed, __ATOMIC_ACQUIRE))
+			return -1;
+		// Returns at once if the head moved since it was read
+		if (syscall(SYS_futex, &r->hdr->head, FUTEX_WAIT, head, timeout_ms >= 0 ? &ts : NULL, NULL, 0) < 0 &&
+			errno == ETIMEDOUT)
+			return 0;
+	}
+}
+
+/**
+ * Frame n (counting from 0) in place, if its slot still holds it. The data
+ * may be overwritten while it is being used; shm_ring_valid() tells
+ * afterwards whether it was.
+ *
+ * @return the slot, NULL if frame n is not (or no longer) in the ring
+ */
+const struct shm_ring_slot *shm_ring_frame(const SHM_RING_T *r, uint32_t n, const uint8_t **data)
+{
+	const struct shm_ring_slot *slot = &r->slots[n % r->hdr->num_slots];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * n + 2)
+		return NULL;
+	*data = r->base + slot->offset;
+	return slot;
+}
+
+/**
+ * Whether the slot still held frame n up to now.
+ */
+int shm_ring_valid(const SHM_RING_T *r, const struct shm_ring_slot *slot, uint32_t n)
+{
+	(void)r;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == 2 * n + 2;
+}
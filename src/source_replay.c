@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "frame_source.h"
+#include "trace.h"
+
+// Same values as raw_header.h, which needs the VideoCore headers
+#define REPLAY_BRCM_SIG			0x4D435242	// 'BRCM'
+#define REPLAY_BRCM_HEADER_LEN	32768
+#define REPLAY_MAX_GAP			1000		// Missing indices tolerated without a -ts file
+
+struct replay_entry {
+	uint32_t index;
+	int64_t pts;
+};
+
+struct replay_source {
+	char *pattern;
+	struct replay_entry *entries;	// From the -ts file, NULL to scan for files
+	uint32_t num_entries;
+	uint8_t *buf;
+};
+
+/**
+ * Reads the "delta,index,pts" lines written by -ts (or ts2csv).
+ *
+ * @return number of entries, -1 on failure
+ */
+static int replay_load_csv(struct replay_source *r, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	uint32_t cap = 0;
+
+	if (!f)
+	{
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		const char *p = strchr(line, ',');
+		struct replay_entry e;
+		long long pts;
+
+		if (!p || sscanf(p + 1, "%u,%lld", &e.index, &pts) != 2)
+			continue;
+		e.pts = pts;
+		if (r->num_entries == cap)
+		{
+			struct replay_entry *n;
+
+			cap = cap ? cap * 2 : 1024;
+			n = realloc(r->entries, cap * sizeof(*n));
+			if (!n)
+			{
+				fclose(f);
+				return -1;
+			}
+			r->entries = n;
+		}
+		r->entries[r->num_entries++] = e;
+	}
+	fclose(f);
+	return r->num_entries;
+}
+
+/**
+ * Loads frame index into r->buf, skipping a per-frame BRCM header.
+ *
+ * @return payload bytes, -1 if the file does not exist or cannot be read
+ */
+static ssize_t replay_read(FRAME_SOURCE_T *s, uint32_t index, const uint8_t **data)
+{
+	struct replay_source *r = (struct replay_source *)s->priv;
+	char name[4096];
+	ssize_t len = 0, n;
+	int fd;
+
+	snprintf(name, sizeof(name), r->pattern, index);
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	while ((size_t)len < s->buffer_size && (n = read(fd, r->buf + len, s->buffer_size - len)) > 0)
+		len += n;
+	close(fd);
+
+	*data = r->buf;
+	if (len > REPLAY_BRCM_HEADER_LEN && *(const uint32_t *)r->buf == REPLAY_BRCM_SIG)
+	{
+		*data += REPLAY_BRCM_HEADER_LEN;
+		len -= REPLAY_BRCM_HEADER_LEN;
+	}
+	return len;
+}
+
+static void *replay_thread(void *args)
+{
+	FRAME_SOURCE_T *s = (FRAME_SOURCE_T *)args;
+	struct replay_source *r = (struct replay_source *)s->priv;
+	struct frame_slot frame = { 0 };
+	uint64_t start_ns = frame_clock_ns();
+	int64_t first_pts = r->entries ? r->entries[0].pts : 0;
+	uint32_t i, gap = 0;
+
+	TRACE_THREAD("frame source");
+	for (i = 0; s->running; i++)
+	{
+		uint32_t index;
+		const uint8_t *data;
+		ssize_t len;
+
+		if (r->entries && i >= r->num_entries)
+			break;
+		index = r->entries ? r->entries[i].index : i;
+		len = replay_read(s, index, &data);
+		if (len < 0)
+		{
+			// Without a -ts file, run until REPLAY_MAX_GAP files in a row are missing
+			if (!r->entries && ++gap < REPLAY_MAX_GAP)
+				continue;
+			if (!r->entries)
+				break;
+			fprintf(stderr, "replay source: frame %u missing, skipped\n", index);
+			continue;
+		}
+		gap = 0;
+
+		if (r->entries)
+		{
+			// Keep the recorded spacing relative to the first frame
+			uint64_t t = start_ns + (uint64_t)(r->entries[i].pts - first_pts) * 1000;
+			struct timespec next = { t / 1000000000ull, t % 1000000000ull };
+
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0 && s->running)
+				;
+			frame.pts = r->entries[i].pts;
+		}
+		else
+			frame.pts = frame_clock_ns() / 1000;
+
+		frame.index = index;
+		frame.length = len;
+		frame.flags = 0;
+		frame.data = (uint8_t *)data;
+		frame.host_ns = frame_clock_ns();
+		s->deliver(s->ctx, &frame);
+		s->delivered++;
+	}
+	s->finished = 1;
+	return NULL;
+}
+
+static int replay_start(FRAME_SOURCE_T *s)
+{
+	return pthread_create(&s->thread, NULL, replay_thread, s) == 0 ? 0 : -1;
+}
+
+static void replay_stop(FRAME_SOURCE_T *s)
+{
+	pthread_join(s->thread, NULL);
+}
+
+static void replay_close(FRAME_SOURCE_T *s)
+{
+	struct replay_source *r = (struct replay_source *)s->priv;
+
+	if (r)
+	{
+		free(r->pattern);
+		free(r->entries);
+		free(r->buf);
+		free(r);
+	}
+}
+
+/**
+ * "<pattern>[:<tstamps.csv>]". With a -ts file the frames listed in it are
+ * replayed with their recorded pts and spacing; without one all files
+ * found are delivered as fast as the consumer takes them.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int replay_source_open(FRAME_SOURCE_T *s, const char *args)
+{
+	struct replay_source *r = calloc(1, sizeof(*r));
+	const char *csv = strchr(args, ':');
+	uint32_t i, first = 0;
+	char name[4096];
+	struct stat st;
+
+	if (!r)
+		return -1;
+	r->pattern = csv ? strndup(args, csv - args) : strdup(args);
+	if (!r->pattern || (csv && replay_load_csv(r, csv + 1) <= 0))
+		goto fail;
+
+	// The first frame found sizes the buffer
+	for (i = 0; i < (r->entries ? r->num_entries : REPLAY_MAX_GAP); i++)
+	{
+		first = r->entries ? r->entries[i].index : i;
+		snprintf(name, sizeof(name), r->pattern, first);
+		if (stat(name, &st) == 0)
+			break;
+	}
+	if (i == (r->entries ? r->num_entries : REPLAY_MAX_GAP))
+	{
+		fprintf(stderr, "replay source: no frames matching %s\n", r->pattern);
+		goto fail;
+	}
+	// Frames are expected to be no larger than the first one
+	s->buffer_size = st.st_size;
+	r->buf = malloc(s->buffer_size);
+	if (!r->buf)
+		goto fail;
+
+	s->name = "replay";
+	if (r->entries && r->num_entries > 1 && r->entries[r->num_entries - 1].pts > r->entries[0].pts)
+		s->fps = (r->num_entries - 1) * 1e6 / (r->entries[r->num_entries - 1].pts - r->entries[0].pts);
+	s->start = replay_start;
+	s->stop = replay_stop;
+	s->close = replay_close;
+	s->priv = r;
+	return 0;
+
+fail:
+	s->priv = r;
+	replay_close(s);
+	s->priv = NULL;
+	return -1;
+}
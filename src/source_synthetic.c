@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_source.h"
+#include "trace.h"
+
+#define SYNTHETIC_FRAMES	8		// Distinct frames generated up front
+
+struct synthetic_source {
+	uint8_t *frames;
+	uint32_t frame_size;
+};
+
+/**
+ * Value of the test pattern at (x, y) in frame n: a diagonal ramp per
+ * Bayer channel (RGGB) that moves by a few pixels every frame.
+ */
+static uint32_t synthetic_pixel(uint32_t x, uint32_t y, uint32_t n, uint32_t bit_depth)
+{
+	uint32_t max = (1u << bit_depth) - 1;
+	uint32_t channel = (y & 1) * 2 + (x & 1);
+	uint32_t v = (x + y + n * 4) * (channel + 1);
+
+	return v % (max + 1);
+}
+
+/**
+ * Packs one line of pixel values the way the CSI-2 receiver stores them.
+ */
+static void synthetic_pack_line(uint8_t *out, const uint16_t *px, uint32_t width, uint32_t bit_depth)
+{
+	uint32_t x;
+
+	if (bit_depth == 8)
+	{
+		for (x = 0; x < width; x++)
+			*out++ = px[x];
+	}
+	else if (bit_depth == 10)
+	{
+		for (x = 0; x + 3 < width; x += 4)
+		{
+			out[0] = px[x] >> 2;
+			out[1] = px[x + 1] >> 2;
+			out[2] = px[x + 2] >> 2;
+			out[3] = px[x + 3] >> 2;
+			out[4] = (px[x] & 3) | (px[x + 1] & 3) << 2 | (px[x + 2] & 3) << 4 | (px[x + 3] & 3) << 6;
+			out += 5;
+		}
+	}
+	else
+	{
+		for (x = 0; x + 1 < width; x += 2)
+		{
+			out[0] = px[x] >> 4;
+			out[1] = px[x + 1] >> 4;
+			out[2] = (px[x] & 15) | (px[x + 1] & 15) << 4;
+			out += 3;
+		}
+	}
+}
+
+static void *synthetic_thread(void *args)
+{
+	FRAME_SOURCE_T *s = (FRAME_SOURCE_T *)args;
+	struct synthetic_source *syn = (struct synthetic_source *)s->priv;
+	struct frame_slot frame = { 0 };
+	struct timespec next;
+	uint64_t period_ns = s->fps > 0 ? (uint64_t)(1e9 / s->fps) : 0;
+	uint32_t n;
+
+	TRACE_THREAD("frame source");
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (n = 0; s->running; n++)
+	{
+		if (period_ns)
+		{
+			// Absolute deadlines, so a late frame does not shift the ones after it
+			uint64_t t = (uint64_t)next.tv_sec * 1000000000ull + next.tv_nsec + period_ns;
+
+			next.tv_sec = t / 1000000000ull;
+			next.tv_nsec = t % 1000000000ull;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0 && s->running)
+				;
+			frame.pts = t / 1000;
+		}
+		else
+			frame.pts = frame_clock_ns() / 1000;
+
+		frame.index = n;
+		frame.length = syn->frame_size;
+		frame.flags = 0;
+		frame.data = syn->frames + (size_t)(n % SYNTHETIC_FRAMES) * syn->frame_size;
+		frame.host_ns = frame_clock_ns();
+		s->deliver(s->ctx, &frame);
+		s->delivered++;
+	}
+	return NULL;
+}
+
+static int synthetic_start(FRAME_SOURCE_T *s)
+{
+	return pthread_create(&s->thread, NULL, synthetic_thread, s) == 0 ? 0 : -1;
+}
+
+static void synthetic_stop(FRAME_SOURCE_T *s)
+{
+	pthread_join(s->thread, NULL);
+}
+
+static void synthetic_close(FRAME_SOURCE_T *s)
+{
+	struct synthetic_source *syn = (struct synthetic_source *)s->priv;
+
+	if (syn)
+	{
+		free(syn->frames);
+		free(syn);
+	}
+}
+
+/**
+ * "<w>x<h>[:<bits>[:<fps>]]", 10 bit at 30 fps by default; fps 0 delivers
+ * frames as fast as the consumer takes them.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int synthetic_source_open(FRAME_SOURCE_T *s, const char *args)
+{
+	struct synthetic_source *syn;
+	uint32_t width, height, bits = 10, stride, y, n;
+	double fps = 30;
+	uint16_t *line;
+
+	if (sscanf(args, "%ux%u:%u:%lf", &width, &height, &bits, &fps) < 2 ||
+		!width || !height || (bits != 8 && bits != 10 && bits != 12) || fps < 0)
+	{
+		fprintf(stderr, "synthetic source: expected <w>x<h>[:8|10|12[:<fps>]], got %s\n", args);
+		return -1;
+	}
+
+	stride = frame_source_stride(width, bits);
+	syn = calloc(1, sizeof(*syn));
+	line = calloc(width + 4, sizeof(*line));
+	if (!syn || !line)
+		goto fail;
+	// Rows are padded to 16 like the rawcam buffers
+	syn->frame_size = stride * ((height + 15) & ~15u);
+	syn->frames = calloc(SYNTHETIC_FRAMES, syn->frame_size);
+	if (!syn->frames)
+		goto fail;
+
+	for (n = 0; n < SYNTHETIC_FRAMES; n++)
+	{
+		for (y = 0; y < height; y++)
+		{
+			uint32_t x;
+
+			for (x = 0; x < width; x++)
+				line[x] = synthetic_pixel(x, y, n, bits);
+			synthetic_pack_line(syn->frames + (size_t)n * syn->frame_size + (size_t)y * stride, line, width, bits);
+		}
+	}
+	free(line);
+
+	s->name = "synthetic";
+	s->width = width;
+	s->height = height;
+	s->bit_depth = bits;
+	s->fps = fps;
+	s->buffer_size = syn->frame_size;
+	s->start = synthetic_start;
+	s->stop = synthetic_stop;
+	s->close = synthetic_close;
+	s->priv = syn;
+	return 0;
+
+fail:
+	free(line);
+	if (syn)
+		free(syn->frames);
+	free(syn);
+	return -1;
+}
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "stream_sink.h"
+
+static int stream_stdout = -1;
+
+/**
+ * Whether -o names a stream rather than a file pattern: "-" for stdout or
+ * an existing FIFO.
+ */
+int stream_sink_is_stream(const char *path)
+{
+	struct stat st;
+
+	return !strcmp(path, "-") || (stat(path, &st) == 0 && S_ISFIFO(st.st_mode));
+}
+
+/**
+ * Takes stdout for the stream; anything printed to stdout from then on
+ * goes to stderr. Call before the first printf() when streaming to stdout.
+ *
+ * @return the descriptor of the original stdout, -1 on failure
+ */
+int stream_sink_take_stdout(void)
+{
+	if (stream_stdout < 0)
+	{
+		fflush(stdout);
+		stream_stdout = dup(STDOUT_FILENO);
+		if (stream_stdout >= 0)
+			dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+	return stream_stdout;
+}
+
+static int stream_write_all(int fd, const uint8_t *p, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Opens the stream (a FIFO waits for its reader here), writes the prefix,
+ * if any, and switches to non-blocking writes.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int stream_sink_open(STREAM_SINK_T *s, const char *path, size_t max_frame, int frame_headers,
+					 const void *prefix, size_t prefix_len)
+{
+	memset(s, 0, sizeof(*s));
+	s->frame_headers = frame_headers;
+	if (!strcmp(path, "-"))
+		s->fd = stream_sink_take_stdout();
+	else
+	{
+		fprintf(stderr, "Waiting for a reader on %s\n", path);
+		s->fd = open(path, O_WRONLY | O_CLOEXEC);
+	}
+	if (s->fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	// A reader going away shows up as EPIPE, not as a signal
+	signal(SIGPIPE, SIG_IGN);
+	fcntl(s->fd, F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+
+	s->size = STREAM_STAGING_FRAMES * (max_frame + sizeof(struct stream_frame_header));
+	s->buf = malloc(s->size);
+	if (!s->buf)
+	{
+		close(s->fd);
+		return -1;
+	}
+	// Fault the staging buffer in before the capture needs it
+	memset(s->buf, 0, s->size);
+
+	if (prefix_len && stream_write_all(s->fd, prefix, prefix_len) < 0)
+	{
+		perror(path);
+		stream_sink_close(s);
+		return -1;
+	}
+	s->bytes = prefix_len;
+	fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+/**
+ * Copies the frame (header and data, less the first skip bytes) behind
+ * what is staged already.
+ *
+ * @return 0 on success, -1 if it does not fit
+ */
+static int stream_stage(STREAM_SINK_T *s, const struct iovec *iov, int iovcnt, size_t skip)
+{
+	size_t need = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		need += iov[i].iov_len;
+	need -= skip;
+	if (need > s->size - (s->tail - s->head))
+		return -1;
+	if (need > s->size - s->tail)
+	{
+		memmove(s->buf, s->buf + s->head, s->tail - s->head);
+		s->tail -= s->head;
+		s->head = 0;
+	}
+	for (i = 0; i < iovcnt; i++)
+	{
+		size_t len = iov[i].iov_len;
+
+		if (skip >= len)
+		{
+			skip -= len;
+			continue;
+		}
+		memcpy(s->buf + s->tail, (const uint8_t *)iov[i].iov_base + skip, len - skip);
+		s->tail += len - skip;
+		skip = 0;
+	}
+	return 0;
+}
+
+/**
+ * Sends one frame, together with whatever is still staged, in a single
+ * writev(). Never blocks.
+ *
+ * @return 0 if the frame was sent or staged, -1 if it was dropped
+ */
+int stream_sink_write(STREAM_SINK_T *s, uint32_t index, int64_t pts, uint32_t flags, const void *data, uint32_t length)
+{
+	struct stream_frame_header hdr = { STREAM_MAGIC, index, data ? length : 0, flags, pts };
+	struct iovec iov[3];
+	size_t staged = s->tail - s->head, frame_len = 0;
+	ssize_t n;
+	int iovcnt = 0, i;
+
+	if (s->closed)
+	{
+		s->dropped++;
+		return -1;
+	}
+	if (staged)
+	{
+		iov[iovcnt].iov_base = s->buf + s->head;
+		iov[iovcnt++].iov_len = staged;
+	}
+	if (s->frame_headers)
+	{
+		iov[iovcnt].iov_base = &hdr;
+		iov[iovcnt++].iov_len = sizeof(hdr);
+	}
+	if (hdr.length)
+	{
+		iov[iovcnt].iov_base = (void *)data;
+		iov[iovcnt++].iov_len = hdr.length;
+	}
+	for (i = staged ? 1 : 0; i < iovcnt; i++)
+		frame_len += iov[i].iov_len;
+
+	do
+		n = writev(s->fd, iov, iovcnt);
+	while (n < 0 && errno == EINTR);
+	s->writes++;
+	if (n < 0)
+	{
+		if (errno != EAGAIN)
+		{
+			if (errno == EPIPE)
+				fprintf(stderr, "Stream reader went away\n");
+			else
+				perror("stream");
+			s->closed = 1;
+			s->dropped++;
+			return -1;
+		}
+		n = 0;
+	}
+	s->bytes += n;
+
+	if ((size_t)n >= staged)
+	{
+		// Staged bytes are out, the frame may not be
+		s->head = s->tail = 0;
+		if ((size_t)n < staged + frame_len)
+		{
+			stream_stage(s, &iov[staged ? 1 : 0], iovcnt - (staged ? 1 : 0), n - staged);
+			s->staged++;
+		}
+	}
+	else
+	{
+		s->head += n;
+		if (stream_stage(s, &iov[1], iovcnt - 1, 0) < 0)
+		{
+			s->dropped++;
+			return -1;
+		}
+		s->staged++;
+	}
+	s->frames++;
+	return 0;
+}
+
+/**
+ * Sends what is still staged, waiting for the reader up to
+ * STREAM_CLOSE_TIMEOUT_MS at a time, and closes the stream.
+ */
+void stream_sink_close(STREAM_SINK_T *s)
+{
+	while (!s->closed && s->tail > s->head)
+	{
+		struct pollfd pfd = { s->fd, POLLOUT, 0 };
+		ssize_t n;
+
+		if (poll(&pfd, 1, STREAM_CLOSE_TIMEOUT_MS) <= 0)
+			break;
+		n = write(s->fd, s->buf + s->head, s->tail - s->head);
+		if (n < 0 && errno != EAGAIN && errno != EINTR)
+			break;
+		if (n > 0)
+		{
+			s->head += n;
+			s->bytes += n;
+		}
+	}
+	if (s->tail > s->head)
+		fprintf(stderr, "Stream: %zu bytes never reached the reader\n", s->tail - s->head);
+	fprintf(stderr, "Stream: %u frames, %.1f MB in %u writes, %u staged, %u dropped\n", s->frames, s->bytes / 1e6,
+			s->writes, s->staged, s->dropped);
+	if (s->fd >= 0)
+		close(s->fd);
+	if (s->fd == stream_stdout)
+		stream_stdout = -1;
+	free(s->buf);
+	s->buf = NULL;
+	s->fd = -1;
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+typedef struct trace {
+	char *path;
+	uint32_t capacity;				// Events per thread
+	uint32_t num_buffers;
+	uint32_t claimed;				// Buffers handed out to threads
+	uint32_t unclaimed;				// Events of threads beyond num_buffers
+	uint64_t start_ns;
+	struct trace_buffer *buffers;
+} TRACE_T;
+
+volatile int trace_enabled = 0;
+
+static TRACE_T trace;
+static __thread struct trace_buffer *trace_local;
+
+/**
+ * Hands the calling thread the next free buffer, named name or, without
+ * one, after the thread.
+ *
+ * @return the buffer, NULL if all are taken
+ */
+static struct trace_buffer *trace_claim(const char *name)
+{
+	uint32_t i = __atomic_fetch_add(&trace.claimed, 1, __ATOMIC_RELAXED);
+	struct trace_buffer *b;
+
+	if (i >= trace.num_buffers)
+		return NULL;
+	b = &trace.buffers[i];
+	if (name)
+		snprintf(b->name, sizeof(b->name), "%s", name);
+	else if (pthread_getname_np(pthread_self(), b->name, sizeof(b->name)) != 0)
+		snprintf(b->name, sizeof(b->name), "thread %u", i);
+	b->tid = syscall(SYS_gettid);
+	trace_local = b;
+	return b;
+}
+
+/**
+ * Gives the calling thread a buffer under name, so its events show up
+ * under that name instead of the thread's own.
+ */
+void trace_thread(const char *name)
+{
+	if (trace_enabled && !trace_local)
+		trace_claim(name);
+}
+
+/**
+ * Records an event of the calling thread from start_ns until now. Called
+ * through TRACE_END().
+ */
+void trace_record(const char *name, uint64_t start_ns, uint32_t arg)
+{
+	struct trace_buffer *b = trace_local;
+	struct trace_event *e;
+
+	if (!trace_enabled)
+		return;
+	if (!b && !(b = trace_claim(NULL)))
+	{
+		__atomic_fetch_add(&trace.unclaimed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (b->count >= trace.capacity)
+	{
+		b->lost++;
+		return;
+	}
+	e = &b->events[b->count];
+	e->name = name;
+	e->start_ns = start_ns;
+	e->dur_ns = frame_clock_ns() - start_ns;
+	e->arg = arg;
+	// The event is complete before trace_stop() can count it
+	__atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Allocates buffers for threads threads and starts recording.
+ * spec is <file>[:<events per thread>].
+ *
+ * @return 0 on success, -1 on failure
+ */
+int trace_start(const char *spec, uint32_t threads)
+{
+#if RASPIRAW_TRACE
+	const char *colon = strrchr(spec, ':');
+	uint32_t i;
+
+	memset(&trace, 0, sizeof(trace));
+	trace.capacity = TRACE_DEFAULT_EVENTS;
+	if (colon && colon[1] && !strchr(colon, '/'))
+	{
+		char *end;
+
+		trace.capacity = strtoul(colon + 1, &end, 10);
+		if (*end || !trace.capacity)
+		{
+			fprintf(stderr, "Invalid trace event count %s\n", colon + 1);
+			return -1;
+		}
+		trace.path = strndup(spec, colon - spec);
+	}
+	else
+		trace.path = strdup(spec);
+	trace.num_buffers = threads;
+	trace.buffers = calloc(threads, sizeof(*trace.buffers));
+	if (!trace.path || !trace.buffers)
+		goto fail;
+	for (i = 0; i < threads; i++)
+	{
+		// Touched now, so recording never faults a page in
+		trace.buffers[i].events = malloc((size_t)trace.capacity * sizeof(struct trace_event));
+		if (!trace.buffers[i].events)
+			goto fail;
+		memset(trace.buffers[i].events, 0, (size_t)trace.capacity * sizeof(struct trace_event));
+	}
+	trace.start_ns = frame_clock_ns();
+	trace_enabled = 1;
+	fprintf(stderr, "Trace: %u threads of %u events to %s\n", threads, trace.capacity, trace.path);
+	return 0;
+
+fail:
+	perror("trace");
+	for (i = 0; trace.buffers && i < threads; i++)
+		free(trace.buffers[i].events);
+	free(trace.buffers);
+	free(trace.path);
+	memset(&trace, 0, sizeof(trace));
+	return -1;
+#else
+	(void)spec;
+	(void)threads;
+	fprintf(stderr, "-trace needs a build with RASPIRAW_TRACE (cmake -DRASPIRAW_TRACE=ON)\n");
+	return -1;
+#endif
+}
+
+/**
+ * Stops recording and writes the events as Chrome trace JSON, in
+ * microseconds since trace_start(). Call once the traced threads are done.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int trace_stop(void)
+{
+	uint32_t i, j, n, events = 0, lost, threads;
+	int pid = getpid(), ret = 0;
+	FILE *f;
+
+	if (!trace_enabled)
+		return 0;
+	trace_enabled = 0;
+
+	f = fopen(trace.path, "w");
+	if (!f)
+	{
+		perror(trace.path);
+		ret = -1;
+	}
+	threads = trace.claimed < trace.num_buffers ? trace.claimed : trace.num_buffers;
+	lost = trace.unclaimed;
+	for (i = 0; f && i < threads; i++)
+	{
+		struct trace_buffer *b = &trace.buffers[i];
+		char *c;
+
+		for (c = b->name; *c; c++)
+		{
+			if (*c == '"' || *c == '\\' || (unsigned char)*c < ' ')
+				*c = '_';
+		}
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				i ? ",\n" : "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", pid, b->tid, b->name);
+		n = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE);
+		for (j = 0; j < n; j++)
+		{
+			const struct trace_event *e = &b->events[j];
+
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"n\":%u}}",
+					e->name, (e->start_ns - trace.start_ns) / 1e3, e->dur_ns / 1e3, pid, b->tid, e->arg);
+		}
+		events += n;
+		lost += b->lost;
+	}
+	if (f)
+	{
+		fprintf(f, "%s]}\n", threads ? "\n" : "{\"traceEvents\":[");
+		if (fclose(f) != 0)
+		{
+			perror(trace.path);
+			ret = -1;
+		}
+		fprintf(stderr, "Trace: %u events of %u threads in %s, %u lost\n", events, threads, trace.path, lost);
+	}
+
+	for (i = 0; i < trace.num_buffers; i++)
+		free(trace.buffers[i].events);
+	free(trace.buffers);
+	free(trace.path);
+	memset(&trace, 0, sizeof(trace));
+	return ret;
+}
@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracker.h"
+
+#define TRACKER_NONE	UINT32_MAX
+
+/**
+ * Parses "<level>[:<step>[:<min area>]]": the 8 bit grey level a marker
+ * reaches, the cells between samples of the decimated plane (default 1)
+ * and the smallest blob in cells (default 2).
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tracker_parse(const char *spec, uint32_t *level, uint32_t *step, uint32_t *min_area)
+{
+	char *end;
+	long v = strtol(spec, &end, 10);
+
+	if (end == spec || v < 1 || v > 255)
+		return -1;
+	*level = v;
+	*step = 1;
+	*min_area = 2;
+	if (*end == ':')
+	{
+		v = strtol(end + 1, &end, 10);
+		if (v < 1 || v > 64)
+			return -1;
+		*step = v;
+	}
+	if (*end == ':')
+	{
+		v = strtol(end + 1, &end, 10);
+		if (v < 1)
+			return -1;
+		*min_area = v;
+	}
+	return *end ? -1 : 0;
+}
+
+/**
+ * Allocates the plane and labelling buffers for frames of width x height
+ * pixels with lines of stride bytes (0 = the rawcam layout).
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tracker_init(TRACKER_T *t, uint32_t width, uint32_t height, uint32_t stride, uint32_t bit_depth,
+				 uint32_t level, uint32_t step, uint32_t min_area)
+{
+	memset(t, 0, sizeof(*t));
+	if ((bit_depth != 8 && bit_depth != 10 && bit_depth != 12) || !step || width < 2 * step || height < 2 * step)
+	{
+		fprintf(stderr, "Tracker: cannot analyse %ux%u RAW%u frames\n", width, height, bit_depth);
+		return -1;
+	}
+	t->level = level;
+	t->step = step;
+	t->min_area = min_area;
+	t->image.width = width;
+	t->image.height = height;
+	t->image.stride = stride ? stride : raw_unpack_stride(width, bit_depth);
+	t->image.bit_depth = bit_depth;
+
+	// Cells whose 2x2 pixels are all inside the frame
+	t->cols = (width - 2) / (2 * step) + 1;
+	t->rows = (height - 2) / (2 * step) + 1;
+
+	t->lines = malloc((size_t)width * 2);
+	t->cells = malloc(t->cols * sizeof(*t->cells));
+	t->runs[0] = malloc((t->cols / 2 + 1) * sizeof(*t->runs[0]));
+	t->runs[1] = malloc((t->cols / 2 + 1) * sizeof(*t->runs[1]));
+	t->labels = malloc(TRACKER_MAX_LABELS * sizeof(*t->labels));
+	if (!t->lines || !t->cells || !t->runs[0] || !t->runs[1] || !t->labels)
+	{
+		fprintf(stderr, "Tracker: out of memory\n");
+		tracker_destroy(t);
+		return -1;
+	}
+	return 0;
+}
+
+void tracker_destroy(TRACKER_T *t)
+{
+	free(t->lines);
+	free(t->cells);
+	free(t->runs[0]);
+	free(t->runs[1]);
+	free(t->labels);
+	memset(t, 0, sizeof(*t));
+}
+
+static uint32_t tracker_root(struct tracker_label *labels, uint32_t l)
+{
+	uint32_t root = l;
+
+	while (labels[root].parent != root)
+		root = labels[root].parent;
+	// Path compression
+	while (labels[l].parent != root)
+	{
+		uint32_t next = labels[l].parent;
+
+		labels[l].parent = root;
+		l = next;
+	}
+	return root;
+}
+
+/**
+ * Labels the bright runs of one plane row, joining them to the runs of the
+ * previous row they touch (8-connectivity).
+ *
+ * @return number of runs, -1 if the labels ran out
+ */
+static int tracker_row(TRACKER_T *t, uint32_t v, const struct tracker_run *prev, int num_prev,
+					   struct tracker_run *cur, uint32_t *num_labels)
+{
+	struct tracker_label *labels = t->labels;
+	uint32_t thr = 4 * t->level, u, x;
+	int num_cur = 0, j = 0, k;
+
+	for (u = 0; u < t->cols; u++)
+	{
+		uint32_t start, label = TRACKER_NONE;
+		struct tracker_label *l;
+
+		if (t->cells[u] < thr)
+			continue;
+		start = u;
+		while (u + 1 < t->cols && t->cells[u + 1] >= thr)
+			u++;
+
+		// Runs of the previous row overlapping [start - 1, u + 1]
+		while (j < num_prev && prev[j].end + 1 < start)
+			j++;
+		for (k = j; k < num_prev && prev[k].start <= u + 1; k++)
+		{
+			uint32_t root = tracker_root(labels, prev[k].label);
+
+			if (label == TRACKER_NONE)
+				label = root;
+			else if (root < label)
+			{
+				labels[label].parent = root;
+				label = root;
+			}
+			else if (root > label)
+				labels[root].parent = label;
+		}
+		if (label == TRACKER_NONE)
+		{
+			if (*num_labels == TRACKER_MAX_LABELS)
+				return -1;
+			label = (*num_labels)++;
+			memset(&labels[label], 0, sizeof(labels[label]));
+			labels[label].parent = label;
+		}
+
+		l = &labels[label];
+		for (x = start; x <= u; x++)
+		{
+			uint32_t w = t->cells[x] - thr + 1;
+
+			l->area++;
+			l->weight += w;
+			l->sum_x += (uint64_t)w * x;
+			l->sum_y += (uint64_t)w * v;
+			if (t->cells[x] > l->peak)
+				l->peak = t->cells[x];
+		}
+		cur[num_cur].start = start;
+		cur[num_cur].end = u;
+		cur[num_cur].label = label;
+		num_cur++;
+	}
+	return num_cur;
+}
+
+/**
+ * Finds the markers of one frame. index and pts of rec are left to the
+ * caller.
+ *
+ * @return 0 on success, -1 if the frame could not be unpacked
+ */
+int tracker_find(TRACKER_T *t, const uint8_t *data, uint32_t length, struct tracker_record *rec)
+{
+	struct raw_image img = t->image;
+	struct tracker_label *labels = t->labels, *best[TRACKER_MAX_BLOBS];
+	uint32_t row_bytes = 2 * t->step * img.stride, rows = t->rows, num_labels = 0, u, v, l;
+	uint32_t scale = 2 * t->step;
+	int num_prev = 0, num_best = 0, i;
+
+	img.height = 2;
+	rec->count = 0;
+	rec->angle = NAN;
+	rec->flags = 0;
+	memset(rec->blob, 0, sizeof(rec->blob));
+
+	// Plane rows whose two sensor lines are all there
+	if (length < (uint64_t)(rows - 1) * row_bytes + 2 * img.stride)
+	{
+		rows = length >= 2 * img.stride ? (length - 2 * img.stride) / row_bytes + 1 : 0;
+		rec->flags |= TRACKER_FLAG_SHORT;
+	}
+
+	for (v = 0; v < rows; v++)
+	{
+		const uint8_t *a = t->lines, *b = t->lines + img.width;
+		int num_cur;
+
+		img.data = data + (size_t)v * row_bytes;
+		if (raw_unpack8(&img, t->lines, img.width, NULL, RAW_UNPACK_AUTO) < 0)
+			return -1;
+		for (u = 0; u < t->cols; u++)
+		{
+			uint32_t x = u * scale;
+
+			t->cells[u] = a[x] + a[x + 1] + b[x] + b[x + 1];
+		}
+
+		num_cur = tracker_row(t, v, t->runs[(v & 1) ^ 1], num_prev, t->runs[v & 1], &num_labels);
+		if (num_cur < 0)
+		{
+			rec->flags |= TRACKER_FLAG_OVERFLOW;
+			return 0;
+		}
+		num_prev = num_cur;
+	}
+
+	// Fold every label into its root, then keep the strongest blobs
+	for (l = 0; l < num_labels; l++)
+	{
+		uint32_t root = tracker_root(labels, l);
+
+		if (root != l)
+		{
+			labels[root].area += labels[l].area;
+			labels[root].weight += labels[l].weight;
+			labels[root].sum_x += labels[l].sum_x;
+			labels[root].sum_y += labels[l].sum_y;
+			if (labels[l].peak > labels[root].peak)
+				labels[root].peak = labels[l].peak;
+			labels[l].area = 0;
+		}
+	}
+	for (l = 0; l < num_labels; l++)
+	{
+		struct tracker_label *blob = &labels[l];
+
+		if (labels[l].parent != l || blob->area < t->min_area)
+			continue;
+		rec->count++;
+		for (i = num_best; i > 0 && best[i - 1]->weight < blob->weight; i--)
+		{
+			if (i < TRACKER_MAX_BLOBS)
+				best[i] = best[i - 1];
+		}
+		if (i < TRACKER_MAX_BLOBS)
+		{
+			best[i] = blob;
+			if (num_best < TRACKER_MAX_BLOBS)
+				num_best++;
+		}
+	}
+
+	// Cell u covers pixels scale * u and scale * u + 1
+	for (i = 0; i < num_best; i++)
+	{
+		rec->blob[i].x = (float)((double)best[i]->sum_x / best[i]->weight * scale + 0.5);
+		rec->blob[i].y = (float)((double)best[i]->sum_y / best[i]->weight * scale + 0.5);
+		rec->blob[i].area = best[i]->area;
+		rec->blob[i].peak = best[i]->peak / 4;
+	}
+	if (num_best >= 2)
+	{
+		float dx, dy;
+
+		if (rec->blob[1].x < rec->blob[0].x)
+		{
+			struct tracker_blob tmp = rec->blob[0];
+
+			rec->blob[0] = rec->blob[1];
+			rec->blob[1] = tmp;
+		}
+		dx = rec->blob[1].x - rec->blob[0].x;
+		dy = rec->blob[1].y - rec->blob[0].y;
+		rec->angle = atan2f(dy, dx) * (float)(180 / M_PI);
+	}
+	return 0;
+}
+
+static void tracker_write(TRACKER_T *t, const struct tracker_record *rec)
+{
+	int i, ok;
+
+	if (!t->csv)
+		ok = fwrite(rec, sizeof(*rec), 1, t->out) == 1;
+	else
+	{
+		ok = fprintf(t->out, "%u,%lld,", rec->index, (long long)rec->pts) > 0;
+		if (!isnan(rec->angle))
+			fprintf(t->out, "%.3f", rec->angle);
+		fprintf(t->out, ",%u,%u", rec->count, rec->flags);
+		for (i = 0; i < TRACKER_MAX_BLOBS; i++)
+		{
+			if (i < (int)rec->count)
+				fprintf(t->out, ",%.2f,%.2f,%u", rec->blob[i].x, rec->blob[i].y, rec->blob[i].area);
+			else
+				fputs(",,,", t->out);
+		}
+		fputc('\n', t->out);
+	}
+	// Readers of a FIFO see every frame as soon as it is tracked
+	if (!ok || fflush(t->out) != 0)
+		t->write_errors++;
+}
+
+static void *tracker_thread(void *args)
+{
+	TRACKER_T *t = (TRACKER_T *)args;
+	struct tracker_record rec;
+	struct frame_slot *frame;
+
+	for (;;)
+	{
+		uint64_t start;
+
+		frame = frame_ring_wait(&t->ring);
+		if (!frame)
+		{
+			if (t->ring.stop)
+				break;
+			continue;
+		}
+		start = frame_clock_ns();
+		rec.index = frame->index;
+		rec.pts = frame->pts;
+		tracker_find(t, frame->data, frame->length, &rec);
+		frame_ring_release(&t->ring);
+		t->busy_ns += frame_clock_ns() - start;
+		t->frames++;
+		if (!isnan(rec.angle))
+			t->pairs++;
+		tracker_write(t, &rec);
+	}
+	return NULL;
+}
+
+/**
+ * Opens the output (binary, or CSV for a path ending in .csv) and starts
+ * the tracker thread behind a ring of TRACKER_RING_DEPTH slots.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tracker_start(TRACKER_T *t, const char *path, uint32_t slot_size)
+{
+	size_t len = strlen(path);
+
+	t->csv = len > 4 && !strcmp(path + len - 4, ".csv");
+	t->out = fopen(path, "w");
+	if (!t->out)
+	{
+		perror(path);
+		return -1;
+	}
+	if (t->csv)
+	{
+		int i;
+
+		fputs("index,pts,angle,count,flags", t->out);
+		for (i = 0; i < TRACKER_MAX_BLOBS; i++)
+			fprintf(t->out, ",x%d,y%d,area%d", i, i, i);
+		fputc('\n', t->out);
+	}
+	else
+	{
+		struct tracker_file_header hdr = { TRACKER_MAGIC, TRACKER_VERSION, sizeof(struct tracker_record), TRACKER_MAX_BLOBS,
+										   t->image.width, t->image.height, { 0, 0 } };
+
+		fwrite(&hdr, sizeof(hdr), 1, t->out);
+	}
+
+	if (frame_ring_init(&t->ring, TRACKER_RING_DEPTH, slot_size) < 0)
+		goto fail;
+	if (pthread_create(&t->thread, NULL, tracker_thread, t) != 0)
+	{
+		frame_ring_destroy(&t->ring);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	fclose(t->out);
+	t->out = NULL;
+	return -1;
+}
+
+/**
+ * Callback side: queues a copy of the frame for the tracker thread. Never
+ * blocks; a full ring drops the frame.
+ */
+void tracker_frame(TRACKER_T *t, const struct frame_slot *frame)
+{
+	frame_ring_push(&t->ring, frame);
+}
+
+/**
+ * Lets the thread finish the queued frames, prints the summary and frees
+ * everything.
+ */
+void tracker_stop(TRACKER_T *t)
+{
+	if (t->out)
+	{
+		frame_ring_stop(&t->ring);
+		pthread_join(t->thread, NULL);
+		fprintf(stderr, "Tracker: %u frames tracked, %u with two markers, %u not tracked (ring full), %.1f us per frame\n",
+				t->frames, t->pairs, t->ring.dropped, t->frames ? t->busy_ns / 1e3 / t->frames : 0.0);
+		if (t->write_errors)
+			fprintf(stderr, "Tracker: %u records could not be written\n", t->write_errors);
+		frame_ring_destroy(&t->ring);
+		fclose(t->out);
+	}
+	tracker_destroy(t);
+}
@@ -0,0 +1,235 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "tslog.h"
+#include "motion_gate.h"
+#include "capture.h"
+
+#define TS_LOG_ENTRY_BYTES	(sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint64_t) + 5 * sizeof(uint32_t))
+
+/**
+ * Creates the log file and the page-locked buffer for one block.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int ts_log_open(TS_LOG_T *t, const char *path)
+{
+	struct ts_log_header hdr = { TS_LOG_MAGIC, TS_LOG_VERSION, TS_LOG_BLOCK, 0 };
+
+	memset(t, 0, sizeof(*t));
+	t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (t->fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	if (write(t->fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+	{
+		perror(path);
+		close(t->fd);
+		return -1;
+	}
+
+	// 64 bit arrays first keeps every array naturally aligned
+	t->mem_bytes = TS_LOG_BLOCK * TS_LOG_ENTRY_BYTES;
+	t->mem = mmap(NULL, t->mem_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (t->mem == MAP_FAILED)
+	{
+		perror("ts_log: mmap");
+		close(t->fd);
+		t->mem = NULL;
+		return -1;
+	}
+	if (mlock(t->mem, t->mem_bytes) < 0)
+		perror("ts_log: mlock (continuing without)");
+
+	t->pts = (int64_t *)t->mem;
+	t->host_ns = (uint64_t *)(t->pts + TS_LOG_BLOCK);
+	t->index = (uint32_t *)(t->host_ns + TS_LOG_BLOCK);
+	t->flags = t->index + TS_LOG_BLOCK;
+	t->score = t->flags + TS_LOG_BLOCK;
+	t->sensor_frame = t->score + TS_LOG_BLOCK;
+	t->exposure = t->sensor_frame + TS_LOG_BLOCK;
+	t->gain = t->exposure + TS_LOG_BLOCK;
+	return 0;
+}
+
+/**
+ * Writes the entries collected so far as one block.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int ts_log_flush(TS_LOG_T *t)
+{
+	struct ts_log_block blk = { t->count, 0 };
+	struct iovec iov[9] = {
+		{ &blk, sizeof(blk) },
+		{ t->index, t->count * sizeof(*t->index) },
+		{ t->pts, t->count * sizeof(*t->pts) },
+		{ t->host_ns, t->count * sizeof(*t->host_ns) },
+		{ t->flags, t->count * sizeof(*t->flags) },
+		{ t->score, t->count * sizeof(*t->score) },
+		{ t->sensor_frame, t->count * sizeof(*t->sensor_frame) },
+		{ t->exposure, t->count * sizeof(*t->exposure) },
+		{ t->gain, t->count * sizeof(*t->gain) },
+	};
+	ssize_t len = sizeof(blk) + (ssize_t)t->count * TS_LOG_ENTRY_BYTES;
+
+	if (!t->count)
+		return 0;
+	t->total += t->count;
+	t->count = 0;
+	if (writev(t->fd, iov, 9) != len)
+	{
+		t->write_errors++;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Records one saved frame. No allocation; one writev every TS_LOG_BLOCK
+ * frames.
+ */
+void ts_log_record(TS_LOG_T *t, const struct frame_slot *frame)
+{
+	uint32_t i = t->count;
+
+	if (!t->mem)
+		return;
+	t->index[i] = frame->index;
+	t->pts[i] = frame->pts;
+	t->host_ns[i] = frame->host_ns;
+	t->flags[i] = frame->flags;
+	t->score[i] = frame->score;
+	t->sensor_frame[i] = frame->sensor_frame;
+	t->exposure[i] = frame->exposure;
+	t->gain[i] = frame->gain;
+	if (++t->count == TS_LOG_BLOCK)
+		ts_log_flush(t);
+}
+
+/**
+ * Flushes the last (partial) block and closes the log.
+ *
+ * @return 0 on success, -1 if any block could not be written
+ */
+int ts_log_close(TS_LOG_T *t)
+{
+	int ret = 0;
+
+	if (!t->mem)
+		return -1;
+	if (ts_log_flush(t) < 0 || t->write_errors)
+	{
+		fprintf(stderr, "ts_log: %u blocks could not be written\n", t->write_errors);
+		ret = -1;
+	}
+	if (close(t->fd) < 0)
+		ret = -1;
+	munlock(t->mem, t->mem_bytes);
+	munmap(t->mem, t->mem_bytes);
+	t->mem = NULL;
+	return ret;
+}
+
+static int ts_log_read(FILE *f, void *buf, size_t len)
+{
+	return fread(buf, 1, len, f) == len ? 0 : -1;
+}
+
+/**
+ * Converts a binary log to the -ts CSV layout: "delta,index,pts" per frame,
+ * with an empty delta on the first line. extended appends the host
+ * CLOCK_MONOTONIC time (ns), the buffer flags, the motion score in grey
+ * levels (empty for a version 1 log) and the sensor frame counter, exposure
+ * and gain (empty without embedded data).
+ *
+ * @return number of entries converted, -1 on failure
+ */
+int ts_log_to_csv(const char *path, FILE *out, int extended)
+{
+	struct ts_log_header hdr;
+	struct ts_log_block blk;
+	uint32_t *index = NULL, *flags = NULL, *score = NULL, *sensor = NULL;
+	int64_t *pts = NULL, last = 0;
+	uint64_t *host_ns = NULL;
+	int total = 0;
+	FILE *f = fopen(path, "rb");
+
+	if (!f)
+	{
+		perror(path);
+		return -1;
+	}
+	if (ts_log_read(f, &hdr, sizeof(hdr)) < 0 || hdr.magic != TS_LOG_MAGIC ||
+		hdr.version < 1 || hdr.version > TS_LOG_VERSION || !hdr.block_entries)
+	{
+		fprintf(stderr, "%s: not a timestamp log\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	index = malloc(hdr.block_entries * sizeof(*index));
+	pts = malloc(hdr.block_entries * sizeof(*pts));
+	host_ns = malloc(hdr.block_entries * sizeof(*host_ns));
+	flags = malloc(hdr.block_entries * sizeof(*flags));
+	score = malloc(hdr.block_entries * sizeof(*score));
+	sensor = malloc(3 * hdr.block_entries * sizeof(*sensor));		// Frame counter, exposure, gain
+	if (!index || !pts || !host_ns || !flags || !score || !sensor)
+	{
+		total = -1;
+		goto out;
+	}
+
+	while (ts_log_read(f, &blk, sizeof(blk)) == 0)
+	{
+		uint32_t i;
+
+		if (blk.count > hdr.block_entries ||
+			ts_log_read(f, index, blk.count * sizeof(*index)) < 0 ||
+			ts_log_read(f, pts, blk.count * sizeof(*pts)) < 0 ||
+			ts_log_read(f, host_ns, blk.count * sizeof(*host_ns)) < 0 ||
+			ts_log_read(f, flags, blk.count * sizeof(*flags)) < 0 ||
+			(hdr.version >= 2 && ts_log_read(f, score, blk.count * sizeof(*score)) < 0) ||
+			(hdr.version >= 3 && ts_log_read(f, sensor, 3 * blk.count * sizeof(*sensor)) < 0))
+		{
+			fprintf(stderr, "%s: truncated block after %d entries\n", path, total);
+			break;
+		}
+
+		for (i = 0; i < blk.count; i++, total++)
+		{
+			if (total)
+				fprintf(out, "%lld", (long long)(pts[i] - last));
+			fprintf(out, ",%u,%lld", index[i], (long long)pts[i]);
+			if (extended)
+			{
+				fprintf(out, ",%llu,%u,", (unsigned long long)host_ns[i], flags[i]);
+				if (hdr.version >= 2)
+					fprintf(out, "%.2f", score[i] / (double)MOTION_SCORE_ONE);
+				if (hdr.version >= 3 && (flags[i] & FRAME_FLAG_EMBEDDED))
+					fprintf(out, ",%u,%u,%u", sensor[i], sensor[blk.count + i], sensor[2 * blk.count + i]);
+				else
+					fputs(",,,", out);
+			}
+			fputc('\n', out);
+			last = pts[i];
+		}
+	}
+
+out:
+	free(index);
+	free(pts);
+	free(host_ns);
+	free(flags);
+	free(score);
+	free(sensor);
+	fclose(f);
+	return total;
+}
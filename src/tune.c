@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tune.h"
+
+/**
+ * Sets up the ladder of buffer counts from min_buffers to max_buffers,
+ * growing by about half each step. max_workers 0 tunes the buffers only.
+ */
+void tune_init(TUNE_T *t, int min_buffers, int max_buffers, int max_workers)
+{
+	int n;
+
+	memset(t, 0, sizeof(*t));
+	if (min_buffers < 1)
+		min_buffers = 1;
+	if (max_buffers < min_buffers)
+		max_buffers = min_buffers;
+	for (n = min_buffers; n < max_buffers && t->num_buffers < TUNE_MAX_STEPS - 1; n += n > 2 ? n / 2 : 1)
+		t->buffers[t->num_buffers++] = n;
+	t->buffers[t->num_buffers++] = max_buffers;
+	t->max_workers = max_workers;
+	t->workers = max_workers;
+}
+
+/**
+ * Hands out the configuration of the next trial.
+ *
+ * @return 1 with a trial to run, 0 once the search is over
+ */
+int tune_next(TUNE_T *t, int *buffer_num, int *copy_workers)
+{
+	if (t->done)
+		return 0;
+	*buffer_num = t->buffers[t->step];
+	*copy_workers = t->workers;
+	return 1;
+}
+
+/**
+ * Takes the outcome of the trial tune_next() handed out.
+ */
+void tune_result(TUNE_T *t, int sustained)
+{
+	t->trials++;
+	if (sustained)
+	{
+		t->found = 1;
+		t->best.buffer_num = t->buffers[t->step];
+		t->best.copy_workers = t->workers;
+		t->shrinking = 1;
+		if (t->workers <= 1)
+			t->done = 1;
+		else
+			t->workers--;
+	}
+	else if (t->shrinking || ++t->step == t->num_buffers)
+		t->done = 1;
+}
+
+static int tune_parse(const char *line, struct tune_entry *e)
+{
+	return sscanf(line, "%u %u %lf %d %d", &e->width, &e->height, &e->fps, &e->buffer_num, &e->copy_workers) == 5 &&
+		   e->buffer_num > 0 && e->copy_workers >= 0 ? 0 : -1;
+}
+
+static int tune_read(const char *path, struct tune_entry *entries, int max)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+	int n = 0;
+
+	if (!file)
+		return errno == ENOENT ? 0 : -1;
+	while (n < max && fgets(line, sizeof(line), file))
+	{
+		if (line[0] != '#' && tune_parse(line, &entries[n]) == 0)
+			n++;
+	}
+	fclose(file);
+	return n;
+}
+
+/**
+ * Looks up the entry for a resolution: the one calibrated at the lowest
+ * frame rate not below fps.
+ *
+ * @return 0 on success, -1 if the profile has no such entry
+ */
+int tune_profile_load(const char *path, uint32_t width, uint32_t height, double fps, struct tune_entry *entry)
+{
+	struct tune_entry entries[TUNE_MAX_ENTRIES];
+	int i, n = tune_read(path, entries, TUNE_MAX_ENTRIES), best = -1;
+
+	for (i = 0; i < n; i++)
+	{
+		if (entries[i].width != width || entries[i].height != height || entries[i].fps < fps * 0.999)
+			continue;
+		if (best < 0 || entries[i].fps < entries[best].fps)
+			best = i;
+	}
+	if (best < 0)
+		return -1;
+	*entry = entries[best];
+	return 0;
+}
+
+/**
+ * Adds the entry to the profile, replacing one for the same resolution and
+ * frame rate. The file is replaced atomically.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tune_profile_save(const char *path, const struct tune_entry *entry)
+{
+	struct tune_entry entries[TUNE_MAX_ENTRIES];
+	char *tmp = NULL;
+	FILE *file;
+	int i, n = tune_read(path, entries, TUNE_MAX_ENTRIES - 1);
+
+	if (n < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (entries[i].width == entry->width && entries[i].height == entry->height &&
+			entries[i].fps - entry->fps < 0.05 && entry->fps - entries[i].fps < 0.05)
+			break;
+	}
+	entries[i] = *entry;
+	if (i == n)
+		n++;
+
+	if (asprintf(&tmp, "%s.tmp", path) < 0)
+		return -1;
+	file = fopen(tmp, "w");
+	if (!file)
+	{
+		perror(tmp);
+		free(tmp);
+		return -1;
+	}
+	fprintf(file, "# width height fps buffers workers\n");
+	for (i = 0; i < n; i++)
+		fprintf(file, "%u %u %.1f %d %d\n", entries[i].width, entries[i].height, entries[i].fps,
+				entries[i].buffer_num, entries[i].copy_workers);
+	if (fclose(file) != 0 || rename(tmp, path) < 0)
+	{
+		perror(path);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+	return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Times process.sh (dcraw per frame) against rawconv on copies of the same
+# capture, as both may delete their input.
+# usage: tools/convbench.sh <capture dir> [rawconv binary] [rawconv options]
+
+src="${1:?usage: $0 <capture dir> [rawconv binary] [rawconv options]}"
+rawconv="${2:-./build/rawconv}"
+shift $(( $# < 2 ? $# : 2 ))
+
+frames=$(find "$src" -name 'out.*.raw' | wc -l)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mkdir -p "$work/in1" "$work/in2" "$work/out1" "$work/out2"
+cp "$src"/out.*.raw "$work/in1/"
+cp "$src"/out.*.raw "$work/in2/"
+if [ -f "$src/hd0.32k" ]; then
+    cp "$src/hd0.32k" "$work/in1/"
+    cp "$src/hd0.32k" "$work/in2/"
+fi
+
+run() {
+    local name="$1" out="$2"
+    shift 2
+    local start=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    local end=$(date +%s%N)
+    awk -v n="$name" -v f="$frames" -v i="$(ls "$out" | wc -l)" -v ns=$((end - start)) \
+        'BEGIN { printf "%s: %d frames in %.2f s, %.1f frames/s, %d images\n", n, f, ns / 1e9, f / (ns / 1e9), i }'
+}
+
+run "process.sh + dcraw" "$work/out1" ./process.sh "$work/in1" "$work/out1"
+run "rawconv" "$work/out2" "$rawconv" "$@" "$work/in2" "$work/out2"
@@ -0,0 +1,228 @@
+/*
+ * Programs every mode table of the supported sensors into a stand-in I2C
+ * bus, once one register per write() as raspiraw used to and once batched
+ * as it does now, checks that both leave the same register contents
+ * behind and compares the syscalls, bus bytes and the modelled time to
+ * get through each table.
+ *
+ * format: i2cregs [-hz bus clock] [-us cost per syscall]
+ *
+ * The model charges every transfer the syscall cost and every message a
+ * start, the slave address, its bytes and a stop at 9 bit times per byte.
+ * Sleep pseudo registers are really slept but not counted.
+ *
+ * It also checks that the exposure, VTS and gain values of every sensor
+ * read back from its mode table as they were stored.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reg_map.h"
+#include "sensor.h"
+
+// All the mode tables need from MMAL
+#define MMAL_ENCODING_UYVY	0x59565955
+
+#include "ov5647_modes.h"
+#include "imx219_modes.h"
+#include "adv7282m_modes.h"
+
+static const struct sensor_def *sensors[] = {
+	&ov5647,
+	&imx219,
+	&adv7282,
+	NULL
+};
+
+/*
+ * 7 bit address space of 16 bit register files, each register byte
+ * auto-incrementing like the sensors do.
+ */
+struct standin {
+	uint8_t *mem[128];
+	uint32_t hz;
+	uint32_t syscall_ns;
+	uint64_t ns;
+	int addressing;
+};
+
+static int standin_transfer(void *ctx, struct i2c_msg *msgs, int num)
+{
+	struct standin *bus = (struct standin *)ctx;
+	int i, j;
+
+	bus->ns += bus->syscall_ns;
+	for (i = 0; i < num; i++)
+	{
+		struct i2c_msg *m = &msgs[i];
+		uint16_t reg;
+
+		// Start, address byte, data bytes and stop
+		bus->ns += (uint64_t)(2 + 9 * (1 + m->len)) * 1000000000ull / bus->hz;
+
+		if (m->addr > 127 || m->len <= bus->addressing)
+			return i ? i : -1;
+		if (!bus->mem[m->addr] && !(bus->mem[m->addr] = calloc(1, 1 << 16)))
+			return i ? i : -1;
+		reg = bus->addressing == 1 ? m->buf[0] : m->buf[0] << 8 | m->buf[1];
+		for (j = bus->addressing; j < m->len; j++)
+			bus->mem[m->addr][reg++] = m->buf[j];
+	}
+	return num;
+}
+
+static void standin_reset(struct standin *bus, int addressing)
+{
+	int i;
+
+	for (i = 0; i < 128; i++)
+	{
+		if (bus->mem[i])
+			memset(bus->mem[i], 0, 1 << 16);
+	}
+	bus->ns = 0;
+	bus->addressing = addressing;
+}
+
+static int standin_same(const struct standin *a, const struct standin *b)
+{
+	static const uint8_t zero[1 << 16];
+	int i;
+
+	for (i = 0; i < 128; i++)
+	{
+		if (memcmp(a->mem[i] ? a->mem[i] : zero, b->mem[i] ? b->mem[i] : zero, 1 << 16))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Writes one table through the engine into the stand-in.
+ */
+static void program(I2C_REGS_T *regs, struct standin *bus, const struct sensor_def *sensor, int batched,
+					const struct sensor_regs *table, int num)
+{
+	i2c_regs_init(regs, sensor->i2c_addr, sensor->i2c_addressing, sensor->i2c_data_size,
+				  batched ? sensor->i2c_burst : 1);
+	if (!batched)
+		regs->max_msgs = 1;
+	regs->transfer = standin_transfer;
+	regs->ctx = bus;
+	standin_reset(bus, regs->addressing);
+	i2c_regs_write(regs, table, num);
+}
+
+static int compare(const struct sensor_def *sensor, const char *name, const struct sensor_regs *table, int num,
+				   struct standin *legacy_bus, struct standin *batched_bus)
+{
+	I2C_REGS_T legacy, batched;
+	int same;
+
+	program(&legacy, legacy_bus, sensor, 0, table, num);
+	program(&batched, batched_bus, sensor, 1, table, num);
+	same = standin_same(legacy_bus, batched_bus);
+
+	printf("%-8s %-6s %5u | %5u %6u %8.2f | %5u %5u %6u %8.2f | %5.1fx %s\n", sensor->name, name, legacy.regs,
+		   legacy.transfers, legacy.bytes, legacy_bus->ns / 1e6, batched.msgs, batched.transfers, batched.bytes,
+		   batched_bus->ns / 1e6, batched_bus->ns ? (double)legacy_bus->ns / batched_bus->ns : 0.0,
+		   same ? "same" : "DIFFERENT");
+	return same ? 0 : -1;
+}
+
+/**
+ * Stores a few values num_bits wide at reg of the first mode's table and
+ * reads them back.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int round_trip(const struct sensor_def *sensor, const char *name, uint16_t reg, int num_bits)
+{
+	static const uint32_t values[] = { 0, 1000, 0x12345, 0xA5A5A5A5, 0xFFFFFFFF };
+	uint32_t mask = num_bits < 32 ? (1u << num_bits) - 1 : 0xFFFFFFFF;
+	REG_MAP_T map;
+	unsigned int i;
+	int ret = 0;
+
+	if (!num_bits || !sensor->num_modes)
+		return 0;
+	if (reg_map_init(&map, sensor->modes[0].regs, sensor->modes[0].num_regs, sensor->i2c_addr,
+					 sensor->stream_reg) < 0)
+	{
+		perror("reg_map_init");
+		return -1;
+	}
+	for (i = 0; i < NUM_ELEMENTS(values) && !ret; i++)
+	{
+		uint32_t got;
+
+		if (reg_map_set_value(&map, reg, num_bits, values[i]) < 0)
+			ret = -1;
+		else if ((got = reg_map_get_value(&map, reg, num_bits)) != (values[i] & mask))
+		{
+			printf("%-8s %-8s %04X %2d bit: stored %X, read back %X\n", sensor->name, name, reg, num_bits,
+				   values[i] & mask, got);
+			ret = -1;
+		}
+	}
+	if (!ret)
+		printf("%-8s %-8s %04X %2d bit: same\n", sensor->name, name, reg, num_bits);
+	reg_map_destroy(&map);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct standin legacy_bus = { .hz = 100000, .syscall_ns = 50000 };
+	struct standin batched_bus;
+	const struct sensor_def **s;
+	int i, failed = 0;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-hz") && atoi(argv[i + 1]) > 0)
+			legacy_bus.hz = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-us") && atoi(argv[i + 1]) >= 0)
+			legacy_bus.syscall_ns = atoi(argv[i + 1]) * 1000;
+		else
+			break;
+	}
+	if (i < argc)
+	{
+		fprintf(stderr, "format: %s [-hz bus clock] [-us cost per syscall]\n", argv[0]);
+		return 1;
+	}
+	batched_bus = legacy_bus;
+
+	printf("Bus %u Hz, %u us per syscall\n", legacy_bus.hz, legacy_bus.syscall_ns / 1000);
+	printf("%-8s %-6s %5s | %5s %6s %8s | %5s %5s %6s %8s |\n", "sensor", "table", "regs",
+		   "write", "bytes", "ms", "msgs", "ioctl", "bytes", "ms");
+	for (s = sensors; *s; s++)
+	{
+		char name[16];
+
+		for (i = 0; i < (*s)->num_modes; i++)
+		{
+			snprintf(name, sizeof(name), "mode%d", i);
+			failed |= compare(*s, name, (*s)->modes[i].regs, (*s)->modes[i].num_regs, &legacy_bus, &batched_bus);
+		}
+		failed |= compare(*s, "stop", (*s)->stop, (*s)->num_stop_regs, &legacy_bus, &batched_bus);
+	}
+
+	printf("\n");
+	for (s = sensors; *s; s++)
+	{
+		failed |= round_trip(*s, "exposure", (*s)->exposure_reg, (*s)->exposure_reg_num_bits);
+		failed |= round_trip(*s, "vts", (*s)->vts_reg, (*s)->vts_reg_num_bits);
+		failed |= round_trip(*s, "gain", (*s)->gain_reg, (*s)->gain_reg_num_bits);
+	}
+
+	for (i = 0; i < 128; i++)
+	{
+		free(legacy_bus.mem[i]);
+		free(batched_bus.mem[i]);
+	}
+	return failed ? 1 : 0;
+}
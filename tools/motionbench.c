@@ -0,0 +1,199 @@
+/*
+ * Checks the motion gate's SIMD kernel against the scalar one and measures
+ * the time it takes per frame, against the frame period of the target
+ * rate.
+ *
+ * format: motionbench [-t ms] [-res WxH,...] [-bits 8,10,12] [-fps rate] [-motion <level>[:<step>]]
+ *
+ * -motion takes the gate settings of faster-raspiraw -motion (default 3).
+ *
+ * The test scene is a static gradient with sensor-like noise in the low
+ * bits and +-2 grey levels in the high ones; for MOTIONBENCH_MOVING frames
+ * a bright block moves across it. Both kernels score the whole sequence
+ * three times over and must give the same score for every frame. The exit
+ * status is 1 if they differ. The active frames are counted before, during
+ * and after the movement; frames after it stay active while the background
+ * forgets the block.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion_gate.h"
+#include "raw_unpack.h"
+#include "frame_ring.h"
+
+#define MOTIONBENCH_MAX_AXIS	16
+#define MOTIONBENCH_FRAMES		128		// Distinct frames of the test scene
+#define MOTIONBENCH_MOVE_AT		32		// First frame with the moving block
+#define MOTIONBENCH_MOVING		16
+#define MOTIONBENCH_PASSES		3
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+// 0 before the movement, 1 during it, 2 after it
+static int phase(uint32_t n)
+{
+	return n < MOTIONBENCH_MOVE_AT ? 0 : n < MOTIONBENCH_MOVE_AT + MOTIONBENCH_MOVING ? 1 : 2;
+}
+
+/**
+ * Packs frame n of the test scene. Only the high byte of each pixel is
+ * set on purpose; the bytes holding the low bits stay random.
+ */
+static void make_frame(uint8_t *frame, size_t size, uint32_t width, uint32_t height, uint32_t bits, uint32_t n)
+{
+	uint32_t stride = raw_unpack_stride(width, bits), x, y;
+	uint32_t bw = width / 4, bh = height / 2, bx = (n * width / 32) % (width - bw), by = height / 4;
+
+	for (x = 0; x < size; x++)
+		frame[x] = rng();
+	for (y = 0; y < height; y++)
+	{
+		uint8_t *line = frame + (size_t)y * stride;
+
+		for (x = 0; x < width; x++)
+		{
+			int v = 40 + (x + y) * 160 / (width + height) + (int)(rng() % 5) - 2;
+			uint32_t off = bits == 10 ? (x >> 2) * 5 + (x & 3) : bits == 12 ? (x >> 1) * 3 + (x & 1) : x;
+
+			if (phase(n) == 1 && x >= bx && x < bx + bw && y >= by && y < by + bh)
+				v += 80;
+			line[off] = v;
+		}
+	}
+}
+
+static double bench_one(MOTION_GATE_T *g, uint8_t **frames, uint32_t size, int ms)
+{
+	uint64_t start = frame_clock_ns(), elapsed;
+	uint32_t runs = 0;
+
+	do
+	{
+		motion_gate_frame(g, frames[runs % MOTIONBENCH_FRAMES], size);
+		runs++;
+		elapsed = frame_clock_ns() - start;
+	} while (elapsed < (uint64_t)ms * 1000000);
+	return elapsed / 1e3 / runs;
+}
+
+static int parse_list(const char *arg, uint32_t *values)
+{
+	int n = 0;
+
+	while (*arg && n < MOTIONBENCH_MAX_AXIS)
+	{
+		values[n++] = strtoul(arg, (char **)&arg, 10);
+		if (*arg == ',')
+			arg++;
+		else if (*arg)
+			return -1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t res_w[MOTIONBENCH_MAX_AXIS] = { 640, 640, 1640, 3280 }, res_h[MOTIONBENCH_MAX_AXIS] = { 64, 480, 1232, 2464 };
+	uint32_t bits[MOTIONBENCH_MAX_AXIS] = { 10, 12 }, step = 0, threshold = 3 * MOTION_SCORE_ONE;
+	int num_res = 4, num_bits = 2, ms = 300, i, j, bad = 0;
+	double fps = 660;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-t"))
+			ms = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-bits"))
+			num_bits = parse_list(argv[i + 1], bits);
+		else if (!strcmp(argv[i], "-fps"))
+			fps = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "-motion"))
+		{
+			if (motion_gate_parse(argv[i + 1], &threshold, &step) < 0)
+				break;
+		}
+		else if (!strcmp(argv[i], "-res"))
+		{
+			const char *p = argv[i + 1];
+
+			for (num_res = 0; *p && num_res < MOTIONBENCH_MAX_AXIS; num_res++)
+			{
+				if (sscanf(p, "%ux%u", &res_w[num_res], &res_h[num_res]) != 2)
+					break;
+				p = strchr(p, ',') ? strchr(p, ',') + 1 : "";
+			}
+		}
+		else
+			break;
+	}
+	if (i != argc || num_bits <= 0 || num_res <= 0 || fps <= 0)
+	{
+		fprintf(stderr, "format: %s [-t ms] [-res WxH,...] [-bits 8,10,12] [-fps rate] [-motion <level>[:<step>]]\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < num_res; i++)
+	{
+		for (j = 0; j < num_bits; j++)
+		{
+			uint32_t size = raw_unpack_frame_size(res_w[i], res_h[i], bits[j]), n, differ = 0;
+			uint32_t active[3] = { 0 }, frames_in[3] = { 0 };
+			uint8_t *frames[MOTIONBENCH_FRAMES];
+			MOTION_GATE_T simd, scalar;
+			double us_simd, us_scalar;
+
+			for (n = 0; n < MOTIONBENCH_FRAMES; n++)
+			{
+				if (!(frames[n] = malloc(size)))
+					return 1;
+				make_frame(frames[n], size, res_w[i], res_h[i], bits[j], n);
+			}
+			if (motion_gate_init(&simd, res_w[i], res_h[i], raw_unpack_stride(res_w[i], bits[j]), bits[j], 0, step, threshold) < 0 ||
+				motion_gate_init(&scalar, res_w[i], res_h[i], raw_unpack_stride(res_w[i], bits[j]), bits[j], 0, step, threshold) < 0)
+				return 1;
+			scalar.scalar = 1;
+
+			// Same scores from both kernels, and what the gate made of the scene
+			for (n = 0; n < MOTIONBENCH_FRAMES * MOTIONBENCH_PASSES; n++)
+			{
+				int on = motion_gate_frame(&simd, frames[n % MOTIONBENCH_FRAMES], size);
+
+				motion_gate_frame(&scalar, frames[n % MOTIONBENCH_FRAMES], size);
+				if (simd.score != scalar.score)
+					differ++;
+				if (n >= MOTIONBENCH_FRAMES)
+				{
+					active[phase(n % MOTIONBENCH_FRAMES)] += on;
+					frames_in[phase(n % MOTIONBENCH_FRAMES)]++;
+				}
+			}
+			if (differ)
+				fprintf(stderr, "MISMATCH RAW%u %ux%u: %u scores differ\n", bits[j], res_w[i], res_h[i], differ);
+			bad += differ;
+
+			us_scalar = bench_one(&scalar, frames, size, ms);
+			us_simd = bench_one(&simd, frames, size, ms);
+			printf("%4ux%-4u RAW%-2u %4ux%-4u samples (step %2u)  active before %u/%u moving %u/%u after %u/%u  "
+				   "scalar %6.1f us  simd %6.1f us  %4.1f%% of %.0f fps\n",
+				   res_w[i], res_h[i], bits[j], simd.cols, simd.rows, simd.step, active[0], frames_in[0],
+				   active[1], frames_in[1], active[2], frames_in[2], us_scalar, us_simd, us_simd * fps / 1e4, fps);
+			fflush(stdout);
+
+			motion_gate_destroy(&simd);
+			motion_gate_destroy(&scalar);
+			for (n = 0; n < MOTIONBENCH_FRAMES; n++)
+				free(frames[n]);
+		}
+	}
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * End-to-end capture throughput benchmark: drives the capture pipeline
+ * (source callback -> frame ring -> writer -> /dev/shm -> copy pool ->
+ * destination) with synthetic frames over a matrix of sensor presets, bit
+ * depths, header on/off, save rates and copy worker counts. One JSON
+ * object per run goes to stdout (or -j file) so runs can be diffed.
+ *
+ * format: rawbench [-t ms] [-res WxH@fps,...] [-bits 10,12] [-hd 0,1] [-sr 1,2]
+ *                  [-cw 1,4] [-o shm pattern] [-d dest pattern] [-j out.jsonl]
+ *
+ * Latencies are in ns, as the upper bound of a log2 histogram bucket:
+ *   deliver    source handed the frame over until the callback returned
+ *   save       frame entered the pipeline until written to /dev/shm
+ *   copy_wait  queued for copying until a worker took it
+ *   copy       worker took it until it was at the destination
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "frame_source.h"
+
+#define RAWBENCH_MAX_AXIS		16
+#define RAWBENCH_HEADER_LENGTH	32768	// Size of the BRCM header
+
+struct preset {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+	double fps;
+};
+
+// The capture scripts in tools/
+static const struct preset presets[] = {
+	{ "640x32", 640, 32, 749 },
+	{ "640x64", 640, 64, 659 },
+	{ "640x128", 640, 128, 349 },
+	{ "640x240", 640, 240, 180 },
+	{ "320x240", 320, 240, 180 },
+	{ "640x416_s", 640, 208, 210 },
+	{ "640x480", 640, 480, 90 },
+	{ "1280x720", 1280, 720, 90 },
+	{ "1640x922", 1640, 922, 40 },
+	{ "1640x1232", 1640, 1232, 40 },
+	{ "1920x1080", 1920, 1080, 30 },
+	{ "2592x1944_s", 2592, 972, 30 },
+	{ "3280x2464", 3280, 2464, 15 },
+};
+
+struct axis {
+	int n;
+	int v[RAWBENCH_MAX_AXIS];
+};
+
+static CAPTURE_T capture;
+static COPY_POOL_T copy_pool;
+static FRAME_SOURCE_T source;
+static uint8_t header[RAWBENCH_HEADER_LENGTH];
+
+static int parse_axis(struct axis *a, const char *arg)
+{
+	char *end;
+
+	a->n = 0;
+	while (*arg && a->n < RAWBENCH_MAX_AXIS)
+	{
+		a->v[a->n++] = strtol(arg, &end, 10);
+		if (end == arg)
+			return -1;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return a->n ? 0 : -1;
+}
+
+/**
+ * Parses "WxH@fps,..." into the run list, replacing the presets.
+ */
+static int parse_res(struct preset *res, int max, const char *arg)
+{
+	int n = 0;
+
+	while (*arg && n < max)
+	{
+		struct preset *p = &res[n];
+		int len;
+
+		if (sscanf(arg, "%ux%u@%lf%n", &p->width, &p->height, &p->fps, &len) != 3)
+			return -1;
+		p->name = strndup(arg, len);
+		n++;
+		arg += len;
+		if (*arg == ',')
+			arg++;
+	}
+	return n;
+}
+
+static double timeval_s(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print_lat(FILE *out, const char *name, const struct lat_hist *h)
+{
+	fprintf(out, ", \"%s_p50\": %llu, \"%s_p99\": %llu, \"%s_max\": %llu", name,
+			(unsigned long long)lat_hist_pct(h, 50), name,
+			(unsigned long long)lat_hist_pct(h, 99), name,
+			(unsigned long long)lat_hist_pct(h, 100));
+}
+
+/**
+ * One benchmark run.
+ *
+ * @return 0 on success, -1 if the pipeline could not be set up
+ */
+static int run(FILE *out, const struct preset *p, int bits, int hd, int saverate, int workers,
+			   int timeout, const char *shm_pattern, const char *dst_pattern)
+{
+	static const char *method_names[COPY_METHODS] = { "rename", "copy_file_range", "sendfile", "pwrite" };
+	char spec[64], workers_arg[16];
+	struct rusage ru0, ru1;
+	uint64_t t0, t1;
+	uint32_t offered, ring_dropped, ring_high, i;
+	double wall, cpu, span, method_mb = 0, copied_mb = 0;
+	const char *method = "none";
+
+	snprintf(spec, sizeof(spec), "synthetic:%ux%u:%d:%g", p->width, p->height, bits, p->fps);
+	if (frame_source_open(&source, spec) < 0)
+		return -1;
+
+	capture_init(&capture);
+	capture.mem_pattern = shm_pattern;
+	capture.saverate = saverate;
+	capture.frame_period_us = source.fps > 0 ? 1e6 / source.fps : 0;
+	if (hd)
+	{
+		capture.header = header;
+		capture.header_len = sizeof(header);
+	}
+	copy_pool_defaults(&copy_pool, workers);
+	snprintf(workers_arg, sizeof(workers_arg), "%d", workers);
+	if (copy_pool_parse_workers(&copy_pool, workers_arg) < 0 ||
+		copy_pool_start(&copy_pool, shm_pattern, dst_pattern) < 0)
+	{
+		frame_source_close(&source);
+		return -1;
+	}
+	capture.copy = &copy_pool;
+	if (capture_start_ring(&capture, 0, source.buffer_size) < 0)
+	{
+		copy_pool_stop(&copy_pool);
+		frame_source_close(&source);
+		return -1;
+	}
+
+	getrusage(RUSAGE_SELF, &ru0);
+	t0 = frame_clock_ns();
+	frame_source_start(&source, capture_deliver, &capture);
+	usleep(timeout * 1000);
+	frame_source_stop(&source);
+
+	offered = (capture.count + saverate - 1) / saverate;
+	ring_dropped = capture.ring.dropped;
+	ring_high = capture.ring.high_water;
+	capture_stop(&capture);
+	copy_pool_stop(&copy_pool);
+	t1 = frame_clock_ns();
+	getrusage(RUSAGE_SELF, &ru1);
+
+	wall = (t1 - t0) / 1e9;
+	cpu = timeval_s(ru1.ru_utime) - timeval_s(ru0.ru_utime) + timeval_s(ru1.ru_stime) - timeval_s(ru0.ru_stime);
+	span = (capture.stats.last_pts - capture.stats.first_pts) / 1e6;
+	for (i = 0; i < COPY_METHODS; i++)
+	{
+		copied_mb += copy_pool.stats[i].bytes / 1e6;
+		if (copy_pool.stats[i].bytes / 1e6 > method_mb)
+		{
+			method_mb = copy_pool.stats[i].bytes / 1e6;
+			method = method_names[i];
+		}
+	}
+
+	fprintf(out, "{\"preset\": \"%s\", \"width\": %u, \"height\": %u, \"bits\": %d, \"fps_target\": %g, "
+			"\"header\": %d, \"saverate\": %d, \"workers\": %d, \"frame_bytes\": %u, "
+			"\"offered\": %u, \"saved\": %u, \"copied\": %u, \"copy_failed\": %u, "
+			"\"dropped\": %u, \"drop_rate\": %.6f, \"fps_sustained\": %.2f, \"copy_fps\": %.2f, "
+			"\"copy_mb_s\": %.1f, \"copy_method\": \"%s\", \"ring_high_water\": %u, \"queue_high_water\": %u, "
+			"\"wall_s\": %.3f, \"cpu_s\": %.3f, \"cpu_pct\": %.1f, \"cpus\": %ld",
+			p->name, p->width, p->height, bits, p->fps, hd, saverate, workers, source.buffer_size,
+			offered, capture.stats.frames, copy_pool.copied, copy_pool.failed,
+			ring_dropped, offered ? (double)(offered - capture.stats.frames) / offered : 0.0,
+			span > 0 ? (capture.stats.frames - 1) / span : 0.0, wall > 0 ? copy_pool.copied / wall : 0.0,
+			wall > 0 ? copied_mb / wall : 0.0, method, ring_high, copy_pool.queue.high_water,
+			wall, cpu, wall > 0 ? 100 * cpu / wall : 0.0, sysconf(_SC_NPROCESSORS_ONLN));
+	print_lat(out, "deliver", &capture.stats.lat_deliver);
+	print_lat(out, "save", &capture.stats.lat_save);
+	print_lat(out, "copy_wait", &copy_pool.lat_wait);
+	print_lat(out, "copy", &copy_pool.lat_copy);
+	fprintf(out, "}\n");
+	fflush(out);
+
+	// Leave nothing behind for the next run
+	for (i = 1; i <= capture.count; i++)
+	{
+		char name[4096];
+
+		snprintf(name, sizeof(name), dst_pattern, i);
+		unlink(name);
+		snprintf(name, sizeof(name), shm_pattern, i);
+		unlink(name);
+	}
+	frame_source_close(&source);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct preset res[RAWBENCH_MAX_AXIS * 2];
+	struct axis bits = { 1, { 10 } }, hd = { 2, { 0, 1 } }, sr = { 1, { 1 } }, cw = { 2, { 1, 4 } };
+	const char *shm_pattern = "/dev/shm/rawbench.%06d.raw", *dst_pattern = "/tmp/rawbench/out.%06d.raw";
+	int num_res = 0, timeout = 1000, i, b, h, s, w, failed = 0;
+	FILE *out = stdout;
+	char *dir;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		const char *arg = argv[i], *val = argv[i + 1];
+		int ok = 0;
+
+		if (!strcmp(arg, "-t"))
+			ok = (timeout = atoi(val)) > 0;
+		else if (!strcmp(arg, "-res"))
+			ok = (num_res = parse_res(res, sizeof(res) / sizeof(res[0]), val)) > 0;
+		else if (!strcmp(arg, "-bits"))
+			ok = !parse_axis(&bits, val);
+		else if (!strcmp(arg, "-hd"))
+			ok = !parse_axis(&hd, val);
+		else if (!strcmp(arg, "-sr"))
+			ok = !parse_axis(&sr, val);
+		else if (!strcmp(arg, "-cw"))
+			ok = !parse_axis(&cw, val);
+		else if (!strcmp(arg, "-o"))
+			ok = (shm_pattern = val) != NULL;
+		else if (!strcmp(arg, "-d"))
+			ok = (dst_pattern = val) != NULL;
+		else if (!strcmp(arg, "-j"))
+			ok = (out = fopen(val, "a")) != NULL;
+		if (!ok)
+			break;
+	}
+	if (i < argc)
+	{
+		fprintf(stderr, "format: %s [-t ms] [-res WxH@fps,...] [-bits 10,12] [-hd 0,1] [-sr 1,2] [-cw 1,4]\n"
+				"\t[-o shm pattern] [-d dest pattern] [-j out.jsonl]\n", argv[0]);
+		return 1;
+	}
+	if (!num_res)
+	{
+		num_res = sizeof(presets) / sizeof(presets[0]);
+		memcpy(res, presets, sizeof(presets));
+	}
+
+	dir = strdup(dst_pattern);
+	if (dir && mkdir(dirname(dir), 0755) < 0 && errno != EEXIST)
+		perror(dir);
+	free(dir);
+	memcpy(header, "BRCM", 4);
+
+	for (i = 0; i < num_res; i++)
+		for (b = 0; b < bits.n; b++)
+			for (h = 0; h < hd.n; h++)
+				for (s = 0; s < sr.n; s++)
+					for (w = 0; w < cw.n; w++)
+					{
+						fprintf(stderr, "== %s RAW%d header %d saverate %d workers %d\n",
+								res[i].name, bits.v[b], hd.v[h], sr.v[s], cw.v[w]);
+						if (run(out, &res[i], bits.v[b], hd.v[h], sr.v[s] > 0 ? sr.v[s] : 1, cw.v[w],
+								timeout, shm_pattern, dst_pattern) < 0)
+							failed++;
+					}
+
+	if (out != stdout)
+		fclose(out);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,623 @@
+/*
+ * Converts a whole capture to images in one process: reads the frames
+ * (out.*.raw files as process.sh finds them, or a container), takes the
+ * size, bit depth and Bayer order from the BRCM header, unpacks,
+ * demosaics and writes PPM or PNG. Worker threads take the next frame from
+ * a shared counter and keep their buffers from frame to frame, so nothing
+ * is forked, reallocated or moved per frame.
+ *
+ * format: rawconv [options] <input> [output dir]
+ *
+ *   <input>        directory of out.*.raw files or a container (-cf)
+ *   -f <format>    ppm (8 bit, default), ppm16, png or png16
+ *   -q <method>    edge (default) or bilinear
+ *   -j <threads>   worker threads (default one per online CPU)
+ *   -hd <file>     BRCM header of frames stored without one (default
+ *                  <input>/hd0.32k or the one in the container)
+ *   -bl <level>    black level to subtract, in raw units (default 0)
+ *   -wb <r>,<b>    white balance gains (default 1,1)
+ *   -rm            delete each input file once converted, as process.sh does
+ *
+ * 8 bit output gets the BT.709 curve dcraw applies by default, 16 bit
+ * output stays linear like dcraw -4.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+#include "container.h"
+#include "demosaic.h"
+#include "frame_ring.h"
+#include "raw_header.h"
+#include "raw_unpack.h"
+
+#define RAWCONV_MAX_THREADS	64
+
+enum rawconv_format { FORMAT_PPM, FORMAT_PPM16, FORMAT_PNG, FORMAT_PNG16 };
+
+static const char *format_names[] = { "ppm", "ppm16", "png", "png16" };
+static const char *format_ext[] = { "ppm", "ppm", "png", "png" };
+
+enum rawconv_stage { STAGE_READ, STAGE_UNPACK, STAGE_DEMOSAIC, STAGE_WRITE, STAGE_COUNT };
+
+static const char *stage_names[] = { "read", "unpack", "demosaic", "write" };
+
+// Layout of the frames, from the BRCM header
+struct frame_format {
+	uint32_t width;
+	uint32_t height;
+	uint32_t bit_depth;
+	enum bayer_order order;
+};
+
+struct rawconv {
+	// Settings
+	enum rawconv_format format;
+	enum demosaic_method method;
+	const char *out_dir;
+	int remove;
+
+	// Input: files, or slots of the container
+	struct dirent **files;
+	const char *in_dir;
+	RRC_CONTAINER_T container;
+	int is_container;
+	uint32_t count;
+	uint8_t *shared_header;			// For frames stored without one, NULL if none
+
+	struct frame_format fmt;
+	uint16_t *lut;					// Per channel, 1 << bit_depth entries each
+
+	uint32_t next;					// Next frame to take
+	uint32_t converted;
+	uint32_t failed;
+	uint64_t stage_ns[STAGE_COUNT];
+};
+
+struct worker {
+	pthread_t thread;
+	struct rawconv *conv;
+	uint8_t *in;					// Frame as stored
+	size_t in_size;
+	uint16_t *plane;				// Unpacked Bayer plane
+	uint16_t *rgb;
+	uint8_t *out;					// Tone mapped samples, behind the PPM header
+	size_t out_size;
+};
+
+static int out_name_filter(const struct dirent *d)
+{
+	return fnmatch("out.*.raw", d->d_name, 0) == 0;
+}
+
+/**
+ * Size, depth and order of the frames from a BRCM header.
+ *
+ * @return 0 on success, -1 if the header cannot be used
+ */
+static int parse_header(const uint8_t *hdr, struct frame_format *fmt)
+{
+	const struct brcm_raw_header *h = (const struct brcm_raw_header *)hdr;
+
+	if (h->id != BRCM_ID_SIG)
+		return -1;
+	fmt->width = h->mode.width;
+	fmt->height = h->mode.height;
+	fmt->order = (enum bayer_order)h->mode.bayer_order;
+	switch (h->mode.bayer_format)
+	{
+		case VC_IMAGE_BAYER_RAW8:
+			fmt->bit_depth = 8;
+			break;
+		case VC_IMAGE_BAYER_RAW10:
+			fmt->bit_depth = 10;
+			break;
+		case VC_IMAGE_BAYER_RAW12:
+			fmt->bit_depth = 12;
+			break;
+		default:
+			fprintf(stderr, "Unsupported Bayer format %u\n", h->mode.bayer_format);
+			return -1;
+	}
+	if (fmt->order > BAYER_GRBG || !fmt->width || !fmt->height)
+	{
+		fprintf(stderr, "Invalid BRCM header: %ux%u, Bayer order %d\n", fmt->width, fmt->height, (int)fmt->order);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Tone curve per channel: black level, white balance and scaling to the
+ * output depth, with the BT.709 curve for 8 bit output.
+ */
+static int build_lut(struct rawconv *conv, int black, const double *wb)
+{
+	uint32_t max = (1u << conv->fmt.bit_depth) - 1, v;
+	int out_max = conv->format == FORMAT_PPM || conv->format == FORMAT_PNG ? 255 : 65535, c;
+
+	conv->lut = malloc(3 * (max + 1) * sizeof(uint16_t));
+	if (!conv->lut)
+		return -1;
+	for (c = 0; c < 3; c++)
+	{
+		for (v = 0; v <= max; v++)
+		{
+			double x = ((double)v - black) / ((double)max - black) * wb[c];
+
+			x = x < 0 ? 0 : x > 1 ? 1 : x;
+			if (out_max == 255)
+				x = x < 0.018 ? 4.5 * x : 1.099 * pow(x, 0.45) - 0.099;
+			conv->lut[c * (max + 1) + v] = (uint16_t)(x * out_max + 0.5);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reads frame n into the worker's buffer.
+ *
+ * @return the frame data (after its own header, if any), NULL on failure
+ */
+static const uint8_t *read_frame(struct worker *w, uint32_t n, size_t *len, const uint8_t **hdr, char **name)
+{
+	struct rawconv *conv = w->conv;
+	ssize_t got;
+
+	if (conv->is_container)
+	{
+		const struct rrc_frame_record *rec = rrc_record(&conv->container, n);
+
+		if (!rec || asprintf(name, "out.%04u.raw", rec->index) < 0)
+			return NULL;
+		got = rrc_read(&conv->container, n, w->in, w->in_size);
+	}
+	else
+	{
+		char *path = NULL;
+		struct stat st;
+		int fd;
+
+		*name = strdup(conv->files[n]->d_name);
+		if (!*name || asprintf(&path, "%s/%s", conv->in_dir, *name) < 0)
+			return NULL;
+		fd = open(path, O_RDONLY);
+		free(path);
+		if (fd < 0 || fstat(fd, &st) < 0)
+		{
+			perror(*name);
+			if (fd >= 0)
+				close(fd);
+			return NULL;
+		}
+		if ((size_t)st.st_size > w->in_size)
+		{
+			uint8_t *in = realloc(w->in, st.st_size);
+
+			if (!in)
+			{
+				close(fd);
+				return NULL;
+			}
+			w->in = in;
+			w->in_size = st.st_size;
+		}
+		got = read(fd, w->in, st.st_size);
+		close(fd);
+		if (got != st.st_size)
+			got = -1;
+	}
+	if (got < 0)
+	{
+		fprintf(stderr, "Cannot read %s\n", *name);
+		return NULL;
+	}
+	if ((size_t)got >= BRCM_RAW_HEADER_LENGTH && *(const uint32_t *)w->in == BRCM_ID_SIG)
+	{
+		*hdr = w->in;
+		*len = got - BRCM_RAW_HEADER_LENGTH;
+		return w->in + BRCM_RAW_HEADER_LENGTH;
+	}
+	*hdr = conv->shared_header;
+	*len = got;
+	return w->in;
+}
+
+/**
+ * Tone maps the RGB frame and writes it as name.<ext> to the output
+ * directory.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_image(struct worker *w, const char *name)
+{
+	struct rawconv *conv = w->conv;
+	const struct frame_format *fmt = &conv->fmt;
+	size_t n = (size_t)fmt->width * fmt->height, i;
+	uint32_t lut_size = 1u << fmt->bit_depth;
+	const uint16_t *lut_r = conv->lut, *lut_g = lut_r + lut_size, *lut_b = lut_g + lut_size;
+	int wide = conv->format == FORMAT_PPM16 || conv->format == FORMAT_PNG16;
+	char *path = NULL;
+	uint8_t *p;
+	int hdr_len;
+	volatile int ret = 0;	// Set across the libpng setjmp()
+
+	if (asprintf(&path, "%s/%s.%s", conv->out_dir, name, format_ext[conv->format]) < 0)
+		return -1;
+
+	// PPM and PNG both want the samples big-endian
+	hdr_len = conv->format == FORMAT_PPM || conv->format == FORMAT_PPM16 ?
+			  snprintf((char *)w->out, 32, "P6\n%u %u\n%d\n", fmt->width, fmt->height, wide ? 65535 : 255) : 0;
+	p = w->out + hdr_len;
+	for (i = 0; i < n; i++)
+	{
+		const uint16_t *px = w->rgb + i * 3;
+		uint16_t r = lut_r[px[0]], g = lut_g[px[1]], b = lut_b[px[2]];
+
+		if (wide)
+		{
+			p[0] = r >> 8;
+			p[1] = r;
+			p[2] = g >> 8;
+			p[3] = g;
+			p[4] = b >> 8;
+			p[5] = b;
+			p += 6;
+		}
+		else
+		{
+			p[0] = r;
+			p[1] = g;
+			p[2] = b;
+			p += 3;
+		}
+	}
+
+	if (conv->format == FORMAT_PPM || conv->format == FORMAT_PPM16)
+	{
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		size_t len = p - w->out;
+
+		if (fd < 0 || write(fd, w->out, len) != (ssize_t)len)
+		{
+			perror(path);
+			ret = -1;
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+	else
+	{
+#ifdef HAVE_PNG
+		png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+		png_infop info = png ? png_create_info_struct(png) : NULL;
+		FILE *f = fopen(path, "wb");
+		uint32_t y;
+
+		if (!png || !info || !f || setjmp(png_jmpbuf(png)))
+		{
+			fprintf(stderr, "Cannot write %s\n", path);
+			ret = -1;
+		}
+		else
+		{
+			png_init_io(png, f);
+			// Frames are many and large, compress for speed
+			png_set_compression_level(png, 1);
+			png_set_IHDR(png, info, fmt->width, fmt->height, wide ? 16 : 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+						 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+			png_write_info(png, info);
+			for (y = 0; y < fmt->height; y++)
+				png_write_row(png, w->out + (size_t)y * fmt->width * (wide ? 6 : 3));
+			png_write_end(png, NULL);
+		}
+		png_destroy_write_struct(png ? &png : NULL, info ? &info : NULL);
+		if (f)
+			fclose(f);
+#else
+		fprintf(stderr, "Built without libpng, %s not written\n", path);
+		ret = -1;
+#endif
+	}
+	free(path);
+	return ret;
+}
+
+static void *conv_worker(void *args)
+{
+	struct worker *w = (struct worker *)args;
+	struct rawconv *conv = w->conv;
+	const struct frame_format *fmt = &conv->fmt;
+	uint64_t stage_ns[STAGE_COUNT] = { 0 };
+	uint32_t n;
+
+	while ((n = __atomic_fetch_add(&conv->next, 1, __ATOMIC_RELAXED)) < conv->count)
+	{
+		struct frame_format frame_fmt;
+		struct raw_image img = { NULL, fmt->width, fmt->height, 0, fmt->bit_depth };
+		const uint8_t *hdr = NULL;
+		char *name = NULL;
+		uint64_t t0 = frame_clock_ns(), t1, t2, t3;
+		size_t len = 0;
+		int ok = 0;
+
+		img.data = read_frame(w, n, &len, &hdr, &name);
+		t1 = frame_clock_ns();
+		if (!img.data)
+			;
+		else if (!hdr || parse_header(hdr, &frame_fmt) < 0 || memcmp(&frame_fmt, fmt, sizeof(*fmt)))
+			fprintf(stderr, "%s: no header or not in the %ux%u RAW%u layout of the first frame\n", name,
+					fmt->width, fmt->height, fmt->bit_depth);
+		else if (len < raw_unpack_stride(fmt->width, fmt->bit_depth) * (size_t)(fmt->height - 1) +
+					   (fmt->width * fmt->bit_depth + 7) / 8)
+			fprintf(stderr, "%s: %zu bytes are too short for %ux%u RAW%u\n", name, len, fmt->width, fmt->height,
+					fmt->bit_depth);
+		else if (raw_unpack16(&img, w->plane, 0, RAW_UNPACK_AUTO) == 0)
+		{
+			t2 = frame_clock_ns();
+			stage_ns[STAGE_UNPACK] += t2 - t1;
+			demosaic(w->plane, fmt->width, fmt->height, fmt->width, fmt->order, (1u << fmt->bit_depth) - 1,
+					 conv->method, w->rgb);
+			t3 = frame_clock_ns();
+			stage_ns[STAGE_DEMOSAIC] += t3 - t2;
+			ok = write_image(w, name) == 0;
+			stage_ns[STAGE_WRITE] += frame_clock_ns() - t3;
+		}
+		stage_ns[STAGE_READ] += t1 - t0;
+
+		if (ok)
+		{
+			__atomic_fetch_add(&conv->converted, 1, __ATOMIC_RELAXED);
+			if (conv->remove && !conv->is_container)
+			{
+				char *path = NULL;
+
+				if (asprintf(&path, "%s/%s", conv->in_dir, name) >= 0)
+					unlink(path);
+				free(path);
+			}
+		}
+		else
+			__atomic_fetch_add(&conv->failed, 1, __ATOMIC_RELAXED);
+		free(name);
+	}
+	for (n = 0; n < STAGE_COUNT; n++)
+		__atomic_fetch_add(&conv->stage_ns[n], stage_ns[n], __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * Opens the input and finds the layout of its frames from the first one
+ * or the shared header.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int open_input(struct rawconv *conv, const char *input, const char *header_path)
+{
+	struct stat st;
+	uint8_t *first = NULL;
+	ssize_t len = 0;
+	char *path = NULL, *header_default = NULL;
+	FILE *f;
+
+	if (stat(input, &st) < 0)
+	{
+		perror(input);
+		return -1;
+	}
+	conv->shared_header = calloc(1, BRCM_RAW_HEADER_LENGTH);
+	first = malloc(BRCM_RAW_HEADER_LENGTH);
+	if (!conv->shared_header || !first)
+		return -1;
+
+	if (S_ISDIR(st.st_mode))
+	{
+		int n = scandir(input, &conv->files, out_name_filter, alphasort);
+
+		if (n <= 0)
+		{
+			fprintf(stderr, "No out.*.raw files in %s\n", input);
+			free(first);
+			return -1;
+		}
+		conv->count = n;
+		conv->in_dir = input;
+		if (!header_path && asprintf(&header_default, "%s/hd0.32k", input) >= 0)
+			header_path = header_default;
+		if (asprintf(&path, "%s/%s", input, conv->files[0]->d_name) >= 0 && (f = fopen(path, "rb")))
+		{
+			len = fread(first, 1, BRCM_RAW_HEADER_LENGTH, f);
+			fclose(f);
+		}
+		free(path);
+	}
+	else
+	{
+		if (rrc_open(&conv->container, input) < 0)
+		{
+			free(first);
+			return -1;
+		}
+		conv->is_container = 1;
+		conv->count = rrc_count(&conv->container);
+		if (!header_path && rrc_read_prefix(&conv->container, conv->shared_header, BRCM_RAW_HEADER_LENGTH) <= 0)
+			memset(conv->shared_header, 0, BRCM_RAW_HEADER_LENGTH);
+		if (conv->count)
+			len = rrc_read(&conv->container, 0, first, BRCM_RAW_HEADER_LENGTH);
+	}
+
+	if (header_path && (f = fopen(header_path, "rb")))
+	{
+		if (fread(conv->shared_header, 1, BRCM_RAW_HEADER_LENGTH, f) != BRCM_RAW_HEADER_LENGTH)
+			memset(conv->shared_header, 0, BRCM_RAW_HEADER_LENGTH);
+		fclose(f);
+	}
+	free(header_default);
+	if (*(const uint32_t *)conv->shared_header != BRCM_ID_SIG)
+	{
+		free(conv->shared_header);
+		conv->shared_header = NULL;
+	}
+
+	// The first frame's own header wins, as it does for every frame
+	if (len == BRCM_RAW_HEADER_LENGTH && parse_header(first, &conv->fmt) == 0)
+		;
+	else if (!conv->shared_header || parse_header(conv->shared_header, &conv->fmt) < 0)
+	{
+		fprintf(stderr, "%s: frames have no BRCM header and there is no hd0.32k (see -hd)\n", input);
+		free(first);
+		return -1;
+	}
+	free(first);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct rawconv conv;
+	struct worker workers[RAWCONV_MAX_THREADS];
+	const char *header_path = NULL, *input = NULL;
+	double wb[3] = { 1, 1, 1 };
+	int threads = sysconf(_SC_NPROCESSORS_ONLN), black = 0, i;
+	uint64_t start, elapsed;
+	size_t frame_pixels;
+
+	memset(&conv, 0, sizeof(conv));
+	conv.format = FORMAT_PPM;
+	conv.method = DEMOSAIC_EDGE;
+	conv.out_dir = ".";
+	conv.container.fd = -1;
+
+	for (i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-')
+		{
+			if (!input)
+				input = arg;
+			else
+				conv.out_dir = arg;
+			continue;
+		}
+		if (!strcmp(arg, "-rm"))
+		{
+			conv.remove = 1;
+			continue;
+		}
+		if (!val)
+			break;
+		i++;
+		if (!strcmp(arg, "-f"))
+		{
+			for (conv.format = FORMAT_PPM; conv.format <= FORMAT_PNG16; conv.format++)
+			{
+				if (!strcmp(val, format_names[conv.format]))
+					break;
+			}
+		}
+		else if (!strcmp(arg, "-q"))
+			conv.method = !strcmp(val, "bilinear") ? DEMOSAIC_BILINEAR : DEMOSAIC_EDGE;
+		else if (!strcmp(arg, "-j"))
+			threads = atoi(val);
+		else if (!strcmp(arg, "-hd"))
+			header_path = val;
+		else if (!strcmp(arg, "-bl"))
+			black = atoi(val);
+		else if (!strcmp(arg, "-wb") && sscanf(val, "%lf,%lf", &wb[0], &wb[2]) == 2)
+			;
+		else
+			break;
+	}
+	if (i != argc || !input || conv.format > FORMAT_PNG16 || threads < 1)
+	{
+		fprintf(stderr, "format: %s [-f ppm|ppm16|png|png16] [-q edge|bilinear] [-j threads] [-hd header]\n"
+				"\t[-bl black] [-wb r,b] [-rm] <directory|container> [output dir]\n", argv[0]);
+		return 1;
+	}
+	if (threads > RAWCONV_MAX_THREADS)
+		threads = RAWCONV_MAX_THREADS;
+
+	if (open_input(&conv, input, header_path) < 0)
+		return 1;
+	// black must leave room below the white level, build_lut() divides by it
+	if (black < 0 || black >= (1 << conv.fmt.bit_depth) - 1 || build_lut(&conv, black, wb) < 0)
+	{
+		fprintf(stderr, "Black level %d out of range for RAW%u\n", black, conv.fmt.bit_depth);
+		return 1;
+	}
+	fprintf(stderr, "%u frames, %ux%u RAW%u, Bayer order %d -> %s, %s demosaic, %d threads, %s unpack\n", conv.count,
+			conv.fmt.width, conv.fmt.height, conv.fmt.bit_depth, conv.fmt.order, format_names[conv.format],
+			conv.method == DEMOSAIC_EDGE ? "edge-aware" : "bilinear", threads, raw_unpack_name(RAW_UNPACK_AUTO));
+
+	// Everything a worker needs for a frame, allocated once
+	frame_pixels = (size_t)conv.fmt.width * conv.fmt.height;
+	for (i = 0; i < threads; i++)
+	{
+		struct worker *w = &workers[i];
+
+		memset(w, 0, sizeof(*w));
+		w->conv = &conv;
+		w->in_size = BRCM_RAW_HEADER_LENGTH + raw_unpack_frame_size(conv.fmt.width, conv.fmt.height, conv.fmt.bit_depth);
+		if (conv.is_container && w->in_size < conv.container.hdr->max_frame_size)
+			w->in_size = conv.container.hdr->max_frame_size;
+		w->in = malloc(w->in_size);
+		w->plane = malloc(frame_pixels * sizeof(uint16_t));
+		w->rgb = malloc(frame_pixels * 3 * sizeof(uint16_t));
+		w->out_size = 32 + frame_pixels * 6;
+		w->out = malloc(w->out_size);
+		if (!w->in || !w->plane || !w->rgb || !w->out)
+		{
+			fprintf(stderr, "Out of memory for %d threads\n", threads);
+			return 1;
+		}
+	}
+
+	start = frame_clock_ns();
+	for (i = 0; i < threads; i++)
+		pthread_create(&workers[i].thread, NULL, conv_worker, &workers[i]);
+	for (i = 0; i < threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = frame_clock_ns() - start;
+
+	fprintf(stderr, "Converted %u frames (%u failed) in %.2f s: %.1f frames/s, %.1f Mpixel/s\n", conv.converted,
+			conv.failed, elapsed / 1e9, conv.converted / (elapsed / 1e9),
+			conv.converted * (double)frame_pixels / (elapsed / 1e3));
+	if (conv.converted + conv.failed)
+	{
+		fprintf(stderr, "Per frame and thread:");
+		for (i = 0; i < STAGE_COUNT; i++)
+			fprintf(stderr, " %s %.2f ms", stage_names[i], conv.stage_ns[i] / 1e6 / (conv.converted + conv.failed));
+		fprintf(stderr, "\n");
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		free(workers[i].in);
+		free(workers[i].plane);
+		free(workers[i].rgb);
+		free(workers[i].out);
+	}
+	if (conv.files)
+	{
+		for (i = 0; i < (int)conv.count; i++)
+			free(conv.files[i]);
+		free(conv.files);
+	}
+	if (conv.is_container)
+		rrc_close(&conv.container);
+	free(conv.shared_header);
+	free(conv.lut);
+	return conv.failed ? 1 : 0;
+}
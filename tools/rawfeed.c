@@ -0,0 +1,313 @@
+/*
+ * Runs the faster-raspiraw capture pipeline (pre-trigger history, frame
+ * ring, writer, container or per-frame files, copy pool, timestamp log)
+ * from a host frame source instead of the camera, so storage and copy
+ * throughput can be measured and regression-tested on any Linux box.
+ *
+ * format: rawfeed -src <source> [options]
+ *
+ *   -src synthetic:<w>x<h>[:<bits>[:<fps>]] | replay:<pattern>[:<tstamps.csv>]
+ *   -o <pattern>     per-frame files (default /dev/shm/out.%04d.raw), or
+ *                    - / a FIFO to stream the frames to a reader
+ *   -sh              frame header in front of every streamed frame
+ *   -d <pattern>     move the files on to here with the copy pool
+ *   -cw <workers>    copy workers: <n> or auto[:<min>-<max>] (default 4)
+ *   -cf <file>       write a container instead of files
+ *   -cn <frames>     container capacity (default from -t and the source fps)
+ *   -t <ms>          run time, 0 = until the source ends or SIGINT (default 5000)
+ *   -sr <n>          save every n-th frame (default 1)
+ *   -rd <depth>      frame ring depth, 0 = save in the source thread
+ *   -hd              store a 32 KB dummy header in front of every frame
+ *   -ts <csv>        timestamps in the -ts CSV layout
+ *   -tb <log>        binary timestamp log
+ *   -pre/-post <n>   pre-trigger history and post-trigger frames
+ *   -tg <trigger>    trigger source (sigusr1 or fifo:<path>)
+ *   -motion <level>[:<step>]
+ *                    save only while the motion gate sees activity, with
+ *                    -pre/-post as margins (default 16 frames each)
+ *   -shm <name>      export every frame in a shared memory ring (see shmwatch)
+ *   -track <file>    marker centroids and angle of every frame (.csv for text)
+ *   -tks <level>[:<step>[:<min area>]]
+ *                    marker tracking settings (default 200:1:2)
+ *   -health <file>   capture health once per second to stderr (-) or <file>
+ *   -trace <file>[:<events>]
+ *                    Chrome trace JSON of the pipeline stages (RASPIRAW_TRACE
+ *                    builds), <events> per thread
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "frame_source.h"
+
+#define RAWFEED_HEADER_LENGTH	32768	// Same size as the BRCM header
+#define RAWFEED_MOTION_MARGIN	16		// Default -pre and -post with -motion
+
+static CAPTURE_T capture;
+static COPY_POOL_T copy_pool;
+static FRAME_SOURCE_T source;
+static SHM_RING_T shm_ring = { .fd = -1 };
+static TRACKER_T tracker;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "format: %s -src synthetic:<w>x<h>[:<bits>[:<fps>]] | replay:<pattern>[:<tstamps.csv>]\n"
+			"\t[-o pattern|-|fifo] [-sh] [-d pattern] [-cw workers] [-cf container] [-cn frames] [-t ms] [-sr n]\n"
+			"\t[-rd depth] [-hd] [-ts csv] [-tb log] [-pre n] [-post n] [-tg trigger] [-shm name]\n"
+			"\t[-motion level[:step]] [-track file] [-tks level[:step[:min area]]]\n"
+			"\t[-health file|-] [-trace file[:events]]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *spec = NULL, *dst = NULL, *container = NULL, *tstamps = NULL, *tslog = NULL, *shm = NULL;
+	const char *motion = NULL, *track = NULL, *track_settings = "200", *health = NULL;
+	const char *trace = NULL;
+	const char *triggers[PRETRIGGER_MAX_SOURCES];
+	int timeout = 5000, ring_depth = -1, capacity = 0, pre = 0, post = 0, num_triggers = 0, header = 0;
+	int stream = 0, stream_headers = 0;
+	char *tslog_tmp = NULL;
+	uint8_t *dummy_header = NULL;
+	int i, ret = 1;
+
+	capture_init(&capture);
+	capture.mem_pattern = "/dev/shm/out.%04d.raw";
+	copy_pool_defaults(&copy_pool, 4);
+
+	for (i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(arg, "-hd"))
+		{
+			header = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-sh"))
+		{
+			stream_headers = 1;
+			continue;
+		}
+		if (!val)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		i++;
+		if (!strcmp(arg, "-src"))
+			spec = val;
+		else if (!strcmp(arg, "-o"))
+			capture.mem_pattern = val;
+		else if (!strcmp(arg, "-d"))
+			dst = val;
+		else if (!strcmp(arg, "-cw"))
+		{
+			if (copy_pool_parse_workers(&copy_pool, val) < 0)
+			{
+				fprintf(stderr, "Invalid worker count %s\n", val);
+				return 1;
+			}
+		}
+		else if (!strcmp(arg, "-cf"))
+			container = val;
+		else if (!strcmp(arg, "-cn"))
+			capacity = atoi(val);
+		else if (!strcmp(arg, "-t"))
+			timeout = atoi(val);
+		else if (!strcmp(arg, "-sr"))
+			capture.saverate = atoi(val) > 0 ? atoi(val) : 1;
+		else if (!strcmp(arg, "-rd"))
+			ring_depth = atoi(val);
+		else if (!strcmp(arg, "-ts"))
+			tstamps = val;
+		else if (!strcmp(arg, "-tb"))
+			tslog = val;
+		else if (!strcmp(arg, "-pre"))
+			pre = atoi(val);
+		else if (!strcmp(arg, "-post"))
+			post = atoi(val);
+		else if (!strcmp(arg, "-motion"))
+			motion = val;
+		else if (!strcmp(arg, "-shm"))
+			shm = val;
+		else if (!strcmp(arg, "-track"))
+			track = val;
+		else if (!strcmp(arg, "-tks"))
+			track_settings = val;
+		else if (!strcmp(arg, "-health"))
+			health = val;
+		else if (!strcmp(arg, "-trace"))
+			trace = val;
+		else if (!strcmp(arg, "-tg") && num_triggers < PRETRIGGER_MAX_SOURCES)
+			triggers[num_triggers++] = val;
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!spec)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	stream = stream_sink_is_stream(capture.mem_pattern);
+	if (stream && !strcmp(capture.mem_pattern, "-") && stream_sink_take_stdout() < 0)
+		return 1;
+
+	if (trace && trace_start(trace, COPY_POOL_MAX_THREADS + TRACE_EXTRA_THREADS) < 0)
+		return 1;
+	if (frame_source_open(&source, spec) < 0)
+		return 1;
+	fprintf(stderr, "Source %s: %ux%u RAW%u, %.1f fps, %u bytes per frame\n", source.name,
+			source.width, source.height, source.bit_depth, source.fps, source.buffer_size);
+	capture.frame_period_us = source.fps > 0 ? 1e6 / source.fps : 0;
+
+	if (header)
+	{
+		// Stands in for the BRCM header, only its size matters here
+		dummy_header = calloc(1, RAWFEED_HEADER_LENGTH);
+		if (!dummy_header)
+			goto out;
+		memcpy(dummy_header, "BRCM", 4);
+		capture.header = dummy_header;
+		capture.header_len = RAWFEED_HEADER_LENGTH;
+	}
+
+	if (container)
+	{
+		if (!capacity)
+			capacity = (int)((timeout ? timeout : RRC_UNTIMED_MS) * (source.fps > 0 ? source.fps : 1000) / 1000 / capture.saverate) + 1;
+		if (rrc_create(&capture.container, container, source.buffer_size + capture.header_len, capacity, NULL, 0) < 0)
+			goto out;
+	}
+	else if (stream)
+	{
+		if (stream_sink_open(&capture.stream, capture.mem_pattern, source.buffer_size, stream_headers,
+							 capture.header, capture.header_len) < 0)
+			goto out;
+	}
+	else if (dst)
+	{
+		if (copy_pool_start(&copy_pool, capture.mem_pattern, dst) < 0)
+			goto out;
+		capture.copy = &copy_pool;
+	}
+
+	if (shm)
+	{
+		if (shm_ring_create(&shm_ring, shm, 0, source.buffer_size, source.width, source.height, source.bit_depth) < 0)
+			goto out;
+		capture.shm = &shm_ring;
+	}
+	if (track)
+	{
+		uint32_t level, step, min_area;
+
+		if (tracker_parse(track_settings, &level, &step, &min_area) < 0)
+		{
+			fprintf(stderr, "Invalid tracker settings %s\n", track_settings);
+			goto out;
+		}
+		if (tracker_init(&tracker, source.width, source.height, frame_source_stride(source.width, source.bit_depth),
+						 source.bit_depth, level, step, min_area) < 0 ||
+			tracker_start(&tracker, track, source.buffer_size) < 0)
+			goto out;
+		capture.tracker = &tracker;
+	}
+
+	if (tstamps && !tslog && asprintf(&tslog_tmp, "%s.bin", tstamps) >= 0)
+		tslog = tslog_tmp;
+	if (tslog && ts_log_open(&capture.ts_log, tslog) < 0)
+		goto out;
+
+	if (motion)
+	{
+		uint32_t threshold, step;
+
+		if (motion_gate_parse(motion, &threshold, &step) < 0)
+		{
+			fprintf(stderr, "Invalid motion gate %s\n", motion);
+			goto out;
+		}
+		// The synthetic pattern is RGGB
+		if (motion_gate_init(&capture.motion, source.width, source.height,
+							 frame_source_stride(source.width, source.bit_depth), source.bit_depth, 0, step, threshold) < 0)
+			goto out;
+		if (!pre)
+		{
+			pre = RAWFEED_MOTION_MARGIN;
+			post = post ? post : RAWFEED_MOTION_MARGIN;
+		}
+		fprintf(stderr, "Motion gate: %ux%u samples every %u pixels, threshold %.2f, %d frames before and %d after\n",
+				capture.motion.cols, capture.motion.rows, capture.motion.step, threshold / (double)MOTION_SCORE_ONE, pre, post);
+	}
+
+	if (pre && !ring_depth)
+		ring_depth = -1;
+	if (ring_depth && capture_start_ring(&capture, ring_depth > 0 ? ring_depth : 0, source.buffer_size) < 0)
+		goto out;
+	if (pre)
+	{
+		if (pretrigger_init(&capture.pretrigger, pre, post, source.buffer_size, &capture.ring) < 0)
+			goto out;
+		if (!num_triggers)
+			triggers[num_triggers++] = "sigusr1";
+		for (i = 0; i < num_triggers; i++)
+		{
+			if (pretrigger_add_source(&capture.pretrigger, triggers[i]) < 0)
+			{
+				fprintf(stderr, "Invalid trigger source %s\n", triggers[i]);
+				goto out;
+			}
+		}
+	}
+
+	if (health && capture_start_health(&capture, health) < 0)
+		goto out;
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	if (frame_source_start(&source, capture_deliver, &capture) < 0)
+		goto out;
+	for (i = 0; !stop_requested && !source.finished && (!timeout || i < timeout); i += 10)
+		usleep(10000);
+	frame_source_stop(&source);
+	fprintf(stderr, "Source delivered %u frames\n", source.delivered);
+	ret = 0;
+
+out:
+	capture_stop(&capture);
+	if (tstamps && tslog && !ret)
+	{
+		FILE *csv = fopen(tstamps, "w");
+
+		if (!csv || ts_log_to_csv(tslog, csv, 0) < 0)
+			fprintf(stderr, "Failed to write timestamps to %s\n", tstamps);
+		if (csv)
+			fclose(csv);
+	}
+	if (tslog_tmp)
+		unlink(tslog_tmp);
+	if (capture.copy)
+		copy_pool_stop(&copy_pool);
+	frame_source_close(&source);
+	shm_ring_destroy(&shm_ring);
+	tracker_stop(&tracker);
+	trace_stop();
+	free(dummy_header);
+	free(tslog_tmp);
+	return ret;
+}
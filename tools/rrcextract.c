@@ -0,0 +1,92 @@
+/*
+ * Extracts frames from a faster-raspiraw capture container (-cf) into the
+ * legacy one-file-per-frame layout (out.%04d.raw) used by process.sh,
+ * tools/raw2ogg2anim and dcraw. A header stored once in the container
+ * (-hdm once) is put back in front of every extracted frame.
+ *
+ * format: rrcextract container [pattern] [first] [last]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "container.h"
+
+int main(int argc, char *argv[])
+{
+	RRC_CONTAINER_T c;
+	const char *pattern = "out.%04d.raw";
+	uint32_t first = 0, last = UINT32_MAX, i, n, written = 0;
+	uint8_t *buf;
+	ssize_t prefix_len;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "format: %s container [pattern] [first] [last]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		pattern = argv[2];
+	if (argc > 3)
+		first = strtoul(argv[3], NULL, 0);
+	if (argc > 4)
+		last = strtoul(argv[4], NULL, 0);
+
+	if (rrc_open(&c, argv[1]) < 0)
+		return 1;
+
+	buf = malloc(c.hdr->prefix_length + c.hdr->max_frame_size);
+	if (!buf)
+	{
+		rrc_close(&c);
+		return 1;
+	}
+	prefix_len = rrc_read_prefix(&c, buf, c.hdr->prefix_length);
+	if (prefix_len < 0)
+		prefix_len = 0;
+
+	n = rrc_count(&c);
+	for (i = 0; i < n; i++)
+	{
+		const struct rrc_frame_record *rec = rrc_record(&c, i);
+		char name[4096];
+		FILE *f;
+		ssize_t len;
+
+		if (rec->index < first || rec->index > last)
+			continue;
+
+		// buf holds max_frame_size; rrc_read() refuses longer records
+		len = rrc_read(&c, i, buf + prefix_len, c.hdr->max_frame_size);
+		if (len < 0)
+		{
+			fprintf(stderr, "Slot %u: corrupt record (%u bytes in slots of %u), skipped\n", i, rec->length,
+					c.hdr->max_frame_size);
+			continue;
+		}
+		if (len != rec->length)
+		{
+			fprintf(stderr, "Short read on slot %u\n", i);
+			break;
+		}
+		len += prefix_len;
+
+		snprintf(name, sizeof(name), pattern, rec->index);
+		f = fopen(name, "wb");
+		if (!f || fwrite(buf, 1, len, f) != (size_t)len)
+		{
+			perror(name);
+			if (f)
+				fclose(f);
+			break;
+		}
+		fclose(f);
+		written++;
+	}
+
+	fprintf(stderr, "%u of %u frames extracted (%u dropped at capture)\n", written, n, c.hdr->dropped);
+
+	free(buf);
+	rrc_close(&c);
+	return written ? 0 : 1;
+}
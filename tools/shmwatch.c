@@ -0,0 +1,107 @@
+/*
+ * Example reader of the shared memory frame ring (-shm): attaches
+ * read-only, works on every frame in place (the mean of its bytes stands
+ * in for real analysis) and prints once a second how many frames it saw,
+ * missed because it fell behind, or found overwritten while reading them,
+ * and how long after arrival in the capture process it got to them.
+ *
+ * format: shmwatch [-t ms] [-d us] <name>
+ *
+ *   -t <ms>   run time, 0 = until the capture ends or SIGINT (default 0)
+ *   -d <us>   extra time spent per frame, to play a slow reader
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	SHM_RING_T ring;
+	uint64_t start, report, lat_sum = 0;
+	uint32_t next, seen = 0, missed = 0, torn = 0, total = 0;
+	int timeout = 0, delay_us = 0, i, head = 0;
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2)
+	{
+		if (!strcmp(argv[i], "-t"))
+			timeout = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-d"))
+			delay_us = atoi(argv[i + 1]);
+		else
+			break;
+	}
+	if (i != argc - 1)
+	{
+		fprintf(stderr, "format: shmwatch [-t ms] [-d us] <name>\n");
+		return 1;
+	}
+	if (shm_ring_attach(&ring, argv[i]) < 0)
+		return 1;
+	fprintf(stderr, "%s: %ux%u RAW%u, %u slots of %u bytes, writer pid %u\n", ring.name, ring.hdr->width,
+			ring.hdr->height, ring.hdr->bit_depth, ring.hdr->num_slots, ring.hdr->slot_size, ring.hdr->writer_pid);
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	// Start with the newest frame, not with what is left from before
+	next = ring.hdr->head;
+	start = report = frame_clock_ns();
+	while (!stop_requested && (!timeout || frame_clock_ns() - start < (uint64_t)timeout * 1000000))
+	{
+		head = shm_ring_wait(&ring, next, 100);
+		if (head < 0)
+			break;
+		for (; (int32_t)((uint32_t)head - next) > 0; next++)
+		{
+			const struct shm_ring_slot *slot;
+			const uint8_t *data;
+			uint64_t sum = 0;
+			uint32_t j;
+
+			slot = shm_ring_frame(&ring, next, &data);
+			if (!slot)
+			{
+				missed++;
+				continue;
+			}
+			lat_sum += frame_clock_ns() - slot->host_ns;
+			for (j = 0; j < slot->length; j += 64)
+				sum += data[j];
+			if (delay_us)
+				usleep(delay_us);
+			if (!shm_ring_valid(&ring, slot, next))
+			{
+				torn++;
+				continue;
+			}
+			seen++;
+			(void)sum;
+		}
+		if (frame_clock_ns() - report >= 1000000000ull)
+		{
+			printf("%u frames, %u missed, %u overwritten, %.1f us after arrival\n", seen, missed, torn,
+				   seen + torn ? lat_sum / 1e3 / (seen + torn) : 0.0);
+			fflush(stdout);
+			total += seen;
+			seen = missed = torn = 0;
+			lat_sum = 0;
+			report = frame_clock_ns();
+		}
+	}
+	total += seen;
+	fprintf(stderr, "%u frames read%s\n", total, head < 0 ? ", capture ended" : "");
+	shm_ring_destroy(&ring);
+	return 0;
+}
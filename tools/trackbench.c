@@ -0,0 +1,263 @@
+/*
+ * Checks the marker tracker on rendered frames and measures it.
+ *
+ * format: trackbench [-t ms] [-res WxH,...] [-bits 8,10,12] [-fps rate] [-track <level>[:<step>[:<min area>]]]
+ *
+ * Every frame shows two Gaussian markers (sigma 2 pixels) at the ends of a
+ * bar pivoting about the centre of the frame, over a dark noisy
+ * background. The bar swings as far as the frame height allows, up to
+ * 30 degrees either way. The check reports how far the centroids and the
+ * angle are from the rendered ones. The live run then hands frames to the
+ * tracker thread at -fps (default 660) for -t ms, as the capture callback
+ * would, and reports the time each hand-over took in the callback and the
+ * frames the thread could not keep up with. The exit status is 1 if a
+ * frame lost a marker or the angle is off by more than 0.5 degrees.
+ */
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tracker.h"
+#include "raw_unpack.h"
+#include "frame_ring.h"
+
+#define TRACKBENCH_MAX_AXIS		16
+#define TRACKBENCH_FRAMES		64		// Distinct rendered frames
+#define TRACKBENCH_SIGMA		2.0
+#define TRACKBENCH_MAX_ERROR	0.5		// Degrees
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+struct scene {
+	double x[2], y[2];		// Marker centres, left one first
+	double angle;
+};
+
+/**
+ * Renders frame n packed like the CSI-2 receiver.
+ */
+static void make_frame(uint8_t *frame, uint32_t width, uint32_t height, uint32_t bits, uint32_t n, struct scene *s)
+{
+	uint32_t stride = raw_unpack_stride(width, bits), max = (1u << bits) - 1, x, y;
+	double len = width / 3.0, limit = asin(fmin((height / 2.0 - 4 * TRACKBENCH_SIGMA) / len, 0.5));
+	double theta = limit * sin(2 * M_PI * n / TRACKBENCH_FRAMES);
+	uint16_t *px = malloc(width * sizeof(*px));
+	int i;
+
+	s->angle = theta * 180 / M_PI;
+	for (i = 0; i < 2; i++)
+	{
+		double sign = i ? 1 : -1;
+
+		s->x[i] = width / 2.0 + sign * len / 2 * cos(theta);
+		s->y[i] = height / 2.0 + sign * len / 2 * sin(theta);
+	}
+	for (y = 0; y < height; y++)
+	{
+		uint8_t *out = frame + (size_t)y * stride;
+
+		for (x = 0; x < width; x++)
+		{
+			double v = max * (0.06 + (rng() % 100) / 5000.0);
+
+			for (i = 0; i < 2; i++)
+			{
+				double dx = x - s->x[i], dy = y - s->y[i];
+
+				v += max * 0.9 * exp(-(dx * dx + dy * dy) / (2 * TRACKBENCH_SIGMA * TRACKBENCH_SIGMA));
+			}
+			px[x] = v > max ? max : (uint16_t)v;
+		}
+		for (x = 0; x < width; x++)
+		{
+			if (bits == 8)
+				out[x] = px[x];
+			else if (bits == 10)
+			{
+				out[(x >> 2) * 5 + (x & 3)] = px[x] >> 2;
+				if ((x & 3) == 0)
+					out[(x >> 2) * 5 + 4] = 0;
+				out[(x >> 2) * 5 + 4] |= (px[x] & 3) << ((x & 3) * 2);
+			}
+			else
+			{
+				out[(x >> 1) * 3 + (x & 1)] = px[x] >> 4;
+				if ((x & 1) == 0)
+					out[(x >> 1) * 3 + 2] = 0;
+				out[(x >> 1) * 3 + 2] |= (px[x] & 15) << ((x & 1) * 4);
+			}
+		}
+	}
+	free(px);
+}
+
+static int parse_list(const char *arg, uint32_t *values)
+{
+	int n = 0;
+
+	while (*arg && n < TRACKBENCH_MAX_AXIS)
+	{
+		values[n++] = strtoul(arg, (char **)&arg, 10);
+		if (*arg == ',')
+			arg++;
+		else if (*arg)
+			return -1;
+	}
+	return n;
+}
+
+/**
+ * Hands frames to the tracker thread at fps for ms, like the callback.
+ */
+static void live_run(TRACKER_T *t, uint8_t **frames, uint32_t size, double fps, int ms, double *push_us, uint32_t *pushed)
+{
+	struct frame_slot slot = { 0 };
+	struct timespec next;
+	uint64_t period_ns = (uint64_t)(1e9 / fps), push_ns = 0, end = frame_clock_ns() + (uint64_t)ms * 1000000;
+	uint32_t n;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (n = 0; frame_clock_ns() < end; n++)
+	{
+		uint64_t start, when = (uint64_t)next.tv_sec * 1000000000ull + next.tv_nsec + period_ns;
+
+		next.tv_sec = when / 1000000000ull;
+		next.tv_nsec = when % 1000000000ull;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+			;
+		slot.index = n + 1;
+		slot.pts = when / 1000;
+		slot.data = frames[n % TRACKBENCH_FRAMES];
+		slot.length = size;
+		start = frame_clock_ns();
+		tracker_frame(t, &slot);
+		push_ns += frame_clock_ns() - start;
+	}
+	*pushed = n;
+	*push_us = n ? push_ns / 1e3 / n : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t res_w[TRACKBENCH_MAX_AXIS] = { 640, 640, 1640 }, res_h[TRACKBENCH_MAX_AXIS] = { 64, 480, 1232 };
+	uint32_t bits[TRACKBENCH_MAX_AXIS] = { 10 }, level = 128, step = 1, min_area = 2;
+	int num_res = 3, num_bits = 1, ms = 1000, i, j, bad = 0;
+	double fps = 660;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-t"))
+			ms = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-bits"))
+			num_bits = parse_list(argv[i + 1], bits);
+		else if (!strcmp(argv[i], "-fps"))
+			fps = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "-track"))
+		{
+			if (tracker_parse(argv[i + 1], &level, &step, &min_area) < 0)
+				break;
+		}
+		else if (!strcmp(argv[i], "-res"))
+		{
+			const char *p = argv[i + 1];
+
+			for (num_res = 0; *p && num_res < TRACKBENCH_MAX_AXIS; num_res++)
+			{
+				if (sscanf(p, "%ux%u", &res_w[num_res], &res_h[num_res]) != 2)
+					break;
+				p = strchr(p, ',') ? strchr(p, ',') + 1 : "";
+			}
+		}
+		else
+			break;
+	}
+	if (i != argc || num_bits <= 0 || num_res <= 0 || fps <= 0)
+	{
+		fprintf(stderr, "format: %s [-t ms] [-res WxH,...] [-bits 8,10,12] [-fps rate] [-track level[:step[:min area]]]\n",
+				argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < num_res; i++)
+	{
+		for (j = 0; j < num_bits; j++)
+		{
+			uint32_t size = raw_unpack_frame_size(res_w[i], res_h[i], bits[j]), n, lost = 0, pushed;
+			double pos_err = 0, pos_max = 0, ang_err = 0, ang_max = 0, push_us, us;
+			uint8_t *frames[TRACKBENCH_FRAMES];
+			struct scene scenes[TRACKBENCH_FRAMES];
+			struct tracker_record rec;
+			uint64_t start;
+			TRACKER_T t;
+
+			if (tracker_init(&t, res_w[i], res_h[i], 0, bits[j], level, step, min_area) < 0)
+				return 1;
+			for (n = 0; n < TRACKBENCH_FRAMES; n++)
+			{
+				if (!(frames[n] = calloc(1, size)))
+					return 1;
+				make_frame(frames[n], res_w[i], res_h[i], bits[j], n, &scenes[n]);
+			}
+
+			// Accuracy against the rendered positions
+			start = frame_clock_ns();
+			for (n = 0; n < TRACKBENCH_FRAMES; n++)
+			{
+				int k;
+
+				tracker_find(&t, frames[n], size, &rec);
+				if (rec.count != 2 || isnan(rec.angle))
+				{
+					lost++;
+					continue;
+				}
+				for (k = 0; k < 2; k++)
+				{
+					double e = hypot(rec.blob[k].x - scenes[n].x[k], rec.blob[k].y - scenes[n].y[k]);
+
+					pos_err += e / 2;
+					pos_max = fmax(pos_max, e);
+				}
+				ang_err += fabs(rec.angle - scenes[n].angle);
+				ang_max = fmax(ang_max, fabs(rec.angle - scenes[n].angle));
+			}
+			us = (frame_clock_ns() - start) / 1e3 / TRACKBENCH_FRAMES;
+			if (lost < TRACKBENCH_FRAMES)
+			{
+				pos_err /= TRACKBENCH_FRAMES - lost;
+				ang_err /= TRACKBENCH_FRAMES - lost;
+			}
+			if (lost || ang_max > TRACKBENCH_MAX_ERROR)
+				bad++;
+			printf("%4ux%-4u RAW%-2u %4ux%-4u cells  lost %u/%u  centroid error mean %.3f max %.3f px  "
+				   "angle error mean %.3f max %.3f deg  %.1f us per frame  %.1f%% of %.0f fps\n",
+				   res_w[i], res_h[i], bits[j], t.cols, t.rows, lost, TRACKBENCH_FRAMES, pos_err, pos_max,
+				   ang_err, ang_max, us, us * fps / 1e4, fps);
+
+			// Live: the tracker thread behind the callback hand-over
+			if (tracker_start(&t, "/dev/null", size) < 0)
+				return 1;
+			live_run(&t, frames, size, fps, ms, &push_us, &pushed);
+			printf("%4ux%-4u RAW%-2u live at %.0f fps: %u frames handed over in %.1f us each, ", res_w[i], res_h[i],
+				   bits[j], fps, pushed, push_us);
+			printf("%u not tracked\n", t.ring.dropped);
+			fflush(stdout);
+			tracker_stop(&t);
+
+			for (n = 0; n < TRACKBENCH_FRAMES; n++)
+				free(frames[n]);
+		}
+	}
+	return bad ? 1 : 0;
+}
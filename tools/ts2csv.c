@@ -0,0 +1,45 @@
+/*
+ * Converts a binary timestamp log (-tb) into the CSV layout written by -ts,
+ * as read by measure.sh and tools/640x480. With -x the host CLOCK_MONOTONIC
+ * time (ns), the MMAL buffer flags, the motion score and the sensor frame
+ * counter, exposure and gain from -embedded are appended to every line.
+ *
+ * format: ts2csv [-x] log [csv]
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "tslog.h"
+
+int main(int argc, char *argv[])
+{
+	int extended = 0, n;
+	FILE *out = stdout;
+
+	if (argc > 1 && !strcmp(argv[1], "-x"))
+	{
+		extended = 1;
+		argc--;
+		argv++;
+	}
+	if (argc < 2)
+	{
+		fprintf(stderr, "format: ts2csv [-x] log [csv]\n");
+		return 1;
+	}
+	if (argc > 2 && !(out = fopen(argv[2], "w")))
+	{
+		perror(argv[2]);
+		return 1;
+	}
+
+	n = ts_log_to_csv(argv[1], out, extended);
+	if (out != stdout && fclose(out) != 0)
+	{
+		perror(argv[2]);
+		return 1;
+	}
+	if (n >= 0)
+		fprintf(stderr, "%d timestamps converted\n", n);
+	return n >= 0 ? 0 : 1;
+}
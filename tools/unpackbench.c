@@ -0,0 +1,217 @@
+/*
+ * Checks the RAW10/RAW12 unpack kernels bit for bit against the scalar
+ * reference and measures them in Mpixel/s.
+ *
+ * format: unpackbench [-t ms] [-res WxH,...] [-bits 10,12] [-impl scalar,ssse3,avx2,neon]
+ *
+ * The check runs every width from 1 to 96 and the tools/ widths at both
+ * depths, on random packed data with random bytes in the line padding, for
+ * 16 bit output, 8 bit output and 8 bit output through a LUT. The exit
+ * status is 1 if any kernel differs from the reference.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw_unpack.h"
+#include "frame_ring.h"
+
+#define UNPACKBENCH_MAX_AXIS	16
+
+static const char *impl_names[] = { "auto", "scalar", "ssse3", "avx2", "neon" };
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void fill_random(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = rng();
+}
+
+/**
+ * Compares one frame layout for all impls against the scalar reference.
+ *
+ * @return the number of outputs that differ
+ */
+static int check_layout(uint32_t width, uint32_t height, uint32_t bits, const enum raw_unpack_impl *impls, int num_impls,
+						const uint8_t *lut)
+{
+	struct raw_image img = { NULL, width, height, 0, bits };
+	size_t size = raw_unpack_frame_size(width, height, bits), pixels = (size_t)width * height;
+	uint8_t *packed = malloc(size), *ref8 = malloc(pixels), *out8 = malloc(pixels);
+	uint16_t *ref16 = malloc(pixels * 2), *out16 = malloc(pixels * 2);
+	int i, mode, bad = 0;
+
+	if (!packed || !ref8 || !out8 || !ref16 || !out16)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	fill_random(packed, size);
+	img.data = packed;
+	for (mode = 0; mode < 3; mode++)
+	{
+		const uint8_t *mode_lut = mode == 2 ? lut : NULL;
+
+		if (mode == 0)
+			raw_unpack16(&img, ref16, 0, RAW_UNPACK_SCALAR);
+		else
+			raw_unpack8(&img, ref8, 0, mode_lut, RAW_UNPACK_SCALAR);
+		for (i = 0; i < num_impls; i++)
+		{
+			int differs;
+
+			if (mode == 0)
+			{
+				memset(out16, 0xa5, pixels * 2);
+				differs = raw_unpack16(&img, out16, 0, impls[i]) < 0 || memcmp(out16, ref16, pixels * 2);
+			}
+			else
+			{
+				memset(out8, 0xa5, pixels);
+				differs = raw_unpack8(&img, out8, 0, mode_lut, impls[i]) < 0 || memcmp(out8, ref8, pixels);
+			}
+			if (differs)
+			{
+				fprintf(stderr, "MISMATCH %s RAW%u %ux%u %s\n", impl_names[impls[i]], bits, width, height,
+						mode == 0 ? "16 bit" : mode == 1 ? "8 bit" : "8 bit LUT");
+				bad++;
+			}
+		}
+	}
+	free(packed);
+	free(ref8);
+	free(out8);
+	free(ref16);
+	free(out16);
+	return bad;
+}
+
+static double bench_one(const struct raw_image *img, int mode, const uint8_t *lut, enum raw_unpack_impl impl,
+						void *dst, int ms)
+{
+	uint64_t start = frame_clock_ns(), elapsed;
+	uint32_t runs = 0;
+
+	do
+	{
+		if (mode == 0)
+			raw_unpack16(img, dst, 0, impl);
+		else
+			raw_unpack8(img, dst, 0, mode == 2 ? lut : NULL, impl);
+		runs++;
+		elapsed = frame_clock_ns() - start;
+	} while (elapsed < (uint64_t)ms * 1000000);
+	return (double)runs * img->width * img->height / (elapsed / 1e3);
+}
+
+static int parse_list(const char *arg, uint32_t *values)
+{
+	int n = 0;
+
+	while (*arg && n < UNPACKBENCH_MAX_AXIS)
+	{
+		values[n++] = strtoul(arg, (char **)&arg, 10);
+		if (*arg == ',')
+			arg++;
+		else if (*arg)
+			return -1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t widths[] = { 320, 640, 1280, 1296, 1640, 1920, 2592, 3280 };
+	uint32_t res_w[UNPACKBENCH_MAX_AXIS] = { 640, 1640, 3280 }, res_h[UNPACKBENCH_MAX_AXIS] = { 480, 1232, 2464 };
+	uint32_t bits[UNPACKBENCH_MAX_AXIS] = { 10, 12 };
+	enum raw_unpack_impl impls[UNPACKBENCH_MAX_AXIS];
+	int num_res = 3, num_bits = 2, num_impls = 0, ms = 300, i, j, k, mode, bad = 0, cases = 0;
+	uint8_t lut[4096];
+	const char *impl_arg = NULL;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-t"))
+			ms = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-bits"))
+			num_bits = parse_list(argv[i + 1], bits);
+		else if (!strcmp(argv[i], "-impl"))
+			impl_arg = argv[i + 1];
+		else if (!strcmp(argv[i], "-res"))
+		{
+			const char *p = argv[i + 1];
+
+			for (num_res = 0; *p && num_res < UNPACKBENCH_MAX_AXIS; num_res++)
+			{
+				if (sscanf(p, "%ux%u", &res_w[num_res], &res_h[num_res]) != 2)
+					break;
+				p = strchr(p, ',') ? strchr(p, ',') + 1 : "";
+			}
+		}
+		else
+			break;
+	}
+	if (i != argc || num_bits <= 0 || num_res <= 0)
+	{
+		fprintf(stderr, "format: %s [-t ms] [-res WxH,...] [-bits 10,12] [-impl scalar,ssse3,avx2,neon]\n", argv[0]);
+		return 1;
+	}
+	for (k = RAW_UNPACK_SCALAR; k <= RAW_UNPACK_NEON; k++)
+	{
+		if ((!impl_arg || strstr(impl_arg, impl_names[k])) && raw_unpack_supported(k))
+			impls[num_impls++] = k;
+	}
+	fprintf(stderr, "Kernels: auto = %s\n", raw_unpack_name(RAW_UNPACK_AUTO));
+
+	// Bit-exactness against the scalar reference
+	for (i = 0; i < 4096; i++)
+		lut[i] = rng();
+	for (j = 0; j < num_bits; j++)
+	{
+		for (i = 1; i <= 96; i++, cases++)
+			bad += check_layout(i, 3, bits[j], impls, num_impls, lut);
+		for (i = 0; i < (int)(sizeof(widths) / sizeof(widths[0])); i++, cases++)
+			bad += check_layout(widths[i], 17, bits[j], impls, num_impls, lut);
+	}
+	printf("bit-exact check: %d layouts, %d mismatches\n", cases, bad);
+
+	for (i = 0; i < num_res; i++)
+	{
+		for (j = 0; j < num_bits; j++)
+		{
+			struct raw_image img = { NULL, res_w[i], res_h[i], 0, bits[j] };
+			size_t size = raw_unpack_frame_size(res_w[i], res_h[i], bits[j]);
+			uint8_t *packed = malloc(size);
+			void *dst = malloc((size_t)res_w[i] * res_h[i] * 2);
+
+			if (!packed || !dst)
+				return 1;
+			fill_random(packed, size);
+			img.data = packed;
+			for (mode = 0; mode < 3; mode++)
+			{
+				printf("%4ux%-4u RAW%-2u %-9s", res_w[i], res_h[i], bits[j],
+					   mode == 0 ? "16 bit" : mode == 1 ? "8 bit" : "8 bit LUT");
+				for (k = 0; k < num_impls; k++)
+					printf("  %s %7.1f", impl_names[impls[k]], bench_one(&img, mode, lut, impls[k], dst, ms));
+				printf("  Mpixel/s\n");
+				fflush(stdout);
+			}
+			free(packed);
+			free(dst);
+		}
+	}
+	return bad ? 1 : 0;
+}